@@ -260,9 +260,21 @@ public class LineChartFactory {
         return dataset;
     }
 
+    /**
+     * Returns the coarsest table that keyfrog maintains which is still
+     * finer than accumulation range -- hourly and daily rollups are
+     * much smaller than the keypresses table.
+     */
+    private String accumulationTable() {
+        if(m_accumulationRange >= DAY)
+            return "keypresses_daily";
+        else if(m_accumulationRange >= HOUR)
+            return "keypresses_hourly";
+        return "keypresses";
+    }
+
     /**
      * Reads database, creates JFreeChart dataset
-     * FIXME: Optimization needed
      */
     private XYDataset createAverageDataset() {
         // Can this approach be optimized?
@@ -282,7 +294,7 @@ public class LineChartFactory {
             
             // Create a result set object for the statement
             String query = "SELECT cluster_begin, cluster_end, count, app_group " +
-                    "FROM keypresses WHERE cluster_begin >= '" + m_beginTimestamp + "' AND " + 
+                    "FROM " + accumulationTable() + " WHERE cluster_begin >= '" + m_beginTimestamp + "' AND " + 
                     "cluster_begin <= '" + m_endTimestamp + "' ORDER BY cluster_begin, app_group";
             System.err.println(query);
             ResultSet rs = stmt.executeQuery(query);
@@ -0,0 +1,268 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "Aggregate.h"
+
+#include <algorithm>
+#include <vector>
+#include <climits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KF_AGGREGATE_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace keyfrog {
+
+    /// Rows per pass of group_totals, chosen so that both columns stay in L1 cache
+    static const size_t groupChunk = 2048;
+
+    typedef int64_t (*SumFunc)( const int32_t *, size_t );
+    typedef int64_t (*SumGroupFunc)( const int32_t *, const int32_t *, size_t, int32_t );
+    typedef void (*DiffFunc)( const double *, const double *, size_t, double, double * );
+
+    static int64_t sum_scalar( const int32_t *counts, size_t n ) {
+        int64_t sum = 0;
+        for ( size_t i = 0; i < n; i++ )
+            sum += counts[i];
+        return sum;
+    }
+
+    static int64_t sum_group_scalar( const int32_t *groups, const int32_t *counts, size_t n, int32_t group ) {
+        int64_t sum = 0;
+        for ( size_t i = 0; i < n; i++ ) {
+            if ( groups[i] == group )
+                sum += counts[i];
+        }
+        return sum;
+    }
+
+    /// out[i] = (upper[i] - lower[i]) / window
+    static void diff_scalar( const double *upper, const double *lower, size_t n, double window, double *out ) {
+        for ( size_t i = 0; i < n; i++ )
+            out[i] = ( upper[i] - lower[i] ) / window;
+    }
+
+#ifdef KF_AGGREGATE_X86
+
+    __attribute__(( target( "sse4.1" ) ))
+    static int64_t sum_sse41( const int32_t *counts, size_t n ) {
+        __m128i acc = _mm_setzero_si128();
+        size_t i = 0;
+        for ( ; i + 4 <= n; i += 4 ) {
+            __m128i c = _mm_loadu_si128( (const __m128i *) ( counts + i ) );
+            acc = _mm_add_epi64( acc, _mm_cvtepi32_epi64( c ) );
+            acc = _mm_add_epi64( acc, _mm_cvtepi32_epi64( _mm_srli_si128( c, 8 ) ) );
+        }
+        int64_t lanes[2];
+        _mm_storeu_si128( (__m128i *) lanes, acc );
+        return lanes[0] + lanes[1] + sum_scalar( counts + i, n - i );
+    }
+
+    __attribute__(( target( "sse4.1" ) ))
+    static int64_t sum_group_sse41( const int32_t *groups, const int32_t *counts, size_t n, int32_t group ) {
+        __m128i key = _mm_set1_epi32( group );
+        __m128i acc = _mm_setzero_si128();
+        size_t i = 0;
+        for ( ; i + 4 <= n; i += 4 ) {
+            __m128i g = _mm_loadu_si128( (const __m128i *) ( groups + i ) );
+            __m128i c = _mm_loadu_si128( (const __m128i *) ( counts + i ) );
+            c = _mm_and_si128( _mm_cmpeq_epi32( g, key ), c );
+            acc = _mm_add_epi64( acc, _mm_cvtepi32_epi64( c ) );
+            acc = _mm_add_epi64( acc, _mm_cvtepi32_epi64( _mm_srli_si128( c, 8 ) ) );
+        }
+        int64_t lanes[2];
+        _mm_storeu_si128( (__m128i *) lanes, acc );
+        return lanes[0] + lanes[1] + sum_group_scalar( groups + i, counts + i, n - i, group );
+    }
+
+    __attribute__(( target( "sse4.1" ) ))
+    static void diff_sse41( const double *upper, const double *lower, size_t n, double window, double *out ) {
+        __m128d w = _mm_set1_pd( window );
+        size_t i = 0;
+        for ( ; i + 2 <= n; i += 2 ) {
+            __m128d d = _mm_sub_pd( _mm_loadu_pd( upper + i ), _mm_loadu_pd( lower + i ) );
+            _mm_storeu_pd( out + i, _mm_div_pd( d, w ) );
+        }
+        diff_scalar( upper + i, lower + i, n - i, window, out + i );
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    static int64_t sum_avx2( const int32_t *counts, size_t n ) {
+        __m256i acc = _mm256_setzero_si256();
+        size_t i = 0;
+        for ( ; i + 8 <= n; i += 8 ) {
+            __m256i c = _mm256_loadu_si256( (const __m256i *) ( counts + i ) );
+            acc = _mm256_add_epi64( acc, _mm256_cvtepi32_epi64( _mm256_castsi256_si128( c ) ) );
+            acc = _mm256_add_epi64( acc, _mm256_cvtepi32_epi64( _mm256_extracti128_si256( c, 1 ) ) );
+        }
+        int64_t lanes[4];
+        _mm256_storeu_si256( (__m256i *) lanes, acc );
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_scalar( counts + i, n - i );
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    static int64_t sum_group_avx2( const int32_t *groups, const int32_t *counts, size_t n, int32_t group ) {
+        __m256i key = _mm256_set1_epi32( group );
+        __m256i acc = _mm256_setzero_si256();
+        size_t i = 0;
+        for ( ; i + 8 <= n; i += 8 ) {
+            __m256i g = _mm256_loadu_si256( (const __m256i *) ( groups + i ) );
+            __m256i c = _mm256_loadu_si256( (const __m256i *) ( counts + i ) );
+            c = _mm256_and_si256( _mm256_cmpeq_epi32( g, key ), c );
+            acc = _mm256_add_epi64( acc, _mm256_cvtepi32_epi64( _mm256_castsi256_si128( c ) ) );
+            acc = _mm256_add_epi64( acc, _mm256_cvtepi32_epi64( _mm256_extracti128_si256( c, 1 ) ) );
+        }
+        int64_t lanes[4];
+        _mm256_storeu_si256( (__m256i *) lanes, acc );
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_group_scalar( groups + i, counts + i, n - i, group );
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    static void diff_avx2( const double *upper, const double *lower, size_t n, double window, double *out ) {
+        __m256d w = _mm256_set1_pd( window );
+        size_t i = 0;
+        for ( ; i + 4 <= n; i += 4 ) {
+            __m256d d = _mm256_sub_pd( _mm256_loadu_pd( upper + i ), _mm256_loadu_pd( lower + i ) );
+            _mm256_storeu_pd( out + i, _mm256_div_pd( d, w ) );
+        }
+        diff_scalar( upper + i, lower + i, n - i, window, out + i );
+    }
+
+#endif
+
+    /**
+     * Kernel implementations picked for this CPU
+     */
+    struct Kernels {
+        const char *isa;
+        SumFunc sum;
+        SumGroupFunc sumGroup;
+        DiffFunc diff;
+    };
+
+    static const Kernels scalarKernels = { "scalar", sum_scalar, sum_group_scalar, diff_scalar };
+
+    static Kernels detectKernels() {
+#ifdef KF_AGGREGATE_X86
+        __builtin_cpu_init();
+        if ( __builtin_cpu_supports( "avx2" ) ) {
+            Kernels k = { "avx2", sum_avx2, sum_group_avx2, diff_avx2 };
+            return k;
+        }
+        if ( __builtin_cpu_supports( "sse4.1" ) ) {
+            Kernels k = { "sse4.1", sum_sse41, sum_group_sse41, diff_sse41 };
+            return k;
+        }
+#endif
+        return scalarKernels;
+    }
+
+    static bool forceScalar = false;
+
+    static const Kernels & kernels() {
+        static const Kernels detected = detectKernels();
+        return forceScalar ? scalarKernels : detected;
+    }
+
+    const char *aggregate_isa() {
+        return kernels().isa;
+    }
+
+    void aggregate_force_scalar( bool scalar ) {
+        forceScalar = scalar;
+    }
+
+    int64_t sum_counts( const int32_t *counts, size_t n ) {
+        return kernels().sum( counts, n );
+    }
+
+    int64_t sum_group_counts( const int32_t *groups, const int32_t *counts, size_t n, int32_t group ) {
+        return kernels().sumGroup( groups, counts, n, group );
+    }
+
+    /**
+     * One masked pass per group over L1 sized chunks, so that columns
+     * are read from memory only once
+     */
+    void group_totals( const int32_t *groups, const int32_t *counts, size_t n,
+            const int32_t *groupIds, size_t groupCount, int64_t *out ) {
+        SumGroupFunc sumGroup = kernels().sumGroup;
+        for ( size_t start = 0; start < n; start += groupChunk ) {
+            size_t len = min( groupChunk, n - start );
+            for ( size_t g = 0; g < groupCount; g++ )
+                out[g] += sumGroup( groups + start, counts + start, len, groupIds[g] );
+        }
+    }
+
+    /**
+     * Bucket borders are found by binary search in sorted times, every
+     * bucket is then summed with group_totals()
+     */
+    void bucket_sums( const int32_t *times, const int32_t *groups, const int32_t *counts, size_t n,
+            int32_t origin, int32_t bucket, size_t buckets,
+            const int32_t *groupIds, size_t groupCount, int64_t *out ) {
+        const int32_t *end = times + n;
+        const int32_t *pos = lower_bound( times, end, origin );
+        for ( size_t b = 0; b < buckets && pos != end; b++ ) {
+            int64_t limit = (int64_t) origin + (int64_t) ( b + 1 ) * bucket;
+            const int32_t *next = limit > INT_MAX ? end : lower_bound( pos, end, (int32_t) limit );
+            size_t first = pos - times;
+            group_totals( groups + first, counts + first, next - pos, groupIds, groupCount, out + b * groupCount );
+            pos = next;
+        }
+    }
+
+    /**
+     * Window sums are differences of prefix sums; prefix sums are
+     * sequential, the differences are computed in vectors
+     */
+    void moving_average( const double *values, size_t n, size_t window, double *out ) {
+        if ( n == 0 || window == 0 )
+            return;
+        vector<double> prefix( n + 1 );
+        prefix[0] = 0;
+        for ( size_t i = 0; i < n; i++ )
+            prefix[i + 1] = prefix[i] + values[i];
+
+        // Windows reaching before the start
+        size_t head = min( window, n );
+        for ( size_t i = 0; i < head; i++ )
+            out[i] = prefix[i + 1] / window;
+        if ( n > window )
+            kernels().diff( &prefix[window + 1], &prefix[1], n - window, (double) window, out + window );
+    }
+
+}
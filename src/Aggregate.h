@@ -0,0 +1,90 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGAGGREGATE_H
+#define KEYFROGAGGREGATE_H
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace keyfrog {
+
+    /*
+     * Aggregation kernels over keypress columns (cluster times, groups,
+     * counts as parallel arrays). On x86 the widest instruction set
+     * supported by the running CPU (AVX2, SSE4.1) is picked at first
+     * use, otherwise plain loops are used.
+     */
+
+    /**
+     * Instruction set used by the kernels: "avx2", "sse4.1" or "scalar"
+     */
+    const char *aggregate_isa();
+
+    /**
+     * Restricts kernels to plain loops (for comparison and testing)
+     */
+    void aggregate_force_scalar( bool scalar );
+
+    /**
+     * Sum of counts
+     */
+    int64_t sum_counts( const int32_t *counts, size_t n );
+
+    /**
+     * Sum of counts of rows belonging to group
+     */
+    int64_t sum_group_counts( const int32_t *groups, const int32_t *counts, size_t n, int32_t group );
+
+    /**
+     * Per group sums: out[g] gets sum of counts of rows of groupIds[g].
+     * Rows of groups not listed are ignored.
+     */
+    void group_totals( const int32_t *groups, const int32_t *counts, size_t n,
+            const int32_t *groupIds, size_t groupCount, int64_t *out );
+
+    /**
+     * Per bucket and group sums; bucket b covers times
+     * [origin + b * bucket, origin + (b + 1) * bucket) and is added to
+     * out[b * groupCount + g]. Times must be sorted, rows outside of
+     * the buckets are ignored.
+     */
+    void bucket_sums( const int32_t *times, const int32_t *groups, const int32_t *counts, size_t n,
+            int32_t origin, int32_t bucket, size_t buckets,
+            const int32_t *groupIds, size_t groupCount, int64_t *out );
+
+    /**
+     * Mean of window values ending at each position (values before
+     * the start count as zero)
+     */
+    void moving_average( const double *values, size_t n, size_t window, double *out );
+
+}
+
+#endif
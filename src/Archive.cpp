@@ -0,0 +1,481 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "Archive.h"
+#include "Common.h"
+#include "Aggregate.h"
+#include "Debug.h"
+
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace keyfrog {
+
+    static const char archiveMagic[8] = { 'K', 'F', 'A', 'R', 'C', 'H', 'V', '1' };
+    static const char archiveIndexMagic[8] = { 'K', 'F', 'I', 'D', 'X', '0', '0', '1' };
+    static const char archiveBlockMagic[4] = { 'K', 'F', 'B', '1' };
+    static const uint32_t archiveVersion = 1;
+
+    /// magic, cluster size, version
+    static const size_t archiveHeaderSize = 16;
+    /// magic, rows, min time, max time, time unit, dictionary size, payload size
+    static const size_t archiveBlockHeaderSize = 28;
+    /// offset, size, rows, min time, max time
+    static const size_t archiveIndexEntrySize = 24;
+    /// block count, index offset, magic
+    static const size_t archiveFooterSize = 20;
+
+    // Fixed size little endian fields
+
+    static void put_u32(string & out, uint32_t v) {
+        for(int i = 0; i < 4; i++)
+            out += (char) ((v >> (8 * i)) & 0xff);
+    }
+
+    static void put_u64(string & out, uint64_t v) {
+        for(int i = 0; i < 8; i++)
+            out += (char) ((v >> (8 * i)) & 0xff);
+    }
+
+    static uint32_t get_u32(const unsigned char *p) {
+        return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+    }
+
+    static uint64_t get_u64(const unsigned char *p) {
+        return (uint64_t) get_u32(p) | ((uint64_t) get_u32(p + 4) << 32);
+    }
+
+    //
+    // ArchiveWriter
+    //
+
+    ArchiveWriter::ArchiveWriter() : m_file(NULL), m_clusterSize(0), m_offset(0), m_rows(0) {
+    }
+
+    ArchiveWriter::~ArchiveWriter() {
+        if(m_file)
+            close();
+    }
+
+    bool ArchiveWriter::write(const string & data) {
+        if(data.size() != fwrite(data.data(), 1, data.size(), m_file)) {
+            _dbg("Write to archive `%s' failed", m_path.c_str());
+            return false;
+        }
+        m_offset += data.size();
+        return true;
+    }
+
+    bool ArchiveWriter::open(const string & path, int clusterSize) {
+        m_path = path;
+        m_clusterSize = clusterSize > 0 ? clusterSize : 1;
+        m_file = fopen(m_path.c_str(), "wb");
+        if(m_file == NULL) {
+            _dbg("Could not create archive `%s'", m_path.c_str());
+            return false;
+        }
+        m_offset = 0;
+        m_rows = 0;
+        m_index.clear();
+        m_pending.clear();
+
+        string header(archiveMagic, sizeof(archiveMagic));
+        put_u32(header, m_clusterSize);
+        put_u32(header, archiveVersion);
+        return write(header);
+    }
+
+    bool ArchiveWriter::add(int cluster_begin, int app_group, int count) {
+        if(m_file == NULL)
+            return false;
+        if(m_pending.size() && cluster_begin < m_pending.times.back()) {
+            _dbg("Archive rows out of order (%d < %d)", cluster_begin, m_pending.times.back());
+            return false;
+        }
+        if(m_pending.size() == 0 && !m_index.empty() && cluster_begin < m_index.back().maxTime) {
+            _dbg("Archive rows out of order (%d < %d)", cluster_begin, m_index.back().maxTime);
+            return false;
+        }
+        m_pending.push_back(cluster_begin, app_group, count);
+        m_rows++;
+        if(m_pending.size() >= blockRows)
+            return flushBlock();
+        return true;
+    }
+
+    /**
+     * Encodes gathered rows as one block
+     */
+    bool ArchiveWriter::flushBlock() {
+        size_t n = m_pending.size();
+        if(n == 0)
+            return true;
+
+        // Times are stored in cluster units when possible
+        uint32_t unit = m_clusterSize;
+        for(size_t i = 0; i < n && unit > 1; i++) {
+            if(m_pending.times[i] % (int32_t) unit)
+                unit = 1;
+        }
+
+        // Group dictionary
+        vector<int32_t> dict(m_pending.groups);
+        sort(dict.begin(), dict.end());
+        dict.erase(unique(dict.begin(), dict.end()), dict.end());
+
+        string payload;
+        for(size_t i = 0; i < dict.size(); i++)
+            put_varint(payload, zigzag_encode(dict[i]));
+
+        // Time column: ( delta, run length ) pairs
+        int64_t prev = 0;
+        for(size_t i = 0; i < n; ) {
+            size_t run = 1;
+            while(i + run < n && m_pending.times[i + run] == m_pending.times[i])
+                run++;
+            int64_t t = m_pending.times[i] / (int32_t) unit;
+            put_varint(payload, zigzag_encode(t - prev));
+            put_varint(payload, run);
+            prev = t;
+            i += run;
+        }
+
+        // Group column: dictionary indexes
+        for(size_t i = 0; i < n; i++) {
+            put_varint(payload, lower_bound(dict.begin(), dict.end(), m_pending.groups[i]) - dict.begin());
+        }
+
+        // Count column
+        for(size_t i = 0; i < n; i++) {
+            put_varint(payload, zigzag_encode(m_pending.counts[i]));
+        }
+
+        ArchiveBlockInfo info;
+        info.offset = m_offset;
+        info.rows = n;
+        info.minTime = m_pending.times.front();
+        info.maxTime = m_pending.times.back();
+
+        string block(archiveBlockMagic, sizeof(archiveBlockMagic));
+        put_u32(block, info.rows);
+        put_u32(block, info.minTime);
+        put_u32(block, info.maxTime);
+        put_u32(block, unit);
+        put_u32(block, dict.size());
+        put_u32(block, payload.size());
+        block += payload;
+        info.size = block.size();
+
+        m_pending.clear();
+        if(!write(block))
+            return false;
+        m_index.push_back(info);
+        return true;
+    }
+
+    bool ArchiveWriter::close() {
+        if(m_file == NULL)
+            return false;
+        bool ok = flushBlock();
+
+        uint64_t indexOffset = m_offset;
+        string index;
+        for(size_t i = 0; i < m_index.size(); i++) {
+            put_u64(index, m_index[i].offset);
+            put_u32(index, m_index[i].size);
+            put_u32(index, m_index[i].rows);
+            put_u32(index, m_index[i].minTime);
+            put_u32(index, m_index[i].maxTime);
+        }
+        put_u32(index, m_index.size());
+        put_u64(index, indexOffset);
+        index.append(archiveIndexMagic, sizeof(archiveIndexMagic));
+        ok = ok && write(index);
+
+        ok = (0 == fclose(m_file)) && ok;
+        m_file = NULL;
+        return ok;
+    }
+
+    //
+    // ArchiveReader
+    //
+
+    ArchiveReader::ArchiveReader() : m_fd(-1), m_map(NULL), m_size(0), m_clusterSize(0) {
+    }
+
+    ArchiveReader::~ArchiveReader() {
+        close();
+    }
+
+    bool ArchiveReader::open(const string & path) {
+        close();
+        m_fd = ::open(path.c_str(), O_RDONLY);
+        if(m_fd == -1) {
+            _dbg("Could not open archive `%s'", path.c_str());
+            return false;
+        }
+        struct stat st;
+        if(-1 == fstat(m_fd, &st) || (size_t) st.st_size < archiveHeaderSize + archiveFooterSize) {
+            close();
+            return false;
+        }
+        m_size = st.st_size;
+        void *addr = mmap(NULL, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+        if(addr == MAP_FAILED) {
+            m_map = NULL;
+            close();
+            return false;
+        }
+        m_map = (const unsigned char *) addr;
+#ifdef MADV_SEQUENTIAL
+        madvise(addr, m_size, MADV_SEQUENTIAL);
+#endif
+
+        const unsigned char *footer = m_map + m_size - archiveFooterSize;
+        if(memcmp(m_map, archiveMagic, sizeof(archiveMagic)) ||
+                memcmp(footer + 12, archiveIndexMagic, sizeof(archiveIndexMagic))) {
+            _dbg("`%s' is not a keyfrog archive", path.c_str());
+            close();
+            return false;
+        }
+        m_clusterSize = get_u32(m_map + 8);
+
+        uint32_t blocks = get_u32(footer);
+        uint64_t indexOffset = get_u64(footer + 4);
+        if(indexOffset + (uint64_t) blocks * archiveIndexEntrySize + archiveFooterSize != m_size) {
+            _dbg("Archive `%s' has broken index", path.c_str());
+            close();
+            return false;
+        }
+        m_index.resize(blocks);
+        const unsigned char *p = m_map + indexOffset;
+        for(uint32_t i = 0; i < blocks; i++, p += archiveIndexEntrySize) {
+            m_index[i].offset = get_u64(p);
+            m_index[i].size = get_u32(p + 8);
+            m_index[i].rows = get_u32(p + 12);
+            m_index[i].minTime = (int32_t) get_u32(p + 16);
+            m_index[i].maxTime = (int32_t) get_u32(p + 20);
+            if(m_index[i].offset > indexOffset || m_index[i].size > indexOffset - m_index[i].offset) {
+                _dbg("Archive `%s' has broken index", path.c_str());
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void ArchiveReader::close() {
+        if(m_map) {
+            munmap((void *) m_map, m_size);
+            m_map = NULL;
+        }
+        if(m_fd != -1) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        m_index.clear();
+        m_size = 0;
+    }
+
+    uint64_t ArchiveReader::rows() const {
+        uint64_t total = 0;
+        for(size_t i = 0; i < m_index.size(); i++)
+            total += m_index[i].rows;
+        return total;
+    }
+
+    bool ArchiveReader::readBlock(size_t i, ArchiveColumns & out, vector<int32_t> *dictionary) const {
+        if(m_map == NULL || i >= m_index.size())
+            return false;
+        if(m_index[i].size < archiveBlockHeaderSize)
+            return false;
+        const unsigned char *p = m_map + m_index[i].offset;
+        if(memcmp(p, archiveBlockMagic, sizeof(archiveBlockMagic)))
+            return false;
+        uint32_t rows = get_u32(p + 4);
+        uint32_t unit = get_u32(p + 16);
+        uint32_t dictSize = get_u32(p + 20);
+        uint32_t payloadSize = get_u32(p + 24);
+        const unsigned char *pos = p + archiveBlockHeaderSize;
+        const unsigned char *end = pos + payloadSize;
+        if(archiveBlockHeaderSize + payloadSize != m_index[i].size)
+            return false;
+        // Every dictionary entry takes a byte at least, every row two
+        // (group and count), so sizes can be checked before allocating
+        if(dictSize > payloadSize || (uint64_t) rows * 2 > payloadSize)
+            return false;
+
+        uint64_t v;
+        vector<int32_t> dict(dictSize);
+        for(uint32_t d = 0; d < dictSize; d++) {
+            if(!get_varint(pos, end, v))
+                return false;
+            dict[d] = (int32_t) zigzag_decode(v);
+        }
+        if(dictionary)
+            *dictionary = dict;
+
+        size_t base = out.size();
+        out.times.resize(base + rows);
+        out.groups.resize(base + rows);
+        out.counts.resize(base + rows);
+
+        int32_t *times = &out.times[base];
+        int64_t t = 0;
+        for(uint32_t r = 0; r < rows; ) {
+            uint64_t run;
+            if(!get_varint(pos, end, v) || !get_varint(pos, end, run) || run == 0 || r + run > rows)
+                return false;
+            t += zigzag_decode(v);
+            int32_t time = (int32_t) (t * unit);
+            for(uint64_t k = 0; k < run; k++)
+                times[r++] = time;
+        }
+
+        int32_t *groups = &out.groups[base];
+        for(uint32_t r = 0; r < rows; r++) {
+            if(!get_varint(pos, end, v) || v >= dictSize)
+                return false;
+            groups[r] = dict[v];
+        }
+
+        int32_t *counts = &out.counts[base];
+        for(uint32_t r = 0; r < rows; r++) {
+            if(!get_varint(pos, end, v))
+                return false;
+            counts[r] = (int32_t) zigzag_decode(v);
+        }
+        return pos == end;
+    }
+
+    bool ArchiveReader::readRange(int from, int to, ArchiveColumns & out) const {
+        for(size_t i = 0; i < m_index.size(); i++) {
+            if(m_index[i].maxTime < from || m_index[i].minTime >= to)
+                continue;
+            size_t base = out.size();
+            if(!readBlock(i, out))
+                return false;
+            // Border blocks -- trim rows outside of range
+            if(m_index[i].minTime < from || m_index[i].maxTime >= to) {
+                size_t w = base;
+                for(size_t r = base; r < out.size(); r++) {
+                    if(out.times[r] >= from && out.times[r] < to) {
+                        out.times[w] = out.times[r];
+                        out.groups[w] = out.groups[r];
+                        out.counts[w] = out.counts[r];
+                        w++;
+                    }
+                }
+                out.times.resize(w);
+                out.groups.resize(w);
+                out.counts.resize(w);
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Blocks are summed by aggregation kernels straight from decoded
+     * columns, without gathering rows of whole range
+     */
+    bool ArchiveReader::groupTotals(int from, int to, map<int, int64_t> & totals) const {
+        ArchiveColumns cols;
+        vector<int32_t> dict;
+        vector<int64_t> sums;
+        for(size_t i = 0; i < m_index.size(); i++) {
+            if(m_index[i].maxTime < from || m_index[i].minTime >= to)
+                continue;
+            cols.clear();
+            if(!readBlock(i, cols, &dict))
+                return false;
+            size_t first = lower_bound(cols.times.begin(), cols.times.end(), from) - cols.times.begin();
+            size_t last = lower_bound(cols.times.begin() + first, cols.times.end(), to) - cols.times.begin();
+            if(first == last)
+                continue;
+            sums.assign(dict.size(), 0);
+            group_totals(&cols.groups[first], &cols.counts[first], last - first, &dict[0], dict.size(), &sums[0]);
+            for(size_t g = 0; g < dict.size(); g++)
+                totals[dict[g]] += sums[g];
+        }
+        return true;
+    }
+
+    bool ArchiveReader::bucketSums(int from, int to, int bucket, map<pair<int, int>, int64_t> & sums) const {
+        if(bucket <= 0)
+            return false;
+        ArchiveColumns cols;
+        vector<int32_t> dict;
+        vector<int64_t> blockSums;
+        for(size_t i = 0; i < m_index.size(); i++) {
+            if(m_index[i].maxTime < from || m_index[i].minTime >= to)
+                continue;
+            cols.clear();
+            if(!readBlock(i, cols, &dict))
+                return false;
+            size_t first = lower_bound(cols.times.begin(), cols.times.end(), from) - cols.times.begin();
+            size_t last = lower_bound(cols.times.begin() + first, cols.times.end(), to) - cols.times.begin();
+            if(first == last)
+                continue;
+            // Buckets are aligned on local time as in Query and Storage::series,
+            // and summed one nonempty bucket at a time, so that a small bucket
+            // over a long block doesn't allocate them all
+            size_t r = first;
+            while(r < last) {
+                int32_t start = local_bucket_start(cols.times[r], bucket);
+                int32_t end = local_bucket_start(start + bucket, bucket);
+                if(end <= start) {
+                    // Day that got an extra hour from DST change
+                    end = local_bucket_start(start + bucket + 3600, bucket);
+                }
+                end = max(end, cols.times[r] + 1);
+                size_t next = lower_bound(cols.times.begin() + r, cols.times.begin() + last, end) - cols.times.begin();
+                blockSums.assign(dict.size(), 0);
+                bucket_sums(&cols.times[r], &cols.groups[r], &cols.counts[r], next - r,
+                        start, end - start, 1, &dict[0], dict.size(), &blockSums[0]);
+                for(size_t g = 0; g < dict.size(); g++) {
+                    if(blockSums[g])
+                        sums[make_pair(start, dict[g])] += blockSums[g];
+                }
+                r = next;
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,157 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGARCHIVE_H
+#define KEYFROGARCHIVE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <stdint.h>
+
+namespace keyfrog {
+
+    /**
+     * Location and time span of one archive block, kept in file index
+     * so that readers can skip blocks without decoding them.
+     */
+    struct ArchiveBlockInfo {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t rows;
+        int32_t minTime;
+        int32_t maxTime;
+    };
+
+    /**
+     * Keypress rows in columnar form
+     */
+    struct ArchiveColumns {
+        std::vector<int32_t> times;
+        std::vector<int32_t> groups;
+        std::vector<int32_t> counts;
+
+        size_t size() const { return times.size(); }
+        void clear() { times.clear(); groups.clear(); counts.clear(); }
+        void push_back(int32_t time, int32_t group, int32_t count) {
+            times.push_back(time);
+            groups.push_back(group);
+            counts.push_back(count);
+        }
+    };
+
+    /**
+     * Writes keypress history into columnar archive file.
+     *
+     * Rows are gathered into blocks. In a block cluster times are
+     * run-length and delta encoded (in units of cluster size), groups
+     * are coded through per-block dictionary and counts are varints.
+     * Index of blocks with min/max times closes the file. Rows must
+     * be added in non-decreasing time order.
+     */
+    class ArchiveWriter {
+        FILE *m_file;
+        std::string m_path;
+        int m_clusterSize;
+        /// Rows gathered for current block
+        ArchiveColumns m_pending;
+        /// Index of already written blocks
+        std::vector<ArchiveBlockInfo> m_index;
+        uint64_t m_offset;
+        uint64_t m_rows;
+
+        bool flushBlock();
+        bool write(const std::string & data);
+
+        public:
+        ArchiveWriter();
+        ~ArchiveWriter();
+
+        /// Rows per block
+        static const size_t blockRows = 64 * 1024;
+
+        /// Creates archive file
+        bool open(const std::string & path, int clusterSize);
+
+        /// Adds row; time must not be lower than time of previous row
+        bool add(int cluster_begin, int app_group, int count);
+
+        /// Writes pending block and index
+        bool close();
+
+        /// Number of rows written so far
+        uint64_t rows() const { return m_rows; }
+    };
+
+    /**
+     * Reads archive through read-only mapping; blocks are decoded
+     * straight from mapped memory.
+     */
+    class ArchiveReader {
+        int m_fd;
+        const unsigned char *m_map;
+        size_t m_size;
+        int m_clusterSize;
+        std::vector<ArchiveBlockInfo> m_index;
+
+        public:
+        ArchiveReader();
+        ~ArchiveReader();
+
+        /// Maps the file and reads its index
+        bool open(const std::string & path);
+
+        void close();
+
+        int clusterSize() const { return m_clusterSize; }
+
+        size_t blockCount() const { return m_index.size(); }
+
+        const ArchiveBlockInfo & blockInfo(size_t i) const { return m_index[i]; }
+
+        /// Total number of rows
+        uint64_t rows() const;
+
+        /// Decodes block and appends its rows to out; distinct groups of block go to dictionary
+        bool readBlock(size_t i, ArchiveColumns & out, std::vector<int32_t> *dictionary = NULL) const;
+
+        /// Appends rows with time in [from, to) to out, skipping blocks by index
+        bool readRange(int from, int to, ArchiveColumns & out) const;
+
+        /// Adds keypresses per group with time in [from, to) to totals
+        bool groupTotals(int from, int to, std::map<int, int64_t> & totals) const;
+
+        /// Adds keypresses per (bucket start, group) with time in [from, to) to sums;
+        /// buckets are aligned on local time (see local_bucket_start())
+        bool bucketSums(int from, int to, int bucket, std::map<std::pair<int, int>, int64_t> & sums) const;
+    };
+}
+
+#endif
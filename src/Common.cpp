@@ -31,6 +31,7 @@
 #include <config.h>
 #endif
 #include "Common.h"
+#include <ctime>
 
 namespace keyfrog {
 
@@ -49,4 +50,59 @@ namespace keyfrog {
         return true;
     }
 
+    /**
+     * Appends LEB128 varint to the buffer
+     */
+    void put_varint( std::string& out, uint64_t value ) {
+        while( value >= 0x80 ) {
+            out += (char) ( ( value & 0x7f ) | 0x80 );
+            value >>= 7;
+        }
+        out += (char) value;
+    }
+
+    /**
+     * Reads LEB128 varint, advances the pointer
+     */
+    bool get_varint( const unsigned char *& pos, const unsigned char *end, uint64_t& value ) {
+        value = 0;
+        for( int shift = 0; pos < end && shift < 64; shift += 7 ) {
+            unsigned char byte = *pos++;
+            value |= (uint64_t) ( byte & 0x7f ) << shift;
+            if( !( byte & 0x80 ) ) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int64_t monotonic_ms() {
+        struct timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    int64_t local_time( int timestamp ) {
+        time_t t = timestamp;
+        struct tm tm;
+        localtime_r( &t, &tm );
+        return timegm( &tm );
+    }
+
+    int from_local_time( int64_t local ) {
+        time_t t = local;
+        struct tm tm;
+        gmtime_r( &t, &tm );
+        tm.tm_isdst = -1;
+        return mktime( &tm );
+    }
+
+    int local_bucket_start( int timestamp, int bucket ) {
+        int64_t local = local_time( timestamp );
+        int64_t rem = local % bucket;
+        if( rem < 0 )
+            rem += bucket;
+        return from_local_time( local - rem );
+    }
+
 }
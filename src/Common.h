@@ -31,6 +31,7 @@
 #define KEYFROGCOMMON_H
 
 #include <string>
+#include <stdint.h>
 
 namespace keyfrog {
 
@@ -39,6 +40,50 @@ namespace keyfrog {
      */
     bool string_eq_ci( const std::string& str1, const std::string& str2 );
 
+    /**
+     * Appends LEB128 varint to the buffer
+     */
+    void put_varint( std::string& out, uint64_t value );
+
+    /**
+     * Reads LEB128 varint, advances the pointer
+     * @return false if buffer ends before the varint does
+     */
+    bool get_varint( const unsigned char *& pos, const unsigned char *end, uint64_t& value );
+
+    /**
+     * Maps signed numbers to unsigned so that small magnitudes stay small
+     */
+    inline uint64_t zigzag_encode( int64_t value ) {
+        return ( (uint64_t) value << 1 ) ^ (uint64_t) ( value >> 63 );
+    }
+
+    inline int64_t zigzag_decode( uint64_t value ) {
+        return (int64_t) ( value >> 1 ) ^ -(int64_t) ( value & 1 );
+    }
+
+    /**
+     * Monotonic clock in milliseconds
+     */
+    int64_t monotonic_ms();
+
+    /**
+     * Local wall clock time of timestamp, counted as seconds since epoch
+     */
+    int64_t local_time( int timestamp );
+
+    /**
+     * Timestamp of local wall clock time returned by local_time()
+     */
+    int from_local_time( int64_t local );
+
+    /**
+     * Start of bucket containing timestamp; buckets are aligned on local
+     * wall clock time, so daily ones start at local midnight also
+     * across DST changes (same as rollup tables)
+     */
+    int local_bucket_start( int timestamp, int bucket );
+
 }
 
 #endif
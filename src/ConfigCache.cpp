@@ -0,0 +1,205 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "ConfigCache.h"
+#include "Debug.h"
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+namespace keyfrog {
+
+    static const char cacheMagic[8] = { 'K', 'F', 'C', 'A', 'C', 'H', 'E', '1' };
+    /// magic, size, mtime, hash
+    static const size_t cacheHeaderSize = 32;
+
+    // Fixed size little endian fields
+
+    static void put_u32(string & out, uint32_t v) {
+        for(int i = 0; i < 4; i++)
+            out += (char) ((v >> (8 * i)) & 0xff);
+    }
+
+    static void put_u64(string & out, uint64_t v) {
+        for(int i = 0; i < 8; i++)
+            out += (char) ((v >> (8 * i)) & 0xff);
+    }
+
+    static void put_str(string & out, const string & str) {
+        put_u32(out, str.size());
+        out += str;
+    }
+
+    static uint32_t get_u32(const unsigned char *p) {
+        return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+    }
+
+    static uint64_t get_u64(const unsigned char *p) {
+        return (uint64_t) get_u32(p) | ((uint64_t) get_u32(p + 4) << 32);
+    }
+
+    /// Reads u32 at pos, advances it; false past the end
+    static bool take_u32(const unsigned char *& pos, const unsigned char *end, uint32_t & value) {
+        if(end - pos < 4)
+            return false;
+        value = get_u32(pos);
+        pos += 4;
+        return true;
+    }
+
+    static bool take_str(const unsigned char *& pos, const unsigned char *end, string & str) {
+        uint32_t len;
+        if(!take_u32(pos, end, len) || (size_t) (end - pos) < len)
+            return false;
+        str.assign((const char *) pos, len);
+        pos += len;
+        return true;
+    }
+
+    /// Unmaps cache file when the last matcher using it is gone
+    struct CacheMapping {
+        void *addr;
+        size_t size;
+
+        CacheMapping(void *a, size_t s) : addr(a), size(s) {
+        }
+
+        ~CacheMapping() {
+            munmap(addr, size);
+        }
+    };
+
+    ConfigKey::ConfigKey(const string & contents, time_t theMtime) : size(contents.size()), mtime(theMtime) {
+        hash = 14695981039346656037ULL;
+        for(string::const_iterator it = contents.begin(); it != contents.end(); ++it) {
+            hash ^= (unsigned char) *it;
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    ConfigCache::ConfigCache(const string & path) : m_path(path) {
+    }
+
+    bool ConfigCache::load(const ConfigKey & key, vector<OptionElement> & options, GroupMatcher & matcher) const {
+        int fd = ::open(m_path.c_str(), O_RDONLY);
+        if(fd == -1)
+            return false;
+        struct stat st;
+        if(-1 == fstat(fd, &st) || (size_t) st.st_size < cacheHeaderSize) {
+            ::close(fd);
+            return false;
+        }
+        size_t size = st.st_size;
+        void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(addr == MAP_FAILED)
+            return false;
+        boost::shared_ptr<CacheMapping> mapping(new CacheMapping(addr, size));
+
+        const unsigned char *map = (const unsigned char *) addr;
+        const unsigned char *end = map + size;
+        if(memcmp(map, cacheMagic, sizeof(cacheMagic)) || get_u64(map + 8) != key.size ||
+                (int64_t) get_u64(map + 16) != key.mtime || get_u64(map + 24) != key.hash) {
+            _dbg("Cache %s is stale", m_path.c_str());
+            return false;
+        }
+
+        const unsigned char *pos = map + cacheHeaderSize;
+        vector<OptionElement> cached;
+        uint32_t count;
+        if(!take_u32(pos, end, count))
+            return false;
+        for(uint32_t i = 0; i < count; i++) {
+            OptionElement elem;
+            uint32_t line, attributes;
+            if(!take_str(pos, end, elem.name) || !take_u32(pos, end, line) || !take_u32(pos, end, attributes))
+                return false;
+            elem.line = line;
+            for(uint32_t j = 0; j < attributes; j++) {
+                pair<string, string> attr;
+                if(!take_str(pos, end, attr.first) || !take_str(pos, end, attr.second))
+                    return false;
+                elem.attributes.push_back(attr);
+            }
+            cached.push_back(elem);
+        }
+
+        uint32_t matcherSize;
+        if(!take_u32(pos, end, matcherSize) || (size_t) (end - pos) != matcherSize ||
+                !matcher.attach(mapping, pos, matcherSize)) {
+            _dbg("Cache %s is broken", m_path.c_str());
+            return false;
+        }
+        options.swap(cached);
+        return true;
+    }
+
+    bool ConfigCache::save(const ConfigKey & key, const vector<OptionElement> & options, const GroupMatcher & matcher) const {
+        string header;
+        header.append(cacheMagic, sizeof(cacheMagic));
+        put_u64(header, key.size);
+        put_u64(header, key.mtime);
+        put_u64(header, key.hash);
+        put_u32(header, options.size());
+        for(vector<OptionElement>::const_iterator it = options.begin(); it != options.end(); ++it) {
+            put_str(header, it->name);
+            put_u32(header, it->line);
+            put_u32(header, it->attributes.size());
+            for(size_t j = 0; j < it->attributes.size(); j++) {
+                put_str(header, it->attributes[j].first);
+                put_str(header, it->attributes[j].second);
+            }
+        }
+        put_u32(header, matcher.size());
+
+        string tmpPath = m_path + ".tmp";
+        FILE *file = fopen(tmpPath.c_str(), "wb");
+        if(file == NULL)
+            return false;
+        bool ok = fwrite(header.data(), header.size(), 1, file) == 1;
+        if(ok && matcher.size())
+            ok = fwrite(matcher.image(), matcher.size(), 1, file) == 1;
+        ok = (fclose(file) == 0) && ok;
+        if(!ok || rename(tmpPath.c_str(), m_path.c_str()) != 0) {
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+}
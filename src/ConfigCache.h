@@ -0,0 +1,87 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGCONFIGCACHE_H
+#define KEYFROGCONFIGCACHE_H
+
+#include "GroupMatcher.h"
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <ctime>
+#include <stdint.h>
+
+namespace keyfrog {
+
+    /**
+     * Element of <options> section, kept as parsed so that it can
+     * be interpreted again without the document
+     */
+    struct OptionElement {
+        std::string name;
+        /// Line in config file (for messages)
+        long line;
+        std::vector< std::pair<std::string, std::string> > attributes;
+    };
+
+    /**
+     * Identifies config file contents a cache was written for
+     */
+    struct ConfigKey {
+        uint64_t size;
+        int64_t mtime;
+        /// FNV-1a of file contents
+        uint64_t hash;
+
+        ConfigKey(const std::string & contents, time_t mtime);
+    };
+
+    /**
+     * Compiled config next to the config file (config.cache).
+     *
+     * Holds option elements and the image of GroupMatcher. On load
+     * the file is mapped and the matcher uses the mapping directly,
+     * so thousands of rules need neither XML parsing nor compiling.
+     * A cache written for other contents of config is ignored.
+     */
+    class ConfigCache {
+        std::string m_path;
+        public:
+        ConfigCache(const std::string & path);
+
+        /// Reads cache, false if it is missing, broken or written for other key
+        bool load(const ConfigKey & key, std::vector<OptionElement> & options, GroupMatcher & matcher) const;
+
+        /// Replaces cache file
+        bool save(const ConfigKey & key, const std::vector<OptionElement> & options, const GroupMatcher & matcher) const;
+    };
+}
+
+#endif
@@ -32,8 +32,12 @@
 #endif
 
 #include "ConfigReader.h"
-#include <exception>
+#include <cstdio>
 #include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <sstream>
+#include <sys/stat.h>
 #include "Debug.h"
 #include "TermCode.h"
 
@@ -42,12 +46,55 @@ using namespace keyfrog::TermCodes;
 
 namespace keyfrog {
 
+    /// Value of attribute (string of xmlGetProp is freed here)
+    static bool property(xmlNode *node, const xmlChar *name, string & value) {
+        xmlChar *prop = xmlGetProp(node, name);
+        if(prop == NULL)
+            return false;
+        value = (const char *) prop;
+        xmlFree(prop);
+        return true;
+    }
+
+    static bool attribute(const OptionElement & opt, const char *name, string & value) {
+        for(vector< pair<string, string> >::const_iterator it = opt.attributes.begin(); it != opt.attributes.end(); ++it) {
+            if(it->first == name) {
+                value = it->second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool parse_int(const string & str, int & value) {
+        if(str.empty())
+            return false;
+        char *end;
+        errno = 0;
+        long lvalue = strtol(str.c_str(), &end, 10);
+        if(*end != '\0' || errno == ERANGE || lvalue < INT_MIN || lvalue > INT_MAX)
+            return false;
+        value = lvalue;
+        return true;
+    }
+
+    /// Text of rule; there must be only one children with text
+    static bool rule_value(xmlNode *rule, string & value) {
+        xmlNode *child = rule->children;
+        if(child == NULL || child->type != XML_TEXT_NODE || child->next != NULL ||
+                child->children != NULL || child->content == NULL || child->content[0] == '\0') {
+            return false;
+        }
+        value = (const char *) child->content;
+        return true;
+    }
+
     /** 
      * Base initialization
      * 
      * @param configPath 
      */
-    ConfigReader::ConfigReader() : m_config(NULL) {
+    ConfigReader::ConfigReader() : m_config(NULL), m_useCache(true) {
         xmlKeepBlanksDefault(0);
     }
 
@@ -59,11 +106,21 @@ namespace keyfrog {
     }
 
     /** 
-     * Uses sub-function for each bigger group of tags.
+     * Takes compiled groups and options from config.cache when it
+     * was written for current contents of config. Otherwise parses
+     * config, using sub-function for each bigger group of tags, and
+     * writes the cache (only when there were no errors).
      */
-    void ConfigReader::readConfig() {
-        configXmlDoc = xmlReadFile(m_config->configPath().c_str(), NULL, 0);
-        if(configXmlDoc == NULL) {
+    bool ConfigReader::readConfig() {
+        m_errors.clear();
+        const string & path = m_config->configPath();
+
+        string text;
+        struct stat st;
+        FILE *file = fopen(path.c_str(), "rb");
+        if(file == NULL || fstat(fileno(file), &st) == -1) {
+            if(file)
+                fclose(file);
             _inf(
                     "%sThere is no config file (~/.keyfrog/config).\n"
                     "You must create one. You can use example config included with keyfrog.\n"
@@ -71,8 +128,60 @@ namespace keyfrog {
                     "`/usr/local/share/keyfrog/doc/sample-config'. If it's not there,\n"
                     "download sources and check doc/ directory.%s\n"
                     , ccyan, creset);
+            return false;
+        }
+        char buf[65536];
+        size_t len;
+        while((len = fread(buf, 1, sizeof(buf), file)) > 0)
+            text.append(buf, len);
+        fclose(file);
+
+        ConfigKey key(text, st.st_mtime);
+        ConfigCache cache(path + ".cache");
+        vector<OptionElement> options;
+        GroupMatcher matcher;
+        bool cached = m_useCache && cache.load(key, options, matcher);
+        if(cached) {
+            _dbg("Config taken from %s.cache (%d groups)", path.c_str(), matcher.groupCount());
+            m_config->filterConfig().setMatcher(matcher);
+        } else {
+            if(!parseConfig(text, options))
+                return false;
+            m_config->filterConfig().compile();
+        }
+
+        for(vector<OptionElement>::const_iterator it = options.begin(); it != options.end(); ++it)
+            processOption(*it);
+
+        if(!m_errors.empty())
+            return false;
+        if(m_useCache && !cached && !cache.save(key, options, m_config->filterConfig().matcher()))
+            _dbg("Could not write %s.cache", path.c_str());
+        return true;
+    }
+
+    /**
+     * Problems are reported and skipped, so that everything else
+     * of the file is still read
+     */
+    bool ConfigReader::parseConfig(const string & text, vector<OptionElement> & options) {
+        const string & path = m_config->configPath();
+        xmlDoc *configXmlDoc = xmlReadMemory(text.data(), text.size(), path.c_str(), NULL,
+                XML_PARSE_NOBLANKS | XML_PARSE_NONET | XML_PARSE_NOERROR | XML_PARSE_NOWARNING);
+        if(configXmlDoc == NULL) {
+            const xmlError *err = xmlGetLastError();
+            string message = err && err->message ? err->message : "not an XML document";
+            while(!message.empty() && message[message.size() - 1] == '\n')
+                message.erase(message.size() - 1);
+            error(err ? err->line : 0, message);
+            return false;
         }
         xmlNode *rootElement = xmlDocGetRootElement(configXmlDoc);
+        if(rootElement == NULL) {
+            error(0, "document is empty");
+            xmlFreeDoc(configXmlDoc);
+            return false;
+        }
         // Walk through nodes and invoke proper processing functions
         for (xmlNode * cur_node = rootElement->children; cur_node; cur_node = cur_node->next) {
             if (cur_node->type != XML_ELEMENT_NODE) {
@@ -80,12 +189,14 @@ namespace keyfrog {
             }
             if(0==xmlStrcmp((const xmlChar *)"application-groups",cur_node->name)) {
                 processGroups(cur_node->children);
-            }
-            if(0==xmlStrcmp((const xmlChar *)"options",cur_node->name)) {
-                processOptions(cur_node->children);
+            } else if(0==xmlStrcmp((const xmlChar *)"options",cur_node->name)) {
+                collectOptions(cur_node->children, options);
+            } else {
+                error(xmlGetLineNo(cur_node), string("unknown section <") + (const char *) cur_node->name + ">");
             }
         }
         xmlFreeDoc(configXmlDoc);
+        return true;
     }
 
     /**
@@ -94,64 +205,57 @@ namespace keyfrog {
      */
     void ConfigReader::processGroups(xmlNode *startGroup) {
         for (xmlNode * cur_group = startGroup; cur_group; cur_group = cur_group->next) {
-            if(cur_group->type == XML_COMMENT_NODE) {
+            if(cur_group->type != XML_ELEMENT_NODE) {
                 continue;
             }
+            long line = xmlGetLineNo(cur_group);
             if(0!=xmlStrcmp((const xmlChar *)"group",cur_group->name)) {
-                throw exception();
+                error(line, string("expected <group>, found <") + (const char *) cur_group->name + ">");
+                continue;
+            }
+            string groupId;
+            int id;
+            if(!property(cur_group, (const xmlChar *)"id", groupId)) {
+                error(line, "group has no id");
+                continue;
+            }
+            if(!parse_int(groupId, id) || id < 0) {
+                error(line, "group id `" + groupId + "' is not a non-negative number");
+                continue;
             }
-            xmlChar *groupId = xmlGetProp(cur_group, (const xmlChar *)"id");
             Group newGroup;
-            newGroup.setId(atoi((char *)groupId));
+            newGroup.setId(id);
             // Walk through rules of this group
             for(xmlNode * cur_rule = cur_group->children; cur_rule; cur_rule = cur_rule->next) {
                 if (cur_rule->type != XML_ELEMENT_NODE) {
                     continue;
                 }
+                line = xmlGetLineNo(cur_rule);
                 if(0!=xmlStrcmp((const xmlChar *)"rule",cur_rule->name)) {
-                    throw exception();
+                    error(line, string("expected <rule>, found <") + (const char *) cur_rule->name + ">");
+                    continue;
+                }
+                string ruleType, value;
+                if(!property(cur_rule, (const xmlChar *)"type", ruleType)) {
+                    error(line, "rule has no type");
+                    continue;
+                }
+                if(!rule_value(cur_rule, value)) {
+                    error(line, "rule must contain just a name");
+                    continue;
                 }
-                xmlChar *ruleType = xmlGetProp(cur_rule, (const xmlChar *)"type");
                 // WND_CLASS X11 window property
-                if(0==xmlStrcmp((const xmlChar *)"windowClassName", ruleType)) {
-                    // It contains WND_CLASS window property
-                    // There must be only one children with text
-                    if(cur_rule->children == NULL || 
-                            cur_rule->children->type != XML_TEXT_NODE ||
-                            cur_rule->children->next != NULL ||
-                            cur_rule->children->children != NULL) 
-                    {
-                        // TODO: descriptful error message instead of exception throw
-                        _dbg("exception1");
-                        throw exception();
-                    }
-                    const char * tmp = (const char *)cur_rule->children->content;
-                    newGroup.addWindowClass(tmp);
-                    _dbg("new wndClass %s%s%s", cboldGreen, tmp, creset);
-                } else if(0==xmlStrcmp((const xmlChar *)"terminalProcessName", ruleType)) {
-                    if(cur_rule->children == NULL || 
-                            cur_rule->children->type != XML_TEXT_NODE ||
-                            cur_rule->children->next != NULL ||
-                            cur_rule->children->children != NULL) 
-                    {
-                        _dbg("exception2");
-                        throw exception();
-                    }
-                    const char * tmp = (const char *)cur_rule->children->content;
-                    newGroup.addTerminalProcess(tmp);
-                    _dbg("new termProc %s-T-%s%s%s", cboldRed, cboldGreen, tmp, creset);
-                } else if(0==xmlStrcmp((const xmlChar *)"processName", ruleType)) {
-                    if(cur_rule->children == NULL || 
-                            cur_rule->children->type != XML_TEXT_NODE ||
-                            cur_rule->children->next != NULL ||
-                            cur_rule->children->children != NULL) 
-                    {
-                        _dbg("exception3");
-                        throw exception();
-                    }
-                    const char * tmp = (const char *)cur_rule->children->content;
-                    newGroup.addProcess(tmp);
-                    _dbg("new proc %s%s%s", cboldGreen, tmp, creset);
+                if(ruleType == "windowClassName") {
+                    newGroup.addWindowClass(value);
+                    _dbg("new wndClass %s%s%s", cboldGreen, value.c_str(), creset);
+                } else if(ruleType == "terminalProcessName") {
+                    newGroup.addTerminalProcess(value);
+                    _dbg("new termProc %s-T-%s%s%s", cboldRed, cboldGreen, value.c_str(), creset);
+                } else if(ruleType == "processName") {
+                    newGroup.addProcess(value);
+                    _dbg("new proc %s%s%s", cboldGreen, value.c_str(), creset);
+                } else {
+                    error(line, "unknown rule type `" + ruleType + "'");
                 }
             }
             // XXX: should empty group be added?
@@ -160,55 +264,171 @@ namespace keyfrog {
         }
     }
 
-    void ConfigReader::processOptions(xmlNode *startOption) {
+    void ConfigReader::collectOptions(xmlNode *startOption, vector<OptionElement> & options) {
         for (xmlNode * cur_opt = startOption; cur_opt; cur_opt = cur_opt->next) {
-            char *_opt;
-            string opt;
-
-            if( 0 == xmlStrcmp((const xmlChar *)"debug", cur_opt->name) ) {
-                // state=""
-                _opt = (char *) xmlGetProp(cur_opt, (const xmlChar *)"state");
-                opt = _opt ? _opt : "off";
-                if(opt == "off")
-                    m_config->options().setDebugState(false);
-                else if(opt == "on")
-                    m_config->options().setDebugState(true);
-
-                // uselog=""
-                _opt = (char *) xmlGetProp(cur_opt, (const xmlChar *)"uselogfile");
-                opt = _opt ? _opt : "off";
-                if(opt == "off")
-                    m_config->options().setDebugUseLogFile(false);
-                else if(opt == "on")
-                    m_config->options().setDebugUseLogFile(true);
-
-                // usestderr=""
-                _opt = (char *) xmlGetProp(cur_opt, (const xmlChar *)"usestderr");
-                opt = _opt ? _opt : "off";
-                if(opt == "off")
-                    m_config->options().setDebugUseStdErr(false);
-                else if(opt == "on")
-                    m_config->options().setDebugUseStdErr(true);
-
-                // logfile=""
-                _opt = (char *) xmlGetProp(cur_opt, (const xmlChar *)"logfile");
-                if(_opt) {
-                    opt = _opt;
-                    m_config->options().setDebugLogFile(opt);
-                }
+            if(cur_opt->type != XML_ELEMENT_NODE) {
+                continue;
+            }
+            OptionElement opt;
+            opt.name = (const char *) cur_opt->name;
+            opt.line = xmlGetLineNo(cur_opt);
+            for(xmlAttr *attr = cur_opt->properties; attr; attr = attr->next) {
+                string value;
+                if(property(cur_opt, attr->name, value))
+                    opt.attributes.push_back(make_pair(string((const char *) attr->name), value));
+            }
+            options.push_back(opt);
+        }
+    }
 
-            } else if( 0 == xmlStrcmp((const xmlChar *)"cluster", cur_opt->name) ) {
-                // cluster=""
-                _opt = (char *) xmlGetProp(cur_opt, (const xmlChar *)"size");
-                if(_opt) {
-                    int size = atoi(_opt);
-                    m_config->options().setClusterSize(size);
-                }
-            } else {
-                // skip
+    void ConfigReader::processOption(const OptionElement & opt) {
+        string value;
+        bool state;
+        int number;
+
+        if( opt.name == "debug" ) {
+            // state=""
+            if(stateAttribute(opt, "state", "off", state))
+                m_config->options().setDebugState(state);
+
+            // uselog=""
+            if(stateAttribute(opt, "uselogfile", "off", state))
+                m_config->options().setDebugUseLogFile(state);
+
+            // usestderr=""
+            if(stateAttribute(opt, "usestderr", "off", state))
+                m_config->options().setDebugUseStdErr(state);
+
+            // logfile=""
+            if(attribute(opt, "logfile", value)) {
+                m_config->options().setDebugLogFile(value);
+            }
+
+        } else if( opt.name == "cluster" ) {
+            // cluster=""
+            if(intAttribute(opt, "size", number)) {
+                m_config->options().setClusterSize(number);
+            }
+        } else if( opt.name == "display" ) {
+            // name="" (may be given many times)
+            if(attribute(opt, "name", value)) {
+                m_config->options().addDisplay(value);
+            }
+        } else if( opt.name == "capture" ) {
+            // source="" (record, evdev)
+            if(attribute(opt, "source", value)) {
+                if(value != "record" && value != "evdev")
+                    error(opt.line, "capture source must be record or evdev, not `" + value + "'");
+                else
+                    m_config->options().setCaptureSource(value);
             }
 
+            // devices="" (space separated paths)
+            if(attribute(opt, "devices", value)) {
+                list<string> devices;
+                istringstream in(value);
+                string path;
+                while(in >> path)
+                    devices.push_back(path);
+                m_config->options().setCaptureDevices(devices);
+            }
+
+            // trace="" (file events are recorded to)
+            if(attribute(opt, "trace", value)) {
+                m_config->options().setCaptureTrace(value);
+            }
+        } else if( opt.name == "storage" ) {
+            // uri=""
+            if(attribute(opt, "uri", value)) {
+                m_config->options().setStorageUri(value);
+            }
+        } else if( opt.name == "commit" ) {
+            // interval=""
+            if(intAttribute(opt, "interval", number)) {
+                m_config->options().setCommitInterval(number);
+            }
+        } else if( opt.name == "journal" ) {
+            // state=""
+            if(stateAttribute(opt, "state", "on", state))
+                m_config->options().setJournalState(state);
+
+            // sync=""
+            if(intAttribute(opt, "sync", number)) {
+                m_config->options().setJournalSyncInterval(number);
+            }
+        } else if( opt.name == "socket" ) {
+            // state=""
+            if(stateAttribute(opt, "state", "on", state))
+                m_config->options().setStatsSocketState(state);
+        } else if( opt.name == "keys" ) {
+            // state=""
+            if(stateAttribute(opt, "state", "on", state))
+                m_config->options().setKeyStatsState(state);
+        } else if( opt.name == "sessions" ) {
+            // gap="" (seconds, 0 - off)
+            if(intAttribute(opt, "gap", number)) {
+                m_config->options().setSessionGap(number);
+            }
+        } else if( opt.name == "history" ) {
+            // hours=""
+            if(intAttribute(opt, "hours", number)) {
+                m_config->options().setHistoryHours(number);
+            }
+
+            // snapshot=""
+            if(stateAttribute(opt, "snapshot", "on", state))
+                m_config->options().setHistorySnapshot(state);
+        } else if( opt.name == "retention" ) {
+            // detail="" (days)
+            if(intAttribute(opt, "detail", number)) {
+                m_config->options().setDetailRetention(number);
+            }
+
+            // downsample="" (days)
+            if(intAttribute(opt, "downsample", number)) {
+                m_config->options().setDetailDownsample(number);
+            }
+        } else if( opt.name == "compaction" ) {
+            // idle="" (seconds)
+            if(intAttribute(opt, "idle", number)) {
+                m_config->options().setCompactionIdle(number);
+            }
+        } else {
+            error(opt.line, "unknown option <" + opt.name + ">");
         }
     }
 
+    bool ConfigReader::intAttribute(const OptionElement & opt, const char *name, int & value) {
+        string str;
+        if(!attribute(opt, name, str))
+            return false;
+        if(!parse_int(str, value)) {
+            error(opt.line, string(name) + "=\"" + str + "\" of <" + opt.name + "> is not a number");
+            return false;
+        }
+        return true;
+    }
+
+    bool ConfigReader::stateAttribute(const OptionElement & opt, const char *name, const char *defaultState, bool & state) {
+        string str;
+        if(!attribute(opt, name, str))
+            str = defaultState;
+        if(str == "on") {
+            state = true;
+        } else if(str == "off") {
+            state = false;
+        } else {
+            error(opt.line, string(name) + "=\"" + str + "\" of <" + opt.name + "> must be on or off");
+            return false;
+        }
+        return true;
+    }
+
+    void ConfigReader::error(long line, const string & message) {
+        ostringstream out;
+        out << m_config->configPath() << ":" << line << ": " << message;
+        m_errors.push_back(out.str());
+        _err("%s", out.str().c_str());
+    }
+
 }
@@ -31,10 +31,13 @@
 #define KEYFROGCONFIGREADER_H
 
 #include <string>
+#include <list>
+#include <vector>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 
 #include "Configuration.h"
+#include "ConfigCache.h"
 
 namespace keyfrog {
 
@@ -44,7 +47,11 @@ namespace keyfrog {
     class ConfigReader{
         Configuration * m_config;
 
-        xmlDoc *configXmlDoc;
+        /// Problems found by last readConfig(), as "file:line: message"
+        std::list<std::string> m_errors;
+
+        /// Is config.cache used
+        bool m_useCache;
 
         public:
         ConfigReader();
@@ -55,14 +62,35 @@ namespace keyfrog {
             m_config = &theVal;
         }
 
-        /// Loads and interpretes config
-        void readConfig();              
+        /// Turns compiled config cache on or off (on by default)
+        void setUseCache(bool theVal) {
+            m_useCache = theVal;
+        }
+
+        /// Loads and interpretes config, false if file couldn't be parsed or has errors
+        bool readConfig();
+
+        const std::list<std::string> & errors() const {
+            return m_errors;
+        }
 
         private:
+        /// Builds groups and collects option elements from config text
+        bool parseConfig(const std::string & text, std::vector<OptionElement> & options);
         /// Processes group tags
         void processGroups(xmlNode *startGroup);
-        /// Processes options tags
-        void processOptions(xmlNode *startOption);
+        /// Collects options tags
+        void collectOptions(xmlNode *startOption, std::vector<OptionElement> & options);
+        /// Interpretes collected option
+        void processOption(const OptionElement & opt);
+
+        /// Integer attribute, false if it's missing or malformed
+        bool intAttribute(const OptionElement & opt, const char *name, int & value);
+        /// on/off attribute (defaultState if missing), false if malformed
+        bool stateAttribute(const OptionElement & opt, const char *name, const char *defaultState, bool & state);
+
+        /// Records problem found at given line
+        void error(long line, const std::string & message);
     };
 
 }
@@ -0,0 +1,242 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H       /* HAVE_CONFIG_H */
+#include <config.h>
+#else                           /* HAVE_CONFIG_H */
+#include <FallbackConfigH.h>
+#endif                          /* HAVE_CONFIG_H */
+
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HOST_IS_LINUX
+#include <sys/inotify.h>
+#endif
+#include <boost/bind.hpp>
+
+#include "ConfigWatcher.h"
+#include "Configuration.h"
+#include "Common.h"
+#include "Debug.h"
+
+using namespace std;
+
+namespace keyfrog {
+
+    ConfigWatcher::ConfigWatcher() : m_fd(-1), m_mtime(0), m_lastCheck(0), m_due(0),
+            m_loader(NULL), m_loading(false), m_loaded(NULL) {
+    }
+
+    /**
+     * Waits for running load, so that it doesn't outlive
+     * the reader it uses
+     */
+    ConfigWatcher::~ConfigWatcher() {
+        if(m_loader) {
+            m_loader->join();
+            delete m_loader;
+        }
+        if(m_fd != -1)
+            ::close(m_fd);
+        delete m_loaded;
+    }
+
+    bool ConfigWatcher::watch(const string & configPath) {
+        m_configPath = configPath;
+        string::size_type slash = configPath.rfind('/');
+        if(slash == string::npos) {
+            m_dirPath = ".";
+            m_fileName = configPath;
+        } else {
+            m_dirPath = slash ? configPath.substr(0, slash) : string("/");
+            m_fileName = configPath.substr(slash + 1);
+        }
+
+        struct stat st;
+        if(stat(m_configPath.c_str(), &st) == 0)
+            m_mtime = st.st_mtime;
+        m_lastCheck = time(NULL);
+
+#ifdef HOST_IS_LINUX
+        m_fd = inotify_init();
+        if(m_fd == -1) {
+            _err("inotify_init failed: %s", strerror(errno));
+            return false;
+        }
+        int flags = fcntl(m_fd, F_GETFL);
+        if(flags == -1 || fcntl(m_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+            _err("Could not make inotify descriptor non-blocking: %s", strerror(errno));
+            ::close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        fcntl(m_fd, F_SETFD, FD_CLOEXEC);
+        // Directory, not file: editors often save by writing new file and renaming it
+        if(inotify_add_watch(m_fd, m_dirPath.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+            _err("Cannot watch %s: %s", m_dirPath.c_str(), strerror(errno));
+            ::close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    void ConfigWatcher::addPollFds(vector<pollfd> & fds) const {
+        if(m_fd == -1)
+            return;
+        pollfd pfd;
+        pfd.fd = m_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        fds.push_back(pfd);
+    }
+
+    int ConfigWatcher::timeout() const {
+        if(m_configPath.empty())
+            return -1;
+        if(m_due) {
+            long long left = m_due - monotonic_ms();
+            return left > 0 ? (int) left : 0;
+        }
+        boost::mutex::scoped_lock lock(m_mutex);
+        if(m_loading || m_loaded)
+            return 50;
+        return m_fd == -1 ? 1000 : -1;
+    }
+
+    void ConfigWatcher::handle(const vector<pollfd> & fds) {
+        if(m_configPath.empty())
+            return;
+
+        bool changed = false;
+        if(m_fd != -1) {
+#ifdef HOST_IS_LINUX
+            bool readable = false;
+            for(vector<pollfd>::const_iterator it = fds.begin(); it != fds.end(); ++it) {
+                if(it->fd == m_fd && (it->revents & POLLIN))
+                    readable = true;
+            }
+            while(readable) {
+                char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+                ssize_t len = read(m_fd, buf, sizeof(buf));
+                if(len <= 0)
+                    break;
+                for(char *ptr = buf; ptr < buf + len; ) {
+                    const struct inotify_event *ev = (const struct inotify_event *) ptr;
+                    if(ev->mask & IN_Q_OVERFLOW)
+                        changed = true;
+                    else if(ev->len && m_fileName == ev->name)
+                        changed = true;
+                    ptr += sizeof(struct inotify_event) + ev->len;
+                }
+            }
+#endif
+        } else {
+            time_t now = time(NULL);
+            if(now != m_lastCheck) {
+                m_lastCheck = now;
+                struct stat st;
+                if(stat(m_configPath.c_str(), &st) == 0 && st.st_mtime != m_mtime) {
+                    m_mtime = st.st_mtime;
+                    changed = true;
+                }
+            }
+        }
+
+        if(changed) {
+            _dbg("Config %s changed", m_configPath.c_str());
+            m_due = monotonic_ms() + settleDelay;
+        }
+        startLoader();
+    }
+
+    void ConfigWatcher::startLoader() {
+        if(!m_due || monotonic_ms() < m_due)
+            return;
+        boost::mutex::scoped_lock lock(m_mutex);
+        if(m_loading) {
+            // Picked up again when current load ends
+            return;
+        }
+        if(m_loader) {
+            m_loader->join();
+            delete m_loader;
+        }
+        m_due = 0;
+        m_loading = true;
+        m_loader = new boost::thread(boost::bind(&ConfigWatcher::load, this));
+    }
+
+    /**
+     * Parses config into a configuration of its own. Options are
+     * parsed too, but only groups are handed over -- other
+     * options take effect after restart.
+     */
+    void ConfigWatcher::load() {
+        Configuration config;
+        string path = m_configPath;
+        config.setConfigPath(path);
+        m_reader.setConfiguration(config);
+
+        bool ok;
+        try {
+            ok = m_reader.readConfig();
+        } catch(const std::exception & ex) {
+            ok = false;
+        }
+
+        FilterConfig *loaded = ok ? new FilterConfig(config.filterConfig()) : NULL;
+        if(loaded)
+            _inf("Config %s reloaded (%d groups)", m_configPath.c_str(), loaded->matcher().groupCount());
+        else
+            _err("Config %s could not be read, previous groups are kept", m_configPath.c_str());
+
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_loading = false;
+        if(loaded) {
+            delete m_loaded;
+            m_loaded = loaded;
+        }
+    }
+
+    bool ConfigWatcher::takeFilterConfig(FilterConfig & filterConfig) {
+        boost::mutex::scoped_lock lock(m_mutex);
+        if(!m_loaded)
+            return false;
+        filterConfig = *m_loaded;
+        delete m_loaded;
+        m_loaded = NULL;
+        return true;
+    }
+}
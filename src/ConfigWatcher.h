@@ -0,0 +1,112 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGCONFIGWATCHER_H
+#define KEYFROGCONFIGWATCHER_H
+
+#include "ConfigReader.h"
+#include "FilterConfig.h"
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <poll.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace keyfrog {
+
+    /**
+     * Reloads application groups when config file changes.
+     *
+     * On Linux the directory holding the config is watched with
+     * inotify, so that editors replacing the file by rename are
+     * noticed too; elsewhere modification time is checked once
+     * a second. A change is let to settle for settleDelay, then
+     * the file is parsed in a thread of its own. The new
+     * FilterConfig is picked up by the daemon's event loop with
+     * takeFilterConfig(), between event batches.
+     *
+     * Driven like StatsServer: addPollFds(), timeout(), handle().
+     */
+    class ConfigWatcher {
+        /// Watched file, its directory and name
+        std::string m_configPath;
+        std::string m_dirPath;
+        std::string m_fileName;
+        /// inotify descriptor (-1 - modification time is checked)
+        int m_fd;
+        /// Last seen modification time of config
+        time_t m_mtime;
+        /// When modification time was checked last time
+        time_t m_lastCheck;
+        /// When loading starts (monotonic milliseconds, 0 - no change seen)
+        long long m_due;
+
+        /// Parses config in loader thread
+        ConfigReader m_reader;
+        boost::thread *m_loader;
+
+        /// Guards fields below, shared with loader thread
+        mutable boost::mutex m_mutex;
+        bool m_loading;
+        /// Result of last successful load (NULL - nothing new)
+        FilterConfig *m_loaded;
+
+        /// Loader thread body
+        void load();
+
+        /// Starts loader if change settled and no load is running
+        void startLoader();
+
+        public:
+        /// Milliseconds of quiet after last change before config is read
+        static const int settleDelay = 250;
+
+        ConfigWatcher();
+        ~ConfigWatcher();
+
+        /// Starts watching given config file
+        bool watch(const std::string & configPath);
+
+        /// Appends descriptors to poll
+        void addPollFds(std::vector<pollfd> & fds) const;
+
+        /// Milliseconds until watcher needs handle() again, -1 if not needed
+        int timeout() const;
+
+        /// Reads change notifications and starts loading when due
+        void handle(const std::vector<pollfd> & fds);
+
+        /// Moves freshly loaded groups into given config, false if there are none
+        bool takeFilterConfig(FilterConfig & filterConfig);
+    };
+}
+
+#endif
@@ -0,0 +1,192 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "CountRing.h"
+#include "Debug.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std;
+
+namespace keyfrog {
+
+    static const char ringMagic[8] = { 'K', 'F', 'R', 'I', 'N', 'G', '0', '1' };
+
+    /// Snapshot file header, followed by group ids, slot times and counters
+    struct RingHeader {
+        char magic[8];
+        int32_t resolution;
+        uint32_t slots;
+        uint32_t columns;
+        uint32_t groupsUsed;
+        int32_t latest;
+    };
+
+    CountRing::CountRing(int resolution, size_t slots, size_t columns) :
+        m_resolution(resolution > 0 ? resolution : 1), m_slots(slots ? slots : 1), m_columns(columns ? columns : 1),
+        m_slotTimes(m_slots, 0), m_counts(m_slots * m_columns, 0), m_latest(0)
+    {
+    }
+
+    void CountRing::reset(int resolution, size_t slots, size_t columns) {
+        m_resolution = resolution > 0 ? resolution : 1;
+        m_slots = slots ? slots : 1;
+        m_columns = columns ? columns : 1;
+        m_slotTimes.assign(m_slots, 0);
+        m_counts.assign(m_slots * m_columns, 0);
+        m_groups.clear();
+        m_latest = 0;
+    }
+
+    /**
+     * @return column of group or -1 if there is no free column
+     */
+    int CountRing::columnOf(int app_group) {
+        for(size_t c = 0; c < m_groups.size(); c++) {
+            if(m_groups[c] == app_group)
+                return c;
+        }
+        if(m_groups.size() == m_columns) {
+            _dbg("No free ring column for group %d", app_group);
+            return -1;
+        }
+        m_groups.push_back(app_group);
+        return m_groups.size() - 1;
+    }
+
+    void CountRing::add(int app_group, int timestamp, int count) {
+        int32_t start = timestamp - timestamp % m_resolution;
+        if(start <= m_latest - span())
+            return;
+        int column = columnOf(app_group);
+        if(column == -1)
+            return;
+
+        size_t slot = (start / m_resolution) % m_slots;
+        uint32_t *row = &m_counts[slot * m_columns];
+        if(m_slotTimes[slot] != start) {
+            // Slot held data from previous turn of the ring
+            fill(row, row + m_columns, 0);
+            m_slotTimes[slot] = start;
+        }
+        row[column] += count;
+        m_latest = max(m_latest, start);
+    }
+
+    void CountRing::totals(int from, int to, map<int, long long> & out) const {
+        for(size_t slot = 0; slot < m_slots; slot++) {
+            int32_t start = m_slotTimes[slot];
+            if(start == 0 || start < from || start >= to || start <= m_latest - span())
+                continue;
+            const uint32_t *row = &m_counts[slot * m_columns];
+            for(size_t c = 0; c < m_groups.size(); c++) {
+                if(row[c])
+                    out[m_groups[c]] += row[c];
+            }
+        }
+    }
+
+    void CountRing::series(int from, int to, int step, map<pair<int, int>, long long> & out) const {
+        if(step <= 0)
+            step = m_resolution;
+        for(size_t slot = 0; slot < m_slots; slot++) {
+            int32_t start = m_slotTimes[slot];
+            if(start == 0 || start < from || start >= to || start <= m_latest - span())
+                continue;
+            int32_t bucket = start - start % step;
+            const uint32_t *row = &m_counts[slot * m_columns];
+            for(size_t c = 0; c < m_groups.size(); c++) {
+                if(row[c])
+                    out[make_pair(bucket, m_groups[c])] += row[c];
+            }
+        }
+    }
+
+    bool CountRing::save(const string & path) const {
+        RingHeader header;
+        memcpy(header.magic, ringMagic, sizeof(ringMagic));
+        header.resolution = m_resolution;
+        header.slots = m_slots;
+        header.columns = m_columns;
+        header.groupsUsed = m_groups.size();
+        header.latest = m_latest;
+
+        string tmpPath = path + ".tmp";
+        FILE *file = fopen(tmpPath.c_str(), "wb");
+        if(file == NULL)
+            return false;
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        if(ok && !m_groups.empty())
+            ok = fwrite(&m_groups[0], sizeof(int32_t), m_groups.size(), file) == m_groups.size();
+        ok = ok && fwrite(&m_slotTimes[0], sizeof(int32_t), m_slots, file) == m_slots;
+        ok = ok && fwrite(&m_counts[0], sizeof(uint32_t), m_counts.size(), file) == m_counts.size();
+        ok = (fclose(file) == 0) && ok;
+        if(!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool CountRing::load(const string & path) {
+        FILE *file = fopen(path.c_str(), "rb");
+        if(file == NULL)
+            return false;
+        RingHeader header;
+        bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+            memcmp(header.magic, ringMagic, sizeof(ringMagic)) == 0 &&
+            header.resolution == m_resolution && header.slots == m_slots &&
+            header.columns == m_columns && header.groupsUsed <= m_columns;
+
+        vector<int32_t> groups(header.groupsUsed);
+        vector<int32_t> slotTimes(m_slots);
+        vector<uint32_t> counts(m_counts.size());
+        if(ok && !groups.empty())
+            ok = fread(&groups[0], sizeof(int32_t), groups.size(), file) == groups.size();
+        ok = ok && fread(&slotTimes[0], sizeof(int32_t), m_slots, file) == m_slots;
+        ok = ok && fread(&counts[0], sizeof(uint32_t), counts.size(), file) == counts.size();
+        fclose(file);
+        if(!ok) {
+            _dbg("Ignoring ring snapshot %s", path.c_str());
+            return false;
+        }
+        m_groups.swap(groups);
+        m_slotTimes.swap(slotTimes);
+        m_counts.swap(counts);
+        m_latest = header.latest;
+        return true;
+    }
+}
@@ -0,0 +1,97 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGCOUNTRING_H
+#define KEYFROGCOUNTRING_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+namespace keyfrog {
+
+    /**
+     * Fixed-size ring of per-group keypress counts.
+     *
+     * Every slot covers `resolution' seconds and holds one counter per
+     * group column; the ring spans resolution * slots seconds, older
+     * slots are reused. Memory is allocated once. Groups get columns
+     * on first use; when all columns are taken further groups are not
+     * counted.
+     */
+    class CountRing {
+        int m_resolution;
+        size_t m_slots;
+        size_t m_columns;
+        /// Start time of data held by each slot (0 - empty)
+        std::vector<int32_t> m_slotTimes;
+        /// m_slots rows of m_columns counters
+        std::vector<uint32_t> m_counts;
+        /// Group id of each used column
+        std::vector<int32_t> m_groups;
+        /// Newest slot start time seen
+        int32_t m_latest;
+
+        int columnOf(int app_group);
+
+        public:
+        CountRing(int resolution, size_t slots, size_t columns);
+
+        /// Drops all counts and changes geometry of the ring
+        void reset(int resolution, size_t slots, size_t columns);
+
+        /// Bytes of memory held by counters
+        size_t memorySize() const { return m_counts.size() * sizeof(uint32_t) + m_slotTimes.size() * sizeof(int32_t); }
+
+        /// Seconds covered by one slot
+        int resolution() const { return m_resolution; }
+
+        /// Seconds covered by whole ring
+        int span() const { return m_resolution * m_slots; }
+
+        /// Adds keypresses; ignored if older than the ring
+        void add(int app_group, int timestamp, int count);
+
+        /// Adds counts of slots beginning in [from, to) to per group sums
+        void totals(int from, int to, std::map<int, long long> & out) const;
+
+        /// Adds counts of slots beginning in [from, to) to sums per ( step start, group )
+        void series(int from, int to, int step, std::map<std::pair<int, int>, long long> & out) const;
+
+        /// Writes ring to file (atomically, through a temporary file)
+        bool save(const std::string & path) const;
+
+        /// Reads ring saved by save(); fails if file has other geometry
+        bool load(const std::string & path);
+    };
+}
+
+#endif
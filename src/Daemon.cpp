@@ -38,11 +38,14 @@
 #include <boost/thread/xtime.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include "Daemon.h"
 #include "ProcessManagerLinux.h"
 #include "ProcessManagerMac.h"
 #include "ProcessManagerFBSD.h"
+#include "EventMonitorEvdev.h"
+#include "EventTrace.h"
 #include "RawEvent.h"
 #include "CallbackClosure.h"
 #include "Configuration.h"
@@ -51,16 +54,25 @@
 #include "TermCode.h"
 
 #include <exception>
+#include <cstring>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
+#include <vector>
 
 using namespace std;
 using namespace keyfrog::TermCodes;
 namespace fs = boost::filesystem;
 
 namespace keyfrog {
+    volatile sig_atomic_t Daemon::s_stopRequested = 0;
+
+    void Daemon::requestStop(int) {
+        s_stopRequested = 1;
+    }
+
     /** 
      * @brief FIXME
      */
@@ -84,7 +96,7 @@ namespace keyfrog {
     /**
      * Initializes application code.
      */
-    Daemon::Daemon(bool asDaemon) : m_xConnected(false) {
+    Daemon::Daemon(bool asDaemon) : m_nextConnect(0), m_statsServer(NULL) {
 #ifdef HOST_IS_OSX
         m_processManager = new ProcessManagerMac();
 #elif defined HOST_IS_LINUX
@@ -92,7 +104,6 @@ namespace keyfrog {
 #elif defined HOST_IS_FBSD
         m_processManager = new ProcessManagerFBSD();
 #endif
-        m_eventFilter = new EventFilter( m_wim, *m_processManager );
         m_processMonitor = new ProcessMonitor();
 
 #ifndef _KF_COLORS
@@ -114,12 +125,44 @@ namespace keyfrog {
         createDefaultConfig(homeDir);
         m_configReader.setConfiguration(m_configuration);
         m_configReader.readConfig();
-        m_eventFilter->setFilterConfig(m_configuration.filterConfig());
 
         // Create database
-        m_storageBackend = new StorageSqlite();
+        string storageLocation;
+        m_storageBackend = Storage::create(m_configuration.options().storageUri(), storageLocation);
+        if(m_storageBackend == NULL) {
+            _err("Unknown storage URI `%s'", m_configuration.options().storageUri().c_str());
+            throw exception();
+        }
+        if(storageLocation.compare(0, 2, "~/") == 0) {
+            storageLocation.replace(0, 1, homeDir);
+        }
+        StorageSqlite *storageSqlite = dynamic_cast<StorageSqlite *>(m_storageBackend);
+        if(storageSqlite) {
+            storageSqlite->setDetailRetention(m_configuration.options().detailRetention());
+            storageSqlite->setDownsampleAge(m_configuration.options().detailDownsample());
+        }
         m_storage = new StorageManager(m_storageBackend);
-        m_storage->connect(homeDir + "/.keyfrog/keyfrog.db");
+        m_storage->setClusterSize(m_configuration.options().clusterSize());
+        m_storage->setCommitInterval(m_configuration.options().commitInterval());
+        m_storage->setCompactionIdle(m_configuration.options().compactionIdle());
+        if(m_configuration.options().journalState()) {
+            m_storage->setJournalPath(homeDir + "/.keyfrog/keyfrog.journal");
+            m_storage->setJournalSyncInterval(m_configuration.options().journalSyncInterval());
+        }
+        m_storage->setHistoryHours(m_configuration.options().historyHours());
+        m_storage->connect(storageLocation);
+        if(m_configuration.options().historySnapshot()) {
+            m_historyPath = homeDir + "/.keyfrog/keyfrog.history";
+            m_storage->loadHistory(m_historyPath);
+        }
+
+        if(m_configuration.options().statsSocketState()) {
+            m_statsServer = new StatsServer(*m_storage);
+            if(!m_statsServer->listen(homeDir + "/.keyfrog/keyfrog.sock")) {
+                delete m_statsServer;
+                m_statsServer = NULL;
+            }
+        }
 
     }
 
@@ -127,34 +170,97 @@ namespace keyfrog {
      * Main task is closing database and disconnecting from Xserver
      */
     Daemon::~Daemon() {
-        m_eventFilter->stop();
+        for(vector<Seat *>::iterator it = m_seats.begin(); it != m_seats.end(); ++it) {
+            Seat *seat = *it;
+            if(seat->connected)
+                seat->filter->stop();
+            delete seat->filter;
+            delete seat->recorder;
+            delete seat->monitor;
+            delete seat;
+        }
+        delete m_statsServer;
+        // Joins commiter thread, which uses the backend
+        delete m_storage;
+        delete m_storageBackend;
         delete m_processMonitor;
-        delete m_eventFilter;
         delete m_processManager;
     }
 
-    /// FIXME Fix configuration
-    bool Daemon::connectXserver(string displayName) {
-        // Connect to Xserver
-        while ( 1 ) {
-            if(m_eventFilter->connect(displayName)) {
-                _dbg("%sSuccessfully connected to Xserver (DISPLAY=%s)%s", cboldGreen, displayName.c_str(), creset);
-                m_xConnected = true;
-                break;
+    /**
+     * Evdev devices are not bound to a display, so only the first
+     * seat reads them; others use X RECORD
+     */
+    EventMonitor *Daemon::createEventMonitor(bool first) {
+        const string & captureSource = m_configuration.options().captureSource();
+        if(captureSource == "evdev") {
+#ifdef HOST_IS_LINUX
+            if(first) {
+                EventMonitorEvdev *evdev = new EventMonitorEvdev();
+                const list<string> & devices = m_configuration.options().captureDevices();
+                for(list<string>::const_iterator it = devices.begin(); it != devices.end(); ++it)
+                    evdev->addDevice(*it);
+                return evdev;
             }
-            _dbg("%sConnect to X server (DISPLAY=%s) failed, waiting 60 seconds before trying again%s", cboldRed, displayName.c_str(), creset);
-            // Wait a bit..
-            boost::xtime xt;
-#if BOOST_VERSION >= 105000
-            boost::xtime_get(&xt, boost::TIME_UTC_);
+            _err("Capture source `evdev' serves first display only, using X RECORD");
 #else
-            boost::xtime_get(&xt, boost::TIME_UTC);
+            _err("Capture source `evdev' is available on Linux only, using X RECORD");
 #endif
-            xt.sec += 60;
-            boost::thread::sleep(xt);
+        } else if(captureSource != "record") {
+            _err("Unknown capture source `%s', using X RECORD", captureSource.c_str());
         }
-        m_eventFilter->start();
-        return true;
+        return new EventMonitorX11();
+    }
+
+    /**
+     * Seat is numbered by order of addition; its trace (if
+     * recording) gets the number appended, except for the first
+     */
+    void Daemon::addDisplay(const string & displayName) {
+        Seat *seat = new Seat();
+        seat->displayName = displayName;
+        seat->number = m_seats.size();
+        seat->connected = false;
+        seat->monitor = createEventMonitor(m_seats.empty());
+        seat->recorder = NULL;
+        seat->sessions.setGap(m_configuration.options().sessionGap());
+
+        string tracePath = m_configuration.options().captureTrace();
+        if(!tracePath.empty()) {
+            if(tracePath.compare(0, 2, "~/") == 0)
+                tracePath.replace(0, 1, m_configuration.homeDir());
+            if(!m_seats.empty())
+                tracePath += "." + boost::lexical_cast<string>(m_seats.size());
+            seat->recorder = new EventMonitorRecorder(*seat->monitor, *m_processManager, tracePath);
+        }
+
+        seat->filter = new EventFilter( seat->recorder ? *seat->recorder : *seat->monitor, seat->wim, *m_processManager );
+        seat->filter->setFilterConfig(m_configuration.filterConfig());
+        m_seats.push_back(seat);
+    }
+
+    /**
+     * Tries every display once. Displays that fail are tried
+     * again by run() every 60 seconds.
+     */
+    int Daemon::connectDisplays() {
+        int connected = 0;
+        for(vector<Seat *>::iterator it = m_seats.begin(); it != m_seats.end(); ++it) {
+            Seat *seat = *it;
+            if(!seat->connected) {
+                if(seat->filter->connect(seat->displayName)) {
+                    _dbg("%sSuccessfully connected to Xserver (DISPLAY=%s)%s", cboldGreen, seat->displayName.c_str(), creset);
+                    seat->filter->start();
+                    seat->connected = true;
+                } else {
+                    _dbg("%sConnect to X server (DISPLAY=%s) failed, will try again in 60 seconds%s", cboldRed, seat->displayName.c_str(), creset);
+                }
+            }
+            if(seat->connected)
+                connected ++;
+        }
+        m_nextConnect = connected < (int) m_seats.size() ? time(NULL) + 60 : 0;
+        return connected;
     }
 
     /** 
@@ -215,10 +321,25 @@ namespace keyfrog {
             }
         }
 
-        if(!m_xConnected)
-            if(!connectXserver()) {
-                return 1;
-            }
+        if(m_seats.empty()) {
+            const list<string> & displays = m_configuration.options().displays();
+            for(list<string>::const_iterator it = displays.begin(); it != displays.end(); ++it)
+                addDisplay(*it);
+            if(m_seats.empty())
+                addDisplay(":0");
+        }
+
+        // Nothing to do before some display is connected
+        while(connectDisplays() == 0) {
+            boost::xtime xt;
+#if BOOST_VERSION >= 105000
+            boost::xtime_get(&xt, boost::TIME_UTC_);
+#else
+            boost::xtime_get(&xt, boost::TIME_UTC);
+#endif
+            xt.sec += 60;
+            boost::thread::sleep(xt);
+        }
 
         m_processMonitor->init(m_processManager);
         // Run process monitor thread
@@ -226,27 +347,158 @@ namespace keyfrog {
 
         m_processManager->createProcTree();
 
-        while(1) {
-            // Wait for event from X11
-            Event event = m_eventFilter->nextEvent();
-            switch (event.type()) {
-                case kfKeyPress:
-                    // TODO: config option for this
-                    if(event.groupId() != -1) {
-                        m_storage->addKeyPress(event.groupId());
-                    }
-                    break;
-                case kfFocusIn:
-                    break;
-                case kfDestroyNotify:
-                    m_wim.findAndUseWindow(event.destWin());
-                    m_wim.invalidateEntry();
-                    break;
-                default:
-                    _dbg("Unknown type! (%d)", event.type());
-                    break;
+        if(!m_configWatcher.watch(m_configuration.configPath())) {
+            _inf("Config changes will not be noticed until restart");
+        }
+
+        // No SA_RESTART -- poll() returns at once
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = requestStop;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGTERM, &action, NULL);
+        sigaction(SIGINT, &action, NULL);
+
+        while(!s_stopRequested) {
+            for(vector<Seat *>::iterator it = m_seats.begin(); it != m_seats.end(); ++it) {
+                Seat & seat = **it;
+                if(!seat.connected)
+                    continue;
+                seat.filter->pollEvents();
+                while(seat.filter->numEvents()) {
+                    handleEvent(seat, seat.filter->nextEvent());
+                }
             }
+            if(m_nextConnect && time(NULL) >= m_nextConnect)
+                connectDisplays();
+            applyReloadedConfig();
+            waitForInput();
+        }
+
+        _dbg("Stopping");
+        for(vector<Seat *>::iterator it = m_seats.begin(); it != m_seats.end(); ++it) {
+            Seat & seat = **it;
+            _inf("Display %s: %lu autorepeated and %lu duplicate key presses not counted", seat.displayName.c_str(),
+                    seat.monitor->autoRepeats(), seat.monitor->duplicates());
+        }
+        if(!m_historyPath.empty() && !m_storage->saveHistory(m_historyPath)) {
+            _err("Could not save history to %s", m_historyPath.c_str());
         }
+        // Counts since last periodic commit
+        if(!m_storage->flush()) {
+            _err("Could not store pending keypresses on exit");
+        }
+        // Removes socket file
+        delete m_statsServer;
+        m_statsServer = NULL;
         return EXIT_SUCCESS;
     }
+
+    /**
+     * Swap happens between event batches, so each keypress is
+     * matched against either old or new groups as a whole.
+     * Capture, window cache, process tree and pending counts
+     * are left running.
+     */
+    void Daemon::applyReloadedConfig() {
+        FilterConfig filterConfig;
+        if(!m_configWatcher.takeFilterConfig(filterConfig))
+            return;
+        m_configuration.setFilterConfig(filterConfig);
+        for(vector<Seat *>::iterator it = m_seats.begin(); it != m_seats.end(); ++it) {
+            if((*it)->filter)
+                (*it)->filter->setFilterConfig(filterConfig);
+        }
+    }
+
+    void Daemon::handleEvent(Seat & seat, const Event & event) {
+        switch (event.type()) {
+            case kfKeyPress:
+                // TODO: config option for this
+                if(event.groupId() != -1) {
+                    int group = event.groupId();
+                    int timestamp = seat.clock.timestamp(event.time());
+                    if(m_configuration.options().keyStatsState())
+                        m_storage->addKeyStroke(group, timestamp, event.keyCode(), event.modifiers());
+                    else
+                        m_storage->addKeyPress(group, timestamp, 1);
+                    m_storage->addSeatKeyPresses(seat.number, group, timestamp, 1);
+                    uint32_t interval;
+                    if(seat.intervals.keyPress(event.time(), interval))
+                        m_storage->addInterval(group, timestamp, interval);
+                    if(m_configuration.options().sessionGap() > 0) {
+                        bool newSession;
+                        uint32_t active = seat.sessions.keyPress(group, event.time(), newSession);
+                        m_storage->addActiveTime(group, timestamp, active, newSession);
+                    }
+                }
+                break;
+            case kfFocusIn:
+                // EventFilter has classified the window already
+                break;
+            case kfDestroyNotify:
+                seat.wim.findAndUseWindow(event.destWin());
+                seat.wim.invalidateEntry();
+                break;
+            default:
+                _dbg("Unknown type! (%d)", event.type());
+                break;
+        }
+    }
+
+    /**
+     * One poll() covers X connections, stats sockets and config
+     * file notifications. If some
+     * event source has no descriptor, sources are polled every
+     * 75 ms as before. Wakes up also when a subscriber's update
+     * is due.
+     */
+    void Daemon::waitForInput() {
+        vector<pollfd> fds;
+        bool pollOnly = false;
+        // Events Xlib has already read don't make descriptor readable
+        bool queued = false;
+        for(vector<Seat *>::iterator it = m_seats.begin(); it != m_seats.end(); ++it) {
+            if(!(*it)->connected)
+                continue;
+            int fd = (*it)->filter->fileDescriptor();
+            if(fd == -1) {
+                pollOnly = true;
+                continue;
+            }
+            pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            fds.push_back(pfd);
+
+            // Focus changes come through control display
+            Display *ctrl = (*it)->filter->eventMonitor().ctrlDisplay();
+            if(ctrl && ConnectionNumber(ctrl) != fd) {
+                if(XQLength(ctrl))
+                    queued = true;
+                pfd.fd = ConnectionNumber(ctrl);
+                fds.push_back(pfd);
+            }
+        }
+        if(m_statsServer)
+            m_statsServer->addPollFds(fds);
+        m_configWatcher.addPollFds(fds);
+
+        // Timeout also guards against replies already buffered by Xlib
+        int timeout = queued ? 0 : pollOnly ? 75 : 1000;
+        if(m_statsServer) {
+            int due = m_statsServer->timeout();
+            if(due != -1 && due < timeout)
+                timeout = due;
+        }
+        int due = m_configWatcher.timeout();
+        if(due != -1 && due < timeout)
+            timeout = due;
+        int rc = poll(fds.empty() ? NULL : &fds[0], fds.size(), timeout);
+        if(rc >= 0 && m_statsServer)
+            m_statsServer->handle(fds);
+        if(rc >= 0)
+            m_configWatcher.handle(fds);
+    }
 }
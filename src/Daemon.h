@@ -36,41 +36,82 @@
 #include "EventMonitorX11.h"
 #include "Storage.h"
 #include "StorageManager.h"
+#include "StatsServer.h"
 #include "ConfigReader.h"
+#include "ConfigWatcher.h"
 
 #include <cstdlib>
+#include <csignal>
 #include <string>
+#include <vector>
+#include <ctime>
 
 namespace keyfrog {
     /**
      * @author Sebastian Gniazdowski
      */
     class Daemon {
-        /// General interface to events
-        EventFilter *m_eventFilter;
+        /**
+         * One X display with event source and window cache of its
+         * own; process tree and storage are shared by all seats
+         */
+        struct Seat {
+            /// X display address
+            std::string displayName;
+            /// Number stored with keypresses of the seat (0 for the first display)
+            int number;
+            /// Source of raw events, chosen by configuration
+            EventMonitor *monitor;
+            /// Writes events of monitor to a trace (NULL if not recording)
+            EventMonitor *recorder;
+            /// General interface to events
+            EventFilter *filter;
+            /// Window properties cache
+            KfWindowCache wim;
+            /// Typing sessions of the seat's keyboard
+            Sessionizer sessions;
+            /// Inter-key intervals of the seat's keyboard
+            KeyIntervals intervals;
+            /// Wall clock time of the seat's events
+            EventClock clock;
+            /// Is X server connected
+            bool connected;
+        };
+        std::vector<Seat *> m_seats;
+        /// When displays that failed to connect are tried again
+        time_t m_nextConnect;
         /// Statistics storage
         Storage *m_storageBackend;
-        Storage *m_storage;
+        StorageManager *m_storage;
+        /// Live statistics endpoint (NULL if disabled)
+        StatsServer *m_statsServer;
         /// Creates FilterConfig etc.
         ConfigReader m_configReader;
-        /// Window properties cache
-        KfWindowCache m_wim;
         /// Daemon configuration
         Configuration m_configuration;
+        /// Reloads groups when config file changes
+        ConfigWatcher m_configWatcher;
         /// Process manager
         ProcessManager* m_processManager;
         /// Process monitor 
         ProcessMonitor* m_processMonitor;
-        /// Is X server connected
-        bool m_xConnected;
+        /// Where per-second history is kept between runs (empty - not kept)
+        std::string m_historyPath;
+
+        /// Set by SIGTERM / SIGINT
+        static volatile sig_atomic_t s_stopRequested;
+        static void requestStop(int signal);
 
         public:
         Daemon(bool asDaemon = true);
 
         ~Daemon();
 
-        /// Connect to X server
-        bool connectXserver(std::string displayName = ":0");
+        /// Adds X display to monitor (before run())
+        void addDisplay(const std::string & displayName);
+
+        /// Connects displays that are not connected yet, returns number of connected ones
+        int connectDisplays();
 
         /// Runs daemon, returns exit code
         int run();
@@ -81,6 +122,17 @@ namespace keyfrog {
         /// Forks into background
         bool daemonize();
         private:
+        /// Event source for a new seat, as configured
+        EventMonitor *createEventMonitor(bool first);
+
+        /// Hands groups reloaded by ConfigWatcher to all seats
+        void applyReloadedConfig();
+
+        /// Acts on event from EventFilter of given seat
+        void handleEvent(Seat & seat, const Event & event);
+
+        /// Sleeps until X server or a stats client has something for us
+        void waitForInput();
     };
 }
 
@@ -45,17 +45,24 @@ namespace keyfrog {
         int m_groupId;
         int m_time;
         EventType m_type;
+        /// Key press only: keycode and modifier mask (X event state)
+        unsigned m_keyCode;
+        unsigned m_modifiers;
 
         public:
         int groupId() const { return m_groupId; }
         int time() const { return m_time; }
         int type() const { return m_type; }
         Window destWin() const { return m_destWin; }
+        unsigned keyCode() const { return m_keyCode; }
+        unsigned modifiers() const { return m_modifiers; }
 
         void setGroupId(const int theValue) { m_groupId = theValue; }
         void setTime(const int theValue) { m_time = theValue; }
         void setType(const EventType theValue) { m_type = theValue; }
         void setDestWin(const Window theValue) { m_destWin = theValue; }
+        void setKeyCode(const unsigned theValue) { m_keyCode = theValue; }
+        void setModifiers(const unsigned theValue) { m_modifiers = theValue; }
     };
 
 }
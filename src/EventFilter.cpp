@@ -50,12 +50,13 @@ using namespace boost;
 
 namespace keyfrog {
     /** 
-     * Takes and saves window cache as reference,
-     * no new object is being created.
+     * Takes and saves event source and window cache as
+     * references, no new object is being created.
      *
+     * @param em Event source, as reference
      * @param wim Window cache, as reference
      */
-    EventFilter::EventFilter(KfWindowCache & wim, ProcessManager & pm) : m_wim(wim), m_pm(pm) {
+    EventFilter::EventFilter(EventMonitor & em, KfWindowCache & wim, ProcessManager & pm) : m_wim(wim), m_pm(pm), m_eventMonitor(em) {
         m_wim.setDisplay(m_eventMonitor.ctrlDisplay());
     }
 
@@ -97,6 +98,8 @@ namespace keyfrog {
             switch(rawEvent.type()) {
                 case KeyPress:
                     event.setType(kfKeyPress);
+                    event.setKeyCode(rawEvent.event().u.u.detail);
+                    event.setModifiers(rawEvent.event().u.keyButtonPointer.state);
                     window = rawEvent.event().u.keyButtonPointer.event;
                     event.setDestWin(window);
                     setGroupId(event, window);
@@ -105,9 +108,19 @@ namespace keyfrog {
                     event.setType(kfDestroyNotify);
                     window = rawEvent.event().u.destroyNotify.window;
                     event.setDestWin(window);
+                    m_classifications.erase(window);
+                    m_clientWindows.erase(window);
                     break;
                 case FocusIn:
+                    // Classified now, so that keypresses that follow
+                    // find the window's group cached
                     event.setType(kfFocusIn);
+                    window = rawEvent.event().u.focus.window;
+                    event.setDestWin(window);
+                    if(window != None)
+                        setGroupId(event, window);
+                    else
+                        event.setGroupId(-1);
                     break;
                 default:
                     // This should not happen
@@ -130,6 +143,11 @@ namespace keyfrog {
         }
     }
 
+    void EventFilter::pollEvents() {
+        m_eventMonitor.processEvents();
+        processEvents();
+    }
+
     /**
      * Event is removed from internal queue
      * @return Next buffered event
@@ -143,11 +161,36 @@ namespace keyfrog {
     }
 
     /**
-     * Traverses all groups looking for a match
+     * Resolved once per window, X server is asked only for windows
+     * not seen yet
+     */
+    Window EventFilter::clientWindow(Window window) {
+        map<Window, Window>::iterator it = m_clientWindows.find(window);
+        if(it != m_clientWindows.end())
+            return it->second;
+        m_wim.setDisplay(m_eventMonitor.ctrlDisplay());
+        Window client = m_wim.resolveClientWindow(window);
+        m_clientWindows[window] = client;
+        return client;
+    }
+
+    /**
+     * Traverses all groups looking for a match. Result is cached
+     * per client window until process tree is rebuilt (terminal's
+     * children and process names may change) or groups change, so
+     * FocusIn of the client classifies keypresses of its subwindows.
      */
     void EventFilter::setGroupId(Event & event, Window window) {
         int gid = -1;
         event.setGroupId(-1);
+        window = clientWindow(window);
+
+        unsigned long generation = m_pm.processTree().generation();
+        map<Window, Classification>::iterator cached = m_classifications.find(window);
+        if(cached != m_classifications.end() && cached->second.treeGeneration == generation) {
+            event.setGroupId(cached->second.groupId);
+            return;
+        }
 
         m_wim.setDisplay(m_eventMonitor.ctrlDisplay());
         if(!m_wim.findAndUseWindow(window)) {
@@ -190,102 +233,29 @@ namespace keyfrog {
         else 
             _dbg( "No match (%s)(pid:%d)", className.c_str(), pid );
 
+        Classification & classification = m_classifications[window];
+        classification.groupId = gid;
+        classification.treeGeneration = generation;
         event.setGroupId( gid );
     }
 
     int EventFilter::matchWindowClass(string & className) {
-        int gid = -1;
-        list<Group> & groups = m_filterConfig.groups();
-
-        // Walk through ALL groups (and then iterate over class names, which may not exist)
-        bool matched = false;
-        for(list<Group>::iterator grp = groups.begin(); grp != groups.end(); ++grp) {
-            const list<string> & wndClasses = grp->windowClasses();
-            // Walk through windowClasses
-            if( wndClasses.size() > 0 ) {
-                _ldbg("Window Class Compare");
-            }
-            for ( list<string>::const_iterator clp = wndClasses.begin(); clp != wndClasses.end(); ++clp ) {
-                // Case insensitive compare
-                _qldbg(" %s == %s,", clp->c_str(), className.c_str());
-                if( string_eq_ci( (*clp), className ) ) {
-                    matched = true;
-                    // Set matched group
-                    gid = grp->id();
-                    break;
-                }
-            }
-            if( wndClasses.size() > 0 ) {
-                _qdbg("");
-            }
-            if(matched)
-                break;
-        }
-        return gid;
+        return m_filterConfig.matcher().match(GroupMatcher::windowClass, className);
     }
 
+    /**
+     * First group having a rule for any process running
+     * in the terminal
+     */
     int EventFilter::matchTermProc(pid_t pid) {
-        int gid = -1;
-        const list<Group> & groups = m_filterConfig.groups();
-
         // Fetch the set of descendant processes
         set< pair<pid_t, string> > dprocs = m_pm.processTree().fetchDescendants(pid);
-
-        // Walk through ALL groups (and then iterate over proc names, which may not exist)
-        bool matched = false;
-        for ( list<Group>::const_iterator grp = groups.begin(); grp != groups.end(); ++grp ) {
-            const list<string> & termProcs = grp->termProcs();
-
-            // Iterate through term proc names
-            // TODO: correct term proc match must be at leaf process?
-            for( list<string>::const_iterator tpit = termProcs.begin(); tpit != termProcs.end(); ++tpit ) {
-
-                // Compare proc names in group with fetched sub processes of terminal
-                _ldbg("TermProc Compare");
-                for(set< pair<pid_t, string> >::iterator it = dprocs.begin(); it != dprocs.end(); ++it) {
-                    _qldbg(" %s == %s,", tpit->c_str(), it->second.c_str());
-                    if( string_eq_ci( (*tpit), it->second ) ) {
-                        matched = true;
-                        gid = grp->id();
-                        break;
-                    }
-                }
-                _qdbg("");
-                if(matched)
-                    break;
-            }
-            if(matched)
-                break;
-        }
-
-        return gid;
+        return m_filterConfig.matcher().matchAny(GroupMatcher::terminalProcess, dprocs);
     }
 
     int EventFilter::matchProc(pid_t pid) {
-        int gid = -1;
-        const list<Group> & groups = m_filterConfig.groups();
         const std::string & procName = m_pm.processTree().fetchName( pid );
-
-        // Walk through ALL groups (and then iterate over proc names, which may not exist)
-        bool matched = false;
-        for ( list<Group>::const_iterator grp = groups.begin(); grp != groups.end(); ++grp ) {
-            const list<string> & procs = grp->procs();
-
-            // Iterate through proc names
-            for ( list<string>::const_iterator pit = procs.begin(); pit != procs.end(); ++pit ) {
-                // Compare proc names in group with proc name of given pid
-                _dbg( "ProcCompare %s == %s", pit->c_str(), procName.c_str() );
-                if( string_eq_ci( (*pit), procName ) ) {
-                    matched = true;
-                    gid = grp->id();
-                    break;
-                }
-            }
-            if(matched)
-                break;
-        }
-
-        return gid;
+        return m_filterConfig.matcher().match(GroupMatcher::process, procName);
     }
 }
 
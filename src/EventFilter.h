@@ -32,12 +32,13 @@
 
 
 #include "ProcessManager.h"
-#include "EventMonitorX11.h"
+#include "EventMonitor.h"
 #include "FilterConfig.h"
 #include "Event.h"
 #include "KfWindowCache.h"
 
 #include <list>
+#include <map>
 
 namespace keyfrog {
     /**
@@ -52,23 +53,40 @@ namespace keyfrog {
         FilterConfig m_filterConfig;
         /// Received and processed events
         std::list<Event> m_events;
-        /// Source of events
-        EventMonitorX11 m_eventMonitor;
+        /// Source of events (X RECORD, evdev) - created outside
+        EventMonitor & m_eventMonitor;
+
+        /// Group of window, valid while process tree is not rebuilt
+        struct Classification {
+            int groupId;
+            unsigned long treeGeneration;
+        };
+        /// Classification cache, emptied when groups change
+        std::map<Window, Classification> m_classifications;
+        /// Client window of windows events went to, see clientWindow()
+        std::map<Window, Window> m_clientWindows;
+
+        /// Maps window to its client window, so subwindows share classification
+        Window clientWindow(Window window);
 
         public:
-        EventFilter(KfWindowCache & wim, ProcessManager & pm);
+        EventFilter(EventMonitor & em, KfWindowCache & wim, ProcessManager & pm);
 
         ~EventFilter();
 
+        /// Replaces groups; window and process caches are kept
         void setFilterConfig(const FilterConfig& theValue) {
             m_filterConfig = theValue;
+            if(!m_filterConfig.compiled())
+                m_filterConfig.compile();
+            m_classifications.clear();
         }
 
         FilterConfig filterConfig() const {
             return m_filterConfig;
         }
 
-        const EventMonitorX11 & eventMonitor() const {
+        const EventMonitor & eventMonitor() const {
             return m_eventMonitor;
         }
 
@@ -78,6 +96,12 @@ namespace keyfrog {
         /// Waits for pack of events, processes and requeues them locally
         void waitForEvents();
 
+        /// Processes events that already arrived, without waiting
+        void pollEvents();
+
+        /// Descriptor to wait on for new events (-1 - events must be polled)
+        int fileDescriptor() const { return m_eventMonitor.fileDescriptor(); }
+
         /// Returns next queued event (FIFO), processes and queues new ones if needed
         Event nextEvent();
 
@@ -61,6 +61,20 @@ namespace keyfrog {
 
             /// Returns how many processed events are waiting in local queue for fetch
             virtual int numEvents() const = 0;
+
+            /// Descriptor that becomes readable when events arrive, -1 if there is none
+            virtual int fileDescriptor() const { return -1; }
+
+            /// Display to resolve windows of events with, NULL if not connected
+            virtual Display *ctrlDisplay() const { return NULL; }
+
+            /// Key presses not queued because they were autorepeat
+            virtual unsigned long autoRepeats() const { return 0; }
+
+            /// Key presses not queued because the same event was seen again
+            virtual unsigned long duplicates() const { return 0; }
+
+            virtual ~EventMonitor() {}
     };
 
 }
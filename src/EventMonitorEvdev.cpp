@@ -0,0 +1,437 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H       /* HAVE_CONFIG_H */
+#include <config.h>
+#else                           /* HAVE_CONFIG_H */
+#include <FallbackConfigH.h>
+#endif                          /* HAVE_CONFIG_H */
+
+#ifdef HOST_IS_LINUX
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/input.h>
+
+#include "TermCode.h"
+#include "Debug.h"
+#include "EventMonitorEvdev.h"
+#include "XErrorUtil.h"
+
+
+using namespace std;
+using namespace keyfrog::TermCodes;
+
+namespace {
+    /// epoll tag of X connection (devices are tagged with their index)
+    const unsigned int xConnectionTag = ~0u;
+
+    /// input_events taken by one read()
+    const int readBatch = 64;
+
+    /// X modifier mask held by given key, 0 for other keys
+    unsigned int modifier_mask( unsigned short code ) {
+        switch(code) {
+            case KEY_LEFTSHIFT:
+            case KEY_RIGHTSHIFT:
+                return ShiftMask;
+            case KEY_LEFTCTRL:
+            case KEY_RIGHTCTRL:
+                return ControlMask;
+            case KEY_LEFTALT:
+                return Mod1Mask;
+            case KEY_LEFTMETA:
+            case KEY_RIGHTMETA:
+                return Mod4Mask;
+            case KEY_RIGHTALT:
+                // ISO_Level3_Shift in default XKB maps
+                return Mod5Mask;
+            default:
+                return 0;
+        }
+    }
+
+    bool test_bit( const unsigned char *bits, int bit ) {
+        return bits[bit / 8] & (1 << (bit % 8));
+    }
+}
+
+namespace keyfrog {
+
+    EventMonitorEvdev::EventMonitorEvdev() : m_display(NULL), m_epollFd(-1),
+        m_plainDevices(0), m_started(false), m_modifiers(0), m_autoRepeats(0)
+    {
+    }
+
+    EventMonitorEvdev::~EventMonitorEvdev() {
+        closeDevices();
+        if(m_epollFd != -1)
+            close(m_epollFd);
+        if(m_display)
+            XCloseDisplay(m_display);
+    }
+
+    /**
+     * Virtual
+     */
+    bool EventMonitorEvdev::connect(string displayName) {
+        m_displayName = displayName;
+        if(m_display == NULL) {
+            if(NULL == (m_display = XOpenDisplay(m_displayName.c_str()))) {
+                return false;
+            }
+            // Windows may vanish before their properties are read
+            XErrorUtil::initHandler(1);
+        }
+
+        if(!openDevices()) {
+            XCloseDisplay(m_display);
+            m_display = NULL;
+            return false;
+        }
+
+        // DestroyNotify of watched windows also wakes us up
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = xConnectionTag;
+        if(-1 == epoll_ctl(m_epollFd, EPOLL_CTL_ADD, ConnectionNumber(m_display), &ev) && errno != EEXIST) {
+            _err("Could not watch X connection: %s", strerror(errno));
+        }
+        return true;
+    }
+
+    /**
+     * Opens devices given with addDevice(), or every
+     * /dev/input/event* that looks like a keyboard
+     */
+    bool EventMonitorEvdev::openDevices() {
+        if(!m_devices.empty())
+            return true;
+
+        if(m_epollFd == -1 && -1 == (m_epollFd = epoll_create1(EPOLL_CLOEXEC))) {
+            _err("Could not create epoll descriptor: %s", strerror(errno));
+            return false;
+        }
+
+        if(m_devicePaths.empty()) {
+            DIR *dir = opendir("/dev/input");
+            if(dir) {
+                while(dirent *entry = readdir(dir)) {
+                    if(strncmp(entry->d_name, "event", 5) == 0)
+                        openDevice(string("/dev/input/") + entry->d_name, false);
+                }
+                closedir(dir);
+            }
+        } else {
+            for(list<string>::const_iterator it = m_devicePaths.begin(); it != m_devicePaths.end(); ++it)
+                openDevice(*it, true);
+        }
+
+        if(m_devices.empty()) {
+            _err("No keyboard device could be opened (is user in the `input' group?)");
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Found devices are taken only if they have letter keys,
+     * explicitly given ones are always taken
+     */
+    bool EventMonitorEvdev::openDevice(const string & path, bool explicitPath) {
+        int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if(fd == -1) {
+            if(explicitPath)
+                _err("Could not open %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        struct stat st;
+        if(fstat(fd, &st) == -1) {
+            close(fd);
+            return false;
+        }
+
+        Device device;
+        device.path = path;
+        device.fd = fd;
+        device.plain = S_ISREG(st.st_mode);
+
+        if(!device.plain && !explicitPath) {
+            unsigned char keys[KEY_MAX / 8 + 1];
+            memset(keys, 0, sizeof(keys));
+            if(ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) < 0 ||
+                    !test_bit(keys, KEY_A) || !test_bit(keys, KEY_SPACE) || !test_bit(keys, KEY_ENTER)) {
+                close(fd);
+                return false;
+            }
+        }
+
+        if(device.plain) {
+            m_plainDevices ++;
+        } else {
+            epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.u32 = m_devices.size();
+            if(-1 == epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev)) {
+                _err("Could not watch %s: %s", path.c_str(), strerror(errno));
+                close(fd);
+                return false;
+            }
+        }
+
+        _dbg("Reading keys from %s%s%s", cboldGreen, path.c_str(), creset);
+        m_devices.push_back(device);
+        return true;
+    }
+
+    void EventMonitorEvdev::closeDevices() {
+        for(vector<Device>::iterator it = m_devices.begin(); it != m_devices.end(); ++it) {
+            if(it->fd != -1)
+                close(it->fd);
+        }
+        m_devices.clear();
+        m_plainDevices = 0;
+    }
+
+    /**
+     * Starts event capturing (events read before are dropped)
+     * Virtual
+     */
+    void EventMonitorEvdev::start() {
+        m_started = true;
+    }
+
+    /**
+     * Virtual
+     */
+    void EventMonitorEvdev::stop() {
+        m_started = false;
+    }
+
+    /**
+     * Input focus, or window under pointer when focus follows it
+     * (PointerRoot). New windows get DestroyNotify selected.
+     */
+    Window EventMonitorEvdev::focusWindow() {
+        if(m_display == NULL)
+            return None;
+
+        Window window;
+        int revert;
+        XGetInputFocus(m_display, &window, &revert);
+        if(window == PointerRoot) {
+            Window root, child;
+            int rootX, rootY, winX, winY;
+            unsigned int mask;
+            if(!XQueryPointer(m_display, DefaultRootWindow(m_display), &root, &child,
+                        &rootX, &rootY, &winX, &winY, &mask))
+                child = None;
+            window = child;
+        }
+        if(window == None)
+            return None;
+
+        if(m_watched.insert(window).second) {
+            XSelectInput(m_display, window, StructureNotifyMask);
+            XFlush(m_display);
+        }
+        return window;
+    }
+
+    /**
+     * Drains the device. Modifier state follows every
+     * transition, only presses are queued; autorepeat (value 2)
+     * is counted. Focus is asked once, at first press.
+     */
+    bool EventMonitorEvdev::readDevice(Device & device, Window & focus, bool & focusKnown) {
+        input_event buf[readBatch];
+        while(true) {
+            ssize_t n = read(device.fd, buf, sizeof(buf));
+            if(n == -1) {
+                if(errno == EINTR)
+                    continue;
+                if(errno == EAGAIN)
+                    return true;
+                _err("Reading %s failed: %s", device.path.c_str(), strerror(errno));
+                return false;
+            }
+
+            size_t count = n / sizeof(input_event);
+            size_t rest = n % sizeof(input_event);
+            // Recorded file may end in the middle of an event
+            if(rest && device.plain)
+                lseek(device.fd, -(off_t)rest, SEEK_CUR);
+
+            for(size_t i = 0; i < count; i++) {
+                const input_event & ie = buf[i];
+                if(ie.type != EV_KEY)
+                    continue;
+
+                if(ie.code == KEY_CAPSLOCK) {
+                    if(ie.value == 1)
+                        m_modifiers ^= LockMask;
+                } else if(unsigned int mask = modifier_mask(ie.code)) {
+                    if(ie.value)
+                        m_modifiers |= mask;
+                    else
+                        m_modifiers &= ~mask;
+                }
+
+                // X keycodes are evdev codes shifted by 8
+                if(ie.value == 2 && m_started)
+                    m_autoRepeats ++;
+                if(ie.value != 1 || ie.code > 255 - 8 || !m_started)
+                    continue;
+
+                if(!focusKnown) {
+                    focus = focusWindow();
+                    focusKnown = true;
+                }
+
+                xEvent xe;
+                memset(&xe, 0, sizeof(xe));
+                xe.u.u.type = KeyPress;
+                xe.u.u.detail = ie.code + 8;
+                xe.u.keyButtonPointer.state = m_modifiers;
+                xe.u.keyButtonPointer.event = focus;
+
+                RawEvent rawEvent;
+                rawEvent.setType(KeyPress);
+                rawEvent.setEvent(xe);
+                rawEvent.setTime(ie.time.tv_sec * 1000 + ie.time.tv_usec / 1000);
+                m_events.push_back(rawEvent);
+            }
+
+            // Short read - nothing more pending
+            if((size_t)n < sizeof(buf))
+                return true;
+        }
+    }
+
+    void EventMonitorEvdev::processXEvents() {
+        if(m_display == NULL)
+            return;
+        while(XPending(m_display)) {
+            XEvent xev;
+            XNextEvent(m_display, &xev);
+            if(xev.type != DestroyNotify)
+                continue;
+
+            Window window = xev.xdestroywindow.window;
+            m_watched.erase(window);
+            if(!m_started)
+                continue;
+
+            xEvent xe;
+            memset(&xe, 0, sizeof(xe));
+            xe.u.u.type = DestroyNotify;
+            xe.u.destroyNotify.event = window;
+            xe.u.destroyNotify.window = window;
+
+            RawEvent rawEvent;
+            rawEvent.setType(DestroyNotify);
+            rawEvent.setEvent(xe);
+            rawEvent.setTime(0);
+            m_events.push_back(rawEvent);
+        }
+    }
+
+    /**
+     * Reads devices that epoll reported, then recorded files,
+     * then X events. Does not block.
+     * Virtual
+     */
+    void EventMonitorEvdev::processEvents() {
+        Window focus = None;
+        bool focusKnown = false;
+
+        epoll_event ready[16];
+        int n = m_epollFd == -1 ? 0 : epoll_wait(m_epollFd, ready, 16, 0);
+        for(int i = 0; i < n; i++) {
+            unsigned int tag = ready[i].data.u32;
+            if(tag == xConnectionTag || tag >= m_devices.size())
+                continue;
+            Device & device = m_devices[tag];
+            if(device.fd != -1 && !readDevice(device, focus, focusKnown)) {
+                // Unplugged keyboard
+                epoll_ctl(m_epollFd, EPOLL_CTL_DEL, device.fd, NULL);
+                close(device.fd);
+                device.fd = -1;
+            }
+        }
+
+        if(m_plainDevices) {
+            for(vector<Device>::iterator it = m_devices.begin(); it != m_devices.end(); ++it) {
+                if(it->plain && it->fd != -1)
+                    readDevice(*it, focus, focusKnown);
+            }
+        }
+
+        processXEvents();
+    }
+
+    /**
+     * Virtual
+     */
+    void EventMonitorEvdev::waitForEvents() {
+        while(m_events.size() == 0) {
+            processEvents();
+            if(m_events.size())
+                break;
+            if(fileDescriptor() != -1) {
+                epoll_event ready[16];
+                epoll_wait(m_epollFd, ready, 16, 75);
+            } else {
+                usleep(75000);
+            }
+        }
+    }
+
+    /**
+     * Virtual
+     */
+    RawEvent EventMonitorEvdev::nextEvent() {
+        if(numEvents() == 0)
+            waitForEvents();
+        RawEvent re = m_events.front();
+        m_events.pop_front();
+        return re;
+    }
+}
+
+#endif /* HOST_IS_LINUX */
@@ -0,0 +1,143 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROG_EVENTMONITOREVDEV_H
+#define KEYFROG_EVENTMONITOREVDEV_H
+
+#include <string>
+#include <list>
+#include <vector>
+#include <set>
+
+#include <X11/Xlib.h>
+
+#include "EventMonitor.h"
+#include "RawEvent.h"
+
+namespace keyfrog {
+
+    /**
+     * Reads keypresses straight from Linux input devices
+     * (/dev/input/event*), without the X RECORD extension.
+     *
+     * Devices are opened non-blocking and waited on with one
+     * epoll descriptor; every read() takes as many input_events
+     * as are pending. X server is still needed to tell which
+     * window a keypress goes to: it is the input focus, asked
+     * once per batch of events. Destruction of attributed windows
+     * is watched so that window cache stays valid.
+     *
+     * A device can also be a regular file with recorded
+     * input_event structures - it is read to its end on every
+     * processEvents(), as epoll does not accept regular files.
+     * Reading the devices needs rights to /dev/input (usually
+     * membership in the "input" group).
+     */
+    class EventMonitorEvdev : public EventMonitor {
+        private:
+            /// Opened input device
+            struct Device {
+                std::string path;
+                int fd;
+                /// Regular file, not waited on with epoll
+                bool plain;
+            };
+
+            /// X display address
+            std::string m_displayName;
+            /// Display used for focus and window properties
+            Display *m_display;
+            /// Paths given with addDevice() (empty - keyboards are searched for)
+            std::list<std::string> m_devicePaths;
+            std::vector<Device> m_devices;
+            int m_epollFd;
+            /// Number of devices that are regular files
+            int m_plainDevices;
+            bool m_started;
+            /// Modifier state (X masks) built from key transitions
+            unsigned int m_modifiers;
+            /// Key events with value 2 (kernel autorepeat)
+            unsigned long m_autoRepeats;
+            /// Windows for which DestroyNotify is selected
+            std::set<Window> m_watched;
+            /// Received events
+            std::list<RawEvent> m_events;
+
+            bool openDevice(const std::string & path, bool explicitPath);
+            void closeDevices();
+            /// Reads pending input_events of given device, false on EOF or error
+            bool readDevice(Device & device, Window & focus, bool & focusKnown);
+            /// Window that now receives keyboard input
+            Window focusWindow();
+            /// Queues DestroyNotify events waiting on m_display
+            void processXEvents();
+
+        public:
+            /// Opens X display and input devices
+            virtual bool connect(std::string displayName = ":0");
+
+            /// Starts event capturing
+            virtual void start();
+
+            /// Stops event capturing
+            virtual void stop();
+
+            /// Reads pending input events and queues keypresses
+            virtual void processEvents();
+
+            /// Waits for pack of events, processes and requeues them locally
+            virtual void waitForEvents();
+
+            /// Returns next event
+            virtual RawEvent nextEvent();
+
+            /// Returns how many processed events are waiting in local queue for fetch
+            virtual int numEvents() const { return m_events.size(); }
+
+            virtual unsigned long autoRepeats() const { return m_autoRepeats; }
+
+            /// epoll descriptor of devices, -1 when some device must be polled
+            virtual int fileDescriptor() const { return m_plainDevices ? -1 : m_epollFd; }
+
+            /// Returns control display
+            virtual Display *ctrlDisplay() const { return m_display; }
+
+            /// Adds device (or recorded event file) to read, before connect()
+            void addDevice(const std::string & path) { m_devicePaths.push_back(path); }
+
+            /// Opens devices without connecting to X server (events have no window)
+            bool openDevices();
+
+            EventMonitorEvdev();
+            virtual ~EventMonitorEvdev();
+    };
+
+}
+
+#endif
@@ -0,0 +1,242 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <boost/lexical_cast.hpp>
+
+#include "Common.h"
+#include "Debug.h"
+#include "EventMonitorReplay.h"
+
+using namespace std;
+
+namespace keyfrog {
+
+    //
+    // KfWindowCacheReplay
+    //
+
+    void KfWindowCacheReplay::setWindow(const TraceWindow & window) {
+        m_windows[window.window] = make_pair(window.className, (pid_t) window.pid);
+    }
+
+    string KfWindowCacheReplay::resolveClassName(Window winId) {
+        map<Window, pair<string, pid_t> >::const_iterator it = m_windows.find(winId);
+        return it != m_windows.end() ? it->second.first : string();
+    }
+
+    pid_t KfWindowCacheReplay::resolveClientPid(Window winId) {
+        map<Window, pair<string, pid_t> >::const_iterator it = m_windows.find(winId);
+        return it != m_windows.end() ? it->second.second : 0;
+    }
+
+    //
+    // ProcessManagerReplay
+    //
+
+    bool ProcessManagerReplay::setProcessProperties(ProcessProperties & newProcProp, pid_t pid,
+            bool ppid_known, pid_t ppid, bool name_known, const string & name) {
+        // Trace is the only source, there's nothing to look up
+        if(!ppid_known || !name_known)
+            return false;
+        newProcProp.pid = pid;
+        newProcProp.pidStr = boost::lexical_cast<string>(pid);
+        newProcProp.ppid_known = true;
+        newProcProp.ppid = ppid;
+        newProcProp.ppidStr = boost::lexical_cast<string>(ppid);
+        newProcProp.name_known = true;
+        newProcProp.name = name;
+        return true;
+    }
+
+    void ProcessManagerReplay::setProcesses(const TraceProcesses & processes) {
+        m_clients[processes.pid] = processes;
+        createProcTree();
+    }
+
+    /**
+     * Pid 0 is the root, client processes are its children and
+     * recorded descendants are children of their client
+     */
+    void ProcessManagerReplay::createProcTree() {
+        boost::recursive_mutex::scoped_lock lock(m_accessMutex);
+
+        ProcessMap procMap;
+        setProcessProperties(procMap[0], 0, true, 0, true, "");
+        for(map<pid_t, TraceProcesses>::const_iterator it = m_clients.begin(); it != m_clients.end(); ++it) {
+            const set< pair<pid_t, string> > & descendants = it->second.descendants;
+            for(set< pair<pid_t, string> >::const_iterator dit = descendants.begin(); dit != descendants.end(); ++dit) {
+                if(dit->first != it->first)
+                    setProcessProperties(procMap[dit->first], dit->first, true, it->first, true, dit->second);
+            }
+        }
+        // Clients last - a client that is also someone's descendant stays a client
+        for(map<pid_t, TraceProcesses>::const_iterator it = m_clients.begin(); it != m_clients.end(); ++it)
+            setProcessProperties(procMap[it->first], it->first, true, 0, true, it->second.name);
+
+        m_processTree.clear();
+        m_processTree.addConnectProcesses(procMap);
+    }
+
+    bool ProcessManagerReplay::processExists(const string & pidStr) {
+        pid_t pid = atoi(pidStr.c_str());
+        return m_processTree.fetchName(pid).size() > 0;
+    }
+
+    //
+    // EventMonitorReplay
+    //
+
+    EventMonitorReplay::EventMonitorReplay(KfWindowCacheReplay & wim, ProcessManagerReplay & pm)
+        : m_wim(wim), m_pm(pm), m_speed(0), m_started(false), m_finished(false),
+        m_havePending(false), m_clockSet(false), m_wallStart(0), m_traceStart(0) {
+    }
+
+    bool EventMonitorReplay::connect(string option) {
+        if(!m_trace.open(option))
+            return false;
+        m_finished = false;
+        m_havePending = false;
+        m_clockSet = false;
+        m_events.clear();
+        return true;
+    }
+
+    /**
+     * Window and process records are applied only when queue is
+     * empty: events queued before them must be resolved with the
+     * state they were recorded with.
+     */
+    bool EventMonitorReplay::readEvent() {
+        while(true) {
+            size_t pos = m_trace.position();
+            switch(m_trace.next()) {
+                case TraceReader::Event:
+                    m_pending = m_trace.event();
+                    m_havePending = true;
+                    return true;
+                case TraceReader::Window:
+                    if(!m_events.empty()) {
+                        m_trace.seek(pos);
+                        return false;
+                    }
+                    m_wim.setWindow(m_trace.window());
+                    break;
+                case TraceReader::Processes:
+                    if(!m_events.empty()) {
+                        m_trace.seek(pos);
+                        return false;
+                    }
+                    m_pm.setProcesses(m_trace.processes());
+                    break;
+                case TraceReader::Corrupt:
+                    _err("Trace is corrupt, replay ends");
+                    // fall through
+                case TraceReader::End:
+                    m_finished = true;
+                    return false;
+            }
+        }
+    }
+
+    int64_t EventMonitorReplay::pendingDelay() {
+        if(m_speed == 0)
+            return 0;
+        int64_t now = monotonic_ms();
+        if(!m_clockSet) {
+            m_wallStart = now;
+            m_traceStart = m_pending.time;
+            m_clockSet = true;
+        }
+        // X server time wraps around, differences don't
+        uint32_t traceElapsed = m_pending.time - m_traceStart;
+        int64_t due = m_wallStart + (int64_t) (traceElapsed / m_speed);
+        return due > now ? due - now : 0;
+    }
+
+    void EventMonitorReplay::processEvents() {
+        if(!m_started)
+            return;
+        for(size_t queued = 0; queued < replayBatch; queued++) {
+            if(!m_havePending && !readEvent())
+                break;
+            if(pendingDelay() > 0)
+                break;
+
+            xEvent xe;
+            memset(&xe, 0, sizeof(xe));
+            xe.u.u.type = m_pending.type;
+            if(m_pending.type == KeyPress) {
+                xe.u.u.detail = m_pending.keyCode;
+                xe.u.keyButtonPointer.state = m_pending.modifiers;
+                xe.u.keyButtonPointer.event = m_pending.window;
+            } else if(m_pending.type == DestroyNotify) {
+                xe.u.destroyNotify.event = m_pending.window;
+                xe.u.destroyNotify.window = m_pending.window;
+            } else if(m_pending.type == FocusIn) {
+                xe.u.focus.window = m_pending.window;
+                xe.u.focus.mode = NotifyNormal;
+            }
+
+            RawEvent rawEvent;
+            rawEvent.setType(m_pending.type);
+            rawEvent.setEvent(xe);
+            rawEvent.setTime(m_pending.time);
+            m_events.push_back(rawEvent);
+            m_havePending = false;
+        }
+    }
+
+    void EventMonitorReplay::waitForEvents() {
+        while(m_events.empty() && !m_finished) {
+            processEvents();
+            if(!m_events.empty())
+                break;
+            int64_t delay = m_started && m_havePending ? pendingDelay() : 75;
+            if(delay > 75)
+                delay = 75;
+            if(delay > 0)
+                usleep(delay * 1000);
+        }
+    }
+
+    RawEvent EventMonitorReplay::nextEvent() {
+        if(numEvents() == 0)
+            waitForEvents();
+        RawEvent re = m_events.front();
+        m_events.pop_front();
+        return re;
+    }
+}
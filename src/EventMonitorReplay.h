@@ -0,0 +1,145 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGEVENTMONITORREPLAY_H
+#define KEYFROGEVENTMONITORREPLAY_H
+
+#include <string>
+#include <list>
+#include <map>
+#include <stdint.h>
+
+#include "ProcessManager.h"
+#include "KfWindowCache.h"
+#include "EventMonitor.h"
+#include "EventTrace.h"
+
+namespace keyfrog {
+
+    /**
+     * Window cache answering from window records of a trace
+     * instead of asking X server
+     */
+    class KfWindowCacheReplay : public KfWindowCache {
+        std::map<Window, std::pair<std::string, pid_t> > m_windows;
+
+        public:
+        void setWindow(const TraceWindow & window);
+
+        virtual std::string resolveClassName(Window winId);
+        virtual pid_t resolveClientPid(Window winId);
+        /// Trace describes windows keypresses went to, so they are the clients
+        virtual Window resolveClientWindow(Window winId) { return winId; }
+    };
+
+    /**
+     * Process tree built from process records of a trace instead
+     * of /proc. Descendants of a client process are its children
+     * in the tree, which is all EventFilter looks at.
+     */
+    class ProcessManagerReplay : public ProcessManager {
+        std::map<pid_t, TraceProcesses> m_clients;
+
+        protected:
+        virtual bool setProcessProperties(ProcessProperties & newProcProp, pid_t pid,
+                bool ppid_known, pid_t ppid,
+                bool name_known, const std::string & name);
+
+        public:
+        /// Replaces processes of given client, rebuilds the tree
+        void setProcesses(const TraceProcesses & processes);
+
+        virtual void createProcTree();
+        virtual bool processExists(const std::string & pidStr);
+    };
+
+    /**
+     * Replays recorded trace of events, with the speed they were
+     * recorded (or faster/slower), or as fast as possible. Window
+     * and process records are handed to the replay resolvers when
+     * read, so EventFilter sees the same windows as the recording
+     * daemon did. Used for benchmarks and regression tests, no X
+     * server is needed.
+     */
+    class EventMonitorReplay : public EventMonitor {
+        KfWindowCacheReplay & m_wim;
+        ProcessManagerReplay & m_pm;
+        TraceReader m_trace;
+        /// Speed factor, 0 - as fast as possible
+        double m_speed;
+        bool m_started;
+        bool m_finished;
+
+        /// Event read from trace but not yet due
+        bool m_havePending;
+        TraceEvent m_pending;
+
+        /// Wall clock and trace time of first replayed event
+        bool m_clockSet;
+        int64_t m_wallStart;
+        uint32_t m_traceStart;
+
+        std::list<RawEvent> m_events;
+
+        /// Reads next event into m_pending, false at the end of trace
+        bool readEvent();
+        /// Milliseconds until m_pending is due (0 - now)
+        int64_t pendingDelay();
+
+        public:
+        /// Events queued by one processEvents() at most
+        static const size_t replayBatch = 4096;
+
+        EventMonitorReplay(KfWindowCacheReplay & wim, ProcessManagerReplay & pm);
+
+        /// Opens trace file given as option
+        virtual bool connect(std::string option);
+
+        virtual void start() { m_started = true; }
+        virtual void stop() { m_started = false; }
+
+        /// Queues events that are due
+        virtual void processEvents();
+
+        /// Waits until some event is due or trace ends
+        virtual void waitForEvents();
+
+        virtual RawEvent nextEvent();
+
+        virtual int numEvents() const { return m_events.size(); }
+
+        void setSpeed(double speed) { m_speed = speed > 0 ? speed : 0; }
+        double speed() const { return m_speed; }
+
+        /// Whole trace was replayed and fetched
+        bool finished() const { return m_finished && m_events.empty(); }
+    };
+}
+
+#endif
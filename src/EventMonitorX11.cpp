@@ -33,12 +33,15 @@
 #endif
 
 #include <unistd.h>
+#include <cstring>
 #include <exception>
 using namespace std;
 
 #include "TermCode.h"
 #include "CallbackClosure.h"
 #include "EventMonitorX11.h"
+#include <X11/XKBlib.h>
+#include <X11/Xatom.h>
 #include "EventInternal.h"
 #include "XErrorUtil.h"
 #include "Debug.h"
@@ -49,7 +52,12 @@ namespace keyfrog {
     /**
      * Constructor which optionally takes display name
      */
-    EventMonitorX11::EventMonitorX11() {
+    EventMonitorX11::EventMonitorX11() : m_lastPress(0, 0), m_lastRelease(0, 0),
+        m_repeatLimit(1000), m_autoRepeats(0), m_duplicates(0), m_netActiveWindow(None), m_activeWindow(None)
+    {
+        userData.ctrlDisplay = NULL;
+        userData.dataDisplay = NULL;
+        memset(m_keysDown, 0, sizeof(m_keysDown));
     }
 
     /**
@@ -85,6 +93,11 @@ namespace keyfrog {
 
         setupRecordExtension();
 
+        // Window manager announces focus changes on root window,
+        // before keypresses go to the new window
+        m_netActiveWindow = XInternAtom(userData.ctrlDisplay, "_NET_ACTIVE_WINDOW", False);
+        XSelectInput(userData.ctrlDisplay, root, PropertyChangeMask);
+
         return true;
     }
 
@@ -121,6 +134,18 @@ namespace keyfrog {
         }
         _dbg("Record extension v%d.%d", recVer.first, recVer.second);
 
+        // Detectable autorepeat is chosen by each client, so recorded
+        // stream can have both kinds of autorepeat (see keyTransition());
+        // what's needed from XKB is how long a held key waits to repeat
+        Bool detectable = False;
+        XkbSetDetectableAutoRepeat(userData.ctrlDisplay, True, &detectable);
+        XkbDescPtr xkb = XkbAllocKeyboard();
+        if(xkb && XkbGetControls(userData.ctrlDisplay, XkbRepeatKeysMask, xkb) == Success)
+            m_repeatLimit = xkb->ctrls->repeat_delay + 250;
+        if(xkb)
+            XkbFreeKeyboard(xkb, XkbAllComponentsMask, True);
+        _dbg("Detectable autorepeat %s, repeat limit %u ms", detectable ? "supported" : "not supported", m_repeatLimit);
+
         // Configure it
         recRanges[0] = XRecordAllocRange();
         recRanges[1] = XRecordAllocRange();
@@ -128,9 +153,10 @@ namespace keyfrog {
             // "Could not alloc record range object!\n";
             throw exception();                      
         }
-        // First of all - key presses are recorded
+        // First of all - key presses are recorded, and releases
+        // to tell autorepeat from typing
         recRanges[0]->delivered_events.first=KeyPress;
-        recRanges[0]->delivered_events.last=KeyPress;
+        recRanges[0]->delivered_events.last=KeyRelease;
 
         // Also we must record DestroyNotify to keep
         // window information cache actual
@@ -184,6 +210,7 @@ namespace keyfrog {
             // "Could not enable the record context!\n"
             throw exception();
         }               
+        queueActiveWindow(CurrentTime);
     }
 
     /**
@@ -202,6 +229,55 @@ namespace keyfrog {
      */
     void EventMonitorX11::processEvents() {
         XRecordProcessReplies (userData.dataDisplay);
+        processFocusChanges();
+    }
+
+    /**
+     * Reads _NET_ACTIVE_WINDOW and queues FocusIn of the window
+     * if it has changed
+     */
+    void EventMonitorX11::queueActiveWindow(Time time) {
+        Atom actualType;
+        int actualFormat;
+        unsigned long nitems, bytesLeft;
+        unsigned char *data = NULL;
+        Window active = None;
+        if(Success == XGetWindowProperty(userData.ctrlDisplay, root, m_netActiveWindow, 0, 1, False,
+                    XA_WINDOW, &actualType, &actualFormat, &nitems, &bytesLeft, &data) && data) {
+            if(actualType == XA_WINDOW && actualFormat == 32 && nitems == 1)
+                active = *(Window *) data;
+            XFree(data);
+        }
+        if(active == None || active == m_activeWindow)
+            return;
+        m_activeWindow = active;
+        _dbg("Focus moved to 0x%lx", active);
+
+        xEvent xe;
+        memset(&xe, 0, sizeof(xe));
+        xe.u.u.type = FocusIn;
+        xe.u.u.detail = NotifyNonlinear;
+        xe.u.focus.window = active;
+        xe.u.focus.mode = NotifyNormal;
+
+        RawEvent rawEvent;
+        rawEvent.setType(FocusIn);
+        rawEvent.setEvent(xe);
+        rawEvent.setTime(time);
+        events.push_back(rawEvent);
+    }
+
+    /**
+     * Drains events of control display, which has only
+     * PropertyNotify of root window selected
+     */
+    void EventMonitorX11::processFocusChanges() {
+        while(XPending(userData.ctrlDisplay)) {
+            XEvent xev;
+            XNextEvent(userData.ctrlDisplay, &xev);
+            if(xev.type == PropertyNotify && xev.xproperty.atom == m_netActiveWindow)
+                queueActiveWindow(xev.xproperty.time);
+        }
     }
 
     /**
@@ -233,13 +309,46 @@ namespace keyfrog {
         return re;
     }
 
+    /**
+     * Tells whether key transition is a keypress to count.
+     *
+     * A KeyPress of a key that is down, soon after its previous
+     * press, is autorepeat as seen by clients with detectable
+     * autorepeat. Other clients get a KeyRelease before each
+     * repeated KeyPress, with the same time stamp. The same event
+     * delivered to several clients is recorded for each of them.
+     * Releases are only tracked, never queued.
+     */
+    bool EventMonitorX11::keyTransition(bool press, unsigned keycode, uint32_t time) {
+        uint32_t & word = m_keysDown[(keycode & 255) / 32];
+        uint32_t bit = 1u << (keycode % 32);
+        if(!press) {
+            word &= ~bit;
+            m_lastRelease = make_pair(keycode, time);
+            return false;
+        }
+
+        if(m_lastPress.first == keycode && m_lastPress.second == time) {
+            m_duplicates ++;
+            return false;
+        }
+        // A press without release long after the previous one means
+        // release was missed (e.g. while disconnected), not autorepeat
+        bool repeat = ((word & bit) && m_lastPress.first == keycode && time - m_lastPress.second <= m_repeatLimit) ||
+            (m_lastRelease.first == keycode && time - m_lastRelease.second <= 1);
+        word |= bit;
+        m_lastPress = make_pair(keycode, time);
+        if(repeat)
+            m_autoRepeats ++;
+        return !repeat;
+    }
+
     /**
      * Called from Xserver when new event occurs. Prepares
      * RawEvent object and stores it into EventMonitorX11
      * events attribute.
      */
     void EventMonitorX11::eventCallback(XPointer priv, XRecordInterceptData *hook) {
-        static int pc = 0;
         /* FIXME: need use XQueryPointer to get the first location */
         if (hook->category != XRecordFromServer) {
             XRecordFreeData (hook);
@@ -247,13 +356,14 @@ namespace keyfrog {
         }
 
         CallbackClosure *userData = (CallbackClosure *)priv;
+        EventMonitorX11 *monitor = (EventMonitorX11 *)userData->initialObject;
         XRecordDatum *data = (XRecordDatum*) hook->data;
-        if(data->event.u.u.type == KeyPress) { 
-            int c = data->event.u.u.detail;
-            if(c == pc) {
+        int type = data->event.u.u.type;
+        if(type == KeyPress || type == KeyRelease) {
+            if(!monitor->keyTransition(type == KeyPress, data->event.u.u.detail, hook->server_time)) {
+                XRecordFreeData (hook);
                 return;
-            } else
-                pc = c;
+            }
         }
 
         // Create new RawEvent that will be remembered
@@ -271,6 +381,6 @@ namespace keyfrog {
         XRecordFreeData (hook);
 
         // Append newly received RawEvent to list
-        ((EventMonitorX11 *)userData->initialObject)->events.push_back(newRawEvent);
+        monitor->events.push_back(newRawEvent);
     }
 }
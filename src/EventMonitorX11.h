@@ -33,6 +33,7 @@
 #include <string>
 #include <utility>
 #include <list>
+#include <stdint.h>
 
 #include <X11/Xlibint.h>
 #include <X11/Xlib.h>
@@ -69,7 +70,25 @@ namespace keyfrog {
             /// Record extension version
             std::pair<int,int> recVer;
 
+            /// Bit per keycode, set from KeyPress until KeyRelease
+            uint32_t m_keysDown[256 / 32];
+            /// Last key press and release taken (keycode, server time)
+            std::pair<unsigned, uint32_t> m_lastPress;
+            std::pair<unsigned, uint32_t> m_lastRelease;
+            /// Longest pause (milliseconds) between presses of a held key, from XKB repeat delay
+            uint32_t m_repeatLimit;
+            unsigned long m_autoRepeats;
+            unsigned long m_duplicates;
+
+            /// Root window property naming the focused client (EWMH)
+            Atom m_netActiveWindow;
+            /// Last focused client queued as FocusIn
+            Window m_activeWindow;
+
             void setupRecordExtension();
+            void queueActiveWindow(Time time);
+            void processFocusChanges();
+            bool keyTransition(bool press, unsigned keycode, uint32_t time);
             // TODO: hide implementation?
             static void eventCallback(XPointer priv, XRecordInterceptData *hook);
         public:
@@ -83,6 +102,7 @@ namespace keyfrog {
             virtual void stop();
 
             /// Checks for events in X11 queue, processes and requeues them locally
+            /// (keypresses from RECORD, focus changes from control display)
             virtual void processEvents();
 
             /// Waits for pack of events, processes and requeues them locally
@@ -94,12 +114,18 @@ namespace keyfrog {
             /// Returns how many processed events are waiting in local queue for fetch
             virtual int numEvents() const { return events.size(); }
 
+            /// Connection to X server delivering recorded events
+            virtual int fileDescriptor() const { return userData.dataDisplay ? ConnectionNumber(userData.dataDisplay) : -1; }
+
             /// Returns control display
-            Display *ctrlDisplay() const { return userData.ctrlDisplay; }
+            virtual Display *ctrlDisplay() const { return userData.ctrlDisplay; }
 
             /// Returns data display
             Display *dataDisplay() const { return userData.dataDisplay; }
 
+            virtual unsigned long autoRepeats() const { return m_autoRepeats; }
+            virtual unsigned long duplicates() const { return m_duplicates; }
+
             EventMonitorX11();
             virtual ~EventMonitorX11();
     };
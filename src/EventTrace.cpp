@@ -0,0 +1,396 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Debug.h"
+#include "EventTrace.h"
+
+using namespace std;
+
+namespace keyfrog {
+
+    static const char traceMagic[8] = { 'K', 'F', 'T', 'R', 'A', 'C', 'E', '1' };
+    static const uint32_t traceVersion = 1;
+
+    /// magic, version
+    static const size_t traceHeaderSize = 12;
+    /// tag, time, type, keycode, modifiers, window
+    static const size_t traceEventSize = 13;
+
+    static const char traceEventTag = 'E';
+    static const char traceWindowTag = 'W';
+    static const char traceProcessesTag = 'P';
+
+    // Fixed size little endian fields, strings prefixed with u16 length
+
+    static void put_u16(string & out, uint16_t v) {
+        out += (char) (v & 0xff);
+        out += (char) (v >> 8);
+    }
+
+    static void put_u32(string & out, uint32_t v) {
+        for(int i = 0; i < 4; i++)
+            out += (char) ((v >> (8 * i)) & 0xff);
+    }
+
+    static void put_string(string & out, const string & s) {
+        size_t len = s.size() < 0xffff ? s.size() : 0xffff;
+        put_u16(out, len);
+        out.append(s, 0, len);
+    }
+
+    static uint16_t get_u16(const unsigned char *p) {
+        return (uint16_t) p[0] | ((uint16_t) p[1] << 8);
+    }
+
+    static uint32_t get_u32(const unsigned char *p) {
+        return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+    }
+
+    //
+    // TraceWriter
+    //
+
+    TraceWriter::TraceWriter() : m_file(NULL), m_events(0) {
+    }
+
+    TraceWriter::~TraceWriter() {
+        if(m_file)
+            close();
+    }
+
+    bool TraceWriter::write(const string & data) {
+        if(m_file == NULL)
+            return false;
+        if(data.size() != fwrite(data.data(), 1, data.size(), m_file)) {
+            _dbg("Write to trace `%s' failed", m_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool TraceWriter::open(const string & path) {
+        m_path = path;
+        m_file = fopen(m_path.c_str(), "wb");
+        if(m_file == NULL) {
+            _dbg("Could not create trace `%s'", m_path.c_str());
+            return false;
+        }
+        m_events = 0;
+
+        string header(traceMagic, sizeof(traceMagic));
+        put_u32(header, traceVersion);
+        return write(header);
+    }
+
+    bool TraceWriter::close() {
+        if(m_file == NULL)
+            return false;
+        bool ok = 0 == fclose(m_file);
+        m_file = NULL;
+        return ok;
+    }
+
+    bool TraceWriter::flush() {
+        return m_file && 0 == fflush(m_file);
+    }
+
+    bool TraceWriter::writeEvent(const TraceEvent & event) {
+        string record;
+        record += traceEventTag;
+        put_u32(record, event.time);
+        record += (char) event.type;
+        record += (char) event.keyCode;
+        put_u16(record, event.modifiers);
+        put_u32(record, event.window);
+        m_events ++;
+        return write(record);
+    }
+
+    bool TraceWriter::writeWindow(const TraceWindow & window) {
+        string record;
+        record += traceWindowTag;
+        put_u32(record, window.window);
+        put_u32(record, window.pid);
+        put_string(record, window.className);
+        return write(record);
+    }
+
+    bool TraceWriter::writeProcesses(const TraceProcesses & processes) {
+        string record;
+        record += traceProcessesTag;
+        put_u32(record, processes.pid);
+        put_string(record, processes.name);
+        put_u32(record, processes.descendants.size());
+        for(set< pair<pid_t, string> >::const_iterator it = processes.descendants.begin();
+                it != processes.descendants.end(); ++it) {
+            put_u32(record, it->first);
+            put_string(record, it->second);
+        }
+        return write(record);
+    }
+
+    //
+    // TraceReader
+    //
+
+    TraceReader::TraceReader() : m_fd(-1), m_map(NULL), m_size(0), m_pos(0) {
+    }
+
+    TraceReader::~TraceReader() {
+        close();
+    }
+
+    bool TraceReader::open(const string & path) {
+        close();
+        m_fd = ::open(path.c_str(), O_RDONLY);
+        if(m_fd == -1) {
+            _dbg("Could not open trace `%s'", path.c_str());
+            return false;
+        }
+        struct stat st;
+        if(-1 == fstat(m_fd, &st) || (size_t) st.st_size < traceHeaderSize) {
+            close();
+            return false;
+        }
+        m_size = st.st_size;
+        void *addr = mmap(NULL, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+        if(addr == MAP_FAILED) {
+            m_map = NULL;
+            close();
+            return false;
+        }
+        m_map = (const unsigned char *) addr;
+#ifdef MADV_SEQUENTIAL
+        madvise(addr, m_size, MADV_SEQUENTIAL);
+#endif
+
+        if(memcmp(m_map, traceMagic, sizeof(traceMagic)) || get_u32(m_map + 8) != traceVersion) {
+            _dbg("`%s' is not a keyfrog trace", path.c_str());
+            close();
+            return false;
+        }
+        m_pos = traceHeaderSize;
+        return true;
+    }
+
+    void TraceReader::close() {
+        if(m_map) {
+            munmap((void *) m_map, m_size);
+            m_map = NULL;
+        }
+        if(m_fd != -1) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        m_size = 0;
+        m_pos = 0;
+    }
+
+    bool TraceReader::getString(string & out) {
+        if(m_pos + 2 > m_size)
+            return false;
+        size_t len = get_u16(m_map + m_pos);
+        if(m_pos + 2 + len > m_size)
+            return false;
+        out.assign((const char *) m_map + m_pos + 2, len);
+        m_pos += 2 + len;
+        return true;
+    }
+
+    /**
+     * A record cut by end of file (trace of a killed daemon)
+     * ends the trace
+     */
+    TraceReader::Record TraceReader::next() {
+        if(m_map == NULL || m_pos >= m_size)
+            return End;
+
+        size_t start = m_pos;
+        const unsigned char *p = m_map + m_pos;
+        switch(p[0]) {
+            case traceEventTag:
+                if(m_pos + traceEventSize > m_size)
+                    break;
+                m_event.time = get_u32(p + 1);
+                m_event.type = p[5];
+                m_event.keyCode = p[6];
+                m_event.modifiers = get_u16(p + 7);
+                m_event.window = get_u32(p + 9);
+                m_pos += traceEventSize;
+                return Event;
+
+            case traceWindowTag:
+                if(m_pos + 9 > m_size)
+                    break;
+                m_window.window = get_u32(p + 1);
+                m_window.pid = (int32_t) get_u32(p + 5);
+                m_pos += 9;
+                if(!getString(m_window.className))
+                    break;
+                return Window;
+
+            case traceProcessesTag: {
+                if(m_pos + 5 > m_size)
+                    break;
+                m_processes.pid = (int32_t) get_u32(p + 1);
+                m_processes.descendants.clear();
+                m_pos += 5;
+                if(!getString(m_processes.name) || m_pos + 4 > m_size)
+                    break;
+                uint32_t count = get_u32(m_map + m_pos);
+                m_pos += 4;
+                bool complete = true;
+                for(uint32_t i = 0; complete && i < count; i++) {
+                    string name;
+                    if(m_pos + 4 > m_size) {
+                        complete = false;
+                        break;
+                    }
+                    pid_t pid = (int32_t) get_u32(m_map + m_pos);
+                    m_pos += 4;
+                    complete = getString(name);
+                    m_processes.descendants.insert(make_pair(pid, name));
+                }
+                if(!complete)
+                    break;
+                return Processes;
+            }
+
+            default:
+                _dbg("Unknown trace record `%c' at %lu", p[0], (unsigned long) m_pos);
+                return Corrupt;
+        }
+
+        // Incomplete last record
+        m_pos = start;
+        return End;
+    }
+
+    //
+    // EventMonitorRecorder
+    //
+
+    EventMonitorRecorder::EventMonitorRecorder(EventMonitor & source, const ProcessManager & pm, const string & path)
+        : m_source(source), m_pm(pm), m_path(path) {
+    }
+
+    EventMonitorRecorder::~EventMonitorRecorder() {
+        m_trace.close();
+    }
+
+    bool EventMonitorRecorder::connect(string option) {
+        if(!m_source.connect(option))
+            return false;
+        m_wim.setDisplay(m_source.ctrlDisplay());
+        if(!m_trace.isOpen() && !m_trace.open(m_path))
+            _err("Could not create event trace %s", m_path.c_str());
+        return true;
+    }
+
+    void EventMonitorRecorder::stop() {
+        m_source.stop();
+        m_trace.flush();
+    }
+
+    RawEvent EventMonitorRecorder::nextEvent() {
+        RawEvent rawEvent = m_source.nextEvent();
+        if(m_trace.isOpen())
+            record(rawEvent);
+        return rawEvent;
+    }
+
+    /**
+     * Describes window (and its processes) before the keypress or
+     * focus change that goes to it. Process tree is read on every
+     * keypress, so programs started in a terminal show up in the
+     * trace.
+     */
+    void EventMonitorRecorder::describeWindow(Window window) {
+        map<Window, pid_t>::iterator wit = m_windows.find(window);
+        if(wit == m_windows.end()) {
+            TraceWindow traceWindow;
+            traceWindow.window = window;
+            traceWindow.className = m_wim.resolveClassName(window);
+            traceWindow.pid = m_wim.resolveClientPid(window);
+            m_trace.writeWindow(traceWindow);
+            wit = m_windows.insert(make_pair(window, (pid_t) traceWindow.pid)).first;
+        }
+
+        pid_t pid = wit->second;
+        if(pid > 0) {
+            TraceProcesses processes;
+            processes.pid = pid;
+            processes.name = m_pm.processTree().fetchName(pid);
+            processes.descendants = m_pm.processTree().fetchDescendants(pid);
+            map<pid_t, TraceProcesses>::iterator pit = m_processes.find(pid);
+            if(pit == m_processes.end() || pit->second.name != processes.name ||
+                    pit->second.descendants != processes.descendants) {
+                m_trace.writeProcesses(processes);
+                m_processes[pid] = processes;
+            }
+        }
+    }
+
+    void EventMonitorRecorder::record(const RawEvent & rawEvent) {
+        TraceEvent event;
+        memset(&event, 0, sizeof(event));
+        event.time = rawEvent.time();
+        event.type = rawEvent.type();
+
+        switch(rawEvent.type()) {
+            case KeyPress:
+                event.keyCode = rawEvent.event().u.u.detail;
+                event.modifiers = rawEvent.event().u.keyButtonPointer.state;
+                event.window = rawEvent.event().u.keyButtonPointer.event;
+                describeWindow(event.window);
+                break;
+            case FocusIn:
+                event.window = rawEvent.event().u.focus.window;
+                describeWindow(event.window);
+                break;
+            case DestroyNotify:
+                event.window = rawEvent.event().u.destroyNotify.window;
+                m_windows.erase(event.window);
+                break;
+            default:
+                break;
+        }
+        m_trace.writeEvent(event);
+    }
+}
@@ -0,0 +1,171 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGEVENTTRACE_H
+#define KEYFROGEVENTTRACE_H
+
+#include <string>
+#include <set>
+#include <map>
+#include <cstdio>
+#include <stdint.h>
+
+#include "ProcessManager.h"
+#include "KfWindowCache.h"
+#include "EventMonitor.h"
+
+namespace keyfrog {
+
+    /// Recorded raw event
+    struct TraceEvent {
+        uint32_t time;
+        uint8_t type;
+        uint8_t keyCode;
+        uint16_t modifiers;
+        uint32_t window;
+    };
+
+    /// What X server told about a window when it was first seen
+    struct TraceWindow {
+        uint32_t window;
+        int32_t pid;
+        std::string className;
+    };
+
+    /// Client process of a window and its descendants at some moment
+    struct TraceProcesses {
+        int32_t pid;
+        std::string name;
+        std::set< std::pair<pid_t, std::string> > descendants;
+    };
+
+    /**
+     * Writes event trace file: magic and version, then tagged
+     * records in order they happened. Window and process records
+     * precede the events that need them, so a trace can be
+     * replayed front to back with no X server nor /proc.
+     */
+    class TraceWriter {
+        FILE *m_file;
+        std::string m_path;
+        uint64_t m_events;
+
+        bool write(const std::string & data);
+
+        public:
+        TraceWriter();
+        ~TraceWriter();
+
+        bool open(const std::string & path);
+        bool isOpen() const { return m_file != NULL; }
+        bool close();
+
+        bool writeEvent(const TraceEvent & event);
+        bool writeWindow(const TraceWindow & window);
+        bool writeProcesses(const TraceProcesses & processes);
+
+        /// Makes written records visible to readers
+        bool flush();
+
+        uint64_t events() const { return m_events; }
+    };
+
+    /**
+     * Reads trace through read-only mapping, one record at a time
+     */
+    class TraceReader {
+        int m_fd;
+        const unsigned char *m_map;
+        size_t m_size;
+        size_t m_pos;
+
+        TraceEvent m_event;
+        TraceWindow m_window;
+        TraceProcesses m_processes;
+
+        bool getString(std::string & out);
+
+        public:
+        enum Record { End, Event, Window, Processes, Corrupt };
+
+        TraceReader();
+        ~TraceReader();
+
+        bool open(const std::string & path);
+        void close();
+
+        /// Reads next record, its data is then in event(), window() or processes()
+        Record next();
+
+        /// Offset of next record, to go back to with seek()
+        size_t position() const { return m_pos; }
+        void seek(size_t pos) { m_pos = pos; }
+
+        const TraceEvent & event() const { return m_event; }
+        const TraceWindow & window() const { return m_window; }
+        const TraceProcesses & processes() const { return m_processes; }
+    };
+
+    /**
+     * Passes events of another monitor through, writing them to
+     * a trace. Windows are described once (until destroyed) and
+     * processes of a window whenever they change, using own window
+     * cache on the source's display.
+     */
+    class EventMonitorRecorder : public EventMonitor {
+        EventMonitor & m_source;
+        const ProcessManager & m_pm;
+        KfWindowCache m_wim;
+        TraceWriter m_trace;
+        std::string m_path;
+        /// Recorded windows with their client pids
+        std::map<Window, pid_t> m_windows;
+        /// Last recorded processes of each client pid
+        std::map<pid_t, TraceProcesses> m_processes;
+
+        void record(const RawEvent & rawEvent);
+        void describeWindow(Window window);
+
+        public:
+        EventMonitorRecorder(EventMonitor & source, const ProcessManager & pm, const std::string & path);
+        virtual ~EventMonitorRecorder();
+
+        virtual bool connect(std::string option = ":0");
+        virtual void start() { m_source.start(); }
+        virtual void stop();
+        virtual void processEvents() { m_source.processEvents(); }
+        virtual void waitForEvents() { m_source.waitForEvents(); }
+        virtual RawEvent nextEvent();
+        virtual int numEvents() const { return m_source.numEvents(); }
+        virtual int fileDescriptor() const { return m_source.fileDescriptor(); }
+        virtual Display *ctrlDisplay() const { return m_source.ctrlDisplay(); }
+    };
+}
+
+#endif
@@ -0,0 +1,170 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "Export.h"
+#include "Debug.h"
+
+#include <cerrno>
+#include <cstring>
+
+using namespace std;
+
+namespace keyfrog {
+
+    /// Longest formatted row: three 11 char numbers, two commas, newline
+    static const size_t csvRowMax = 3 * 11 + 3;
+
+    /**
+     * Formats value at p, returns position after it. Done by hand as
+     * printf() dominates export time otherwise.
+     */
+    static char *formatInt(char *p, int value) {
+        unsigned int u = value;
+        if(value < 0) {
+            *p++ = '-';
+            u = 0u - u;
+        }
+        char digits[10];
+        int n = 0;
+        do {
+            digits[n++] = '0' + u % 10;
+            u /= 10;
+        } while(u);
+        while(n)
+            *p++ = digits[--n];
+        return p;
+    }
+
+    CsvWriter::CsvWriter() : m_file(NULL), m_ownFile(false), m_used(0), m_rows(0) {
+    }
+
+    CsvWriter::~CsvWriter() {
+        close();
+    }
+
+    bool CsvWriter::open(const string & path) {
+        close();
+        if(path == "-") {
+            m_file = stdout;
+            m_ownFile = false;
+        } else {
+            m_file = fopen(path.c_str(), "w");
+            m_ownFile = true;
+            if(m_file == NULL) {
+                _dbg("Could not create `%s': %s", path.c_str(), strerror(errno));
+                return false;
+            }
+        }
+        m_chunk.resize(chunkSize);
+        m_rows = 0;
+        const char header[] = "cluster_begin,app_group,count\n";
+        memcpy(&m_chunk[0], header, sizeof(header) - 1);
+        m_used = sizeof(header) - 1;
+        return true;
+    }
+
+    bool CsvWriter::flush() {
+        if(m_used && m_used != fwrite(&m_chunk[0], 1, m_used, m_file)) {
+            _dbg("Writing CSV failed: %s", strerror(errno));
+            return false;
+        }
+        m_used = 0;
+        return true;
+    }
+
+    bool CsvWriter::consume(const KeyPressRow *rows, size_t n) {
+        if(m_file == NULL)
+            return false;
+        for(size_t i = 0; i < n; i++) {
+            if(m_used + csvRowMax > m_chunk.size() && !flush())
+                return false;
+            char *p = &m_chunk[m_used];
+            char *start = p;
+            p = formatInt(p, rows[i].clusterBegin);
+            *p++ = ',';
+            p = formatInt(p, rows[i].appGroup);
+            *p++ = ',';
+            p = formatInt(p, rows[i].count);
+            *p++ = '\n';
+            m_used += p - start;
+        }
+        m_rows += n;
+        return true;
+    }
+
+    bool CsvWriter::close() {
+        if(m_file == NULL)
+            return true;
+        bool ok = flush();
+        if(m_ownFile)
+            ok = (0 == fclose(m_file)) && ok;
+        else
+            ok = (0 == fflush(m_file)) && ok;
+        m_file = NULL;
+        return ok;
+    }
+
+    bool ArchiveSink::consume(const KeyPressRow *rows, size_t n) {
+        for(size_t i = 0; i < n; i++) {
+            if(!m_writer.add(rows[i].clusterBegin, rows[i].appGroup, rows[i].count))
+                return false;
+        }
+        return true;
+    }
+
+    bool scan_archive( const ArchiveReader & reader, int from, int to, KeyPressSink & sink ) {
+        ArchiveColumns cols;
+        vector<KeyPressRow> rows;
+        for(size_t i = 0; i < reader.blockCount(); i++) {
+            const ArchiveBlockInfo & info = reader.blockInfo(i);
+            if(info.maxTime < from || info.minTime >= to)
+                continue;
+            cols.clear();
+            if(!reader.readBlock(i, cols)) {
+                _dbg("Archive block %u is corrupted", (unsigned) i);
+                return false;
+            }
+            rows.clear();
+            for(size_t r = 0; r < cols.size(); r++) {
+                if(cols.times[r] < from || cols.times[r] >= to)
+                    continue;
+                KeyPressRow row = { cols.times[r], cols.groups[r], cols.counts[r] };
+                rows.push_back(row);
+            }
+            if(!rows.empty() && !sink.consume(&rows[0], rows.size()))
+                return false;
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,97 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGEXPORT_H
+#define KEYFROGEXPORT_H
+
+#include "Storage.h"
+#include "Archive.h"
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+
+namespace keyfrog {
+
+    /**
+     * Writes keypress rows as CSV (cluster_begin,app_group,count).
+     *
+     * Rows are formatted into a fixed size chunk which is written out
+     * whole, so memory use does not depend on number of rows.
+     */
+    class CsvWriter : public KeyPressSink {
+        FILE *m_file;
+        bool m_ownFile;
+        std::vector<char> m_chunk;
+        size_t m_used;
+        uint64_t m_rows;
+
+        bool flush();
+
+        public:
+        CsvWriter();
+        ~CsvWriter();
+
+        /// Bytes formatted before a write
+        static const size_t chunkSize = 256 * 1024;
+
+        /// Creates file ("-" is standard output) and writes header line
+        bool open(const std::string & path);
+
+        /// Writes rows of batch
+        virtual bool consume(const KeyPressRow *rows, size_t n);
+
+        /// Writes pending chunk and closes file
+        bool close();
+
+        /// Number of rows written so far
+        uint64_t rows() const { return m_rows; }
+    };
+
+    /**
+     * Passes rows of a scan to archive writer
+     */
+    class ArchiveSink : public KeyPressSink {
+        ArchiveWriter & m_writer;
+
+        public:
+        ArchiveSink(ArchiveWriter & writer) : m_writer(writer) {}
+
+        virtual bool consume(const KeyPressRow *rows, size_t n);
+    };
+
+    /**
+     * Passes rows of archive with time in [from, to) to sink, decoding
+     * one block at a time; blocks outside of range are skipped by index.
+     */
+    bool scan_archive( const ArchiveReader & reader, int from, int to, KeyPressSink & sink );
+
+}
+
+#endif
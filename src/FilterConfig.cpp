@@ -34,7 +34,7 @@
 
 namespace keyfrog {
 
-    FilterConfig::FilterConfig()
+    FilterConfig::FilterConfig() : m_compiled(true)
     {
     }
 
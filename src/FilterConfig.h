@@ -31,6 +31,7 @@
 #define KEYFROGFILTERCONFIG_H
 
 #include "Group.h"
+#include "GroupMatcher.h"
 #include <list>
 
 namespace keyfrog {
@@ -40,6 +41,9 @@ namespace keyfrog {
      */
     class FilterConfig {
         std::list<Group> m_groups;
+        /// Rules of m_groups ready for lookup
+        GroupMatcher m_matcher;
+        bool m_compiled;
         public:
         FilterConfig();
 
@@ -47,9 +51,28 @@ namespace keyfrog {
 
         void addGroup(const Group & group) {
             m_groups.push_back(group);
+            m_compiled = false;
         }
         // Const?
         std::list<Group> & groups() { return m_groups; }
+
+        /// Compiles rules of added groups
+        void compile() {
+            m_matcher.compile(m_groups);
+            m_compiled = true;
+        }
+
+        /// Is matcher up to date with added groups
+        bool compiled() const { return m_compiled; }
+
+        /// Uses tables compiled earlier (e.g. cached); groups() stays empty
+        void setMatcher(const GroupMatcher & matcher) {
+            m_groups.clear();
+            m_matcher = matcher;
+            m_compiled = true;
+        }
+
+        const GroupMatcher & matcher() const { return m_matcher; }
     };
 }
 
@@ -0,0 +1,222 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "GroupMatcher.h"
+
+#include <vector>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdint.h>
+
+using namespace std;
+
+namespace keyfrog {
+
+    /// magic, group count, (entry count, entries offset) per kind
+    static const char matcherMagic[4] = { 'K', 'F', 'G', 'M' };
+    static const size_t matcherHeaderSize = 8 + 8 * GroupMatcher::ruleKinds;
+    /// name offset, name length, group rank, group id
+    static const size_t matcherEntrySize = 16;
+
+    // Fixed size little endian fields
+
+    static void put_u32(string & out, uint32_t v) {
+        for(int i = 0; i < 4; i++)
+            out += (char) ((v >> (8 * i)) & 0xff);
+    }
+
+    static void set_u32(string & out, size_t pos, uint32_t v) {
+        for(int i = 0; i < 4; i++)
+            out[pos + i] = (char) ((v >> (8 * i)) & 0xff);
+    }
+
+    static uint32_t get_u32(const unsigned char *p) {
+        return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+    }
+
+    /// Rule of a group, before it gets into image
+    struct CompiledRule {
+        string name;
+        uint32_t rank;
+        int32_t groupId;
+
+        bool operator<(const CompiledRule & other) const {
+            if(name != other.name)
+                return name < other.name;
+            return rank < other.rank;
+        }
+    };
+
+    static string lower_case(const string & str) {
+        string lower(str);
+        for(string::iterator it = lower.begin(); it != lower.end(); ++it)
+            *it = tolower((unsigned char) *it);
+        return lower;
+    }
+
+    /// Compares lower case name of image with name of any case
+    static int compare_ci(const unsigned char *stored, size_t storedLen, const string & name) {
+        size_t len = min(storedLen, name.size());
+        for(size_t i = 0; i < len; i++) {
+            int c = tolower((unsigned char) name[i]);
+            if(stored[i] != c)
+                return stored[i] < c ? -1 : 1;
+        }
+        if(storedLen == name.size())
+            return 0;
+        return storedLen < name.size() ? -1 : 1;
+    }
+
+    GroupMatcher::GroupMatcher() : m_image(NULL), m_size(0) {
+    }
+
+    void GroupMatcher::compile(const list<Group> & groups) {
+        vector<CompiledRule> rules[ruleKinds];
+        uint32_t rank = 0;
+        for(list<Group>::const_iterator grp = groups.begin(); grp != groups.end(); ++grp, ++rank) {
+            const list<string> *names[ruleKinds] = { &grp->windowClasses(), &grp->termProcs(), &grp->procs() };
+            for(int kind = 0; kind < ruleKinds; kind++) {
+                for(list<string>::const_iterator it = names[kind]->begin(); it != names[kind]->end(); ++it) {
+                    CompiledRule rule;
+                    rule.name = lower_case(*it);
+                    rule.rank = rank;
+                    rule.groupId = grp->id();
+                    rules[kind].push_back(rule);
+                }
+            }
+        }
+
+        boost::shared_ptr<string> image(new string());
+        image->append(matcherMagic, sizeof(matcherMagic));
+        put_u32(*image, groups.size());
+        image->resize(matcherHeaderSize);
+
+        // Entries first, names are appended after all of them
+        vector<size_t> namePos[ruleKinds];
+        for(int kind = 0; kind < ruleKinds; kind++) {
+            vector<CompiledRule> & kindRules = rules[kind];
+            sort(kindRules.begin(), kindRules.end());
+            size_t unique = 0;
+            for(size_t i = 0; i < kindRules.size(); i++) {
+                // Sorted by rank within name, first one is kept
+                if(unique && kindRules[unique - 1].name == kindRules[i].name)
+                    continue;
+                kindRules[unique++] = kindRules[i];
+            }
+            kindRules.resize(unique);
+
+            set_u32(*image, 8 + 8 * kind, unique);
+            set_u32(*image, 12 + 8 * kind, image->size());
+            for(size_t i = 0; i < unique; i++) {
+                namePos[kind].push_back(image->size());
+                put_u32(*image, 0);
+                put_u32(*image, kindRules[i].name.size());
+                put_u32(*image, kindRules[i].rank);
+                put_u32(*image, (uint32_t) kindRules[i].groupId);
+            }
+        }
+        for(int kind = 0; kind < ruleKinds; kind++) {
+            for(size_t i = 0; i < rules[kind].size(); i++) {
+                set_u32(*image, namePos[kind][i], image->size());
+                image->append(rules[kind][i].name);
+            }
+        }
+
+        m_owner = image;
+        m_image = (const unsigned char *) image->data();
+        m_size = image->size();
+    }
+
+    /**
+     * Checks that every table and name lies within the image, so
+     * that lookups can't read past it
+     */
+    bool GroupMatcher::attach(boost::shared_ptr<void> owner, const unsigned char *image, size_t size) {
+        if(size < matcherHeaderSize || memcmp(image, matcherMagic, sizeof(matcherMagic)))
+            return false;
+        for(int kind = 0; kind < ruleKinds; kind++) {
+            uint64_t count = get_u32(image + 8 + 8 * kind);
+            uint64_t offset = get_u32(image + 12 + 8 * kind);
+            if(offset < matcherHeaderSize || offset + count * matcherEntrySize > size)
+                return false;
+            const unsigned char *entry = image + offset;
+            for(uint64_t i = 0; i < count; i++, entry += matcherEntrySize) {
+                if((uint64_t) get_u32(entry) + get_u32(entry + 4) > size)
+                    return false;
+            }
+        }
+        m_owner = owner;
+        m_image = image;
+        m_size = size;
+        return true;
+    }
+
+    int GroupMatcher::groupCount() const {
+        return m_image ? (int) get_u32(m_image + 4) : 0;
+    }
+
+    const unsigned char *GroupMatcher::find(RuleKind kind, const string & name) const {
+        if(!m_image)
+            return NULL;
+        const unsigned char *entries = m_image + get_u32(m_image + 12 + 8 * kind);
+        size_t lo = 0, hi = get_u32(m_image + 8 + 8 * kind);
+        while(lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            const unsigned char *entry = entries + mid * matcherEntrySize;
+            int cmp = compare_ci(m_image + get_u32(entry), get_u32(entry + 4), name);
+            if(cmp == 0)
+                return entry;
+            if(cmp < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return NULL;
+    }
+
+    int GroupMatcher::match(RuleKind kind, const string & name) const {
+        const unsigned char *entry = find(kind, name);
+        return entry ? (int32_t) get_u32(entry + 12) : -1;
+    }
+
+    int GroupMatcher::matchAny(RuleKind kind, const set< pair<pid_t, string> > & names) const {
+        const unsigned char *best = NULL;
+        for(set< pair<pid_t, string> >::const_iterator it = names.begin(); it != names.end(); ++it) {
+            const unsigned char *entry = find(kind, it->second);
+            if(entry && (!best || get_u32(entry + 8) < get_u32(best + 8)))
+                best = entry;
+        }
+        return best ? (int32_t) get_u32(best + 12) : -1;
+    }
+}
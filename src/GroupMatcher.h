@@ -0,0 +1,94 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGGROUPMATCHER_H
+#define KEYFROGGROUPMATCHER_H
+
+#include "Group.h"
+
+#include <string>
+#include <list>
+#include <set>
+#include <utility>
+#include <cstddef>
+#include <sys/types.h>
+#include <boost/shared_ptr.hpp>
+
+namespace keyfrog {
+
+    /**
+     * Rules of all groups compiled into lookup tables.
+     *
+     * The tables live in one flat image, sorted by lower case name,
+     * one entry per name (the first group having the rule wins, as
+     * when groups are walked in order). The image is either built
+     * by compile() or attached from a mapped cache file, and it is
+     * shared, not copied, by copies of the matcher.
+     */
+    class GroupMatcher {
+        /// Keeps image memory alive (built string or file mapping)
+        boost::shared_ptr<void> m_owner;
+        const unsigned char *m_image;
+        size_t m_size;
+
+        public:
+        enum RuleKind {
+            windowClass = 0,
+            terminalProcess,
+            process,
+            ruleKinds
+        };
+
+        GroupMatcher();
+
+        /// Builds tables from rules of groups
+        void compile(const std::list<Group> & groups);
+
+        /// Uses image kept alive by owner, false if it is malformed
+        bool attach(boost::shared_ptr<void> owner, const unsigned char *image, size_t size);
+
+        const unsigned char *image() const { return m_image; }
+        size_t size() const { return m_size; }
+
+        /// Number of groups the tables were compiled from
+        int groupCount() const;
+
+        /// Group with rule of given kind for name (case insensitive), -1 if none
+        int match(RuleKind kind, const std::string & name) const;
+
+        /// As above, for the first group having a rule for any of the names
+        int matchAny(RuleKind kind, const std::set< std::pair<pid_t, std::string> > & names) const;
+
+        private:
+        /// Entry for name, NULL if there is none
+        const unsigned char *find(RuleKind kind, const std::string & name) const;
+    };
+}
+
+#endif
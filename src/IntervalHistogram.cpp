@@ -0,0 +1,122 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "IntervalHistogram.h"
+#include "Common.h"
+
+#include <cstring>
+#include <cmath>
+
+namespace keyfrog {
+
+    void IntervalHistogram::clear() {
+        memset(buckets, 0, sizeof(buckets));
+        count = sum = 0;
+    }
+
+    void IntervalHistogram::merge(const IntervalHistogram & other) {
+        for(unsigned i = 0; i < bucketCount; i++)
+            buckets[i] += other.buckets[i];
+        count += other.count;
+        sum += other.sum;
+    }
+
+    uint32_t IntervalHistogram::bucketLow(unsigned bucket) {
+        if(bucket < linearCount)
+            return bucket;
+        unsigned shift = (bucket - linearCount) / subCount + 1;
+        return (uint32_t) ((bucket - linearCount) % subCount + subCount) << shift;
+    }
+
+    uint32_t IntervalHistogram::bucketHigh(unsigned bucket) {
+        if(bucket < linearCount)
+            return bucket;
+        unsigned shift = (bucket - linearCount) / subCount + 1;
+        return bucketLow(bucket) + ((1u << shift) - 1);
+    }
+
+    uint32_t IntervalHistogram::percentile(double quantile) const {
+        if(count == 0)
+            return 0;
+        // Rank of the interval, 1..count
+        uint64_t rank = (uint64_t) ceil(quantile * count);
+        if(rank < 1)
+            rank = 1;
+        if(rank > count)
+            rank = count;
+        uint64_t seen = 0;
+        for(unsigned i = 0; i < bucketCount; i++) {
+            seen += buckets[i];
+            if(seen >= rank)
+                return bucketLow(i) + (bucketHigh(i) - bucketLow(i)) / 2;
+        }
+        return bucketHigh(bucketCount - 1);
+    }
+
+    void IntervalHistogram::pack(std::string & out) const {
+        put_varint(out, sum);
+        unsigned prev = 0;
+        for(unsigned i = 0; i < bucketCount; i++) {
+            if(!buckets[i])
+                continue;
+            put_varint(out, i - prev);
+            put_varint(out, buckets[i]);
+            prev = i;
+        }
+    }
+
+    bool IntervalHistogram::mergePacked(const void *data, size_t size) {
+        const unsigned char *pos = (const unsigned char *) data;
+        const unsigned char *end = pos + size;
+        uint64_t packedSum;
+        if(!get_varint(pos, end, packedSum))
+            return false;
+        IntervalHistogram packed;
+        packed.sum = packedSum;
+        uint64_t bucket = 0;
+        while(pos < end) {
+            uint64_t gap, n;
+            if(!get_varint(pos, end, gap) || !get_varint(pos, end, n))
+                return false;
+            bucket += gap;
+            if(bucket >= bucketCount)
+                return false;
+            packed.buckets[bucket] += n;
+            packed.count += n;
+        }
+        // Only whole, valid histograms are merged
+        merge(packed);
+        return true;
+    }
+
+}
@@ -0,0 +1,103 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGINTERVALHISTOGRAM_H
+#define KEYFROGINTERVALHISTOGRAM_H
+
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+namespace keyfrog {
+
+    /**
+     * Distribution of intervals between keypresses, in milliseconds.
+     *
+     * Buckets are log-linear (as in HDR histograms): intervals below
+     * 16 ms have a bucket each, every further power of two is split
+     * into 8 buckets, so a bucket is at most 1/8 of its value wide
+     * and 240 buckets cover the whole uint32_t range. Fixed size, so
+     * updating it never allocates. Stored packed like KeyHistogram:
+     * sum of intervals, then nonzero buckets as varint pairs ( gap
+     * from previous bucket, count ).
+     */
+    struct IntervalHistogram {
+        /// Bits of value kept by bucket index (including leading one)
+        static const unsigned subBits = 4;
+        static const unsigned linearCount = 1u << subBits;
+        static const unsigned subCount = linearCount / 2;
+        static const unsigned bucketCount = linearCount + (32 - subBits) * subCount;
+
+        uint32_t buckets[bucketCount];
+        /// Number and sum of recorded intervals (exact mean)
+        uint64_t count;
+        uint64_t sum;
+
+        IntervalHistogram() { clear(); }
+
+        void clear();
+        bool empty() const { return count == 0; }
+
+        void add(uint32_t milliseconds) {
+            buckets[bucketOf(milliseconds)] ++;
+            count ++;
+            sum += milliseconds;
+        }
+
+        void merge(const IntervalHistogram & other);
+
+        /// Interval of given quantile (0..1), middle of its bucket; 0 if empty
+        uint32_t percentile(double quantile) const;
+
+        double mean() const { return count ? (double) sum / count : 0.0; }
+
+        /// Appends packed form to out
+        void pack(std::string & out) const;
+
+        /// Adds packed histogram; false if data is malformed
+        bool mergePacked(const void *data, size_t size);
+
+        static unsigned bucketOf(uint32_t milliseconds) {
+            if(milliseconds < linearCount)
+                return milliseconds;
+            unsigned shift = 0;
+            while((milliseconds >> shift) >= linearCount)
+                shift ++;
+            // Value >> shift is in [subCount, linearCount)
+            return linearCount + (shift - 1) * subCount + (milliseconds >> shift) - subCount;
+        }
+
+        /// Smallest and largest interval of bucket
+        static uint32_t bucketLow(unsigned bucket);
+        static uint32_t bucketHigh(unsigned bucket);
+    };
+
+}
+
+#endif
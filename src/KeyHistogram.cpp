@@ -0,0 +1,99 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "KeyHistogram.h"
+#include "Common.h"
+
+#include <cstring>
+
+namespace keyfrog {
+
+    void KeyHistogram::clear() {
+        memset(keys, 0, sizeof(keys));
+        memset(modifiers, 0, sizeof(modifiers));
+    }
+
+    bool KeyHistogram::empty() const {
+        for(unsigned i = 0; i < keyCount; i++) {
+            if(keys[i])
+                return false;
+        }
+        return true;
+    }
+
+    void KeyHistogram::merge(const KeyHistogram & other) {
+        for(unsigned i = 0; i < keyCount; i++)
+            keys[i] += other.keys[i];
+        for(unsigned i = 0; i < modifierCount; i++)
+            modifiers[i] += other.modifiers[i];
+    }
+
+    void KeyHistogram::pack(std::string & out) const {
+        unsigned prev = 0;
+        for(unsigned i = 0; i < keyCount + modifierCount; i++) {
+            uint32_t count = i < keyCount ? keys[i] : modifiers[i - keyCount];
+            if(!count)
+                continue;
+            put_varint(out, i - prev);
+            put_varint(out, count);
+            prev = i;
+        }
+    }
+
+    bool KeyHistogram::mergePacked(const void *data, size_t size) {
+        const unsigned char *pos = (const unsigned char *) data;
+        const unsigned char *end = pos + size;
+        uint64_t bucket = 0;
+        while(pos < end) {
+            uint64_t gap, count;
+            if(!get_varint(pos, end, gap) || !get_varint(pos, end, count))
+                return false;
+            bucket += gap;
+            if(bucket >= keyCount + modifierCount)
+                return false;
+            if(bucket < keyCount)
+                keys[bucket] += count;
+            else
+                modifiers[bucket - keyCount] += count;
+        }
+        return true;
+    }
+
+    const char *KeyHistogram::modifierName(unsigned i) {
+        static const char *names[modifierCount] = {
+            "shift", "lock", "control", "mod1", "mod2", "mod3", "mod4", "mod5"
+        };
+        return i < modifierCount ? names[i] : "";
+    }
+
+}
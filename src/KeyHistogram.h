@@ -0,0 +1,82 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGKEYHISTOGRAM_H
+#define KEYFROGKEYHISTOGRAM_H
+
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+namespace keyfrog {
+
+    /**
+     * Keypresses per keycode and per modifier held while pressing.
+     *
+     * Fixed size, so updating it never allocates. Stored packed: only
+     * nonzero buckets, as varint pairs ( gap from previous bucket,
+     * count ), modifiers following keycodes as buckets 256..263.
+     */
+    struct KeyHistogram {
+        /// X keycodes are 8..255
+        static const unsigned keyCount = 256;
+        /// Shift, Lock, Control, Mod1..Mod5 (bits of X event state)
+        static const unsigned modifierCount = 8;
+
+        uint32_t keys[keyCount];
+        uint32_t modifiers[modifierCount];
+
+        KeyHistogram() { clear(); }
+
+        void clear();
+        bool empty() const;
+
+        void add(unsigned keycode, unsigned modifierMask, uint32_t count = 1) {
+            keys[keycode & (keyCount - 1)] += count;
+            for(unsigned i = 0; i < modifierCount; i++) {
+                if(modifierMask & (1u << i))
+                    modifiers[i] += count;
+            }
+        }
+
+        void merge(const KeyHistogram & other);
+
+        /// Appends packed form to out
+        void pack(std::string & out) const;
+
+        /// Adds packed histogram; false if data is malformed
+        bool mergePacked(const void *data, size_t size);
+
+        /// Name of modifier bucket ("shift", "control", "mod1", ...)
+        static const char *modifierName(unsigned i);
+    };
+
+}
+
+#endif
@@ -196,6 +196,26 @@ namespace keyfrog {
         return pid;
     }
 
+    /**
+     * Keypresses go to the focused subwindow (e.g. VT100 widget of
+     * xterm), while window manager and _NET_ACTIVE_WINDOW talk about
+     * the client window carrying WM_CLASS
+     */
+    Window KfWindowCache::resolveClientWindow(Window winId) {
+        XClassHint hint;
+        Window window = winId, root;
+        while(m_display && window != 0x0) {
+            if(XGetClassHint(m_display, window, &hint)) {
+                XFree(hint.res_name);
+                XFree(hint.res_class);
+                return window;
+            }
+            if(!getWindowParent(window, root) || window == root)
+                break;
+        }
+        return winId;
+    }
+
     bool KfWindowCache::getWindowParent(Window & winId, Window & _root) {
         Window root, parent, *children = NULL;
         unsigned int num_children;
@@ -57,7 +57,7 @@ namespace keyfrog {
 
         KfWindowCache(Display *display);
 
-        ~KfWindowCache();
+        virtual ~KfWindowCache();
 
         bool findAndUseWindow(Window window);
 
@@ -74,9 +74,13 @@ namespace keyfrog {
 
         pid_t fetchClientPid();
 
-        std::string resolveClassName(Window winId);
+        /// Asks X server (virtual, so that replay can answer from a trace)
+        virtual std::string resolveClassName(Window winId);
 
-        pid_t resolveClientPid(Window winId);
+        virtual pid_t resolveClientPid(Window winId);
+
+        /// First window up the tree having WM_CLASS (the client), or winId if none has it
+        virtual Window resolveClientWindow(Window winId);
 
         void invalidateEntry();
 
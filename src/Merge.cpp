@@ -0,0 +1,304 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "Merge.h"
+#include "Export.h"
+#include "Debug.h"
+
+#include <queue>
+#include <functional>
+#include <boost/bind.hpp>
+
+using namespace std;
+
+namespace keyfrog {
+
+    /// Merged rows passed to sink at once
+    static const size_t mergeBatch = 1024;
+
+    /**
+     * Hands rows of scan over to queue of input
+     */
+    class MergeInput::Reader : public KeyPressSink {
+        MergeInput & m_input;
+        public:
+        Reader(MergeInput & input) : m_input(input) {}
+        virtual bool consume(const KeyPressRow *rows, size_t n) {
+            return m_input.push(rows, n);
+        }
+    };
+
+    MergeInput::MergeInput() : m_storage(NULL), m_from(0), m_to(0), m_done(false), m_failed(false),
+        m_stop(false), m_thread(NULL), m_pos(0)
+    {
+    }
+
+    MergeInput::~MergeInput() {
+        close();
+    }
+
+    bool MergeInput::open(const string & uri) {
+        m_uri = uri;
+        if(uri.compare(0, 8, "archive:") == 0)
+            return m_archive.open(uri.substr(8));
+
+        string location;
+        m_storage = Storage::create(uri, location);
+        if(m_storage == NULL)
+            return false;
+        if(!m_storage->connectReadOnly(location)) {
+            delete m_storage;
+            m_storage = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    int MergeInput::clusterSize() {
+        return m_storage ? m_storage->clusterSize() : m_archive.clusterSize();
+    }
+
+    bool MergeInput::start(int from, int to) {
+        m_from = from;
+        m_to = to;
+        m_done = m_failed = m_stop = false;
+        m_queue.clear();
+        m_batch.clear();
+        m_pos = 0;
+        m_thread = new boost::thread(boost::bind(&MergeInput::run, this));
+        return true;
+    }
+
+    /**
+     * Reader thread
+     */
+    void MergeInput::run() {
+        Reader reader(*this);
+        bool ok;
+        if(m_storage)
+            ok = m_storage->scanRange(m_from, m_to, reader);
+        else
+            ok = scan_archive(m_archive, m_from, m_to, reader);
+
+        boost::mutex::scoped_lock lock(m_mutex);
+        // Scan stopped by close() is not a failure of store
+        m_failed = !ok && !m_stop;
+        m_done = true;
+        m_changed.notify_all();
+    }
+
+    /**
+     * Queues copy of batch, waits while queue is full
+     */
+    bool MergeInput::push(const KeyPressRow *rows, size_t n) {
+        boost::mutex::scoped_lock lock(m_mutex);
+        while(m_queue.size() >= queueBatches && !m_stop)
+            m_changed.wait(lock);
+        if(m_stop)
+            return false;
+        m_queue.push_back(vector<KeyPressRow>(rows, rows + n));
+        m_changed.notify_all();
+        return true;
+    }
+
+    bool MergeInput::next(KeyPressRow & row) {
+        if(m_pos == m_batch.size()) {
+            boost::mutex::scoped_lock lock(m_mutex);
+            while(m_queue.empty() && !m_done)
+                m_changed.wait(lock);
+            if(m_queue.empty())
+                return false;
+            m_batch.swap(m_queue.front());
+            m_queue.pop_front();
+            m_pos = 0;
+            m_changed.notify_all();
+        }
+        row = m_batch[m_pos++];
+        return true;
+    }
+
+    void MergeInput::close() {
+        if(m_thread) {
+            {
+                boost::mutex::scoped_lock lock(m_mutex);
+                m_stop = true;
+                m_changed.notify_all();
+            }
+            m_thread->join();
+            delete m_thread;
+            m_thread = NULL;
+        }
+        if(m_storage) {
+            m_storage->disconnect();
+            delete m_storage;
+            m_storage = NULL;
+        }
+        m_archive.close();
+    }
+
+    Merger::Merger() : m_rowsRead(0) {
+    }
+
+    Merger::~Merger() {
+        for(size_t i = 0; i < m_inputs.size(); i++)
+            delete m_inputs[i];
+    }
+
+    bool Merger::addInput(const string & uri) {
+        MergeInput *input = new MergeInput();
+        if(!input->open(uri)) {
+            m_error = "could not open " + uri;
+            delete input;
+            return false;
+        }
+        if(!m_inputs.empty() && input->clusterSize() != clusterSize()) {
+            m_error = uri + " uses different cluster size than " + m_inputs[0]->uri();
+            delete input;
+            return false;
+        }
+        m_inputs.push_back(input);
+        return true;
+    }
+
+    int Merger::clusterSize() {
+        return m_inputs.empty() ? 0 : m_inputs[0]->clusterSize();
+    }
+
+    /// Head row of input in merge heap
+    struct MergeHead {
+        int clusterBegin;
+        int appGroup;
+        int count;
+        size_t input;
+
+        /// Heap order: lowest key on top
+        bool operator>(const MergeHead & other) const {
+            if(clusterBegin != other.clusterBegin)
+                return clusterBegin > other.clusterBegin;
+            return appGroup > other.appGroup;
+        }
+    };
+
+    bool Merger::run(int from, int to, KeyPressSink & sink) {
+        m_rowsRead = 0;
+        for(size_t i = 0; i < m_inputs.size(); i++)
+            m_inputs[i]->start(from, to);
+
+        priority_queue<MergeHead, vector<MergeHead>, greater<MergeHead> > heap;
+        KeyPressRow row;
+        for(size_t i = 0; i < m_inputs.size(); i++) {
+            if(m_inputs[i]->next(row)) {
+                MergeHead head = { row.clusterBegin, row.appGroup, row.count, i };
+                heap.push(head);
+            }
+        }
+
+        vector<KeyPressRow> out;
+        out.reserve(mergeBatch);
+        bool ok = true;
+        while(ok && !heap.empty()) {
+            MergeHead head = heap.top();
+            heap.pop();
+            KeyPressRow merged = { head.clusterBegin, head.appGroup, 0 };
+            // Sum the key over all inputs, refilling heap as rows are taken
+            for(;;) {
+                merged.count += head.count;
+                m_rowsRead++;
+                if(m_inputs[head.input]->next(row)) {
+                    if(row.clusterBegin < head.clusterBegin ||
+                            (row.clusterBegin == head.clusterBegin && row.appGroup < head.appGroup)) {
+                        m_error = m_inputs[head.input]->uri() + " is not ordered";
+                        ok = false;
+                        break;
+                    }
+                    MergeHead refill = { row.clusterBegin, row.appGroup, row.count, head.input };
+                    heap.push(refill);
+                }
+                if(heap.empty() || heap.top().clusterBegin != merged.clusterBegin ||
+                        heap.top().appGroup != merged.appGroup)
+                    break;
+                head = heap.top();
+                heap.pop();
+            }
+            out.push_back(merged);
+            if(ok && out.size() == mergeBatch) {
+                ok = sink.consume(&out[0], out.size());
+                out.clear();
+            }
+        }
+        if(ok && !out.empty())
+            ok = sink.consume(&out[0], out.size());
+        if(!ok && m_error.empty())
+            m_error = "writing output failed";
+
+        for(size_t i = 0; i < m_inputs.size(); i++) {
+            m_inputs[i]->close();
+            if(ok && m_inputs[i]->failed()) {
+                m_error = "reading " + m_inputs[i]->uri() + " failed";
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    bool StorageSink::consume(const KeyPressRow *rows, size_t n) {
+        for(size_t i = 0; i < n; i++) {
+            if(!m_open) {
+                if(!m_storage.beginBatch())
+                    return false;
+                m_open = true;
+            }
+            if(!m_storage.addKeyPress(rows[i].appGroup, rows[i].clusterBegin, rows[i].count)) {
+                m_storage.abortBatch();
+                m_open = false;
+                return false;
+            }
+            m_rows++;
+            if(++m_inBatch == batchRows) {
+                m_inBatch = 0;
+                m_open = false;
+                if(!m_storage.commitBatch())
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    bool StorageSink::finish() {
+        if(!m_open)
+            return true;
+        m_open = false;
+        m_inBatch = 0;
+        return m_storage.commitBatch();
+    }
+}
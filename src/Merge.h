@@ -0,0 +1,152 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGMERGE_H
+#define KEYFROGMERGE_H
+
+#include "Storage.h"
+#include "Archive.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
+namespace keyfrog {
+
+    /**
+     * One store read by a thread of its own. Rows come in batches
+     * through a short queue, so a slow consumer stops the reader
+     * instead of letting the queue grow.
+     */
+    class MergeInput {
+        class Reader;
+        friend class Reader;
+
+        std::string m_uri;
+        Storage *m_storage;
+        ArchiveReader m_archive;
+        int m_from;
+        int m_to;
+
+        boost::mutex m_mutex;
+        boost::condition m_changed;
+        std::deque<std::vector<KeyPressRow> > m_queue;
+        bool m_done;
+        bool m_failed;
+        bool m_stop;
+        boost::thread *m_thread;
+
+        /// Batch being consumed
+        std::vector<KeyPressRow> m_batch;
+        size_t m_pos;
+
+        void run();
+        bool push(const KeyPressRow *rows, size_t n);
+
+        public:
+        /// Batches waiting in queue at most
+        static const size_t queueBatches = 4;
+
+        MergeInput();
+        ~MergeInput();
+
+        /// Opens store: "archive:path" or storage URI (see Storage::create())
+        bool open(const std::string & uri);
+
+        int clusterSize();
+
+        const std::string & uri() const { return m_uri; }
+
+        /// Starts reading rows of [from, to) in background
+        bool start(int from, int to);
+
+        /// Gets next row; false at end of rows or on error (see failed())
+        bool next(KeyPressRow & row);
+
+        bool failed() const { return m_failed; }
+
+        /// Stops reader and closes store
+        void close();
+    };
+
+    /**
+     * K-way merge of stores ordered by ( cluster_begin, app_group ).
+     * Counts of equal keys are summed, so the output has one row per
+     * key and comes out in the same order.
+     */
+    class Merger {
+        std::vector<MergeInput *> m_inputs;
+        std::string m_error;
+        uint64_t m_rowsRead;
+
+        public:
+        Merger();
+        ~Merger();
+
+        /// Opens input store; all inputs must use the same cluster size
+        bool addInput(const std::string & uri);
+
+        int clusterSize();
+
+        /// Merges rows of [from, to) of all inputs into sink
+        bool run(int from, int to, KeyPressSink & sink);
+
+        /// Rows read from inputs by last run()
+        uint64_t rowsRead() const { return m_rowsRead; }
+
+        const std::string & error() const { return m_error; }
+    };
+
+    /**
+     * Writes rows into Storage, committing a transaction every
+     * batchRows rows
+     */
+    class StorageSink : public KeyPressSink {
+        Storage & m_storage;
+        size_t m_inBatch;
+        uint64_t m_rows;
+        bool m_open;
+
+        public:
+        static const size_t batchRows = 64 * 1024;
+
+        StorageSink(Storage & storage) : m_storage(storage), m_inBatch(0), m_rows(0), m_open(false) {}
+
+        virtual bool consume(const KeyPressRow *rows, size_t n);
+
+        /// Commits last batch
+        bool finish();
+
+        uint64_t rows() const { return m_rows; }
+    };
+}
+
+#endif
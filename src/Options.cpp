@@ -42,7 +42,32 @@ namespace keyfrog {
         m_debugLogFile = "/tmp/keyfrog-debug.log";
 
         // Cluster options
-        int m_clusterSize = 15*60; // 15 min
+        m_clusterSize = 15*60; // 15 min
+
+        // Event source options -- empty device list means all keyboards
+        m_captureSource = "record";
+
+        // Storage options -- journal makes rare commits safe
+        m_storageUri = "sqlite:~/.keyfrog/keyfrog.db";
+        m_commitInterval = 60;
+        m_journalState = true;
+        m_journalSyncInterval = 2;
+        m_detailRetention = 0; // keep forever
+        m_detailDownsample = 0; // never
+        m_compactionIdle = 60;
+
+        // Live statistics socket
+        m_statsSocketState = true;
+
+        // Keycode histograms
+        m_keyStatsState = true;
+
+        // Typing sessions
+        m_sessionGap = 30; // seconds
+
+        // Per-second history in memory
+        m_historyHours = 4; // about 1 MB
+        m_historySnapshot = true;
 
         // General options
         m_userHomeDir = "/tmp";
@@ -31,6 +31,7 @@
 #define KEYFROGOPTIONS_H
 
 #include <string>
+#include <list>
 
 namespace keyfrog {
 
@@ -48,6 +49,36 @@ namespace keyfrog {
         // Cluster options
         int m_clusterSize;
 
+        // X displays to monitor (empty - :0)
+        std::list<std::string> m_displays;
+
+        // Event source options
+        std::string m_captureSource;
+        std::list<std::string> m_captureDevices;
+        std::string m_captureTrace;
+
+        // Storage options
+        std::string m_storageUri;
+        int m_commitInterval;
+        bool m_journalState;
+        int m_journalSyncInterval;
+        int m_detailRetention;
+        int m_detailDownsample;
+        int m_compactionIdle;
+
+        // Live statistics socket
+        bool m_statsSocketState;
+
+        // Keycode histograms
+        bool m_keyStatsState;
+
+        // Typing sessions: longest pause within a session (0 - off)
+        int m_sessionGap;
+
+        // Per-second history in memory
+        int m_historyHours;
+        bool m_historySnapshot;
+
         // General options
         std::string m_userHomeDir;
 
@@ -67,6 +98,54 @@ namespace keyfrog {
         void setClusterSize(int theVal) { m_clusterSize = theVal; }
         int clusterSize() { return m_clusterSize; }
 
+        void addDisplay(const std::string & theVal) { m_displays.push_back(theVal); }
+        const std::list<std::string> & displays() { return m_displays; }
+
+        void setCaptureSource(const std::string & theVal) { m_captureSource = theVal; }
+        const std::string & captureSource() { return m_captureSource; }
+
+        void setCaptureDevices(const std::list<std::string> & theVal) { m_captureDevices = theVal; }
+        const std::list<std::string> & captureDevices() { return m_captureDevices; }
+
+        void setCaptureTrace(const std::string & theVal) { m_captureTrace = theVal; }
+        const std::string & captureTrace() { return m_captureTrace; }
+
+        void setStorageUri(const std::string & theVal) { m_storageUri = theVal; }
+        const std::string & storageUri() { return m_storageUri; }
+
+        void setCommitInterval(int theVal) { m_commitInterval = theVal; }
+        int commitInterval() { return m_commitInterval; }
+
+        void setJournalState(bool theVal) { m_journalState = theVal; }
+        bool journalState() { return m_journalState; }
+
+        void setJournalSyncInterval(int theVal) { m_journalSyncInterval = theVal; }
+        int journalSyncInterval() { return m_journalSyncInterval; }
+
+        void setDetailRetention(int theVal) { m_detailRetention = theVal; }
+        int detailRetention() { return m_detailRetention; }
+
+        void setDetailDownsample(int theVal) { m_detailDownsample = theVal; }
+        int detailDownsample() { return m_detailDownsample; }
+
+        void setCompactionIdle(int theVal) { m_compactionIdle = theVal; }
+        int compactionIdle() { return m_compactionIdle; }
+
+        void setStatsSocketState(bool theVal) { m_statsSocketState = theVal; }
+        bool statsSocketState() { return m_statsSocketState; }
+
+        void setKeyStatsState(bool theVal) { m_keyStatsState = theVal; }
+        bool keyStatsState() { return m_keyStatsState; }
+
+        void setSessionGap(int theVal) { m_sessionGap = theVal; }
+        int sessionGap() { return m_sessionGap; }
+
+        void setHistoryHours(int theVal) { m_historyHours = theVal; }
+        int historyHours() { return m_historyHours; }
+
+        void setHistorySnapshot(bool theVal) { m_historySnapshot = theVal; }
+        bool historySnapshot() { return m_historySnapshot; }
+
         void setDaemonMode(bool theVal) { m_daemonMode = theVal; }
         int daemonMode() { return m_daemonMode; }
 
@@ -42,7 +42,7 @@ using namespace std;
 
 namespace keyfrog {
 
-    ProcessTree::ProcessTree()
+    ProcessTree::ProcessTree() : m_generation(0)
     {
     }
 
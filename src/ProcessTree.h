@@ -56,6 +56,8 @@ namespace keyfrog {
 
             /// No concurent access allowed (read and write)
             mutable boost::recursive_mutex m_accessMutex;
+            /// Bumped by clear(), lets users cache results of queries
+            unsigned long m_generation;
 
             /// Adds process to tree without connecting to parent
             bool addProcess(pid_t pid, ProcessMap & procMap, ProcId & newProc);
@@ -104,6 +106,13 @@ namespace keyfrog {
                 boost::recursive_mutex::scoped_lock lock(m_accessMutex);
                 m_pidToIdMap.clear();
                 m_procTreeGraph.clear();
+                ++m_generation;
+            }
+
+            /// Changes each time tree is rebuilt
+            unsigned long generation() const {
+                boost::recursive_mutex::scoped_lock lock(m_accessMutex);
+                return m_generation;
             }
 
             /// Returns set of descendants of given process
@@ -0,0 +1,254 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "Query.h"
+#include "Aggregate.h"
+#include "Common.h"
+#include "Debug.h"
+
+#include <map>
+#include <algorithm>
+
+using namespace std;
+
+namespace keyfrog {
+
+    /// Orders totals by count, largest first
+    static bool greaterCount(const GroupTotal & a, const GroupTotal & b) {
+        if(a.count != b.count)
+            return a.count > b.count;
+        return a.appGroup < b.appGroup;
+    }
+
+    /// Floor of value to multiple of step (also for negative values)
+    static int64_t floorTo(int64_t value, int step) {
+        int64_t rem = value % step;
+        return value - (rem < 0 ? rem + step : rem);
+    }
+
+    Query::Query() : m_storage(NULL) {
+    }
+
+    Query::~Query() {
+        close();
+    }
+
+    bool Query::open(const string & uri) {
+        close();
+        string location;
+        m_storage = Storage::create(uri, location);
+        if(m_storage == NULL) {
+            m_error = "unknown storage " + uri;
+            return false;
+        }
+        if(!m_storage->connectReadOnly(location)) {
+            m_error = "could not open " + location;
+            delete m_storage;
+            m_storage = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    void Query::close() {
+        if(m_storage) {
+            m_storage->disconnect();
+            delete m_storage;
+            m_storage = NULL;
+        }
+    }
+
+    int Query::bucketStart(int timestamp, int bucket) {
+        return local_bucket_start(timestamp, bucket);
+    }
+
+    bool Query::totals(int from, int to, vector<GroupTotal> & out) {
+        out.clear();
+        if(m_storage == NULL) {
+            m_error = "database not opened";
+            return false;
+        }
+        map<int, long long> sums;
+        if(!m_storage->totals(from, to, sums)) {
+            m_error = "reading totals failed";
+            return false;
+        }
+        for(map<int, long long>::iterator it = sums.begin(); it != sums.end(); ++it) {
+            GroupTotal total = { it->first, it->second };
+            out.push_back(total);
+        }
+        return true;
+    }
+
+    bool Query::top(int from, int to, int limit, vector<GroupTotal> & out) {
+        if(!totals(from, to, out))
+            return false;
+        sort(out.begin(), out.end(), greaterCount);
+        if(limit >= 0 && out.size() > (size_t) limit)
+            out.resize(limit);
+        return true;
+    }
+
+    bool Query::series(int from, int to, int bucket, int group, vector<SeriesPoint> & out) {
+        out.clear();
+        if(m_storage == NULL) {
+            m_error = "database not opened";
+            return false;
+        }
+        if(bucket <= 0) {
+            m_error = "bucket must be positive";
+            return false;
+        }
+
+        map<pair<int, int>, long long> sums;
+        if(!m_storage->series(from, to, bucket, group, sums)) {
+            m_error = "reading series failed";
+            return false;
+        }
+        for(map<pair<int, int>, long long>::iterator it = sums.begin(); it != sums.end(); ++it) {
+            SeriesPoint point = { it->first.first, it->first.second, (double) it->second };
+            out.push_back(point);
+        }
+        return true;
+    }
+
+    /**
+     * Average of the last window buckets (empty buckets count as zero),
+     * emitted for every bucket of [from, to) in which group has data
+     * in its window. Buckets are dense only over runs of data closer
+     * than window to each other, so a wide range costs nothing where
+     * there's no data.
+     */
+    bool Query::movingAverage(int from, int to, int bucket, int window, int group, vector<SeriesPoint> & out) {
+        if(window <= 0) {
+            m_error = "window must be positive";
+            return false;
+        }
+        vector<SeriesPoint> points;
+        if(!series(from, to, bucket, group, points))
+            return false;
+
+        // Per group buckets with data, indexed in local time so DST
+        // changes do not shift buckets
+        int64_t first = floorTo(local_time(from), bucket);
+        int64_t last = (floorTo(local_time(to - 1), bucket) - first) / bucket;
+        map<int, map<int64_t, double> > sparse;
+        for(size_t i = 0; i < points.size(); i++)
+            sparse[points[i].appGroup][(local_time(points[i].time) - first) / bucket] += points[i].value;
+
+        // Ordered by local bucket, then group (two buckets may map to the
+        // same time when clocks go back)
+        map<pair<int64_t, int>, double> averages;
+        vector<double> values, average;
+        for(map<int, map<int64_t, double> >::iterator git = sparse.begin(); git != sparse.end(); ++git) {
+            map<int64_t, double>::iterator it = git->second.begin();
+            while(it != git->second.end()) {
+                // Run of buckets whose windows overlap
+                int64_t runFirst = it->first, runLast = it->first;
+                map<int64_t, double>::iterator runBegin = it;
+                for(++it; it != git->second.end() && it->first - runLast < window; ++it)
+                    runLast = it->first;
+                int64_t runEnd = min(runLast + window - 1, last);
+
+                values.assign(runEnd - runFirst + 1, 0.0);
+                for(map<int64_t, double>::iterator vit = runBegin; vit != it; ++vit)
+                    values[vit->first - runFirst] = vit->second;
+                average.resize(values.size());
+                moving_average(&values[0], values.size(), window, &average[0]);
+                for(size_t b = 0; b < average.size(); b++) {
+                    if(average[b] > 0)
+                        averages[make_pair(runFirst + (int64_t) b, git->first)] = average[b];
+                }
+            }
+        }
+
+        out.clear();
+        for(map<pair<int64_t, int>, double>::iterator it = averages.begin(); it != averages.end(); ++it) {
+            SeriesPoint point = { from_local_time(first + it->first.first * bucket), it->first.second, it->second };
+            out.push_back(point);
+        }
+        return true;
+    }
+
+    bool Query::keys(int from, int to, int group, KeyHistogram & out) {
+        out.clear();
+        if(m_storage == NULL) {
+            m_error = "database not opened";
+            return false;
+        }
+        if(!m_storage->keyHistogram(from, to, group, out)) {
+            m_error = "storage has no key statistics";
+            return false;
+        }
+        return true;
+    }
+
+    bool Query::activeTime(int from, int to, map<int, ActiveTime> & out) {
+        out.clear();
+        if(m_storage == NULL) {
+            m_error = "database not opened";
+            return false;
+        }
+        if(!m_storage->activeTime(from, to, out)) {
+            m_error = "storage has no active time";
+            return false;
+        }
+        return true;
+    }
+
+    bool Query::intervals(int from, int to, int group, IntervalHistogram & out) {
+        out.clear();
+        if(m_storage == NULL) {
+            m_error = "database not opened";
+            return false;
+        }
+        if(!m_storage->intervalHistogram(from, to, group, out)) {
+            m_error = "storage has no interval statistics";
+            return false;
+        }
+        return true;
+    }
+
+    bool Query::seats(int from, int to, map<pair<int, int>, long long> & out) {
+        out.clear();
+        if(m_storage == NULL) {
+            m_error = "database not opened";
+            return false;
+        }
+        if(!m_storage->seatTotals(from, to, out)) {
+            m_error = "storage has no seat statistics";
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,105 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGQUERY_H
+#define KEYFROGQUERY_H
+
+#include "Storage.h"
+#include <string>
+#include <vector>
+#include <map>
+
+namespace keyfrog {
+
+    /// Keypresses of one group
+    struct GroupTotal {
+        int appGroup;
+        long long count;
+    };
+
+    /// Value of one group in one time bucket
+    struct SeriesPoint {
+        int time;
+        int appGroup;
+        double value;
+    };
+
+    /**
+     * Aggregated statistics over a storage opened read-only.
+     *
+     * Aggregation is left to the backend's read API; the SQLite one
+     * pushes it down into SQL and serves it from the coarsest table
+     * that keeps the answer exact. Buckets are aligned to local time.
+     */
+    class Query {
+        Storage *m_storage;
+        std::string m_error;
+
+        public:
+        Query();
+        ~Query();
+
+        /// Opens keyfrog storage (path or URI, see Storage::create()) read-only
+        bool open(const std::string & uri);
+
+        void close();
+
+        /// Description of last failure
+        const std::string & error() const { return m_error; }
+
+        /// Start of local time bucket containing timestamp
+        static int bucketStart(int timestamp, int bucket);
+
+        /// Keypresses per group in [from, to), ordered by group
+        bool totals(int from, int to, std::vector<GroupTotal> & out);
+
+        /// Groups with most keypresses in [from, to), at most limit entries
+        bool top(int from, int to, int limit, std::vector<GroupTotal> & out);
+
+        /// Keypresses per bucket and group (group -1: all groups), ordered by time
+        bool series(int from, int to, int bucket, int group, std::vector<SeriesPoint> & out);
+
+        /// Moving average of series over window buckets, per group
+        bool movingAverage(int from, int to, int bucket, int window, int group, std::vector<SeriesPoint> & out);
+
+        /// Keypresses per keycode and modifier in [from, to) (group -1: all groups)
+        bool keys(int from, int to, int group, KeyHistogram & out);
+
+        /// Active typing time and sessions per group in [from, to)
+        bool activeTime(int from, int to, std::map<int, ActiveTime> & out);
+
+        /// Intervals between consecutive keypresses in [from, to) (group -1: all groups)
+        bool intervals(int from, int to, int group, IntervalHistogram & out);
+
+        /// Keypresses per ( seat, group ) in [from, to), seat being the X display
+        bool seats(int from, int to, std::map<std::pair<int, int>, long long> & out);
+    };
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "Sessionizer.h"
+
+#include <cstddef>
+#include <sys/time.h>
+
+namespace keyfrog {
+
+    Sessionizer::Sessionizer(int gapSeconds) : m_typing(false), m_group(-1), m_lastTime(0) {
+        setGap(gapSeconds);
+    }
+
+    uint32_t Sessionizer::keyPress(int group, int time, bool & newSession) {
+        // Wraps with event time; time going back looks like a long pause
+        uint32_t pause = (uint32_t) time - m_lastTime;
+        bool continued = m_typing && pause <= m_gap;
+
+        newSession = !continued || group != m_group;
+        m_typing = true;
+        m_group = group;
+        m_lastTime = time;
+        return continued ? pause : 0;
+    }
+
+    bool KeyIntervals::keyPress(int time, uint32_t & milliseconds) {
+        bool pressed = m_pressed;
+        milliseconds = (uint32_t) time - m_lastTime;
+        m_pressed = true;
+        m_lastTime = time;
+        return pressed;
+    }
+
+    int EventClock::timestamp(int time) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        int64_t now = (int64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+        if(m_anchored) {
+            // Signed difference, so events just before the anchor work too
+            int64_t wallTime = m_wallTime + (int32_t) ((uint32_t) time - m_eventTime);
+            if(wallTime <= now && wallTime >= now - maxDelay * 1000LL)
+                return (int) (wallTime / 1000);
+        }
+        m_anchored = true;
+        m_wallTime = now;
+        m_eventTime = time;
+        return (int) (now / 1000);
+    }
+}
@@ -0,0 +1,150 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGSESSIONIZER_H
+#define KEYFROGSESSIONIZER_H
+
+#include <stdint.h>
+
+namespace keyfrog {
+
+    /**
+     * Active typing time of a group, summed over a cluster
+     */
+    struct ActiveTime {
+        /// Sum of pauses between keypresses shorter than the gap
+        long long milliseconds;
+        /// Typing sessions begun
+        long long sessions;
+
+        ActiveTime() : milliseconds(0), sessions(0) {}
+
+        void merge(const ActiveTime & other) {
+            milliseconds += other.milliseconds;
+            sessions += other.sessions;
+        }
+    };
+
+    /**
+     * Turns keypresses of one keyboard (one seat) into typing
+     * sessions.
+     *
+     * States are idle and typing in a group. A keypress coming
+     * within gap of the previous one continues typing, and the
+     * pause between them is active time of the keypress' group;
+     * when group changes, a session of the new group begins and
+     * the pause goes to it, as that's where attention went. A
+     * longer pause means the user was idle: a session begins and
+     * nothing is credited. No timers are needed, the idle state
+     * is noticed by the next keypress.
+     *
+     * Times are event times in milliseconds (X server time or
+     * evdev time), which may wrap around.
+     */
+    class Sessionizer {
+        /// Longest pause (milliseconds) still counted as typing
+        uint32_t m_gap;
+        bool m_typing;
+        int m_group;
+        uint32_t m_lastTime;
+
+        public:
+        /// Gap used unless configured
+        static const int defaultGap = 30;
+
+        Sessionizer(int gapSeconds = defaultGap);
+
+        void setGap(int seconds) { m_gap = seconds > 0 ? seconds * 1000u : 0; }
+        int gap() const { return m_gap / 1000; }
+
+        /**
+         * Feeds a keypress of group
+         * @param newSession Set when the keypress begins a session of group
+         * @return Milliseconds of active time the keypress ends
+         */
+        uint32_t keyPress(int group, int time, bool & newSession);
+
+        /// Forgets current session (e.g. when keyboard is disconnected)
+        void reset() { m_typing = false; }
+    };
+
+    /**
+     * Pauses between consecutive keypresses of one keyboard,
+     * whatever their groups and however long. Unlike active time
+     * they don't depend on the session gap.
+     */
+    class KeyIntervals {
+        bool m_pressed;
+        uint32_t m_lastTime;
+
+        public:
+        KeyIntervals() : m_pressed(false), m_lastTime(0) {}
+
+        /**
+         * Feeds a keypress
+         * @param milliseconds Set to the pause since previous keypress
+         * @return false for the first keypress, which ends no interval
+         */
+        bool keyPress(int time, uint32_t & milliseconds);
+
+        void reset() { m_pressed = false; }
+    };
+
+    /**
+     * Converts event times (milliseconds of X server or evdev
+     * clock, which may wrap around) to wall clock timestamps, so
+     * that events are stored in the cluster they happened in even
+     * when they are read late.
+     *
+     * The clock is anchored at an event read promptly: since
+     * events can't be read before they happen, an event that
+     * would fall after the wall clock moves the anchor to itself.
+     * If an event falls more than maxDelay behind the wall clock,
+     * the event clock is taken as restarted (or the wall clock as
+     * adjusted) and the anchor moves too.
+     */
+    class EventClock {
+        bool m_anchored;
+        int64_t m_wallTime;
+        uint32_t m_eventTime;
+
+        public:
+        /// Longest delay (seconds) of reading an event that is trusted
+        static const int maxDelay = 600;
+
+        EventClock() : m_anchored(false), m_wallTime(0), m_eventTime(0) {}
+
+        /// Wall clock timestamp (seconds) of event time
+        int timestamp(int time);
+
+        void reset() { m_anchored = false; }
+    };
+}
+
+#endif
@@ -0,0 +1,378 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "StatsServer.h"
+#include "Common.h"
+#include "Debug.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ctime>
+
+using namespace std;
+
+namespace keyfrog {
+
+    static bool setNonBlocking(int fd) {
+        int flags = fcntl(fd, F_GETFL);
+        return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+    }
+
+    StatsServer::StatsServer(StorageManager & storage) : m_storage(storage), m_listenFd(-1) {
+    }
+
+    StatsServer::~StatsServer() {
+        close();
+    }
+
+    bool StatsServer::listen(const string & path) {
+        close();
+        struct sockaddr_un addr;
+        if(path.size() >= sizeof(addr.sun_path)) {
+            _err("Socket path too long: %s", path.c_str());
+            return false;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path.c_str());
+
+        m_listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(m_listenFd == -1 || !setNonBlocking(m_listenFd)) {
+            _err("Could not create stats socket: %s", strerror(errno));
+            close();
+            return false;
+        }
+        fcntl(m_listenFd, F_SETFD, FD_CLOEXEC);
+
+        // Left by previous run
+        unlink(path.c_str());
+        // Statistics are private
+        mode_t mask = umask(0077);
+        int rc = bind(m_listenFd, (struct sockaddr *) &addr, sizeof(addr));
+        umask(mask);
+        if(rc == -1 || ::listen(m_listenFd, 8) == -1) {
+            _err("Could not listen on %s: %s", path.c_str(), strerror(errno));
+            close();
+            return false;
+        }
+        m_path = path;
+        _dbg("Serving statistics on %s", path.c_str());
+        return true;
+    }
+
+    void StatsServer::close() {
+        for(list<Client>::iterator it = m_clients.begin(); it != m_clients.end(); ++it)
+            ::close(it->fd);
+        m_clients.clear();
+        if(m_listenFd != -1) {
+            ::close(m_listenFd);
+            m_listenFd = -1;
+        }
+        if(!m_path.empty()) {
+            unlink(m_path.c_str());
+            m_path.clear();
+        }
+    }
+
+    void StatsServer::addPollFds(vector<pollfd> & fds) const {
+        if(m_listenFd == -1)
+            return;
+        pollfd pfd;
+        pfd.fd = m_listenFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        fds.push_back(pfd);
+        for(list<Client>::const_iterator it = m_clients.begin(); it != m_clients.end(); ++it) {
+            pfd.fd = it->fd;
+            pfd.events = it->out.empty() ? POLLIN : POLLIN | POLLOUT;
+            fds.push_back(pfd);
+        }
+    }
+
+    void StatsServer::handle(const vector<pollfd> & fds) {
+        for(size_t i = 0; i < fds.size(); i++) {
+            if(fds[i].revents == 0)
+                continue;
+            if(fds[i].fd == m_listenFd) {
+                accept();
+                continue;
+            }
+            for(list<Client>::iterator it = m_clients.begin(); it != m_clients.end(); ++it) {
+                if(it->fd != fds[i].fd)
+                    continue;
+                bool alive = !(fds[i].revents & (POLLERR | POLLNVAL));
+                if(alive && (fds[i].revents & (POLLIN | POLLHUP)))
+                    alive = readRequests(*it);
+                if(alive)
+                    alive = writeReplies(*it);
+                if(!alive) {
+                    ::close(it->fd);
+                    m_clients.erase(it);
+                }
+                break;
+            }
+        }
+
+        long long now = monotonic_ms();
+        for(list<Client>::iterator it = m_clients.begin(); it != m_clients.end(); ) {
+            if(it->subscribed && it->nextPush <= now) {
+                push(*it, now);
+                if(!writeReplies(*it)) {
+                    ::close(it->fd);
+                    it = m_clients.erase(it);
+                    continue;
+                }
+            }
+            ++it;
+        }
+    }
+
+    int StatsServer::timeout() const {
+        long long now = monotonic_ms();
+        long long next = -1;
+        for(list<Client>::const_iterator it = m_clients.begin(); it != m_clients.end(); ++it) {
+            if(it->subscribed && (next == -1 || it->nextPush < next))
+                next = it->nextPush;
+        }
+        if(next == -1)
+            return -1;
+        return next <= now ? 0 : next - now;
+    }
+
+    /**
+     * Sends what changed since the last update, unless previous
+     * update still waits in the output buffer
+     */
+    void StatsServer::push(Client & client, long long now) {
+        client.nextPush = now + client.period;
+        if(!client.out.empty() || client.sentChanges == m_storage.changes())
+            return;
+        client.sentChanges = m_storage.changes();
+
+        map<int, long long> totals;
+        int day = m_storage.dayTotals(totals);
+        if(day != client.sentDay) {
+            encodeUpdate(client, true, day, totals);
+        } else {
+            map<int, long long> delta;
+            for(map<int, long long>::iterator it = totals.begin(); it != totals.end(); ++it) {
+                long long change = it->second - client.sent[it->first];
+                if(change)
+                    delta[it->first] = change;
+            }
+            if(delta.empty())
+                return;
+            encodeUpdate(client, false, day, delta);
+        }
+        client.sent.swap(totals);
+        client.sentDay = day;
+    }
+
+    void StatsServer::encodeUpdate(Client & client, bool snapshot, int day, const map<int, long long> & counts) {
+        if(client.json) {
+            ostringstream out;
+            out << "{\"type\":\"" << (snapshot ? "snapshot" : "delta") << "\",\"day\":" << day << ",\"counts\":{";
+            for(map<int, long long>::const_iterator it = counts.begin(); it != counts.end(); ++it)
+                out << (it == counts.begin() ? "" : ",") << "\"" << it->first << "\":" << it->second;
+            out << "}}\n";
+            client.out += out.str();
+            return;
+        }
+        string payload(1, snapshot ? 'S' : 'D');
+        put_varint(payload, day);
+        put_varint(payload, counts.size());
+        for(map<int, long long>::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+            put_varint(payload, zigzag_encode(it->first));
+            put_varint(payload, zigzag_encode(it->second));
+        }
+        put_varint(client.out, payload.size());
+        client.out += payload;
+    }
+
+    void StatsServer::accept() {
+        while(1) {
+            int fd = ::accept(m_listenFd, NULL, NULL);
+            if(fd == -1)
+                return;
+            if(!setNonBlocking(fd)) {
+                ::close(fd);
+                continue;
+            }
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            Client client;
+            client.fd = fd;
+            client.subscribed = false;
+            client.json = false;
+            client.period = 0;
+            client.nextPush = 0;
+            client.sentDay = -1;
+            client.sentChanges = 0;
+            m_clients.push_back(client);
+        }
+    }
+
+    /**
+     * @return false if client should be dropped
+     */
+    bool StatsServer::readRequests(Client & client) {
+        char buf[4096];
+        while(1) {
+            ssize_t n = read(client.fd, buf, sizeof(buf));
+            if(n == 0)
+                return false;
+            if(n == -1) {
+                if(errno == EINTR)
+                    continue;
+                if(errno != EAGAIN && errno != EWOULDBLOCK)
+                    return false;
+                break;
+            }
+            client.in.append(buf, n);
+        }
+
+        string::size_type eol;
+        while(!client.subscribed && (eol = client.in.find('\n')) != string::npos) {
+            string request = client.in.substr(0, eol);
+            client.in.erase(0, eol + 1);
+            if(!request.empty() && request[request.size() - 1] == '\r')
+                request.erase(request.size() - 1);
+            answer(client, request);
+        }
+        // Subscribers talk no more
+        if(client.subscribed)
+            client.in.clear();
+        return client.in.size() <= maxRequest && client.out.size() <= maxPending;
+    }
+
+    /**
+     * @return false if client should be dropped
+     */
+    bool StatsServer::writeReplies(Client & client) {
+        while(!client.out.empty()) {
+            // No SIGPIPE when client went away
+            ssize_t n = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+            if(n == -1) {
+                if(errno == EINTR)
+                    continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            client.out.erase(0, n);
+        }
+        return true;
+    }
+
+    /**
+     * Answer of requests with two keys per line
+     */
+    static void appendPairs(string & out, const map<pair<int, int>, long long> & counts) {
+        char line[64];
+        snprintf(line, sizeof(line), "OK %d\n", (int) counts.size());
+        out += line;
+        for(map<pair<int, int>, long long>::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+            snprintf(line, sizeof(line), "%d %d %lld\n", it->first.first, it->first.second, it->second);
+            out += line;
+        }
+    }
+
+    void StatsServer::answer(Client & client, const string & request) {
+        istringstream in(request);
+        string command;
+        in >> command;
+
+        map<int, long long> totals;
+        if(command == "TOTALS") {
+            m_storage.dayTotals(totals);
+        } else if(command == "RECENT") {
+            int seconds;
+            if(!(in >> seconds) || seconds <= 0) {
+                client.out += "ERR RECENT needs number of seconds\n";
+                return;
+            }
+            m_storage.recentTotals(seconds, totals);
+        } else if(command == "HISTORY") {
+            int seconds, step = 1;
+            if(!(in >> seconds) || seconds <= 0 || ((in >> step) && step <= 0)) {
+                client.out += "ERR HISTORY needs number of seconds and optional step\n";
+                return;
+            }
+            map<pair<int, int>, long long> series;
+            m_storage.history(seconds, step, series);
+            appendPairs(client.out, series);
+            return;
+        } else if(command == "SEATS") {
+            map<pair<int, int>, long long> seats;
+            m_storage.seatDayTotals(seats);
+            appendPairs(client.out, seats);
+            return;
+        } else if(command == "PING") {
+        } else if(command == "SUBSCRIBE") {
+            int period;
+            string encoding = "binary";
+            if(!(in >> period) || period < minPeriod || period > maxPeriod) {
+                client.out += "ERR SUBSCRIBE needs period in milliseconds\n";
+                return;
+            }
+            in >> encoding;
+            if(encoding != "binary" && encoding != "json") {
+                client.out += "ERR unknown encoding\n";
+                return;
+            }
+            client.subscribed = true;
+            client.json = encoding == "json";
+            client.period = period;
+            // First update (the snapshot) goes out right away
+            client.nextPush = 0;
+            client.sentChanges = m_storage.changes() - 1;
+        } else {
+            client.out += "ERR unknown request\n";
+            return;
+        }
+
+        char line[64];
+        snprintf(line, sizeof(line), "OK %d\n", (int) totals.size());
+        client.out += line;
+        for(map<int, long long>::iterator it = totals.begin(); it != totals.end(); ++it) {
+            snprintf(line, sizeof(line), "%d %lld\n", it->first, it->second);
+            client.out += line;
+        }
+    }
+}
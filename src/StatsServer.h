@@ -0,0 +1,132 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGSTATSSERVER_H
+#define KEYFROGSTATSSERVER_H
+
+#include "StorageManager.h"
+
+#include <string>
+#include <list>
+#include <vector>
+#include <poll.h>
+
+namespace keyfrog {
+
+    /**
+     * Serves live statistics on a Unix domain socket.
+     *
+     * All sockets are non-blocking and are driven from the daemon's
+     * event loop: addPollFds() adds descriptors to wait for, handle()
+     * serves what poll() reported. Requests are text lines:
+     *
+     *   TOTALS            keypresses per group of current day
+     *   RECENT <seconds>  keypresses per group of last seconds (up to a day)
+     *   HISTORY <seconds> [step]
+     *                     per second keypresses of last seconds, summed
+     *                     into steps; lines are "<time> <group> <count>"
+     *   SEATS             keypresses of current day per seat (X display)
+     *                     and group; lines are "<seat> <group> <count>"
+     *   PING
+     *   SUBSCRIBE <milliseconds> [binary|json]
+     *
+     * Answer is "OK <n>" followed by n lines "<group> <count>", or
+     * "ERR <reason>". Data comes from StorageManager memory, the
+     * database is never read.
+     *
+     * After "OK 0" to SUBSCRIBE the connection carries only pushed
+     * updates of day totals, at most one per period: first a snapshot
+     * of all groups, then deltas of groups that changed since the last
+     * sent update. Nothing is queued per tick -- while a subscriber
+     * has unsent data its deltas keep accumulating into the next
+     * update. First update of a new day is a snapshot again.
+     *
+     * Binary update: varint payload length, then payload of type byte
+     * ('S' snapshot, 'D' delta), varint day start, varint number of
+     * entries and zigzag varint pairs (group, count). JSON update is
+     * one line: {"type":"delta","day":<start>,"counts":{"<group>":<count>}}
+     */
+    class StatsServer {
+        struct Client {
+            int fd;
+            std::string in;
+            std::string out;
+
+            /// Subscription state
+            bool subscribed;
+            bool json;
+            int period;
+            long long nextPush;
+            /// Totals as the subscriber knows them
+            std::map<int, long long> sent;
+            int sentDay;
+            unsigned long sentChanges;
+        };
+
+        StorageManager & m_storage;
+        std::string m_path;
+        int m_listenFd;
+        std::list<Client> m_clients;
+
+        void accept();
+        bool readRequests(Client & client);
+        bool writeReplies(Client & client);
+        void answer(Client & client, const std::string & request);
+        void push(Client & client, long long now);
+        void encodeUpdate(Client & client, bool snapshot, int day, const std::map<int, long long> & counts);
+
+        public:
+        /// Longest accepted request line
+        static const size_t maxRequest = 1024;
+        /// Clients not reading their replies are dropped past this
+        static const size_t maxPending = 1024 * 1024;
+        /// Bounds of subscription period (milliseconds)
+        static const int minPeriod = 50;
+        static const int maxPeriod = 3600 * 1000;
+
+        StatsServer(StorageManager & storage);
+        ~StatsServer();
+
+        /// Creates socket file (replacing a stale one) and starts listening
+        bool listen(const std::string & path);
+
+        void close();
+
+        /// Appends descriptors to poll
+        void addPollFds(std::vector<pollfd> & fds) const;
+
+        /// Serves descriptors reported by poll() and pushes due updates
+        void handle(const std::vector<pollfd> & fds);
+
+        /// Milliseconds until next update is due, -1 if there are no subscribers
+        int timeout() const;
+    };
+}
+
+#endif
@@ -31,6 +31,158 @@
 #include <config.h>
 #endif
 #include "Storage.h"
+#include "StorageSqlite.h"
+#include "StorageTsFile.h"
+#include "Common.h"
+#include "Debug.h"
+
+using namespace std;
 
 namespace keyfrog {
+
+    /** 
+     * Backend is chosen by URI scheme
+     */
+    Storage *Storage::create(const string & uri, string & location) {
+        string::size_type colon = uri.find(':');
+        string scheme = colon == string::npos ? "" : uri.substr(0, colon);
+        location = colon == string::npos ? uri : uri.substr(colon + 1);
+        // sqlite:///path form
+        if(location.compare(0, 3, "///") == 0)
+            location.erase(0, 2);
+
+        if(scheme == "" || scheme == "sqlite") {
+            return new StorageSqlite();
+        } else if(scheme == "tsfile") {
+            return new StorageTsFile();
+        }
+        _dbg("Unknown storage scheme `%s'", scheme.c_str());
+        return NULL;
+    }
+
+    /** 
+     * By default every write is durable on its own
+     */
+    bool Storage::beginBatch() {
+        return true;
+    }
+
+    bool Storage::commitBatch() {
+        return true;
+    }
+
+    void Storage::abortBatch() {
+    }
+
+    bool Storage::addKeyHistogram(int app_group, int timestamp, const KeyHistogram & histogram) {
+        return true;
+    }
+
+    bool Storage::keyHistogram(int from, int to, int app_group, KeyHistogram & out) {
+        return false;
+    }
+
+    bool Storage::addActiveTime(int app_group, int timestamp, const ActiveTime & active) {
+        return true;
+    }
+
+    bool Storage::activeTime(int from, int to, map<int, ActiveTime> & out) {
+        return false;
+    }
+
+    bool Storage::addIntervalHistogram(int app_group, int timestamp, const IntervalHistogram & histogram) {
+        return true;
+    }
+
+    bool Storage::intervalHistogram(int from, int to, int app_group, IntervalHistogram & out) {
+        return false;
+    }
+
+    bool Storage::addSeatKeyPresses(int seat, int app_group, int timestamp, int count) {
+        return true;
+    }
+
+    bool Storage::seatTotals(int from, int to, map<pair<int, int>, long long> & out) {
+        return false;
+    }
+
+    /** 
+     * By default there is nothing to maintain
+     */
+    bool Storage::compact(int milliseconds) {
+        return false;
+    }
+
+    bool Storage::expire() {
+        return false;
+    }
+
+    bool Storage::connectReadOnly(string uri) {
+        return false;
+    }
+
+    bool Storage::scanRange(int from, int to, KeyPressSink & sink) {
+        return false;
+    }
+
+    bool Storage::scanGroupRange(int app_group, int from, int to, KeyPressSink & sink) {
+        return false;
+    }
+
+    /**
+     * Sums rows of a scan into buckets
+     */
+    class SeriesSink : public KeyPressSink {
+        int m_bucket;
+        map<pair<int, int>, long long> & m_out;
+        /// Cluster seen last and its bucket; rows come in time order
+        int m_lastCluster;
+        int m_lastBucket;
+        public:
+        SeriesSink(int bucket, map<pair<int, int>, long long> & out) :
+            m_bucket(bucket), m_out(out), m_lastCluster(-1), m_lastBucket(0) {
+        }
+        virtual bool consume(const KeyPressRow *rows, size_t n) {
+            for(size_t i = 0; i < n; i++) {
+                if(rows[i].clusterBegin != m_lastCluster) {
+                    m_lastCluster = rows[i].clusterBegin;
+                    m_lastBucket = local_bucket_start(m_lastCluster, m_bucket);
+                }
+                m_out[make_pair(m_lastBucket, rows[i].appGroup)] += rows[i].count;
+            }
+            return true;
+        }
+    };
+
+    /**
+     * Generic version over scans
+     */
+    bool Storage::series(int from, int to, int bucket, int app_group, map<pair<int, int>, long long> & out) {
+        if(bucket <= 0)
+            return false;
+        SeriesSink sink(bucket, out);
+        if(app_group == -1)
+            return scanRange(from, to, sink);
+        return scanGroupRange(app_group, from, to, sink);
+    }
+
+    /**
+     * Sums rows of a scan per group
+     */
+    class TotalsSink : public KeyPressSink {
+        map<int, long long> & m_out;
+        public:
+        TotalsSink(map<int, long long> & out) : m_out(out) {
+        }
+        virtual bool consume(const KeyPressRow *rows, size_t n) {
+            for(size_t i = 0; i < n; i++)
+                m_out[rows[i].appGroup] += rows[i].count;
+            return true;
+        }
+    };
+
+    bool Storage::totals(int from, int to, map<int, long long> & out) {
+        TotalsSink sink(out);
+        return scanRange(from, to, sink);
+    }
 }
@@ -31,9 +31,33 @@
 #define KEYFROGSTORAGE_H
 
 #include "Configuration.h"
+#include "KeyHistogram.h"
+#include "IntervalHistogram.h"
+#include "Sessionizer.h"
 #include <string>
+#include <map>
+#include <utility>
+#include <cstddef>
 
 namespace keyfrog {
+    /// One row of keypress history
+    struct KeyPressRow {
+        int clusterBegin;
+        int appGroup;
+        int count;
+    };
+
+    /**
+     * Receives rows of a Storage scan in batches
+     */
+    class KeyPressSink {
+        public:
+            /// Gets next batch of rows; returning false stops the scan
+            virtual bool consume(const KeyPressRow *rows, size_t n) = 0;
+
+            virtual ~KeyPressSink() {}
+    };
+
     /**
      * @author Sebastian Gniazdowski <srnt at users dot sf dot net>
      *
@@ -44,6 +68,21 @@ namespace keyfrog {
             virtual bool connect(std::string uri) = 0;
             virtual void disconnect() = 0;
 
+            /** 
+             * @brief Opens existing storage for reading only (cluster size is taken from it)
+             */
+            virtual bool connectReadOnly(std::string uri);
+
+            /** 
+             * @brief Sets width of cluster in seconds (call before connect)
+             */
+            virtual void setClusterSize(int seconds) = 0;
+
+            /** 
+             * @brief Width of cluster in seconds
+             */
+            virtual int clusterSize() = 0;
+
             /** 
              * @brief Gets begining of  cluster timestamp for given timestamp
              */
@@ -59,6 +98,123 @@ namespace keyfrog {
              * @brief Records keypress event at given time
              */
             virtual bool addKeyPress(int app_group, int timestamp, int count = 1) = 0;
+
+            /** 
+             * @brief Adds key histogram to the one of cluster containing timestamp
+             *
+             * Backends without histogram store ignore it.
+             */
+            virtual bool addKeyHistogram(int app_group, int timestamp, const KeyHistogram & histogram);
+
+            /** 
+             * @brief Adds active typing time to the one of cluster containing timestamp
+             *
+             * Backends without active time store ignore it.
+             */
+            virtual bool addActiveTime(int app_group, int timestamp, const ActiveTime & active);
+
+            /** 
+             * @brief Adds inter-key intervals to the histogram of cluster containing timestamp
+             *
+             * Backends without histogram store ignore them.
+             */
+            virtual bool addIntervalHistogram(int app_group, int timestamp, const IntervalHistogram & histogram);
+
+            /** 
+             * @brief Adds keypresses of one seat (X display) to its count in cluster containing timestamp
+             *
+             * Comes on top of addKeyPress(), which counts all seats
+             * together. Backends without per seat store ignore it.
+             */
+            virtual bool addSeatKeyPresses(int seat, int app_group, int timestamp, int count);
+
+            /** 
+             * @brief Starts a batch of writes (one transaction if backend supports it)
+             */
+            virtual bool beginBatch();
+
+            /** 
+             * @brief Makes writes done since beginBatch() durable
+             */
+            virtual bool commitBatch();
+
+            /** 
+             * @brief Discards writes done since beginBatch(), after one of them failed
+             */
+            virtual void abortBatch();
+
+            /** 
+             * @brief Does next piece of maintenance (compaction, vacuum), taking about given time
+             * @return true while current maintenance cycle is unfinished
+             */
+            virtual bool compact(int milliseconds);
+
+            /** 
+             * @brief Deletes next bounded piece of data past retention, apart from compaction
+             * @return true while there is more to delete
+             */
+            virtual bool expire();
+
+            /*
+             * Read API. Methods return false if backend cannot read its
+             * data (or sink stopped the scan).
+             */
+
+            /** 
+             * @brief Passes rows of clusters beginning in [from, to) to sink, ordered by ( cluster_begin, app_group )
+             */
+            virtual bool scanRange(int from, int to, KeyPressSink & sink);
+
+            /** 
+             * @brief Passes rows of one group in [from, to) to sink, ordered by cluster_begin
+             */
+            virtual bool scanGroupRange(int app_group, int from, int to, KeyPressSink & sink);
+
+            /** 
+             * @brief Adds keypresses of clusters beginning in [from, to) to per group sums
+             */
+            virtual bool totals(int from, int to, std::map<int, long long> & out);
+
+            /** 
+             * @brief Adds keypresses in [from, to) to sums per ( bucket start, group )
+             *
+             * Buckets are aligned on local time (see local_bucket_start()).
+             * @param app_group Only this group, or -1 for all groups
+             */
+            virtual bool series(int from, int to, int bucket, int app_group,
+                    std::map<std::pair<int, int>, long long> & out);
+
+            /** 
+             * @brief Adds key histograms of clusters beginning in [from, to) to out
+             * @param app_group Only this group, or -1 for all groups
+             */
+            virtual bool keyHistogram(int from, int to, int app_group, KeyHistogram & out);
+
+            /** 
+             * @brief Adds active time per group of clusters beginning in [from, to) to out
+             */
+            virtual bool activeTime(int from, int to, std::map<int, ActiveTime> & out);
+
+            /** 
+             * @brief Adds interval histograms of clusters beginning in [from, to) to out
+             * @param app_group Only this group, or -1 for all groups
+             */
+            virtual bool intervalHistogram(int from, int to, int app_group, IntervalHistogram & out);
+
+            /** 
+             * @brief Adds keypresses of clusters beginning in [from, to) to sums per ( seat, group )
+             */
+            virtual bool seatTotals(int from, int to, std::map<std::pair<int, int>, long long> & out);
+
+            virtual ~Storage() {}
+
+            /** 
+             * @brief Creates backend for given URI ( sqlite:path, tsfile:path or plain path for SQLite )
+             *
+             * @param location Receives the URI without scheme, to be passed to connect()
+             * @return New backend or NULL for unknown scheme
+             */
+            static Storage *create(const std::string & uri, std::string & location);
     };
 }
 #endif
@@ -0,0 +1,240 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "StorageJournal.h"
+#include "Debug.h"
+
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace keyfrog {
+
+    /// File header: magic + version, then read offset (zero in old files, it was padding)
+    static const char journalMagic[12] = { 'K', 'F', 'J', 'O', 'U', 'R', 'N', 'A', 'L', 0, 0, 1 };
+    static const size_t journalHeadOffset = sizeof(journalMagic);
+    static const size_t journalHeaderSize = sizeof(StorageJournal::Record);
+    /// Initial file size: 64k records (1 MB)
+    static const size_t journalInitialRecords = 64 * 1024;
+
+    StorageJournal::StorageJournal() : m_fd(-1), m_map(NULL), m_mapSize(0),
+        m_records(NULL), m_head(0), m_used(0), m_capacity(0) {
+    }
+
+    StorageJournal::~StorageJournal() {
+        close();
+    }
+
+    /**
+     * Record is valid when its check field matches. The file is zero
+     * filled, so the first invalid record marks the end of journal.
+     */
+    uint32_t StorageJournal::checksum(const Record & rec) {
+        uint32_t h = 0x4b464a31;
+        h = (h ^ (uint32_t) rec.clusterBegin) * 0x01000193;
+        h = (h ^ (uint32_t) rec.appGroup) * 0x01000193;
+        h = (h ^ (uint32_t) rec.count) * 0x01000193;
+        return h ? h : 1;
+    }
+
+    /**
+     * Maps the file with given size (file is extended if needed)
+     */
+    bool StorageJournal::map(size_t size) {
+        if(-1 == ftruncate(m_fd, size)) {
+            _dbg("ftruncate(%s) failed", m_path.c_str());
+            return false;
+        }
+        void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if(addr == MAP_FAILED) {
+            _dbg("mmap(%s) failed", m_path.c_str());
+            return false;
+        }
+        m_map = (char *) addr;
+        m_mapSize = size;
+        m_records = (Record *) (m_map + journalHeaderSize);
+        m_capacity = (m_mapSize - journalHeaderSize) / sizeof(Record);
+        return true;
+    }
+
+    /**
+     * Doubles the file. This is the only place where append() does
+     * system calls.
+     */
+    bool StorageJournal::grow() {
+        size_t newSize = journalHeaderSize + 2 * m_capacity * sizeof(Record);
+        munmap(m_map, m_mapSize);
+        m_map = NULL;
+        if(!map(newSize)) {
+            ::close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        _dbg("Journal grown to %d records", (int) m_capacity);
+        return true;
+    }
+
+    bool StorageJournal::open(const string & path) {
+        close();
+        m_path = path;
+        m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT, 0600);
+        if(m_fd == -1) {
+            _dbg("Could not open journal `%s'", m_path.c_str());
+            return false;
+        }
+
+        struct stat st;
+        if(-1 == fstat(m_fd, &st)) {
+            close();
+            return false;
+        }
+
+        size_t size = journalHeaderSize + journalInitialRecords * sizeof(Record);
+        if((size_t) st.st_size > size)
+            size = st.st_size;
+        if(!map(size)) {
+            close();
+            return false;
+        }
+
+        // Fresh file or unknown format -- start from scratch
+        if(0 != memcmp(m_map, journalMagic, sizeof(journalMagic))) {
+            memset(m_map, 0, m_mapSize);
+            memcpy(m_map, journalMagic, sizeof(journalMagic));
+        }
+
+        uint32_t head;
+        memcpy(&head, m_map + journalHeadOffset, sizeof(head));
+        m_head = head;
+        if(m_head > m_capacity) {
+            _err("Journal `%s' has bad read offset, starting from scratch", m_path.c_str());
+            memset(m_records, 0, m_capacity * sizeof(Record));
+            m_head = 0;
+            writeHead();
+        }
+
+        // Find end of valid records, those before head are committed
+        m_used = m_head;
+        while(m_used < m_capacity && m_records[m_used].check == checksum(m_records[m_used]) &&
+                m_records[m_used].check != 0) {
+            m_used++;
+        }
+        // Anything after a torn record is garbage
+        if(m_used < m_capacity) {
+            memset(m_records + m_used, 0, (m_capacity - m_used) * sizeof(Record));
+        }
+        _dbg("Journal `%s' opened, %d records to replay", m_path.c_str(), (int) (m_used - m_head));
+        return true;
+    }
+
+    void StorageJournal::close() {
+        if(m_map) {
+            msync(m_map, m_mapSize, MS_SYNC);
+            munmap(m_map, m_mapSize);
+            m_map = NULL;
+        }
+        if(m_fd != -1) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        m_records = NULL;
+        m_head = m_used = m_capacity = m_mapSize = 0;
+    }
+
+    bool StorageJournal::append(int cluster_begin, int app_group, int count) {
+        if(m_map == NULL)
+            return false;
+        if(m_used == m_capacity && !grow())
+            return false;
+        Record & rec = m_records[m_used];
+        rec.clusterBegin = cluster_begin;
+        rec.appGroup = app_group;
+        rec.count = count;
+        // Check field goes last, it validates the record
+        rec.check = checksum(rec);
+        m_used++;
+        return true;
+    }
+
+    bool StorageJournal::sync() {
+        if(m_map == NULL)
+            return false;
+        return 0 == msync(m_map, journalHeaderSize + m_used * sizeof(Record), MS_SYNC);
+    }
+
+    void StorageJournal::writeHead() {
+        uint32_t head = m_head;
+        memcpy(m_map + journalHeadOffset, &head, sizeof(head));
+    }
+
+    /**
+     * Discarding only moves the read offset, which is a single
+     * aligned store
+     */
+    void StorageJournal::discard(size_t n) {
+        if(m_map == NULL)
+            return;
+        if(n > size())
+            n = size();
+        m_head += n;
+        writeHead();
+        compact();
+    }
+
+    /**
+     * Once half of the journal is discarded, records left are copied
+     * to the front. The copy only overwrites discarded records and is
+     * followed by an invalid one, and it is synced before the read
+     * offset goes back to zero; the stale records behind it are then
+     * cleared and synced before any append can make them reachable.
+     */
+    void StorageJournal::compact() {
+        size_t left = m_used - m_head;
+        if(m_head < m_capacity / 2 || left >= m_head)
+            return;
+        memcpy(m_records, m_records + m_head, left * sizeof(Record));
+        memset(m_records + left, 0, sizeof(Record));
+        msync(m_map, journalHeaderSize + (left + 1) * sizeof(Record), MS_SYNC);
+        m_head = 0;
+        writeHead();
+        msync(m_map, journalHeaderSize, MS_SYNC);
+        memset(m_records + left + 1, 0, (m_used - left - 1) * sizeof(Record));
+        msync(m_map, journalHeaderSize + m_used * sizeof(Record), MS_SYNC);
+        m_used = left;
+        _dbg("Journal compacted, %d records left", (int) left);
+    }
+}
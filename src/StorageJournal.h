@@ -0,0 +1,115 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGSTORAGEJOURNAL_H
+#define KEYFROGSTORAGEJOURNAL_H
+
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace keyfrog {
+
+    /**
+     * Append-only, memory mapped journal of keypress deltas.
+     *
+     * Records are written straight into the mapping, so appending costs
+     * no system call (except for the rare growth of the file). The file
+     * is synced periodically and the already committed head is discarded
+     * after every successful commit to the real storage, by advancing
+     * the read offset kept in the header. Records are never moved while
+     * the offset points at them, so a crash at any moment leaves either
+     * the old or the new head. What is left in the file on startup has
+     * to be replayed into the storage.
+     *
+     * Delivery is at-least-once: a crash between the storage commit and
+     * discard() replays the last batch a second time.
+     */
+    class StorageJournal {
+        public:
+        /// One delta, 16 bytes so that records never straddle a page
+        struct Record {
+            int32_t clusterBegin;
+            int32_t appGroup;
+            int32_t count;
+            uint32_t check;
+        };
+
+        private:
+        std::string m_path;
+        int m_fd;
+        /// Mapped file; records start right after the header
+        char *m_map;
+        size_t m_mapSize;
+        Record *m_records;
+        /// Index of first record not discarded yet
+        size_t m_head;
+        /// Number of valid records (including discarded ones)
+        size_t m_used;
+        /// Number of records that fit into the mapping
+        size_t m_capacity;
+
+        bool map(size_t size);
+        bool grow();
+        /// Stores m_head into the header and syncs it
+        void writeHead();
+        /// Moves records to the front when the head is far enough
+        void compact();
+        static uint32_t checksum(const Record & rec);
+
+        public:
+        StorageJournal();
+        ~StorageJournal();
+
+        /// Opens (creates) journal file, finds valid records left by previous run
+        bool open(const std::string & path);
+
+        /// Unmaps and closes the file
+        void close();
+
+        bool isOpen() const { return m_map != NULL; }
+
+        /// Appends delta (hot path)
+        bool append(int cluster_begin, int app_group, int count);
+
+        /// Flushes mapping to disk
+        bool sync();
+
+        /// Drops first n records
+        void discard(size_t n);
+
+        /// Number of records in journal
+        size_t size() const { return m_used - m_head; }
+
+        /// Returns i-th record
+        const Record & record(size_t i) const { return m_records[m_head + i]; }
+    };
+}
+
+#endif
@@ -33,13 +33,10 @@
 
 #include "StorageManager.h"
 #include "Debug.h"
-#include <sstream>
 #include <ctime>
-#include <vector>
+#include <algorithm>
 #include <boost/version.hpp>
 #include <boost/thread/xtime.hpp>
-#include <boost/algorithm/string.hpp>
-#include <boost/lexical_cast.hpp>
 
 #if BOOST_VERSION >= 105000
 #define THE_TIME_UTC boost::TIME_UTC_
@@ -47,70 +44,299 @@
 #define THE_TIME_UTC boost::TIME_UTC
 #endif
 
-// TODO:
-// - reduce dependencies (sstream? boost/string? vector?)
-// - choose one way to do things
-
 using namespace std;
 
 namespace keyfrog {
 
     // Commiter (works in thread)
     void StorageManager::StorageManagerCommiter::operator()() {
+        int sinceSync = 0, sinceCommit = 0;
         while(1) {
             xtime_get(&m_xt, THE_TIME_UTC);
-            m_xt.sec += 5;
+            m_xt.sec += 1;
             boost::thread::sleep(m_xt);
 
-            map<string,int> localcache;
-            // Get actual cache snapshot
-            {
+            // Journal group commit -- cheap, so done more often than real commit
+            if(++sinceSync >= m_owner->m_journalSyncInterval) {
+                sinceSync = 0;
                 boost::mutex::scoped_lock lock(m_owner->m_cache_mutex);
-                localcache = m_owner->m_cache;
-                m_owner->m_cache.clear();
+                m_owner->m_journal.sync();
             }
 
-            // Iterate through all cached key presses and send them to real storage
-            for( map<string,int>::iterator it = localcache.begin(); it != localcache.end(); it++) {
-                // Convert string "{app_group}_{timestamp}" to two numbers
-                vector<string> result;
-                split(result, it->first, boost::is_any_of("_"));
-
-                int cluster_begin = boost::lexical_cast<int>(result[0]);
-                int app_group = boost::lexical_cast<int>(result[1]);
-
-                // Now propagate those parameters to real storage
-                m_owner->m_backend->addKeyPress(app_group, cluster_begin, it->second);
+            if(++sinceCommit >= m_owner->m_commitInterval) {
+                sinceCommit = 0;
+                m_owner->commit();
             }
 
-            _dbg("Committed");
+            m_owner->compactWhenIdle();
+            m_owner->expireOnSchedule();
         }
     }
 
-    StorageManager::StorageManager(Storage *backend) {
+    StorageManager::StorageManager(Storage *backend) : m_commitInterval(5), m_journalSyncInterval(5),
+        m_dayBegin(0), m_dayEnd(0), m_recent(60, 24 * 60, 32), m_history(1, 4 * 3600, 16), m_historyHours(4), m_changes(0),
+        m_compactionIdle(60), m_compactionChanges(0), m_lastActivity(time(NULL)), m_nextCompaction(0), m_nextExpiry(0), m_commiter(NULL), m_commiterThread(NULL)
+    {
         // Object that will do real writes
         m_backend = backend;
+    }
 
-        // Create commiter
-        m_commiter = new StorageManagerCommiter(this);
 
-        // Create thread
-        m_commiterThread = new boost::thread(*m_commiter);
+    /**
+     * Stops commiter thread; sleep is its only interruption point,
+     * so a commit in progress is finished first
+     */
+    StorageManager::~StorageManager() {
+        if(m_commiterThread) {
+            m_commiterThread->interrupt();
+            m_commiterThread->join();
+            delete m_commiterThread;
+            delete m_commiter;
+        }
     }
 
+    /** 
+     * Iterates through all cached key presses and sends them to
+     * real storage in one batch. Journal is truncated only after
+     * the batch is durable. Whole commit runs under m_commit_mutex,
+     * so a flush() can't interleave its batch with the commiter's.
+     */
+    bool StorageManager::commit() {
+        boost::mutex::scoped_lock commitLock(m_commit_mutex);
+        map<CacheKey,int> localcache;
+        map<CacheKey,KeyHistogram> localkeys;
+        map<CacheKey,ActiveTime> localactive;
+        map<CacheKey,IntervalHistogram> localintervals;
+        map<SeatKey,int> localseats;
+        size_t journaled;
+        // Get actual cache snapshot
+        {
+            boost::mutex::scoped_lock lock(m_cache_mutex);
+            localcache.swap(m_cache);
+            localkeys.swap(m_keyCache);
+            localactive.swap(m_activeCache);
+            localintervals.swap(m_intervalCache);
+            localseats.swap(m_seatCache);
+            journaled = m_journal.size();
+        }
+        if(localcache.empty() && localkeys.empty() && localactive.empty() && localintervals.empty() && localseats.empty())
+            return true;
 
-    StorageManager::~StorageManager() {
+        bool begun = m_backend->beginBatch();
+        bool ok = begun;
+        for( map<CacheKey,int>::iterator it = localcache.begin(); ok && it != localcache.end(); it++) {
+            // Now propagate those parameters to real storage
+            ok = m_backend->addKeyPress(it->first.second, it->first.first, it->second);
+        }
+        for( map<CacheKey,KeyHistogram>::iterator it = localkeys.begin(); ok && it != localkeys.end(); it++) {
+            ok = m_backend->addKeyHistogram(it->first.second, it->first.first, it->second);
+        }
+        for( map<CacheKey,ActiveTime>::iterator it = localactive.begin(); ok && it != localactive.end(); it++) {
+            ok = m_backend->addActiveTime(it->first.second, it->first.first, it->second);
+        }
+        for( map<CacheKey,IntervalHistogram>::iterator it = localintervals.begin(); ok && it != localintervals.end(); it++) {
+            ok = m_backend->addIntervalHistogram(it->first.second, it->first.first, it->second);
+        }
+        for( map<SeatKey,int>::iterator it = localseats.begin(); ok && it != localseats.end(); it++) {
+            ok = m_backend->addSeatKeyPresses(it->first.second, it->first.first.second, it->first.first.first, it->second);
+        }
+        // A failed write leaves the batch open; it must not stay so
+        if(ok)
+            ok = m_backend->commitBatch();
+        else if(begun)
+            m_backend->abortBatch();
+
+        boost::mutex::scoped_lock lock(m_cache_mutex);
+        if(ok) {
+            m_journal.discard(journaled);
+            _dbg("Committed");
+        } else {
+            // Keep the counts, next commit will retry them
+            for( map<CacheKey,int>::iterator it = localcache.begin(); it != localcache.end(); it++) {
+                m_cache[it->first] += it->second;
+            }
+            for( map<CacheKey,KeyHistogram>::iterator it = localkeys.begin(); it != localkeys.end(); it++) {
+                m_keyCache[it->first].merge(it->second);
+            }
+            for( map<CacheKey,ActiveTime>::iterator it = localactive.begin(); it != localactive.end(); it++) {
+                m_activeCache[it->first].merge(it->second);
+            }
+            for( map<CacheKey,IntervalHistogram>::iterator it = localintervals.begin(); it != localintervals.end(); it++) {
+                m_intervalCache[it->first].merge(it->second);
+            }
+            for( map<SeatKey,int>::iterator it = localseats.begin(); it != localseats.end(); it++) {
+                m_seatCache[it->first] += it->second;
+            }
+            _dbg("Commit failed, %d entries kept for retry", (int) localcache.size());
+        }
+        return ok;
+    }
+
+    /// Time of one compaction slice, milliseconds
+    static const int compactionSlice = 50;
+    /// Pause between compaction cycles, seconds
+    static const int compactionPause = 6 * 3600;
+    /// Pause between expiry runs outside compaction, seconds
+    static const int expiryPause = 3600;
+
+    /** 
+     * Runs in commiter thread, between commits. Keypresses only wait
+     * for m_cache_mutex, which is not held here.
+     */
+    void StorageManager::compactWhenIdle() {
+        unsigned long changes;
+        {
+            boost::mutex::scoped_lock lock(m_cache_mutex);
+            changes = m_changes;
+        }
+        time_t now = time(NULL);
+        if(changes != m_compactionChanges) {
+            m_compactionChanges = changes;
+            m_lastActivity = now;
+            return;
+        }
+        if(m_compactionIdle <= 0 || now - m_lastActivity < m_compactionIdle || now < m_nextCompaction)
+            return;
+        boost::mutex::scoped_lock commitLock(m_commit_mutex);
+        if(!m_backend->compact(compactionSlice))
+            m_nextCompaction = now + compactionPause;
+    }
+
+    /** 
+     * One step (a week of clusters) per commiter tick until nothing is
+     * left, then wait for next period. Idle compaction expires too;
+     * this covers compaction idle="0" and users who never pause.
+     */
+    void StorageManager::expireOnSchedule() {
+        time_t now = time(NULL);
+        if(now < m_nextExpiry)
+            return;
+        boost::mutex::scoped_lock commitLock(m_commit_mutex);
+        if(!m_backend->expire())
+            m_nextExpiry = now + expiryPause;
+    }
+
+    /** 
+     * Sends deltas left by previous run to backend
+     */
+    bool StorageManager::replayJournal() {
+        if(m_journal.size() == 0)
+            return true;
+        bool begun = m_backend->beginBatch();
+        bool ok = begun;
+        for(size_t i = 0; ok && i < m_journal.size(); i++) {
+            const StorageJournal::Record & rec = m_journal.record(i);
+            ok = m_backend->addKeyPress(rec.appGroup, rec.clusterBegin, rec.count);
+        }
+        if(ok)
+            ok = m_backend->commitBatch();
+        else if(begun)
+            m_backend->abortBatch();
+        if(ok) {
+            _dbg("Replayed %d journal records", (int) m_journal.size());
+            m_journal.discard(m_journal.size());
+            m_journal.sync();
+        }
+        return ok;
+    }
+
+    /** 
+     * Day boundaries are local midnights, as in daily rollups
+     */
+    void StorageManager::startDay(int timestamp) {
+        if(timestamp < m_dayEnd)
+            return;
+        time_t t = timestamp;
+        struct tm tm;
+        localtime_r(&t, &tm);
+        tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+        tm.tm_isdst = -1;
+        m_dayBegin = mktime(&tm);
+        tm.tm_mday++;
+        tm.tm_isdst = -1;
+        m_dayEnd = mktime(&tm);
+        m_dayTotals.clear();
+        m_seatDayTotals.clear();
+    }
+
+    int StorageManager::dayTotals(map<int, long long> & out) {
+        boost::mutex::scoped_lock lock(m_cache_mutex);
+        startDay(time(NULL));
+        out = m_dayTotals;
+        return m_dayBegin;
+    }
+
+    int StorageManager::seatDayTotals(map<pair<int, int>, long long> & out) {
+        boost::mutex::scoped_lock lock(m_cache_mutex);
+        startDay(time(NULL));
+        out = m_seatDayTotals;
+        return m_dayBegin;
+    }
+
+    void StorageManager::recentTotals(int seconds, map<int, long long> & out) {
+        int now = time(NULL);
+        boost::mutex::scoped_lock lock(m_cache_mutex);
+        m_recent.totals(now - seconds + 1, now + 1, out);
+    }
+
+    void StorageManager::setHistoryHours(int hours) {
+        boost::mutex::scoped_lock lock(m_cache_mutex);
+        m_historyHours = hours > 0 ? hours : 0;
+        m_history.reset(1, m_historyHours ? m_historyHours * 3600 : 1, 16);
+    }
+
+    void StorageManager::history(int seconds, int step, map<pair<int, int>, long long> & out) {
+        int now = time(NULL);
+        boost::mutex::scoped_lock lock(m_cache_mutex);
+        m_history.series(now - seconds + 1, now + 1, step, out);
+    }
+
+    bool StorageManager::saveHistory(const string & path) {
+        boost::mutex::scoped_lock lock(m_cache_mutex);
+        return m_historyHours && m_history.save(path);
+    }
+
+    bool StorageManager::loadHistory(const string & path) {
+        boost::mutex::scoped_lock lock(m_cache_mutex);
+        return m_historyHours && m_history.load(path);
     }
 
     bool StorageManager::connect(std::string uri) {
-        m_backend->connect(uri);
-        return true;
+        bool ok = m_backend->connect(uri);
+        if(ok && !m_journalPath.empty() && m_journal.open(m_journalPath)) {
+            replayJournal();
+        }
+
+        // Committed part of today's totals, live keypresses are added to it
+        if(ok) {
+            boost::mutex::scoped_lock lock(m_cache_mutex);
+            startDay(time(NULL));
+            if(!m_backend->totals(m_dayBegin, m_dayEnd, m_dayTotals))
+                _dbg("Backend can't sum keypresses, day totals start from zero");
+            if(!m_backend->seatTotals(m_dayBegin, m_dayEnd, m_seatDayTotals))
+                _dbg("Backend keeps no seats, seat totals start from zero");
+        }
+
+        // Create commiter and its thread
+        if(m_commiterThread == NULL) {
+            m_commiter = new StorageManagerCommiter(this);
+            m_commiterThread = new boost::thread(*m_commiter);
+        }
+        return ok;
     }
 
     void StorageManager::disconnect() {
         m_backend->disconnect();
     }
 
+    void StorageManager::setClusterSize(int seconds) {
+        m_backend->setClusterSize(seconds);
+    }
+
+    int StorageManager::clusterSize() {
+        return m_backend->clusterSize();
+    }
+
     // FIXME: cluster calculation should be outside Storage interface?
     int StorageManager::getClusterStart(int timestamp) {
         return m_backend->getClusterStart(timestamp);
@@ -122,16 +348,69 @@ namespace keyfrog {
     }
 
     /** 
-     * Fake addKeyPress method. It only caches given key press.
+     * Fake addKeyPress method. It only caches given key press
+     * (and journals it, which involves no system call).
      */
     bool StorageManager::addKeyPress(int app_group, int timestamp, int count) {
-        stringstream stream;
-        int begin_cluster = m_backend->getClusterStart(timestamp);
-        stream << app_group << "_" << begin_cluster;
+        CacheKey key(m_backend->getClusterStart(timestamp), app_group);
         boost::mutex::scoped_lock lock(m_cache_mutex);
         // Add count
-        m_cache[stream.str()]  += count;
-        _dbg("+=%d, m_cache(%s) is now: %d", count, stream.str().c_str(), m_cache[stream.str()]);
+        int & cached = m_cache[key];
+        cached += count;
+        m_journal.append(key.first, key.second, count);
+        m_recent.add(app_group, timestamp, count);
+        if(m_historyHours)
+            m_history.add(app_group, timestamp, count);
+        m_changes++;
+        startDay(timestamp);
+        if(timestamp >= m_dayBegin)
+            m_dayTotals[app_group] += count;
+        _dbg("+=%d, m_cache(%d_%d) is now: %d", count, key.first, key.second, cached);
+        return true;
+    }
+
+    bool StorageManager::addKeyStroke(int app_group, unsigned keycode, unsigned modifiers) {
+        return addKeyStroke(app_group, time(NULL), keycode, modifiers);
+    }
+
+    bool StorageManager::addKeyStroke(int app_group, int timestamp, unsigned keycode, unsigned modifiers) {
+        addKeyPress(app_group, timestamp, 1);
+        CacheKey key(m_backend->getClusterStart(timestamp), app_group);
+        boost::mutex::scoped_lock lock(m_cache_mutex);
+        m_keyCache[key].add(keycode, modifiers);
+        return true;
+    }
+
+    bool StorageManager::addActiveTime(int app_group, int timestamp, uint32_t milliseconds, bool newSession) {
+        long long end = (long long) timestamp * 1000;
+        long long begin = end - milliseconds;
+        boost::mutex::scoped_lock lock(m_cache_mutex);
+        if(newSession)
+            m_activeCache[CacheKey(m_backend->getClusterStart(timestamp), app_group)].sessions ++;
+        // Walk back from timestamp, cluster by cluster
+        while(end > begin) {
+            int cluster = m_backend->getClusterStart((int) ((end - 1) / 1000));
+            long long from = max(begin, (long long) cluster * 1000);
+            m_activeCache[CacheKey(cluster, app_group)].milliseconds += end - from;
+            end = from;
+        }
+        return true;
+    }
+
+    bool StorageManager::addInterval(int app_group, int timestamp, uint32_t milliseconds) {
+        CacheKey key(m_backend->getClusterStart(timestamp), app_group);
+        boost::mutex::scoped_lock lock(m_cache_mutex);
+        m_intervalCache[key].add(milliseconds);
+        return true;
+    }
+
+    bool StorageManager::addSeatKeyPresses(int seat, int app_group, int timestamp, int count) {
+        CacheKey key(m_backend->getClusterStart(timestamp), app_group);
+        boost::mutex::scoped_lock lock(m_cache_mutex);
+        m_seatCache[SeatKey(key, seat)] += count;
+        startDay(timestamp);
+        if(timestamp >= m_dayBegin)
+            m_seatDayTotals[make_pair(seat, app_group)] += count;
         return true;
     }
 }
@@ -31,7 +31,10 @@
 #define KEYFROGSTORAGEMANAGER_H
 
 #include "Storage.h"
+#include "StorageJournal.h"
+#include "CountRing.h"
 #include <map>
+#include <utility>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/xtime.hpp>
 
@@ -51,19 +54,96 @@ namespace keyfrog {
             void operator()();
         };
 
+        /// ( cluster_begin, app_group )
+        typedef std::pair<int, int> CacheKey;
+
         /**
-         * Maps string cluster_begin + "_" + app_group to number of keys pressed
+         * Maps ( cluster_begin, app_group ) to number of keys pressed
          * Idea: remember last used entry because they are used in series?
          */
-        std::map<std::string, int> m_cache;
+        std::map<CacheKey, int> m_cache;
+
+        /**
+         * Key histograms of uncommitted clusters. Entries are created
+         * once per cluster, keystrokes only increment counters. Not
+         * journaled: a crash loses histograms of last commit interval.
+         */
+        std::map<CacheKey, KeyHistogram> m_keyCache;
+
+        /// Active typing time of uncommitted clusters (not journaled either)
+        std::map<CacheKey, ActiveTime> m_activeCache;
+
+        /// Inter-key intervals of uncommitted clusters, about 1 kB per entry
+        std::map<CacheKey, IntervalHistogram> m_intervalCache;
+
+        /// ( ( cluster_begin, app_group ), seat )
+        typedef std::pair<CacheKey, int> SeatKey;
 
-        /// Synchronizes access to m_cache
+        /// Keypresses per seat of uncommitted clusters (not journaled either)
+        std::map<SeatKey, int> m_seatCache;
+
+        /// Synchronizes access to m_cache, m_keyCache, m_activeCache, m_intervalCache, m_seatCache and m_journal
         boost::mutex m_cache_mutex;
 
+        /// Serializes backend writes of commiter thread and flush(), taken before m_cache_mutex
+        boost::mutex m_commit_mutex;
+
+        /// Crash-safe copy of m_cache
+        StorageJournal m_journal;
+        std::string m_journalPath;
+
+        /// Seconds between commits to backend
+        int m_commitInterval;
+
+        /// Seconds between journal syncs
+        int m_journalSyncInterval;
+
+        /// Keypresses of current local day, committed and pending
+        std::map<int, long long> m_dayTotals;
+        /// The same per ( seat, group )
+        std::map<std::pair<int, int>, long long> m_seatDayTotals;
+        int m_dayBegin;
+        int m_dayEnd;
+
+        /// Keypresses of last day at minute resolution
+        CountRing m_recent;
+
+        /// Keypresses of last hours at second resolution (0 hours - off)
+        CountRing m_history;
+        int m_historyHours;
+
+        /// Number of addKeyPress() calls, lets readers skip unchanged state
+        unsigned long m_changes;
+
+        /// Seconds without keypresses before backend is compacted (0 - never)
+        int m_compactionIdle;
+        /// m_changes seen by commiter and when it last changed
+        unsigned long m_compactionChanges;
+        time_t m_lastActivity;
+        /// No compaction before this time (a cycle has just finished)
+        time_t m_nextCompaction;
+        /// Next time old rows are expired outside of compaction
+        time_t m_nextExpiry;
+
+        /// Moves m_dayTotals to the day of timestamp if it's a later one
+        void startDay(int timestamp);
+
+        /// Sends cache to backend, returns false if backend failed
+        bool commit();
+
+        /// Gives backend a slice of time for compaction when user is idle
+        void compactWhenIdle();
+
+        /// Expires old rows in backend every few hours, idle or not
+        void expireOnSchedule();
+
+        /// Writes records left in journal to backend
+        bool replayJournal();
+
         /// Commiter funobj
         StorageManagerCommiter *m_commiter;
 
-        /// Commiter thread
+        /// Commiter thread (started by connect)
         boost::thread *m_commiterThread;
 
         Storage *m_backend;
@@ -71,6 +151,48 @@ namespace keyfrog {
         StorageManager(Storage *backend);
         ~StorageManager();
 
+        /// Sends cached keypresses to backend now
+        bool flush() { return commit(); }
+
+        /// Journal file; empty path disables journal (call before connect)
+        void setJournalPath(const std::string & path) { m_journalPath = path; }
+
+        void setCommitInterval(int seconds) { m_commitInterval = seconds > 0 ? seconds : 1; }
+        int commitInterval() const { return m_commitInterval; }
+
+        void setJournalSyncInterval(int seconds) { m_journalSyncInterval = seconds > 0 ? seconds : 1; }
+        int journalSyncInterval() const { return m_journalSyncInterval; }
+
+        void setCompactionIdle(int seconds) { m_compactionIdle = seconds; }
+        int compactionIdle() const { return m_compactionIdle; }
+
+        /// Per group keypresses of current local day, including uncommitted ones
+        /// @return Start of the day
+        int dayTotals(std::map<int, long long> & out);
+
+        /// Per ( seat, group ) keypresses of current local day, including uncommitted ones
+        /// @return Start of the day
+        int seatDayTotals(std::map<std::pair<int, int>, long long> & out);
+
+        /// Hours kept by per-second history, up to 16 groups (4 hours take about 1 MB)
+        void setHistoryHours(int hours);
+        int historyHours() const { return m_historyHours; }
+
+        /// Per second keypresses of last given seconds, summed per ( step start, group )
+        void history(int seconds, int step, std::map<std::pair<int, int>, long long> & out);
+
+        /// Stores per-second history in file
+        bool saveHistory(const std::string & path);
+
+        /// Restores history stored by saveHistory()
+        bool loadHistory(const std::string & path);
+
+        /// Grows with every recorded keypress
+        unsigned long changes() const { return m_changes; }
+
+        /// Per group keypresses of last given seconds (at most a day), from memory
+        void recentTotals(int seconds, std::map<int, long long> & out);
+
         /** 
          * @brief Connects to given database
          */
@@ -81,6 +203,16 @@ namespace keyfrog {
          */
         virtual void disconnect();
 
+        /** 
+         * @brief Sets width of cluster in backend
+         */
+        virtual void setClusterSize(int seconds);
+
+        /** 
+         * @brief Width of cluster in backend
+         */
+        virtual int clusterSize();
+
         /** 
          * @brief Gets begining of  cluster timestamp for given timestamp
          */
@@ -95,6 +227,33 @@ namespace keyfrog {
          * @brief Records keypresses at given time
          */
         virtual bool addKeyPress(int app_group, int timestamp, int count = 1);
+
+        /** 
+         * @brief Records keypress at actual time together with its keycode and modifiers
+         */
+        bool addKeyStroke(int app_group, unsigned keycode, unsigned modifiers);
+
+        /** 
+         * @brief Records keypress at given time together with its keycode and modifiers
+         */
+        bool addKeyStroke(int app_group, int timestamp, unsigned keycode, unsigned modifiers);
+
+        /** 
+         * @brief Records active time ending at given time (from Sessionizer)
+         *
+         * Time reaching into earlier clusters is split among them.
+         */
+        bool addActiveTime(int app_group, int timestamp, uint32_t milliseconds, bool newSession);
+
+        /** 
+         * @brief Records interval between two keypresses, ending at given time
+         */
+        bool addInterval(int app_group, int timestamp, uint32_t milliseconds);
+
+        /** 
+         * @brief Records keypresses of one seat, on top of addKeyPress() or addKeyStroke()
+         */
+        virtual bool addSeatKeyPresses(int seat, int app_group, int timestamp, int count);
     };
 }
 
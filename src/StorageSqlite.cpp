@@ -32,20 +32,124 @@
 #endif
 
 #include "StorageSqlite.h"
+#include "Common.h"
 #include "Debug.h"
 #include <ctime>
+#include <cstdlib>
+#include <algorithm>
 #include <exception>
+#include <boost/lexical_cast.hpp>
 
 using namespace std;
 
 namespace keyfrog {
 
+    /// Rows passed to a KeyPressSink at once
+    static const size_t scanBatch = 1024;
+
+    /// Milliseconds to wait for a lock held by another connection
+    static const int busyTimeout = 5000;
+
+    /**
+     * Statements that live as long as the connection. SQLite is told so,
+     * where it knows how, to keep them out of its lookaside memory.
+     */
+    static int prepareLongLived(sqlite3 *db, const string & sql, sqlite3_stmt **stmt) {
+#if SQLITE_VERSION_NUMBER >= 3020000
+        return sqlite3_prepare_v3(db, sql.c_str(), sql.size(), SQLITE_PREPARE_PERSISTENT, stmt, NULL);
+#else
+        return sqlite3_prepare_v2(db, sql.c_str(), sql.size(), stmt, NULL);
+#endif
+    }
+
+    /// WITHOUT ROWID tables appeared in SQLite 3.8.2
+    static bool withoutRowidSupported() {
+        return sqlite3_libversion_number() >= 3008002;
+    }
+
+    /**
+     * Layout of keypresses table (and rollups). Since schema 2 rows are
+     * stored in primary key order, so that range scans read consecutive
+     * pages. Index name is used only by SQLite without WITHOUT ROWID.
+     */
+    static string keypressesSchema(const string & table, const string & index) {
+        if(!withoutRowidSupported()) {
+            return "CREATE TABLE " + table + " ( "
+                "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                "cluster_begin TIMESTAMP, "
+                "cluster_end TIMESTAMP, "
+                "count INTEGER, "
+                "app_group INTEGER "
+                "); "
+                "CREATE UNIQUE INDEX " + index + " "
+                "ON " + table + " ( cluster_begin, app_group ); ";
+        }
+        return "CREATE TABLE " + table + " ( "
+            "cluster_begin INTEGER NOT NULL, "
+            "app_group INTEGER NOT NULL, "
+            "cluster_end INTEGER, "
+            "count INTEGER, "
+            "PRIMARY KEY ( cluster_begin, app_group ) "
+            ") WITHOUT ROWID; ";
+    }
+
+    /**
+     * Rollup tables have the same layout as keypresses. Buckets follow
+     * local time, so that days and months match what user sees. The
+     * expressions take cluster time as parameter ?2.
+     */
+    static const struct {
+        const char *table;
+        const char *beginExpr;
+        const char *endExpr;
+    } rollups[StorageSqlite::rollupCount] = {
+        {
+            "keypresses_hourly",
+            "CAST(strftime('%s', strftime('%Y-%m-%d %H:00:00', ?2, 'unixepoch', 'localtime'), 'utc') AS INTEGER)",
+            "CAST(strftime('%s', strftime('%Y-%m-%d %H:00:00', ?2, 'unixepoch', 'localtime'), 'utc', '+1 hour') AS INTEGER)"
+        },
+        {
+            "keypresses_daily",
+            "CAST(strftime('%s', ?2, 'unixepoch', 'localtime', 'start of day', 'utc') AS INTEGER)",
+            "CAST(strftime('%s', ?2, 'unixepoch', 'localtime', 'start of day', '+1 day', 'utc') AS INTEGER)"
+        },
+        {
+            "keypresses_monthly",
+            "CAST(strftime('%s', ?2, 'unixepoch', 'localtime', 'start of month', 'utc') AS INTEGER)",
+            "CAST(strftime('%s', ?2, 'unixepoch', 'localtime', 'start of month', '+1 month', 'utc') AS INTEGER)"
+        }
+    };
+
     /** 
      * @brief Constructor
      */
-    StorageSqlite::StorageSqlite() {
+    StorageSqlite::StorageSqlite() : m_db(NULL), m_readOnly(false), m_hasRollups(false),
+        m_addKeyPress_insertStmt1(NULL), m_addKeyPress_updateStmt1(NULL), m_expireStmt(NULL),
+        m_keyHist_selectStmt(NULL), m_keyHist_replaceStmt(NULL), m_keyHist_expireStmt(NULL),
+        m_active_updateStmt(NULL), m_active_insertStmt(NULL), m_active_expireStmt(NULL),
+        m_interval_selectStmt(NULL), m_interval_replaceStmt(NULL), m_interval_expireStmt(NULL),
+        m_seat_updateStmt(NULL), m_seat_insertStmt(NULL), m_seat_expireStmt(NULL),
+        m_scanRangeStmt(NULL), m_scanGroupStmt(NULL), m_activeStmt(NULL), m_seatStmt(NULL), m_detailRetention(0), m_downsampleAge(0),
+        m_compactPhase(compactDownsample), m_compactCursor(-1)
+    {
         // Cluster of time that keys will be group by
         m_clusterSize = 15*60;
+        for(int i = 0; i < rollupCount; i++) {
+            m_rollup_insertStmt[i] = NULL;
+            m_rollup_updateStmt[i] = NULL;
+        }
+        for(int i = 0; i < sourceCount; i++) {
+            m_totalsStmt[i] = NULL;
+            m_seriesStmt[i][0] = m_seriesStmt[i][1] = NULL;
+        }
+        m_keyHistStmt[0] = m_keyHistStmt[1] = NULL;
+        m_intervalStmt[0] = m_intervalStmt[1] = NULL;
+    }
+
+    const int StorageSqlite::schemaVersion;
+
+    const char *StorageSqlite::rollupTable(Rollup rollup) {
+        return rollups[rollup].table;
     }
 
     /** 
@@ -54,29 +158,451 @@ namespace keyfrog {
     StorageSqlite::~StorageSqlite() {
     }
 
+    /** 
+     * @brief Checks whether table (or index) exists
+     */
+    bool StorageSqlite::tableExists(const char *name) {
+        sqlite3_stmt *stmt;
+        string sql = "SELECT 1 FROM sqlite_master WHERE name = ?";
+        if(SQLITE_OK != sqlite3_prepare(m_db, sql.c_str(), sql.size(), &stmt, NULL))
+            return false;
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        bool exists = (SQLITE_ROW == sqlite3_step(stmt));
+        sqlite3_finalize(stmt);
+        return exists;
+    }
+
+    /** 
+     * @brief Checks whether table has the WITHOUT ROWID layout
+     */
+    bool StorageSqlite::tableWithoutRowid(const char *name) {
+        sqlite3_stmt *stmt;
+        string sql = "SELECT 1 FROM sqlite_master WHERE name = ? AND sql LIKE '%WITHOUT ROWID%'";
+        if(SQLITE_OK != sqlite3_prepare(m_db, sql.c_str(), sql.size(), &stmt, NULL))
+            return false;
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        bool found = (SQLITE_ROW == sqlite3_step(stmt));
+        sqlite3_finalize(stmt);
+        return found;
+    }
+
     bool StorageSqlite::initDatabase() {
-        int rc;
         char *zErrMsg = NULL;
+        bool fresh = !tableExists("keypresses");
+        if(fresh) {
+            // Free pages can then be given back in small steps by compact()
+            string sql = "PRAGMA auto_vacuum = INCREMENTAL; " + keypressesSchema("keypresses", "cluster_index");
+            if(SQLITE_OK != sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg)) {
+                _dbg("Creating keypresses failed: `%s'", zErrMsg);
+                sqlite3_free(zErrMsg);
+                return false;
+            }
+        }
 
-        string sql = 
-            "CREATE TABLE keypresses ( "
-            "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-            "cluster_begin TIMESTAMP, "
-            "cluster_end TIMESTAMP, "
-            "count INTEGER, "
-            "app_group INTEGER "
+        _dbg("Database initialized");
+        m_hasRollups = initRollups();
+        return m_hasRollups && initKeyHistograms() && initActiveTime() && initIntervals() && initSeats() && initMeta(fresh);
+    }
+
+    /** 
+     * @brief Reads value from keyfrog_meta table
+     * @return false if there is no such key
+     */
+    bool StorageSqlite::readMeta(const string & key, string & value) {
+        sqlite3_stmt *stmt;
+        string sql = "SELECT value FROM keyfrog_meta WHERE key = ?";
+        if(SQLITE_OK != sqlite3_prepare(m_db, sql.c_str(), sql.size(), &stmt, NULL))
+            return false;
+        sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_TRANSIENT);
+        bool found = false;
+        if(SQLITE_ROW == sqlite3_step(stmt)) {
+            const unsigned char *text = sqlite3_column_text(stmt, 0);
+            value = text ? (const char *) text : "";
+            found = true;
+        }
+        sqlite3_finalize(stmt);
+        return found;
+    }
+
+    /** 
+     * @brief Stores value in keyfrog_meta table
+     */
+    bool StorageSqlite::writeMeta(const string & key, const string & value) {
+        sqlite3_stmt *stmt;
+        string sql = "INSERT OR REPLACE INTO keyfrog_meta ( key, value ) VALUES ( ?, ? )";
+        if(SQLITE_OK != sqlite3_prepare(m_db, sql.c_str(), sql.size(), &stmt, NULL))
+            return false;
+        sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, value.c_str(), -1, SQLITE_TRANSIENT);
+        int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        return rc == SQLITE_DONE;
+    }
+
+    /** 
+     * @brief Cluster size of stored rows
+     */
+    int StorageSqlite::storedClusterSize() {
+        string value;
+        if(readMeta("cluster_size", value))
+            return atoi(value.c_str());
+
+        // Databases older than the meta table were always written with 15 min clusters
+        int size = 15*60;
+        sqlite3_stmt *stmt;
+        string sql = "SELECT cluster_end - cluster_begin FROM keypresses LIMIT 1";
+        if(SQLITE_OK == sqlite3_prepare(m_db, sql.c_str(), sql.size(), &stmt, NULL)) {
+            if(SQLITE_ROW == sqlite3_step(stmt) && sqlite3_column_int(stmt, 0) > 0)
+                size = sqlite3_column_int(stmt, 0);
+            sqlite3_finalize(stmt);
+        }
+        return size;
+    }
+
+    /** 
+     * @brief Creates schema metadata table, upgrades schema, re-buckets data if cluster size changed
+     */
+    bool StorageSqlite::initMeta(bool fresh) {
+        char *zErrMsg = NULL;
+        string sql = "CREATE TABLE IF NOT EXISTS keyfrog_meta ( key TEXT PRIMARY KEY, value TEXT )";
+        if(SQLITE_OK != sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg)) {
+            _dbg("Creating keyfrog_meta failed: `%s'", zErrMsg);
+            sqlite3_free(zErrMsg);
+            return false;
+        }
+
+        string value;
+        if(!readMeta("schema_version", value)) {
+            value = (fresh && withoutRowidSupported()) ? boost::lexical_cast<string>(schemaVersion) : "1";
+            writeMeta("schema_version", value);
+        }
+        if(atoi(value.c_str()) < 2 && withoutRowidSupported() && !migrateSchema()) {
+            return false;
+        }
+
+        // Covers per group scans, no table lookups needed
+        sql = "CREATE INDEX IF NOT EXISTS keypresses_group_index ON keypresses ( app_group, cluster_begin, count )";
+        if(SQLITE_OK != sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg)) {
+            _dbg("Creating keypresses_group_index failed: `%s'", zErrMsg);
+            sqlite3_free(zErrMsg);
+            return false;
+        }
+
+        int storedSize = storedClusterSize();
+        if(storedSize != m_clusterSize) {
+            return rebucket(storedSize);
+        }
+        return writeMeta("cluster_size", boost::lexical_cast<string>(m_clusterSize));
+    }
+
+    /** 
+     * @brief Moves keypresses into WITHOUT ROWID table (schema 1 -> 2)
+     */
+    bool StorageSqlite::migrateSchema() {
+        _dbg("Upgrading keypresses table to schema %d", schemaVersion);
+        string sql =
+            "BEGIN; " +
+            keypressesSchema("keypresses_v2", "cluster_index") +
+            "INSERT INTO keypresses_v2 ( cluster_begin, app_group, cluster_end, count ) "
+            "SELECT cluster_begin, app_group, MAX(cluster_end), SUM(count) FROM keypresses "
+            "WHERE cluster_begin IS NOT NULL AND app_group IS NOT NULL "
+            "GROUP BY cluster_begin, app_group; "
+            "DROP TABLE keypresses; "
+            "ALTER TABLE keypresses_v2 RENAME TO keypresses; "
+            "INSERT OR REPLACE INTO keyfrog_meta ( key, value ) VALUES ( 'schema_version', '2' ); "
+            "COMMIT; ";
+        char *zErrMsg = NULL;
+        if(SQLITE_OK != sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg)) {
+            _dbg("Schema upgrade failed: `%s'", zErrMsg);
+            sqlite3_free(zErrMsg);
+            sqlite3_exec(m_db, "ROLLBACK", NULL, NULL, NULL);
+            return false;
+        }
+
+        // The table is rewritten anyway, so this is the time to switch
+        // on incremental vacuum (it takes a full VACUUM)
+        _dbg("Vacuuming database");
+        if(SQLITE_OK != sqlite3_exec(m_db, "PRAGMA auto_vacuum = INCREMENTAL; VACUUM", NULL, NULL, &zErrMsg)) {
+            _dbg("VACUUM failed: `%s'", zErrMsg);
+            sqlite3_free(zErrMsg);
+        }
+        return true;
+    }
+
+    /**
+     * Re-buckets table of packed histograms (KeyHistogram or
+     * IntervalHistogram) into clusters of given size. SQL can't merge
+     * the blobs, so rows are read ordered by new cluster and merged
+     * here; a malformed one is left out.
+     */
+    template<class Histogram>
+    static bool rebucketHistograms(sqlite3 *db, const string & table, const string & column, const string & size) {
+        string sql = "CREATE TEMP TABLE " + table + "_rebucket ( cb INTEGER, g INTEGER, h BLOB )";
+        if(SQLITE_OK != sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL))
+            return false;
+
+        sqlite3_stmt *select = NULL, *insert = NULL;
+        sql = "SELECT cluster_begin - cluster_begin % " + size + ", app_group, " + column + " FROM " + table + " ORDER BY 1, 2";
+        string insertSql = "INSERT INTO temp." + table + "_rebucket ( cb, g, h ) VALUES ( ?, ?, ? )";
+        bool ok = SQLITE_OK == sqlite3_prepare(db, sql.c_str(), sql.size(), &select, NULL) &&
+            SQLITE_OK == sqlite3_prepare(db, insertSql.c_str(), insertSql.size(), &insert, NULL);
+
+        Histogram merged;
+        string packed;
+        int cluster = 0, group = 0;
+        bool pending = false;
+        int rc = SQLITE_ROW;
+        while(ok) {
+            rc = sqlite3_step(select);
+            bool next = rc == SQLITE_ROW;
+            if(pending && (!next || sqlite3_column_int(select, 0) != cluster || sqlite3_column_int(select, 1) != group)) {
+                packed.clear();
+                merged.pack(packed);
+                sqlite3_bind_int(insert, 1, cluster);
+                sqlite3_bind_int(insert, 2, group);
+                sqlite3_bind_blob(insert, 3, packed.data(), packed.size(), SQLITE_TRANSIENT);
+                ok = SQLITE_DONE == sqlite3_step(insert);
+                sqlite3_reset(insert);
+                merged.clear();
+                pending = false;
+            }
+            if(!next)
+                break;
+            cluster = sqlite3_column_int(select, 0);
+            group = sqlite3_column_int(select, 1);
+            if(merged.mergePacked(sqlite3_column_blob(select, 2), sqlite3_column_bytes(select, 2)))
+                pending = true;
+            else
+                _dbg("Malformed %s row ( %d, %d ) dropped", table.c_str(), cluster, group);
+        }
+        sqlite3_finalize(select);
+        sqlite3_finalize(insert);
+        if(!ok || rc != SQLITE_DONE)
+            return false;
+
+        sql = "DELETE FROM " + table + "; "
+            "INSERT INTO " + table + " ( cluster_begin, app_group, " + column + " ) "
+            "SELECT cb, g, h FROM temp." + table + "_rebucket; "
+            "DROP TABLE temp." + table + "_rebucket; ";
+        return SQLITE_OK == sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+    }
+
+    /** 
+     * @brief Moves all rows of keypresses, key histograms, active time,
+     * intervals and seat counts into clusters of current size
+     *
+     * Done in one transaction and one pass over each table. When
+     * clusters get smaller, each old row ends up in the first new
+     * cluster it covers.
+     */
+    bool StorageSqlite::rebucket(int oldClusterSize) {
+        _dbg("Cluster size changed (%d -> %d), re-bucketing keypresses", oldClusterSize, m_clusterSize);
+        string size = boost::lexical_cast<string>(m_clusterSize);
+        string sql =
+            "BEGIN; "
+            "CREATE TEMP TABLE keypresses_rebucket AS "
+            "SELECT cluster_begin - cluster_begin % " + size + " AS cb, SUM(count) AS c, app_group AS g "
+            "FROM keypresses GROUP BY 1, 3; "
+            "DELETE FROM keypresses; "
+            "INSERT INTO keypresses ( cluster_begin, cluster_end, count, app_group ) "
+            "SELECT cb, cb + " + size + ", c, g FROM temp.keypresses_rebucket; "
+            "DROP TABLE temp.keypresses_rebucket; "
+            "CREATE TEMP TABLE activetime_rebucket AS "
+            "SELECT cluster_begin - cluster_begin % " + size + " AS cb, app_group AS g, "
+            "SUM(milliseconds) AS ms, SUM(sessions) AS s FROM activetime GROUP BY 1, 2; "
+            "DELETE FROM activetime; "
+            "INSERT INTO activetime ( cluster_begin, app_group, milliseconds, sessions ) "
+            "SELECT cb, g, ms, s FROM temp.activetime_rebucket; "
+            "DROP TABLE temp.activetime_rebucket; "
+            "CREATE TEMP TABLE seatpresses_rebucket AS "
+            "SELECT cluster_begin - cluster_begin % " + size + " AS cb, app_group AS g, seat AS s, "
+            "SUM(count) AS c FROM seatpresses GROUP BY 1, 2, 3; "
+            "DELETE FROM seatpresses; "
+            "INSERT INTO seatpresses ( cluster_begin, app_group, seat, count ) "
+            "SELECT cb, g, s, c FROM temp.seatpresses_rebucket; "
+            "DROP TABLE temp.seatpresses_rebucket; ";
+        char *zErrMsg = NULL;
+        bool ok = SQLITE_OK == sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg);
+        if(ok) {
+            ok = rebucketHistograms<KeyHistogram>(m_db, "keyhist", "keys", size) &&
+                rebucketHistograms<IntervalHistogram>(m_db, "intervals", "histogram", size);
+            sql = "INSERT OR REPLACE INTO keyfrog_meta ( key, value ) VALUES ( 'cluster_size', '" + size + "' ); "
+                "COMMIT; ";
+            ok = ok && SQLITE_OK == sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg);
+        }
+        if(!ok) {
+            _dbg("Re-bucketing failed: `%s'", zErrMsg ? zErrMsg : sqlite3_errmsg(m_db));
+            sqlite3_free(zErrMsg);
+            sqlite3_exec(m_db, "ROLLBACK", NULL, NULL, NULL);
+            return false;
+        }
+        return true;
+    }
+
+    /** 
+     * @brief Creates keyhist table: packed KeyHistogram per ( cluster_begin, app_group )
+     */
+    bool StorageSqlite::initKeyHistograms() {
+        if(tableExists("keyhist"))
+            return true;
+        string sql = withoutRowidSupported() ?
+            "CREATE TABLE keyhist ( "
+            "cluster_begin INTEGER NOT NULL, "
+            "app_group INTEGER NOT NULL, "
+            "keys BLOB, "
+            "PRIMARY KEY ( cluster_begin, app_group ) "
+            ") WITHOUT ROWID" :
+            "CREATE TABLE keyhist ( "
+            "cluster_begin INTEGER, "
+            "app_group INTEGER, "
+            "keys BLOB "
             "); "
-            "CREATE UNIQUE INDEX cluster_index " 
-            "ON keypresses ( cluster_begin, app_group ); ";
+            "CREATE UNIQUE INDEX keyhist_index ON keyhist ( cluster_begin, app_group )";
+        char *zErrMsg = NULL;
+        if(SQLITE_OK != sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg)) {
+            _dbg("Creating keyhist failed: `%s'", zErrMsg);
+            sqlite3_free(zErrMsg);
+            return false;
+        }
+        return true;
+    }
 
-        rc = sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg);
-        if( rc != SQLITE_OK ) {
-            _dbg("sqlite3_exec failed: `%s' (hint: if table already exists, this is not an actual error)", zErrMsg);
-            // FIXME: if exists..
-            //return false;
+    /** 
+     * @brief Creates activetime table: typing time and sessions per ( cluster_begin, app_group )
+     */
+    bool StorageSqlite::initActiveTime() {
+        if(tableExists("activetime"))
+            return true;
+        string sql = withoutRowidSupported() ?
+            "CREATE TABLE activetime ( "
+            "cluster_begin INTEGER NOT NULL, "
+            "app_group INTEGER NOT NULL, "
+            "milliseconds INTEGER NOT NULL, "
+            "sessions INTEGER NOT NULL, "
+            "PRIMARY KEY ( cluster_begin, app_group ) "
+            ") WITHOUT ROWID" :
+            "CREATE TABLE activetime ( "
+            "cluster_begin INTEGER, "
+            "app_group INTEGER, "
+            "milliseconds INTEGER, "
+            "sessions INTEGER "
+            "); "
+            "CREATE UNIQUE INDEX activetime_index ON activetime ( cluster_begin, app_group )";
+        char *zErrMsg = NULL;
+        if(SQLITE_OK != sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg)) {
+            _dbg("Creating activetime failed: `%s'", zErrMsg);
+            sqlite3_free(zErrMsg);
+            return false;
         }
+        return true;
+    }
 
-        _dbg("Database initialized");
+    /** 
+     * @brief Creates intervals table: packed IntervalHistogram per ( cluster_begin, app_group )
+     */
+    bool StorageSqlite::initIntervals() {
+        if(tableExists("intervals"))
+            return true;
+        string sql = withoutRowidSupported() ?
+            "CREATE TABLE intervals ( "
+            "cluster_begin INTEGER NOT NULL, "
+            "app_group INTEGER NOT NULL, "
+            "histogram BLOB, "
+            "PRIMARY KEY ( cluster_begin, app_group ) "
+            ") WITHOUT ROWID" :
+            "CREATE TABLE intervals ( "
+            "cluster_begin INTEGER, "
+            "app_group INTEGER, "
+            "histogram BLOB "
+            "); "
+            "CREATE UNIQUE INDEX intervals_index ON intervals ( cluster_begin, app_group )";
+        char *zErrMsg = NULL;
+        if(SQLITE_OK != sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg)) {
+            _dbg("Creating intervals failed: `%s'", zErrMsg);
+            sqlite3_free(zErrMsg);
+            return false;
+        }
+        return true;
+    }
+
+    /** 
+     * @brief Creates seatpresses table: keypresses per ( cluster_begin, app_group, seat )
+     */
+    bool StorageSqlite::initSeats() {
+        if(tableExists("seatpresses"))
+            return true;
+        string sql = withoutRowidSupported() ?
+            "CREATE TABLE seatpresses ( "
+            "cluster_begin INTEGER NOT NULL, "
+            "app_group INTEGER NOT NULL, "
+            "seat INTEGER NOT NULL, "
+            "count INTEGER NOT NULL, "
+            "PRIMARY KEY ( cluster_begin, app_group, seat ) "
+            ") WITHOUT ROWID" :
+            "CREATE TABLE seatpresses ( "
+            "cluster_begin INTEGER, "
+            "app_group INTEGER, "
+            "seat INTEGER, "
+            "count INTEGER "
+            "); "
+            "CREATE UNIQUE INDEX seatpresses_index ON seatpresses ( cluster_begin, app_group, seat )";
+        char *zErrMsg = NULL;
+        if(SQLITE_OK != sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg)) {
+            _dbg("Creating seatpresses failed: `%s'", zErrMsg);
+            sqlite3_free(zErrMsg);
+            return false;
+        }
+        return true;
+    }
+
+    /** 
+     * @brief Creates rollup tables; new tables are filled from keypresses
+     *
+     * Rollups created with TIMESTAMP columns and a separate index are
+     * moved to the keypresses layout.
+     */
+    bool StorageSqlite::initRollups() {
+        for(int i = 0; i < rollupCount; i++) {
+            bool exists = tableExists(rollups[i].table);
+            if(exists && (!withoutRowidSupported() || tableWithoutRowid(rollups[i].table)))
+                continue;
+
+            string table = rollups[i].table;
+            string beginExpr = rollups[i].beginExpr;
+            string endExpr = rollups[i].endExpr;
+            // Backfill takes cluster_begin instead of parameter
+            string::size_type pos;
+            while(string::npos != (pos = beginExpr.find("?2")))
+                beginExpr.replace(pos, 2, "cluster_begin");
+            while(string::npos != (pos = endExpr.find("?2")))
+                endExpr.replace(pos, 2, "cluster_begin");
+
+            string sql = exists ?
+                "BEGIN; " +
+                keypressesSchema(table + "_v2", table + "_index") +
+                "INSERT INTO " + table + "_v2 ( cluster_begin, app_group, cluster_end, count ) "
+                "SELECT cluster_begin, app_group, MAX(cluster_end), SUM(count) FROM " + table + " "
+                "WHERE cluster_begin IS NOT NULL AND app_group IS NOT NULL "
+                "GROUP BY cluster_begin, app_group; "
+                "DROP TABLE " + table + "; "
+                "ALTER TABLE " + table + "_v2 RENAME TO " + table + "; "
+                "COMMIT; " :
+                "BEGIN; " +
+                keypressesSchema(table, table + "_index") +
+                "INSERT INTO " + table + " ( cluster_begin, app_group, cluster_end, count ) "
+                "SELECT " + beginExpr + ", app_group, " + endExpr + ", SUM(count) "
+                "FROM keypresses GROUP BY 1, 2; "
+                "COMMIT; ";
+
+            char *zErrMsg = NULL;
+            if(SQLITE_OK != sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg)) {
+                _dbg("Creating %s failed: `%s'", rollups[i].table, zErrMsg);
+                sqlite3_free(zErrMsg);
+                sqlite3_exec(m_db, "ROLLBACK", NULL, NULL, NULL);
+                return false;
+            }
+            _dbg("Rollup table %s created", rollups[i].table);
+        }
         return true;
     }
 
@@ -94,10 +620,7 @@ namespace keyfrog {
         // Statement for adding key record
         stmt_str = "INSERT INTO keypresses ( cluster_begin, cluster_end, count, app_group ) "
             "VALUES ( ?, ?, ?, ? ) ";
-        rc = sqlite3_prepare(m_db,
-                stmt_str.c_str(),
-                stmt_str.size(),
-                &m_addKeyPress_insertStmt1, NULL);
+        rc = prepareLongLived(m_db, stmt_str, &m_addKeyPress_insertStmt1);
         if(rc != SQLITE_OK) {
             _dbg("insert1 init failed");
             return false;
@@ -105,29 +628,142 @@ namespace keyfrog {
 
         // Statement for updating existing key record
         stmt_str = "UPDATE keypresses SET count = count + ? WHERE cluster_begin = ? AND app_group = ?";
-        rc = sqlite3_prepare(m_db,
-                stmt_str.c_str(),
-                stmt_str.size(),
-                &m_addKeyPress_updateStmt1, NULL);
+        rc = prepareLongLived(m_db, stmt_str, &m_addKeyPress_updateStmt1);
         if(rc != SQLITE_OK) {
             _dbg("update1 init failed");
             return false;
         }
 
-        // Statement for updating existing key record
-        stmt_str = "SELECT id FROM keypresses WHERE cluster_begin = ? LIMIT 1";
-        rc = sqlite3_prepare(m_db,
-                stmt_str.c_str(),
-                stmt_str.size(),
-                &m_addKeyPress_existsStmt1, NULL);
+        // Rollup statements, same update-or-insert scheme as above
+        for(int i = 0; i < rollupCount; i++) {
+            stmt_str = string("UPDATE ") + rollups[i].table + " SET count = count + ?1 "
+                "WHERE cluster_begin = " + rollups[i].beginExpr + " AND app_group = ?3";
+            rc = prepareLongLived(m_db, stmt_str, &m_rollup_updateStmt[i]);
+            if(rc != SQLITE_OK) {
+                _dbg("rollup update init failed (%s)", rollups[i].table);
+                return false;
+            }
+
+            stmt_str = string("INSERT INTO ") + rollups[i].table + " ( cluster_begin, cluster_end, count, app_group ) "
+                "VALUES ( " + rollups[i].beginExpr + ", " + rollups[i].endExpr + ", ?1, ?3 )";
+            rc = prepareLongLived(m_db, stmt_str, &m_rollup_insertStmt[i]);
+            if(rc != SQLITE_OK) {
+                _dbg("rollup insert init failed (%s)", rollups[i].table);
+                return false;
+            }
+        }
+
+        // Key histogram statements
+        stmt_str = "SELECT keys FROM keyhist WHERE cluster_begin = ? AND app_group = ?";
+        rc = prepareLongLived(m_db, stmt_str, &m_keyHist_selectStmt);
+        if(rc != SQLITE_OK) {
+            _dbg("keyhist select init failed");
+            return false;
+        }
+
+        stmt_str = "INSERT OR REPLACE INTO keyhist ( cluster_begin, app_group, keys ) VALUES ( ?, ?, ? )";
+        rc = prepareLongLived(m_db, stmt_str, &m_keyHist_replaceStmt);
         if(rc != SQLITE_OK) {
-            _dbg("exists1 init failed");
+            _dbg("keyhist replace init failed");
+            return false;
+        }
+
+        stmt_str = "DELETE FROM keyhist WHERE cluster_begin >= ? AND cluster_begin < ?";
+        rc = prepareLongLived(m_db, stmt_str, &m_keyHist_expireStmt);
+        if(rc != SQLITE_OK) {
+            _dbg("keyhist expire init failed");
+            return false;
+        }
+
+        // Active time statements, update-or-insert as keypresses
+        stmt_str = "UPDATE activetime SET milliseconds = milliseconds + ?1, sessions = sessions + ?2 "
+            "WHERE cluster_begin = ?3 AND app_group = ?4";
+        rc = prepareLongLived(m_db, stmt_str, &m_active_updateStmt);
+        if(rc != SQLITE_OK) {
+            _dbg("activetime update init failed");
+            return false;
+        }
+
+        stmt_str = "INSERT INTO activetime ( cluster_begin, app_group, milliseconds, sessions ) VALUES ( ?3, ?4, ?1, ?2 )";
+        rc = prepareLongLived(m_db, stmt_str, &m_active_insertStmt);
+        if(rc != SQLITE_OK) {
+            _dbg("activetime insert init failed");
+            return false;
+        }
+
+        stmt_str = "DELETE FROM activetime WHERE cluster_begin >= ? AND cluster_begin < ?";
+        rc = prepareLongLived(m_db, stmt_str, &m_active_expireStmt);
+        if(rc != SQLITE_OK) {
+            _dbg("activetime expire init failed");
+            return false;
+        }
+
+        // Interval histogram statements, merged like key histograms
+        stmt_str = "SELECT histogram FROM intervals WHERE cluster_begin = ? AND app_group = ?";
+        rc = prepareLongLived(m_db, stmt_str, &m_interval_selectStmt);
+        if(rc != SQLITE_OK) {
+            _dbg("intervals select init failed");
+            return false;
+        }
+
+        stmt_str = "INSERT OR REPLACE INTO intervals ( cluster_begin, app_group, histogram ) VALUES ( ?, ?, ? )";
+        rc = prepareLongLived(m_db, stmt_str, &m_interval_replaceStmt);
+        if(rc != SQLITE_OK) {
+            _dbg("intervals replace init failed");
+            return false;
+        }
+
+        stmt_str = "DELETE FROM intervals WHERE cluster_begin >= ? AND cluster_begin < ?";
+        rc = prepareLongLived(m_db, stmt_str, &m_interval_expireStmt);
+        if(rc != SQLITE_OK) {
+            _dbg("intervals expire init failed");
+            return false;
+        }
+
+        // Seat statements, update-or-insert as keypresses
+        stmt_str = "UPDATE seatpresses SET count = count + ?1 WHERE cluster_begin = ?2 AND app_group = ?3 AND seat = ?4";
+        rc = prepareLongLived(m_db, stmt_str, &m_seat_updateStmt);
+        if(rc != SQLITE_OK) {
+            _dbg("seatpresses update init failed");
+            return false;
+        }
+
+        stmt_str = "INSERT INTO seatpresses ( cluster_begin, app_group, seat, count ) VALUES ( ?2, ?3, ?4, ?1 )";
+        rc = prepareLongLived(m_db, stmt_str, &m_seat_insertStmt);
+        if(rc != SQLITE_OK) {
+            _dbg("seatpresses insert init failed");
+            return false;
+        }
+
+        stmt_str = "DELETE FROM seatpresses WHERE cluster_begin >= ? AND cluster_begin < ?";
+        rc = prepareLongLived(m_db, stmt_str, &m_seat_expireStmt);
+        if(rc != SQLITE_OK) {
+            _dbg("seatpresses expire init failed");
+            return false;
+        }
+
+        // Statement for retention of detail rows
+        stmt_str = "DELETE FROM keypresses WHERE cluster_begin >= ? AND cluster_begin < ?";
+        rc = prepareLongLived(m_db, stmt_str, &m_expireStmt);
+        if(rc != SQLITE_OK) {
+            _dbg("expire init failed");
             return false;
         }
 
         return true;
     }
 
+    /** 
+     * @brief Sets cluster width in seconds
+     */
+    void StorageSqlite::setClusterSize(int seconds) {
+        if(seconds <= 0) {
+            _dbg("Invalid cluster size %d, keeping %d", seconds, m_clusterSize);
+            return;
+        }
+        m_clusterSize = seconds;
+    }
+
     /** 
      * @brief Returns start time boundary for given time stamp
      * @return time stamp
@@ -149,6 +785,7 @@ namespace keyfrog {
             _dbg("sqlite3_open failed");
             return false;
         }
+        sqlite3_busy_timeout(m_db, busyTimeout);
         if(!initDatabase()) {
             sqlite3_close(m_db);
             _dbg("initDatabase() failed");
@@ -168,7 +805,84 @@ namespace keyfrog {
      * @brief Disconnects from database
      */
     void StorageSqlite::disconnect() {
+        finalizeStatements();
         sqlite3_close(m_db);
+        m_db = NULL;
+    }
+
+    /** 
+     * @brief Opens existing database without changing it
+     *
+     * Schema is not upgraded and rollups are not created, reads fall
+     * back to keypresses table for what is missing.
+     */
+    bool StorageSqlite::connectReadOnly(std::string uri) {
+        m_uri = uri;
+        m_readOnly = true;
+        if(SQLITE_OK != sqlite3_open_v2(m_uri.c_str(), &m_db, SQLITE_OPEN_READONLY, NULL)) {
+            _dbg("sqlite3_open_v2 failed");
+            sqlite3_close(m_db);
+            m_db = NULL;
+            return false;
+        }
+        sqlite3_busy_timeout(m_db, busyTimeout);
+        if(!tableExists("keypresses")) {
+            _dbg("%s has no keypresses table", m_uri.c_str());
+            sqlite3_close(m_db);
+            m_db = NULL;
+            return false;
+        }
+        m_clusterSize = storedClusterSize();
+        m_hasRollups = tableExists(rollups[rollupHourly].table) && tableExists(rollups[rollupDaily].table);
+        if(!m_hasRollups)
+            _dbg("%s has no rollup tables, aggregating detail data", m_uri.c_str());
+        return true;
+    }
+
+    /** 
+     * @brief Prepares read statement on first use
+     */
+    bool StorageSqlite::prepareRead(sqlite3_stmt *& stmt, const string & sql) {
+        if(stmt != NULL)
+            return true;
+        if(m_db == NULL)
+            return false;
+        if(SQLITE_OK != prepareLongLived(m_db, sql, &stmt)) {
+            _dbg("Preparing `%s' failed: %s", sql.c_str(), sqlite3_errmsg(m_db));
+            stmt = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    /** 
+     * @brief Finalizes all statements, so that database can be closed
+     */
+    void StorageSqlite::finalizeStatements() {
+        sqlite3_stmt **stmts[] = {
+            &m_addKeyPress_insertStmt1, &m_addKeyPress_updateStmt1, &m_expireStmt,
+            &m_keyHist_selectStmt, &m_keyHist_replaceStmt, &m_keyHist_expireStmt,
+            &m_active_updateStmt, &m_active_insertStmt, &m_active_expireStmt,
+            &m_interval_selectStmt, &m_interval_replaceStmt, &m_interval_expireStmt,
+            &m_seat_updateStmt, &m_seat_insertStmt, &m_seat_expireStmt,
+            &m_scanRangeStmt, &m_scanGroupStmt, &m_keyHistStmt[0], &m_keyHistStmt[1], &m_activeStmt,
+            &m_intervalStmt[0], &m_intervalStmt[1], &m_seatStmt
+        };
+        for(size_t i = 0; i < sizeof(stmts) / sizeof(stmts[0]); i++) {
+            sqlite3_finalize(*stmts[i]);
+            *stmts[i] = NULL;
+        }
+        for(int i = 0; i < rollupCount; i++) {
+            sqlite3_finalize(m_rollup_insertStmt[i]);
+            sqlite3_finalize(m_rollup_updateStmt[i]);
+            m_rollup_insertStmt[i] = m_rollup_updateStmt[i] = NULL;
+        }
+        for(int i = 0; i < sourceCount; i++) {
+            sqlite3_finalize(m_totalsStmt[i]);
+            sqlite3_finalize(m_seriesStmt[i][0]);
+            sqlite3_finalize(m_seriesStmt[i][1]);
+            m_totalsStmt[i] = m_seriesStmt[i][0] = m_seriesStmt[i][1] = NULL;
+        }
     }
 
     /** 
@@ -177,7 +891,7 @@ namespace keyfrog {
      * @param count how many events
      */
     bool StorageSqlite::addKeyPress(int app_group, int count) {
-        return addKeyPress(time(NULL), app_group, count);
+        return addKeyPress(app_group, time(NULL), count);
     }
 
     /** 
@@ -186,8 +900,10 @@ namespace keyfrog {
      * @param timestamp key press event time
      * @param count how many events
      */
-    bool StorageSqlite::addKeyPress(int timestamp, int app_group, int count) {
+    bool StorageSqlite::addKeyPress(int app_group, int timestamp, int count) {
         int rc;
+        if(m_readOnly)
+            return false;
         _dbg("addKeyPress -- UPDATE (timestamp=%d, app_group=0x%x, count=%d)", timestamp, app_group, count);
 
         // SQL Tip: "update keypresses SET count = count + ? WHERE cluster_begin = ? AND app_group = ?"
@@ -216,6 +932,642 @@ namespace keyfrog {
                 return false;
             }
         }
+
+        for(int i = 0; i < rollupCount; i++) {
+            if(!addToRollup((Rollup) i, app_group, cluster_begin, count))
+                return false;
+        }
+        return true;
+    }
+
+    /** 
+     * @brief Adds keypresses to bucket of given rollup table
+     */
+    bool StorageSqlite::addToRollup(Rollup rollup, int app_group, int timestamp, int count) {
+        int rc;
+        sqlite3_stmt *stmt = m_rollup_updateStmt[rollup];
+        sqlite3_bind_int(stmt, 1, count);
+        sqlite3_bind_int(stmt, 2, timestamp);
+        sqlite3_bind_int(stmt, 3, app_group);
+        rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if( rc != SQLITE_DONE || 0 == sqlite3_changes(m_db) ) {
+            stmt = m_rollup_insertStmt[rollup];
+            sqlite3_bind_int(stmt, 1, count);
+            sqlite3_bind_int(stmt, 2, timestamp);
+            sqlite3_bind_int(stmt, 3, app_group);
+            rc = sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+            if( rc != SQLITE_DONE || 0 == sqlite3_changes(m_db)) {
+                _dbg("addToRollup(%s) -- FAIL (rc=%d)", rollups[rollup].table, rc);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /** 
+     * @brief Opens transaction, so that a whole batch costs one sync
+     */
+    bool StorageSqlite::beginBatch() {
+        char *zErrMsg = NULL;
+        if(SQLITE_OK != sqlite3_exec(m_db, "BEGIN", NULL, NULL, &zErrMsg)) {
+            _dbg("BEGIN failed: `%s'", zErrMsg);
+            sqlite3_free(zErrMsg);
+            return false;
+        }
+        return true;
+    }
+
+    /** 
+     * @brief Commits transaction opened by beginBatch()
+     */
+    bool StorageSqlite::commitBatch() {
+        char *zErrMsg = NULL;
+        if(SQLITE_OK != sqlite3_exec(m_db, "COMMIT", NULL, NULL, &zErrMsg)) {
+            _dbg("COMMIT failed: `%s'", zErrMsg);
+            sqlite3_free(zErrMsg);
+            abortBatch();
+            return false;
+        }
+        return true;
+    }
+
+    /** 
+     * @brief Ends transaction opened by beginBatch() without its writes,
+     * so that next beginBatch() can open a new one
+     */
+    void StorageSqlite::abortBatch() {
+        if(SQLITE_OK != sqlite3_exec(m_db, "ROLLBACK", NULL, NULL, NULL))
+            _dbg("ROLLBACK failed: `%s'", sqlite3_errmsg(m_db));
+    }
+
+    /** 
+     * @brief Table read for given source
+     */
+    static const char *sourceTable(int source) {
+        return source == 0 ? "keypresses" : rollups[source - 1].table;
+    }
+
+    /** 
+     * @brief Steps through statement, handing rows to sink in batches
+     *
+     * Statement has to select cluster_begin, app_group, count.
+     */
+    bool StorageSqlite::scan(sqlite3_stmt *stmt, KeyPressSink & sink) {
+        KeyPressRow rows[scanBatch];
+        size_t n = 0;
+        int rc;
+        bool ok = true;
+        while(SQLITE_ROW == (rc = sqlite3_step(stmt))) {
+            rows[n].clusterBegin = sqlite3_column_int(stmt, 0);
+            rows[n].appGroup = sqlite3_column_int(stmt, 1);
+            rows[n].count = sqlite3_column_int(stmt, 2);
+            if(++n == scanBatch) {
+                n = 0;
+                if(!(ok = sink.consume(rows, scanBatch)))
+                    break;
+            }
+        }
+        sqlite3_reset(stmt);
+        if(!ok)
+            return false;
+        if(rc != SQLITE_DONE) {
+            _dbg("scan -- FAIL (rc=%d)", rc);
+            return false;
+        }
+        return n == 0 || sink.consume(rows, n);
+    }
+
+    /** 
+     * @brief Range scan, walks primary key (schema 2) or cluster_index
+     */
+    bool StorageSqlite::scanRange(int from, int to, KeyPressSink & sink) {
+        if(!prepareRead(m_scanRangeStmt, "SELECT cluster_begin, app_group, count FROM keypresses "
+                    "WHERE cluster_begin >= ?1 AND cluster_begin < ?2 "
+                    "ORDER BY cluster_begin, app_group"))
+            return false;
+        sqlite3_bind_int(m_scanRangeStmt, 1, from);
+        sqlite3_bind_int(m_scanRangeStmt, 2, to);
+        return scan(m_scanRangeStmt, sink);
+    }
+
+    /** 
+     * @brief Range scan of one group, answered from keypresses_group_index alone
+     */
+    bool StorageSqlite::scanGroupRange(int app_group, int from, int to, KeyPressSink & sink) {
+        if(!prepareRead(m_scanGroupStmt, "SELECT cluster_begin, app_group, count FROM keypresses "
+                    "WHERE app_group = ?3 AND cluster_begin >= ?1 AND cluster_begin < ?2 "
+                    "ORDER BY cluster_begin"))
+            return false;
+        sqlite3_bind_int(m_scanGroupStmt, 1, from);
+        sqlite3_bind_int(m_scanGroupStmt, 2, to);
+        sqlite3_bind_int(m_scanGroupStmt, 3, app_group);
+        return scan(m_scanGroupStmt, sink);
+    }
+
+    /** 
+     * @brief Adds sums of given source over [from, to) to out
+     */
+    bool StorageSqlite::sumRange(int source, int from, int to, map<int, long long> & out) {
+        if(from >= to)
+            return true;
+        sqlite3_stmt *& stmt = m_totalsStmt[source];
+        if(!prepareRead(stmt, string("SELECT app_group, SUM(count) FROM ") + sourceTable(source) +
+                    " WHERE cluster_begin >= ?1 AND cluster_begin < ?2 GROUP BY app_group"))
+            return false;
+        sqlite3_bind_int(stmt, 1, from);
+        sqlite3_bind_int(stmt, 2, to);
+        int rc;
+        while(SQLITE_ROW == (rc = sqlite3_step(stmt))) {
+            out[sqlite3_column_int(stmt, 0)] += sqlite3_column_int64(stmt, 1);
+        }
+        sqlite3_reset(stmt);
+        if(rc != SQLITE_DONE) {
+            _dbg("sumRange(%s) -- FAIL (rc=%d)", sourceTable(source), rc);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Rollup buckets of local time lying whole in [from, to): [first, last)
+     */
+    static void wholeBuckets(int from, int to, int unit, int & first, int & last) {
+        first = local_bucket_start(from, unit);
+        if(first < from)
+            first = local_bucket_start(first + unit + unit / 2, unit);
+        last = local_bucket_start(to, unit);
+    }
+
+    /** 
+     * @brief Sums whole buckets of given rollup, partial ones at both ends from next finer table
+     *
+     * Only edges shorter than an hour come from keypresses, so sums
+     * stay right after detail rows expire.
+     */
+    bool StorageSqlite::sumLayered(int source, int from, int to, map<int, long long> & out) {
+        if(source == sourceDetail)
+            return sumRange(sourceDetail, from, to, out);
+        int finer = source == sourceDaily ? sourceHourly : sourceDetail;
+        int first, last;
+        wholeBuckets(from, to, source == sourceDaily ? 24 * 3600 : 3600, first, last);
+        if(first >= last)
+            return sumLayered(finer, from, to, out);
+        return sumLayered(finer, from, first, out) &&
+            sumRange(source, first, last, out) &&
+            sumLayered(finer, last, to, out);
+    }
+
+    /** 
+     * @brief Whole days come from daily rollup, whole hours of partial days from hourly rollup
+     */
+    bool StorageSqlite::totals(int from, int to, map<int, long long> & out) {
+        if(from >= to)
+            return true;
+        return sumLayered(m_hasRollups ? sourceDaily : sourceDetail, from, to, out);
+    }
+
+    /** 
+     * @brief Adds bucketed sums of given source over [from, to) to out
+     */
+    bool StorageSqlite::seriesRange(int source, int from, int to, int bucket, int app_group,
+            map<pair<int, int>, long long> & out) {
+        if(from >= to)
+            return true;
+        bool filtered = app_group != -1;
+        sqlite3_stmt *& stmt = m_seriesStmt[source][filtered];
+        // Same local time arithmetic as local_bucket_start()
+        if(!prepareRead(stmt, string("SELECT CAST(strftime('%s', local - ((local % ?3) + ?3) % ?3, 'unixepoch', 'utc') AS INTEGER), app_group, total FROM "
+                    "(SELECT CAST(strftime('%s', cluster_begin, 'unixepoch', 'localtime') AS INTEGER) AS local, app_group, SUM(count) AS total FROM ") +
+                    sourceTable(source) + " WHERE cluster_begin >= ?1 AND cluster_begin < ?2" +
+                    (filtered ? " AND app_group = ?4" : "") +
+                    " GROUP BY cluster_begin, app_group)"))
+            return false;
+        sqlite3_bind_int(stmt, 1, from);
+        sqlite3_bind_int(stmt, 2, to);
+        sqlite3_bind_int(stmt, 3, bucket);
+        if(filtered)
+            sqlite3_bind_int(stmt, 4, app_group);
+        int rc;
+        while(SQLITE_ROW == (rc = sqlite3_step(stmt))) {
+            out[make_pair(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1))] += sqlite3_column_int64(stmt, 2);
+        }
+        sqlite3_reset(stmt);
+        if(rc != SQLITE_DONE) {
+            _dbg("seriesRange(%s) -- FAIL (rc=%d)", sourceTable(source), rc);
+            return false;
+        }
+        return true;
+    }
+
+    /** 
+     * @brief Same layering as sumLayered()
+     */
+    bool StorageSqlite::seriesLayered(int source, int from, int to, int bucket, int app_group,
+            map<pair<int, int>, long long> & out) {
+        if(source == sourceDetail)
+            return seriesRange(sourceDetail, from, to, bucket, app_group, out);
+        int finer = source == sourceDaily ? sourceHourly : sourceDetail;
+        int first, last;
+        wholeBuckets(from, to, source == sourceDaily ? 24 * 3600 : 3600, first, last);
+        if(first >= last)
+            return seriesLayered(finer, from, to, bucket, app_group, out);
+        return seriesLayered(finer, from, first, bucket, app_group, out) &&
+            seriesRange(source, first, last, bucket, app_group, out) &&
+            seriesLayered(finer, last, to, bucket, app_group, out);
+    }
+
+    /** 
+     * @brief Buckets that are whole days (or hours) are served from rollup,
+     * range edges not aligned to them from finer rollup and keypresses
+     */
+    bool StorageSqlite::series(int from, int to, int bucket, int app_group,
+            map<pair<int, int>, long long> & out) {
+        if(bucket <= 0)
+            return false;
+
+        // Coarsest table that is still exact for this bucket
+        int source = sourceDetail;
+        if(m_hasRollups && bucket % (24 * 3600) == 0)
+            source = sourceDaily;
+        else if(m_hasRollups && bucket % 3600 == 0)
+            source = sourceHourly;
+        return seriesLayered(source, from, to, bucket, app_group, out);
+    }
+
+    /** 
+     * @brief Runs query returning single integer
+     */
+    bool StorageSqlite::queryInt(const string & sql, long long & value) {
+        sqlite3_stmt *stmt;
+        if(SQLITE_OK != sqlite3_prepare(m_db, sql.c_str(), sql.size(), &stmt, NULL))
+            return false;
+        bool ok = (SQLITE_ROW == sqlite3_step(stmt) && SQLITE_NULL != sqlite3_column_type(stmt, 0));
+        if(ok)
+            value = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+        return ok;
+    }
+
+    /** 
+     * @brief Merges one day of detail rows older than downsample age into hour clusters
+     *
+     * Progress is kept in keyfrog_meta, so days are not visited again.
+     */
+    bool StorageSqlite::downsampleStep(bool & done) {
+        int cutoff = time(NULL) - m_downsampleAge * 24 * 3600;
+        cutoff -= cutoff % 3600;
+        if(m_compactCursor == -1) {
+            string value;
+            long long first;
+            if(readMeta("downsampled_until", value))
+                m_compactCursor = atoi(value.c_str());
+            else if(queryInt("SELECT MIN(cluster_begin) FROM keypresses", first))
+                m_compactCursor = first - first % 3600;
+            else
+                m_compactCursor = cutoff;
+        }
+        if(m_compactCursor >= cutoff) {
+            done = true;
+            return true;
+        }
+
+        string begin = boost::lexical_cast<string>(m_compactCursor);
+        string end = boost::lexical_cast<string>(min(m_compactCursor + 24 * 3600, cutoff));
+        string range = "WHERE cluster_begin >= " + begin + " AND cluster_begin < " + end;
+        string sql =
+            "BEGIN; "
+            "CREATE TEMP TABLE IF NOT EXISTS keypresses_downsample ( cb INTEGER, g INTEGER, c INTEGER ); "
+            "INSERT INTO temp.keypresses_downsample "
+            "SELECT cluster_begin - cluster_begin % 3600, app_group, SUM(count) FROM keypresses " + range + " GROUP BY 1, 2; "
+            "DELETE FROM keypresses " + range + "; "
+            "INSERT INTO keypresses ( cluster_begin, cluster_end, count, app_group ) "
+            "SELECT cb, cb + 3600, c, g FROM temp.keypresses_downsample; "
+            "DELETE FROM temp.keypresses_downsample; "
+            "INSERT OR REPLACE INTO keyfrog_meta ( key, value ) VALUES ( 'downsampled_until', '" + end + "' ); "
+            "COMMIT; ";
+        char *zErrMsg = NULL;
+        if(SQLITE_OK != sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg)) {
+            _dbg("Downsampling failed: `%s'", zErrMsg);
+            sqlite3_free(zErrMsg);
+            sqlite3_exec(m_db, "ROLLBACK", NULL, NULL, NULL);
+            return false;
+        }
+        m_compactCursor = atoi(end.c_str());
+        return true;
+    }
+
+    /** 
+     * @brief Deletes up to a week of detail rows older than retention period
+     */
+    bool StorageSqlite::expireStep(bool & done) {
+        int cutoff = getClusterStart(time(NULL) - m_detailRetention * 24 * 3600);
+        long long first;
+        if(!queryInt("SELECT MIN(cluster_begin) FROM keypresses", first) || first >= cutoff) {
+            done = true;
+            return true;
+        }
+
+        int end = min(first + 7 * 24 * 3600, (long long) cutoff);
+        // Key histograms, active time, intervals and seat counts go together with detail rows
+        sqlite3_stmt *stmts[] = { m_expireStmt, m_keyHist_expireStmt, m_active_expireStmt, m_interval_expireStmt, m_seat_expireStmt };
+        for(size_t i = 0; i < sizeof(stmts) / sizeof(stmts[0]); i++) {
+            sqlite3_bind_int(stmts[i], 1, first);
+            sqlite3_bind_int(stmts[i], 2, end);
+            int rc = sqlite3_step(stmts[i]);
+            sqlite3_reset(stmts[i]);
+            if(rc != SQLITE_DONE) {
+                _dbg("expireStep -- FAIL (rc=%d)", rc);
+                return false;
+            }
+            _dbg("Expired %d rows", sqlite3_changes(m_db));
+        }
+        return true;
+    }
+
+    /** 
+     * @brief Gives some free pages back to file system
+     */
+    bool StorageSqlite::vacuumStep(bool & done) {
+        long long mode, freePages;
+        // Databases created before incremental vacuum are left alone
+        if(!queryInt("PRAGMA auto_vacuum", mode) || mode != 2 ||
+                !queryInt("PRAGMA freelist_count", freePages) || freePages == 0) {
+            done = true;
+            return true;
+        }
+        char *zErrMsg = NULL;
+        if(SQLITE_OK != sqlite3_exec(m_db, "PRAGMA incremental_vacuum(256)", NULL, NULL, &zErrMsg)) {
+            _dbg("incremental_vacuum failed: `%s'", zErrMsg);
+            sqlite3_free(zErrMsg);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Retention must hold even if user never pauses long enough for
+     * compaction, so commiter calls this on its own schedule too
+     */
+    bool StorageSqlite::expire() {
+        if(m_db == NULL || m_readOnly || m_detailRetention <= 0)
+            return false;
+        bool done = false;
+        return expireStep(done) && !done;
+    }
+
+    /** 
+     * @brief Does one bounded step of current phase
+     */
+    bool StorageSqlite::compactStep(bool & phaseDone) {
+        phaseDone = false;
+        switch(m_compactPhase) {
+            case compactDownsample:
+                if(m_downsampleAge <= 0 || m_clusterSize >= 3600) {
+                    phaseDone = true;
+                    return true;
+                }
+                return downsampleStep(phaseDone);
+            case compactExpire:
+                if(m_detailRetention <= 0) {
+                    phaseDone = true;
+                    return true;
+                }
+                return expireStep(phaseDone);
+            case compactVacuum:
+                return vacuumStep(phaseDone);
+            case compactAnalyze: {
+                phaseDone = true;
+#if SQLITE_VERSION_NUMBER >= 3018000
+                const char *sql = "PRAGMA optimize";
+#else
+                const char *sql = "ANALYZE";
+#endif
+                return SQLITE_OK == sqlite3_exec(m_db, sql, NULL, NULL, NULL);
+            }
+        }
+        phaseDone = true;
+        return true;
+    }
+
+    /** 
+     * @brief Runs compaction steps until given time is used
+     *
+     * Each step is a short transaction of its own, so the daemon's
+     * commits are never held up for long. A failing step ends the
+     * cycle; it's retried in the next one.
+     */
+    bool StorageSqlite::compact(int milliseconds) {
+        if(m_db == NULL || m_readOnly)
+            return false;
+        int64_t deadline = monotonic_ms() + milliseconds;
+        do {
+            bool phaseDone;
+            if(!compactStep(phaseDone)) {
+                _dbg("Compaction phase %d failed", m_compactPhase);
+                phaseDone = true;
+                m_compactPhase = compactAnalyze;
+            }
+            if(phaseDone) {
+                m_compactCursor = -1;
+                if(++m_compactPhase == compactPhaseCount) {
+                    m_compactPhase = compactDownsample;
+                    _dbg("Compaction cycle finished");
+                    return false;
+                }
+            }
+        } while(monotonic_ms() < deadline);
+        return true;
+    }
+
+    /** 
+     * @brief Merges histogram into stored one (read, add, write back)
+     */
+    bool StorageSqlite::addKeyHistogram(int app_group, int timestamp, const KeyHistogram & histogram) {
+        if(m_readOnly)
+            return false;
+        int cluster_begin = getClusterStart(timestamp);
+        KeyHistogram merged = histogram;
+
+        sqlite3_bind_int(m_keyHist_selectStmt, 1, cluster_begin);
+        sqlite3_bind_int(m_keyHist_selectStmt, 2, app_group);
+        int rc = sqlite3_step(m_keyHist_selectStmt);
+        bool ok = true;
+        if(rc == SQLITE_ROW) {
+            ok = merged.mergePacked(sqlite3_column_blob(m_keyHist_selectStmt, 0),
+                    sqlite3_column_bytes(m_keyHist_selectStmt, 0));
+            if(!ok)
+                _dbg("Malformed keyhist row (%d, %d) replaced", cluster_begin, app_group);
+        }
+        sqlite3_reset(m_keyHist_selectStmt);
+        if(!ok)
+            merged = histogram;
+
+        string packed;
+        merged.pack(packed);
+        sqlite3_bind_int(m_keyHist_replaceStmt, 1, cluster_begin);
+        sqlite3_bind_int(m_keyHist_replaceStmt, 2, app_group);
+        sqlite3_bind_blob(m_keyHist_replaceStmt, 3, packed.data(), packed.size(), SQLITE_STATIC);
+        rc = sqlite3_step(m_keyHist_replaceStmt);
+        sqlite3_reset(m_keyHist_replaceStmt);
+        if(rc != SQLITE_DONE) {
+            _dbg("addKeyHistogram -- FAIL (rc=%d)", rc);
+            return false;
+        }
+        return true;
+    }
+
+    bool StorageSqlite::keyHistogram(int from, int to, int app_group, KeyHistogram & out) {
+        bool filtered = app_group != -1;
+        sqlite3_stmt *& stmt = m_keyHistStmt[filtered];
+        if(!prepareRead(stmt, string("SELECT keys FROM keyhist WHERE cluster_begin >= ?1 AND cluster_begin < ?2") +
+                    (filtered ? " AND app_group = ?3" : "")))
+            return false;
+        sqlite3_bind_int(stmt, 1, from);
+        sqlite3_bind_int(stmt, 2, to);
+        if(filtered)
+            sqlite3_bind_int(stmt, 3, app_group);
+        int rc;
+        bool ok = true;
+        while(ok && SQLITE_ROW == (rc = sqlite3_step(stmt))) {
+            ok = out.mergePacked(sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0));
+        }
+        sqlite3_reset(stmt);
+        if(!ok || rc != SQLITE_DONE) {
+            _dbg("keyHistogram -- FAIL (rc=%d)", rc);
+            return false;
+        }
+        return true;
+    }
+
+    bool StorageSqlite::addActiveTime(int app_group, int timestamp, const ActiveTime & active) {
+        if(m_readOnly)
+            return false;
+        int cluster_begin = getClusterStart(timestamp);
+        sqlite3_stmt *stmts[] = { m_active_updateStmt, m_active_insertStmt };
+        int rc = SQLITE_DONE;
+        for(int i = 0; i < 2; i++) {
+            sqlite3_bind_int64(stmts[i], 1, active.milliseconds);
+            sqlite3_bind_int64(stmts[i], 2, active.sessions);
+            sqlite3_bind_int(stmts[i], 3, cluster_begin);
+            sqlite3_bind_int(stmts[i], 4, app_group);
+            rc = sqlite3_step(stmts[i]);
+            sqlite3_reset(stmts[i]);
+            // Insert only when there was no row to update
+            if(rc == SQLITE_DONE && sqlite3_changes(m_db) > 0)
+                return true;
+        }
+        _dbg("addActiveTime -- FAIL (rc=%d)", rc);
+        return false;
+    }
+
+    bool StorageSqlite::activeTime(int from, int to, map<int, ActiveTime> & out) {
+        if(!prepareRead(m_activeStmt, "SELECT app_group, SUM(milliseconds), SUM(sessions) FROM activetime "
+                    "WHERE cluster_begin >= ?1 AND cluster_begin < ?2 GROUP BY app_group"))
+            return false;
+        sqlite3_bind_int(m_activeStmt, 1, from);
+        sqlite3_bind_int(m_activeStmt, 2, to);
+        int rc;
+        while(SQLITE_ROW == (rc = sqlite3_step(m_activeStmt))) {
+            ActiveTime & active = out[sqlite3_column_int(m_activeStmt, 0)];
+            active.milliseconds += sqlite3_column_int64(m_activeStmt, 1);
+            active.sessions += sqlite3_column_int64(m_activeStmt, 2);
+        }
+        sqlite3_reset(m_activeStmt);
+        if(rc != SQLITE_DONE) {
+            _dbg("activeTime -- FAIL (rc=%d)", rc);
+            return false;
+        }
+        return true;
+    }
+
+    bool StorageSqlite::addIntervalHistogram(int app_group, int timestamp, const IntervalHistogram & histogram) {
+        if(m_readOnly)
+            return false;
+        int cluster_begin = getClusterStart(timestamp);
+        IntervalHistogram merged = histogram;
+
+        sqlite3_bind_int(m_interval_selectStmt, 1, cluster_begin);
+        sqlite3_bind_int(m_interval_selectStmt, 2, app_group);
+        int rc = sqlite3_step(m_interval_selectStmt);
+        if(rc == SQLITE_ROW && !merged.mergePacked(sqlite3_column_blob(m_interval_selectStmt, 0),
+                    sqlite3_column_bytes(m_interval_selectStmt, 0)))
+            _dbg("Malformed intervals row (%d, %d) replaced", cluster_begin, app_group);
+        sqlite3_reset(m_interval_selectStmt);
+
+        string packed;
+        merged.pack(packed);
+        sqlite3_bind_int(m_interval_replaceStmt, 1, cluster_begin);
+        sqlite3_bind_int(m_interval_replaceStmt, 2, app_group);
+        sqlite3_bind_blob(m_interval_replaceStmt, 3, packed.data(), packed.size(), SQLITE_STATIC);
+        rc = sqlite3_step(m_interval_replaceStmt);
+        sqlite3_reset(m_interval_replaceStmt);
+        if(rc != SQLITE_DONE) {
+            _dbg("addIntervalHistogram -- FAIL (rc=%d)", rc);
+            return false;
+        }
+        return true;
+    }
+
+    bool StorageSqlite::intervalHistogram(int from, int to, int app_group, IntervalHistogram & out) {
+        bool filtered = app_group != -1;
+        sqlite3_stmt *& stmt = m_intervalStmt[filtered];
+        if(!prepareRead(stmt, string("SELECT histogram FROM intervals WHERE cluster_begin >= ?1 AND cluster_begin < ?2") +
+                    (filtered ? " AND app_group = ?3" : "")))
+            return false;
+        sqlite3_bind_int(stmt, 1, from);
+        sqlite3_bind_int(stmt, 2, to);
+        if(filtered)
+            sqlite3_bind_int(stmt, 3, app_group);
+        int rc;
+        bool ok = true;
+        while(ok && SQLITE_ROW == (rc = sqlite3_step(stmt))) {
+            ok = out.mergePacked(sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0));
+        }
+        sqlite3_reset(stmt);
+        if(!ok || rc != SQLITE_DONE) {
+            _dbg("intervalHistogram -- FAIL (rc=%d)", rc);
+            return false;
+        }
+        return true;
+    }
+
+    bool StorageSqlite::addSeatKeyPresses(int seat, int app_group, int timestamp, int count) {
+        if(m_readOnly)
+            return false;
+        sqlite3_stmt *stmts[] = { m_seat_updateStmt, m_seat_insertStmt };
+        int rc = SQLITE_DONE;
+        for(int i = 0; i < 2; i++) {
+            sqlite3_bind_int(stmts[i], 1, count);
+            sqlite3_bind_int(stmts[i], 2, getClusterStart(timestamp));
+            sqlite3_bind_int(stmts[i], 3, app_group);
+            sqlite3_bind_int(stmts[i], 4, seat);
+            rc = sqlite3_step(stmts[i]);
+            sqlite3_reset(stmts[i]);
+            // Insert only when there was no row to update
+            if(rc == SQLITE_DONE && sqlite3_changes(m_db) > 0)
+                return true;
+        }
+        _dbg("addSeatKeyPresses -- FAIL (rc=%d)", rc);
+        return false;
+    }
+
+    bool StorageSqlite::seatTotals(int from, int to, map<pair<int, int>, long long> & out) {
+        if(!prepareRead(m_seatStmt, "SELECT seat, app_group, SUM(count) FROM seatpresses "
+                    "WHERE cluster_begin >= ?1 AND cluster_begin < ?2 GROUP BY seat, app_group"))
+            return false;
+        sqlite3_bind_int(m_seatStmt, 1, from);
+        sqlite3_bind_int(m_seatStmt, 2, to);
+        int rc;
+        while(SQLITE_ROW == (rc = sqlite3_step(m_seatStmt)))
+            out[make_pair(sqlite3_column_int(m_seatStmt, 0), sqlite3_column_int(m_seatStmt, 1))] +=
+                sqlite3_column_int64(m_seatStmt, 2);
+        sqlite3_reset(m_seatStmt);
+        if(rc != SQLITE_DONE) {
+            _dbg("seatTotals -- FAIL (rc=%d)", rc);
+            return false;
+        }
         return true;
     }
 }
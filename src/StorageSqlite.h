@@ -39,36 +39,155 @@ namespace keyfrog {
     /**
      * @author Sebastian Gniazdowski <srnt at users dot sf dot net>
      *
-     * @warning FIXME: add setter for cluster size
-     *
      * Front interface for storing and reading event data.
      */
     class StorageSqlite : public Storage {
+        public:
+        /// Coarser copies of keypresses table, maintained on every write
+        enum Rollup {
+            rollupHourly = 0,
+            rollupDaily,
+            rollupMonthly,
+            rollupCount
+        };
+
+        /// Version of schema created by this code
+        static const int schemaVersion = 2;
+
+        /// Steps of compaction cycle, in order
+        enum CompactPhase {
+            compactDownsample = 0,
+            compactExpire,
+            compactVacuum,
+            compactAnalyze,
+            compactPhaseCount
+        };
+
+        private:
+        /// Tables read by aggregating queries: keypresses, then rollups
+        enum Source {
+            sourceDetail = 0,
+            sourceHourly = 1 + rollupHourly,
+            sourceDaily = 1 + rollupDaily,
+            sourceCount = 1 + rollupCount
+        };
+
         std::string m_uri;
         sqlite3 *m_db;
+        bool m_readOnly;
+        /// Rollup tables exist (may be missing in read-only mode)
+        bool m_hasRollups;
         sqlite3_stmt *m_addKeyPress_insertStmt1;
         sqlite3_stmt *m_addKeyPress_updateStmt1;
-        sqlite3_stmt *m_addKeyPress_existsStmt1;
+        sqlite3_stmt *m_rollup_insertStmt[rollupCount];
+        sqlite3_stmt *m_rollup_updateStmt[rollupCount];
+        sqlite3_stmt *m_expireStmt;
+        sqlite3_stmt *m_keyHist_selectStmt;
+        sqlite3_stmt *m_keyHist_replaceStmt;
+        sqlite3_stmt *m_keyHist_expireStmt;
+        sqlite3_stmt *m_active_updateStmt;
+        sqlite3_stmt *m_active_insertStmt;
+        sqlite3_stmt *m_active_expireStmt;
+        sqlite3_stmt *m_interval_selectStmt;
+        sqlite3_stmt *m_interval_replaceStmt;
+        sqlite3_stmt *m_interval_expireStmt;
+        sqlite3_stmt *m_seat_updateStmt;
+        sqlite3_stmt *m_seat_insertStmt;
+        sqlite3_stmt *m_seat_expireStmt;
+
+        // Read statements, prepared on first use
+        sqlite3_stmt *m_scanRangeStmt;
+        sqlite3_stmt *m_scanGroupStmt;
+        sqlite3_stmt *m_totalsStmt[sourceCount];
+        /// [source][filtered by group]
+        sqlite3_stmt *m_seriesStmt[sourceCount][2];
+        /// [filtered by group]
+        sqlite3_stmt *m_keyHistStmt[2];
+        sqlite3_stmt *m_activeStmt;
+        /// [filtered by group]
+        sqlite3_stmt *m_intervalStmt[2];
+        sqlite3_stmt *m_seatStmt;
 
         int m_clusterSize;
 
+        /// Detail rows older than this many days are deleted (0 - keep forever)
+        int m_detailRetention;
+        /// Detail rows older than this many days are merged into hour clusters (0 - never)
+        int m_downsampleAge;
+
+        /// Phase of compaction cycle and start of range its next step handles (-1 - not known yet)
+        int m_compactPhase;
+        int m_compactCursor;
+
         bool prepareStatements();
+        bool prepareRead(sqlite3_stmt *& stmt, const std::string & sql);
+        void finalizeStatements();
+        bool tableExists(const char *name);
+        bool tableWithoutRowid(const char *name);
         bool initDatabase();
+        bool initMeta(bool fresh);
+        bool migrateSchema();
+        int storedClusterSize();
+        bool rebucket(int oldClusterSize);
+        bool readMeta(const std::string & key, std::string & value);
+        bool writeMeta(const std::string & key, const std::string & value);
+        bool initRollups();
+        bool initKeyHistograms();
+        bool initActiveTime();
+        bool initIntervals();
+        bool initSeats();
+        bool addToRollup(Rollup rollup, int app_group, int timestamp, int count);
+        bool queryInt(const std::string & sql, long long & value);
+        bool compactStep(bool & phaseDone);
+        bool downsampleStep(bool & done);
+        bool expireStep(bool & done);
+        bool vacuumStep(bool & done);
+        bool scan(sqlite3_stmt *stmt, KeyPressSink & sink);
+        bool sumRange(int source, int from, int to, std::map<int, long long> & out);
+        bool seriesRange(int source, int from, int to, int bucket, int app_group,
+                std::map<std::pair<int, int>, long long> & out);
+        bool sumLayered(int source, int from, int to, std::map<int, long long> & out);
+        bool seriesLayered(int source, int from, int to, int bucket, int app_group,
+                std::map<std::pair<int, int>, long long> & out);
 
         public:
         StorageSqlite();
         ~StorageSqlite();
 
+        /// Name of table holding given rollup
+        static const char *rollupTable(Rollup rollup);
+
+        /// Days to keep rows of keypresses table (rollups are kept forever)
+        void setDetailRetention(int days) { m_detailRetention = days; }
+
+        /// Days after which detail rows are downsampled to hour clusters
+        void setDownsampleAge(int days) { m_downsampleAge = days; }
+
         /** 
          * @brief Connects to given database
          */
         virtual bool connect(std::string uri);
 
+        /** 
+         * @brief Opens existing database without changing it
+         */
+        virtual bool connectReadOnly(std::string uri);
+
         /** 
          * @brief Disconnects from database
          */
         virtual void disconnect();
 
+        /** 
+         * @brief Sets cluster width; existing rows are re-bucketed on connect if it changed
+         */
+        virtual void setClusterSize(int seconds);
+
+        /** 
+         * @brief Width of cluster in seconds
+         */
+        virtual int clusterSize() { return m_clusterSize; }
+
         /** 
          * @brief Gets begining of  cluster timestamp for given timestamp
          */
@@ -83,6 +202,92 @@ namespace keyfrog {
          * @brief Records keypresses at given time
          */
         virtual bool addKeyPress(int app_group, int timestamp, int count = 1);
+
+        /** 
+         * @brief Merges key histogram into keyhist row of cluster
+         */
+        virtual bool addKeyHistogram(int app_group, int timestamp, const KeyHistogram & histogram);
+
+        /** 
+         * @brief Adds active time to activetime row of cluster
+         */
+        virtual bool addActiveTime(int app_group, int timestamp, const ActiveTime & active);
+
+        /** 
+         * @brief Merges interval histogram into intervals row of cluster
+         */
+        virtual bool addIntervalHistogram(int app_group, int timestamp, const IntervalHistogram & histogram);
+
+        /** 
+         * @brief Adds keypresses to seatpresses row of cluster
+         */
+        virtual bool addSeatKeyPresses(int seat, int app_group, int timestamp, int count);
+
+        /** 
+         * @brief Opens transaction
+         */
+        virtual bool beginBatch();
+
+        /** 
+         * @brief Commits transaction (rolls back on failure)
+         */
+        virtual bool commitBatch();
+
+        /** 
+         * @brief Rolls transaction back
+         */
+        virtual void abortBatch();
+
+        /** 
+         * @brief Downsamples and expires old detail rows, vacuums, updates statistics
+         */
+        virtual bool compact(int milliseconds);
+
+        /** 
+         * @brief Deletes up to a week of detail rows past retention
+         */
+        virtual bool expire();
+
+        /** 
+         * @brief Range scan in primary key order
+         */
+        virtual bool scanRange(int from, int to, KeyPressSink & sink);
+
+        /** 
+         * @brief Range scan of one group through covering group index
+         */
+        virtual bool scanGroupRange(int app_group, int from, int to, KeyPressSink & sink);
+
+        /** 
+         * @brief Sums keypresses per group, whole days and hours from rollups
+         */
+        virtual bool totals(int from, int to, std::map<int, long long> & out);
+
+        /** 
+         * @brief Sums keypresses per bucket in SQL, from coarsest exact table
+         */
+        virtual bool series(int from, int to, int bucket, int app_group,
+                std::map<std::pair<int, int>, long long> & out);
+
+        /** 
+         * @brief Sums packed histograms of keyhist table
+         */
+        virtual bool keyHistogram(int from, int to, int app_group, KeyHistogram & out);
+
+        /** 
+         * @brief Sums activetime table per group
+         */
+        virtual bool activeTime(int from, int to, std::map<int, ActiveTime> & out);
+
+        /** 
+         * @brief Sums packed histograms of intervals table
+         */
+        virtual bool intervalHistogram(int from, int to, int app_group, IntervalHistogram & out);
+
+        /** 
+         * @brief Sums seatpresses table per seat and group
+         */
+        virtual bool seatTotals(int from, int to, std::map<std::pair<int, int>, long long> & out);
     };
 }
 
@@ -0,0 +1,460 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "StorageTsFile.h"
+#include "Debug.h"
+
+#include <ctime>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace keyfrog {
+
+    static const char tsFileMagic[8] = { 'K', 'F', 'T', 'S', 'F', 'I', 'L', '1' };
+    static const uint32_t tsFileVersion = 1;
+    /// Counters start at page boundary
+    static const size_t tsFileHeaderSize = 4096;
+    /// Rows passed to a KeyPressSink at once
+    static const size_t tsFileScanBatch = 1024;
+    /// Farthest a write may extend the file past its data, seconds
+    static const int64_t tsFileMaxGrowth = 366 * 24 * 3600;
+    /// Farthest in future a keypress may be, seconds
+    static const int64_t tsFileMaxAhead = 24 * 3600;
+
+    const uint32_t StorageTsFile::slotCount;
+
+    StorageTsFile::StorageTsFile() : m_fd(-1), m_map(NULL), m_mapSize(0), m_header(NULL),
+        m_counters(NULL), m_lastSlot(0), m_readOnly(false), m_baseTime(0), m_clusterCount(0),
+        m_slotsUsed(0), m_inBatch(false)
+    {
+        // Cluster of time that keys will be group by
+        m_clusterSize = 15*60;
+    }
+
+    StorageTsFile::~StorageTsFile() {
+        disconnect();
+    }
+
+    bool StorageTsFile::map(size_t size) {
+        if(m_map) {
+            munmap(m_map, m_mapSize);
+            m_map = NULL;
+        }
+        int prot = m_readOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+        void *addr = mmap(NULL, size, prot, MAP_SHARED, m_fd, 0);
+        if(addr == MAP_FAILED) {
+            _dbg("mmap(%s) failed", m_uri.c_str());
+            return false;
+        }
+        m_map = (char *) addr;
+        m_mapSize = size;
+        m_header = (Header *) m_map;
+        m_counters = (uint32_t *) (m_map + tsFileHeaderSize);
+        return true;
+    }
+
+    /**
+     * Extends file so that it holds given number of clusters
+     */
+    bool StorageTsFile::resize(uint32_t clusterCount) {
+        size_t size = tsFileHeaderSize + (size_t) clusterCount * slotCount * sizeof(uint32_t);
+        if(-1 == ftruncate(m_fd, size)) {
+            _dbg("ftruncate(%s) failed", m_uri.c_str());
+            return false;
+        }
+        if(!map(size))
+            return false;
+        m_header->clusterCount = clusterCount;
+        return true;
+    }
+
+    /**
+     * Moves data so that file starts at earlier cluster (rare: only
+     * when older data is written, e.g. by journal replay)
+     */
+    bool StorageTsFile::rebase(int32_t baseTime) {
+        uint32_t shift = (m_header->baseTime - baseTime) / m_clusterSize;
+        uint32_t oldCount = m_header->clusterCount;
+        if(!resize(oldCount + shift))
+            return false;
+        memmove(m_counters + (size_t) shift * slotCount, m_counters, (size_t) oldCount * slotCount * sizeof(uint32_t));
+        memset(m_counters, 0, (size_t) shift * slotCount * sizeof(uint32_t));
+        m_header->baseTime = baseTime;
+        return true;
+    }
+
+    /**
+     * Returns column of given group, optionally allocating it
+     */
+    int StorageTsFile::slotOf(int app_group, bool create) {
+        uint32_t slotsUsed = min(m_header->slotsUsed, slotCount);
+        if(m_lastSlot < slotsUsed && m_header->groups[m_lastSlot] == app_group)
+            return m_lastSlot;
+        for(uint32_t i = 0; i < slotsUsed; i++) {
+            if(m_header->groups[i] == app_group) {
+                m_lastSlot = i;
+                return i;
+            }
+        }
+        if(!create || slotsUsed == slotCount)
+            return -1;
+        m_lastSlot = m_header->slotsUsed++;
+        m_header->groups[m_lastSlot] = app_group;
+        return m_lastSlot;
+    }
+
+    bool StorageTsFile::connect(std::string uri) {
+        m_uri = uri;
+        m_fd = ::open(m_uri.c_str(), O_RDWR | O_CREAT, 0644);
+        if(m_fd == -1) {
+            _dbg("Could not open `%s'", m_uri.c_str());
+            return false;
+        }
+        struct stat st;
+        if(-1 == fstat(m_fd, &st)) {
+            disconnect();
+            return false;
+        }
+
+        if((size_t) st.st_size < tsFileHeaderSize) {
+            // New file
+            if(!resize(0)) {
+                disconnect();
+                return false;
+            }
+            memset(m_map, 0, tsFileHeaderSize);
+            memcpy(m_header->magic, tsFileMagic, sizeof(tsFileMagic));
+            m_header->version = tsFileVersion;
+            m_header->clusterSize = m_clusterSize;
+            m_header->baseTime = 0;
+            m_header->clusterCount = 0;
+            m_header->slotsUsed = 0;
+            _dbg("Time series file `%s' created", m_uri.c_str());
+            return true;
+        }
+
+        if(!map(st.st_size) || !checkHeader()) {
+            disconnect();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Validates mapped header and takes cluster size from it
+     */
+    bool StorageTsFile::checkHeader() {
+        if(memcmp(m_header->magic, tsFileMagic, sizeof(tsFileMagic)) || m_header->version != tsFileVersion ||
+                m_header->slotsUsed > slotCount || m_header->clusterSize == 0 ||
+                tsFileHeaderSize + (size_t) m_header->clusterCount * slotCount * sizeof(uint32_t) > m_mapSize) {
+            _dbg("`%s' is not a keyfrog time series file", m_uri.c_str());
+            return false;
+        }
+        if((int) m_header->clusterSize != m_clusterSize) {
+            // Layout depends on cluster size, so the file wins
+            _dbg("Time series file uses %d s clusters (configured: %d s)", m_header->clusterSize, m_clusterSize);
+            m_clusterSize = m_header->clusterSize;
+        }
+        return true;
+    }
+
+    bool StorageTsFile::connectReadOnly(std::string uri) {
+        m_uri = uri;
+        m_readOnly = true;
+        m_fd = ::open(m_uri.c_str(), O_RDONLY);
+        if(m_fd == -1) {
+            _dbg("Could not open `%s'", m_uri.c_str());
+            return false;
+        }
+        struct stat st;
+        if(-1 == fstat(m_fd, &st) || (size_t) st.st_size < tsFileHeaderSize ||
+                !map(st.st_size) || !checkHeader()) {
+            disconnect();
+            return false;
+        }
+        return true;
+    }
+
+    void StorageTsFile::disconnect() {
+        if(m_map) {
+            if(!m_readOnly)
+                msync(m_map, m_mapSize, MS_SYNC);
+            munmap(m_map, m_mapSize);
+            m_map = NULL;
+        }
+        if(m_fd != -1) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        m_header = NULL;
+        m_counters = NULL;
+    }
+
+    void StorageTsFile::setClusterSize(int seconds) {
+        if(seconds > 0)
+            m_clusterSize = seconds;
+    }
+
+    int StorageTsFile::getClusterStart(int timestamp) {
+        return timestamp - (timestamp % m_clusterSize);
+    }
+
+    bool StorageTsFile::addKeyPress(int app_group, int count) {
+        return addKeyPress(app_group, time(NULL), count);
+    }
+
+    bool StorageTsFile::addKeyPress(int app_group, int timestamp, int count) {
+        if(m_map == NULL || m_readOnly)
+            return false;
+        Delta delta;
+        delta.clusterBegin = getClusterStart(timestamp);
+        delta.appGroup = app_group;
+        delta.count = count;
+        if(m_inBatch) {
+            m_batch.push_back(delta);
+            return true;
+        }
+        return apply(vector<Delta>(1, delta));
+    }
+
+    /**
+     * Adds keypresses to counters. File is grown (rebased) to cover all
+     * of them first, so once counters are touched nothing can fail.
+     * Groups that don't fit into slot table are logged and skipped, so
+     * are keypresses far away from data already in file (a clock jump
+     * would otherwise grow it by whole years of empty rows).
+     */
+    bool StorageTsFile::apply(const vector<Delta> & batch) {
+        if(batch.empty())
+            return true;
+        int64_t low, high;
+        if(m_header->clusterCount == 0) {
+            low = high = batch[0].clusterBegin;
+        } else {
+            low = m_header->baseTime;
+            high = low + (int64_t) (m_header->clusterCount - 1) * m_clusterSize;
+        }
+        low -= tsFileMaxGrowth;
+        high = min(high + tsFileMaxGrowth, (int64_t) time(NULL) + tsFileMaxAhead);
+
+        vector<Delta> deltas;
+        deltas.reserve(batch.size());
+        for(size_t i = 0; i < batch.size(); i++) {
+            if(batch[i].clusterBegin < low || batch[i].clusterBegin > high) {
+                _err("Keypresses at %d are too far from data in `%s', %d dropped", batch[i].clusterBegin,
+                        m_uri.c_str(), batch[i].count);
+                continue;
+            }
+            deltas.push_back(batch[i]);
+        }
+        if(deltas.empty())
+            return true;
+
+        int32_t first = deltas[0].clusterBegin;
+        int32_t last = first;
+        for(size_t i = 1; i < deltas.size(); i++) {
+            first = min(first, deltas[i].clusterBegin);
+            last = max(last, deltas[i].clusterBegin);
+        }
+
+        if(m_header->clusterCount == 0) {
+            m_header->baseTime = first;
+        } else if(first < m_header->baseTime) {
+            if(!rebase(first))
+                return false;
+        }
+        uint32_t index = (last - m_header->baseTime) / m_clusterSize;
+        if(index >= m_header->clusterCount) {
+            // Grow by a week of clusters
+            uint32_t week = 7 * 24 * 3600 / m_clusterSize;
+            if(!resize(index + (week ? week : 1)))
+                return false;
+        }
+
+        for(size_t i = 0; i < deltas.size(); i++) {
+            int slot = slotOf(deltas[i].appGroup, true);
+            if(slot == -1) {
+                _err("No free group slot for group %d, %d keypresses dropped", deltas[i].appGroup, deltas[i].count);
+                continue;
+            }
+            index = (deltas[i].clusterBegin - m_header->baseTime) / m_clusterSize;
+            m_counters[(size_t) index * slotCount + slot] += deltas[i].count;
+        }
+        return true;
+    }
+
+    bool StorageTsFile::beginBatch() {
+        if(m_map == NULL || m_readOnly)
+            return false;
+        m_batch.clear();
+        m_inBatch = true;
+        return true;
+    }
+
+    bool StorageTsFile::commitBatch() {
+        if(m_map == NULL || m_readOnly)
+            return false;
+        bool ok = apply(m_batch);
+        m_batch.clear();
+        m_inBatch = false;
+        if(ok && 0 != msync(m_map, m_mapSize, MS_SYNC)) {
+            // Counters are in shared mapping already, retrying would count them twice
+            _err("msync(%s) failed", m_uri.c_str());
+        }
+        return ok;
+    }
+
+    void StorageTsFile::abortBatch() {
+        m_batch.clear();
+        m_inBatch = false;
+    }
+
+    /**
+     * Takes header fields for a read. Read-only mapping is extended if
+     * file grew, and clusters are limited to the mapped ones in case
+     * it grew again since.
+     */
+    bool StorageTsFile::refreshView() {
+        if(m_map == NULL)
+            return false;
+        if(m_readOnly) {
+            struct stat st;
+            if(0 == fstat(m_fd, &st) && (size_t) st.st_size > m_mapSize && !map(st.st_size)) {
+                _dbg("Could not remap `%s' after it grew", m_uri.c_str());
+                return false;
+            }
+        }
+        size_t mapped = (m_mapSize - tsFileHeaderSize) / (slotCount * sizeof(uint32_t));
+        m_clusterCount = (uint32_t) min((size_t) m_header->clusterCount, mapped);
+        m_baseTime = m_header->baseTime;
+        m_slotsUsed = min(m_header->slotsUsed, slotCount);
+        return true;
+    }
+
+    bool StorageTsFile::totals(int from, int to, std::map<int, long long> & out) {
+        if(!refreshView())
+            return false;
+        int64_t first, end;
+        if(!clusterRange(from, to, first, end))
+            return true;
+        for(int64_t t = first; t < end; t += m_clusterSize) {
+            const uint32_t *row = m_counters + (size_t) ((t - m_baseTime) / m_clusterSize) * slotCount;
+            for(uint32_t slot = 0; slot < m_slotsUsed; slot++) {
+                if(row[slot])
+                    out[m_header->groups[slot]] += row[slot];
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Clusters of file beginning in [from, to): [first, end)
+     * @return false if there are none
+     */
+    bool StorageTsFile::clusterRange(int from, int to, int64_t & first, int64_t & end) {
+        if(m_clusterCount == 0 || from >= to)
+            return false;
+        first = (int64_t) getClusterStart(from);
+        if(first < from)
+            first += m_clusterSize;
+        first = max(first, (int64_t) m_baseTime);
+        end = min((int64_t) to, (int64_t) m_baseTime + (int64_t) m_clusterCount * m_clusterSize);
+        return first < end;
+    }
+
+    bool StorageTsFile::scanRange(int from, int to, KeyPressSink & sink) {
+        if(!refreshView())
+            return false;
+        int64_t first, end;
+        if(!clusterRange(from, to, first, end))
+            return true;
+
+        // Slots are allocated in order groups appear, rows need group order
+        vector<pair<int32_t, uint32_t> > slots;
+        for(uint32_t slot = 0; slot < m_slotsUsed; slot++)
+            slots.push_back(make_pair(m_header->groups[slot], slot));
+        sort(slots.begin(), slots.end());
+
+        KeyPressRow rows[tsFileScanBatch];
+        size_t n = 0;
+        for(int64_t t = first; t < end; t += m_clusterSize) {
+            const uint32_t *row = m_counters + (size_t) ((t - m_baseTime) / m_clusterSize) * slotCount;
+            for(size_t i = 0; i < slots.size(); i++) {
+                if(!row[slots[i].second])
+                    continue;
+                rows[n].clusterBegin = t;
+                rows[n].appGroup = slots[i].first;
+                rows[n].count = row[slots[i].second];
+                if(++n == tsFileScanBatch) {
+                    n = 0;
+                    if(!sink.consume(rows, tsFileScanBatch))
+                        return false;
+                }
+            }
+        }
+        return n == 0 || sink.consume(rows, n);
+    }
+
+    bool StorageTsFile::scanGroupRange(int app_group, int from, int to, KeyPressSink & sink) {
+        if(!refreshView())
+            return false;
+        int64_t first, end;
+        int slot = slotOf(app_group, false);
+        if(slot == -1 || !clusterRange(from, to, first, end))
+            return true;
+
+        KeyPressRow rows[tsFileScanBatch];
+        size_t n = 0;
+        for(int64_t t = first; t < end; t += m_clusterSize) {
+            uint32_t count = m_counters[(size_t) ((t - m_baseTime) / m_clusterSize) * slotCount + slot];
+            if(!count)
+                continue;
+            rows[n].clusterBegin = t;
+            rows[n].appGroup = app_group;
+            rows[n].count = count;
+            if(++n == tsFileScanBatch) {
+                n = 0;
+                if(!sink.consume(rows, tsFileScanBatch))
+                    return false;
+            }
+        }
+        return n == 0 || sink.consume(rows, n);
+    }
+}
@@ -0,0 +1,181 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#ifndef KEYFROGSTORAGETSFILE_H
+#define KEYFROGSTORAGETSFILE_H
+
+#include "Storage.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace keyfrog {
+
+    /**
+     * Flat-file time series storage, no SQL engine involved.
+     *
+     * The file is a header followed by a matrix of 32 bit counters, one
+     * row per cluster and one column per group slot. It's mapped into
+     * memory and a keypress is an in-place increment of the counter at
+     * ( cluster_index, group_slot ). The file grows by whole weeks of
+     * clusters. Writes of a batch are staged and applied together in
+     * commitBatch(), so a failed batch leaves the file untouched.
+     */
+    class StorageTsFile : public Storage {
+        public:
+        /// Number of group columns in a row
+        static const uint32_t slotCount = 64;
+
+        private:
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t clusterSize;
+            int32_t baseTime;
+            uint32_t clusterCount;
+            uint32_t slotsUsed;
+            uint32_t reserved;
+            int32_t groups[slotCount];
+        };
+
+        std::string m_uri;
+        int m_fd;
+        char *m_map;
+        size_t m_mapSize;
+        Header *m_header;
+        uint32_t *m_counters;
+        int m_clusterSize;
+        /// Last used slot, keypresses come in series
+        uint32_t m_lastSlot;
+        bool m_readOnly;
+
+        /**
+         * Header fields reads use, taken by refreshView(). Daemon may
+         * grow the file under a read-only mapping, so these are bounded
+         * by what is mapped.
+         */
+        int32_t m_baseTime;
+        uint32_t m_clusterCount;
+        uint32_t m_slotsUsed;
+
+        /// Keypresses staged between beginBatch() and commitBatch()
+        struct Delta {
+            int32_t clusterBegin;
+            int appGroup;
+            int count;
+        };
+        std::vector<Delta> m_batch;
+        bool m_inBatch;
+
+        bool map(size_t size);
+        bool checkHeader();
+        bool refreshView();
+        bool clusterRange(int from, int to, int64_t & first, int64_t & end);
+        bool resize(uint32_t clusterCount);
+        bool rebase(int32_t baseTime);
+        int slotOf(int app_group, bool create);
+        bool apply(const std::vector<Delta> & deltas);
+
+        public:
+        StorageTsFile();
+        ~StorageTsFile();
+
+        /** 
+         * @brief Opens (creates) time series file
+         */
+        virtual bool connect(std::string uri);
+
+        /** 
+         * @brief Maps existing file read-only
+         */
+        virtual bool connectReadOnly(std::string uri);
+
+        /** 
+         * @brief Flushes and closes file
+         */
+        virtual void disconnect();
+
+        /** 
+         * @brief Sets cluster width, only for new files
+         */
+        virtual void setClusterSize(int seconds);
+
+        /** 
+         * @brief Width of cluster in seconds (of file, once connected)
+         */
+        virtual int clusterSize() { return m_clusterSize; }
+
+        /** 
+         * @brief Gets begining of  cluster timestamp for given timestamp
+         */
+        virtual int getClusterStart(int timestamp);
+
+        /** 
+         * @brief Records keypresses at actual time
+         */
+        virtual bool addKeyPress(int app_group, int count = 1);
+
+        /** 
+         * @brief Records keypresses at given time
+         */
+        virtual bool addKeyPress(int app_group, int timestamp, int count = 1);
+
+        /** 
+         * @brief Starts staging keypresses
+         */
+        virtual bool beginBatch();
+
+        /** 
+         * @brief Applies staged keypresses and syncs mapping to disk
+         */
+        virtual bool commitBatch();
+
+        /** 
+         * @brief Drops staged keypresses
+         */
+        virtual void abortBatch();
+
+        /** 
+         * @brief Sums keypresses per group
+         */
+        virtual bool totals(int from, int to, std::map<int, long long> & out);
+
+        /** 
+         * @brief Walks rows of matrix, nonzero counters ordered by group
+         */
+        virtual bool scanRange(int from, int to, KeyPressSink & sink);
+
+        /** 
+         * @brief Walks one column of matrix
+         */
+        virtual bool scanGroupRange(int app_group, int from, int to, KeyPressSink & sink);
+    };
+}
+
+#endif
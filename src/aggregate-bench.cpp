@@ -0,0 +1,162 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+/*
+ * Compares aggregation kernels with row by row loops on synthetic
+ * keypress columns. Run with "make bench".
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "Aggregate.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/time.h>
+
+using namespace std;
+using namespace keyfrog;
+
+/// One minute clusters keep 10M rows within 32-bit timestamps
+static const int clusterSize = 60;
+static const int groupCount = 8;
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report(const char *name, double naive, double kernel, bool same) {
+    printf("%-16s naive %8.1f ms   kernel %8.1f ms   %5.1fx%s\n", name,
+            naive * 1000, kernel * 1000, naive / kernel, same ? "" : "   MISMATCH");
+}
+
+/// Row by row bucketing as done before the kernels
+static void naiveBuckets(const vector<int32_t> & times, const vector<int32_t> & groups, const vector<int32_t> & counts,
+        int32_t origin, int32_t bucket, size_t buckets, const int32_t *groupIds, vector<int64_t> & out) {
+    for(size_t r = 0; r < times.size(); r++) {
+        if(times[r] < origin)
+            continue;
+        size_t b = (times[r] - origin) / bucket;
+        if(b >= buckets)
+            continue;
+        for(int g = 0; g < groupCount; g++) {
+            if(groupIds[g] == groups[r]) {
+                out[b * groupCount + g] += counts[r];
+                break;
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t rows = argc > 1 ? atol(argv[1]) : 10000000;
+    int32_t groupIds[groupCount];
+    for(int g = 0; g < groupCount; g++)
+        groupIds[g] = (g + 1) * 100;
+
+    // Clusters with a random subset of groups, like keypresses table
+    vector<int32_t> times, groups, counts;
+    times.reserve(rows);
+    groups.reserve(rows);
+    counts.reserve(rows);
+    srand(1);
+    int32_t origin = 1200000000;
+    for(int32_t t = origin; times.size() < rows; t += clusterSize) {
+        for(int g = 0; g < groupCount && times.size() < rows; g++) {
+            if(rand() % 3 == 0)
+                continue;
+            times.push_back(t);
+            groups.push_back(groupIds[g]);
+            counts.push_back(rand() % 400);
+        }
+    }
+    printf("%lu rows, %d groups, kernels: %s\n", (unsigned long) rows, groupCount, aggregate_isa());
+
+    // Per group totals
+    double t0 = now();
+    vector<int64_t> naiveTotals(groupCount), totals(groupCount);
+    for(size_t r = 0; r < rows; r++) {
+        for(int g = 0; g < groupCount; g++) {
+            if(groupIds[g] == groups[r]) {
+                naiveTotals[g] += counts[r];
+                break;
+            }
+        }
+    }
+    double t1 = now();
+    group_totals(&groups[0], &counts[0], rows, groupIds, groupCount, &totals[0]);
+    double t2 = now();
+    report("group totals", t1 - t0, t2 - t1, naiveTotals == totals);
+
+    // Daily buckets
+    int32_t day = 24 * 3600;
+    size_t buckets = (times.back() - origin) / day + 1;
+    vector<int64_t> naiveSums(buckets * groupCount), sums(buckets * groupCount);
+    t0 = now();
+    naiveBuckets(times, groups, counts, origin, day, buckets, groupIds, naiveSums);
+    t1 = now();
+    bucket_sums(&times[0], &groups[0], &counts[0], rows, origin, day, buckets, groupIds, groupCount, &sums[0]);
+    t2 = now();
+    report("daily buckets", t1 - t0, t2 - t1, naiveSums == sums);
+
+    // Hourly buckets
+    buckets = (times.back() - origin) / 3600 + 1;
+    naiveSums.assign(buckets * groupCount, 0);
+    sums.assign(buckets * groupCount, 0);
+    t0 = now();
+    naiveBuckets(times, groups, counts, origin, 3600, buckets, groupIds, naiveSums);
+    t1 = now();
+    bucket_sums(&times[0], &groups[0], &counts[0], rows, origin, 3600, buckets, groupIds, groupCount, &sums[0]);
+    t2 = now();
+    report("hourly buckets", t1 - t0, t2 - t1, naiveSums == sums);
+
+    // Moving average over an hour of clusters
+    size_t window = 3600 / clusterSize;
+    vector<double> values(counts.begin(), counts.end());
+    vector<double> naiveAvg(rows), avg(rows);
+    t0 = now();
+    for(size_t i = 0; i < rows; i++) {
+        double sum = 0;
+        for(size_t k = 0; k < window && k <= i; k++)
+            sum += values[i - k];
+        naiveAvg[i] = sum / window;
+    }
+    t1 = now();
+    moving_average(&values[0], rows, window, &avg[0]);
+    t2 = now();
+    report("moving average", t1 - t0, t2 - t1, naiveAvg == avg);
+
+    return EXIT_SUCCESS;
+}
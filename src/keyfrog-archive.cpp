@@ -0,0 +1,241 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <boost/program_options.hpp>
+#include "Archive.h"
+#include "Storage.h"
+#include "Export.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+#include <climits>
+#include <iostream>
+#include <string>
+#include <map>
+
+using namespace std;
+using namespace keyfrog;
+namespace po = boost::program_options;
+
+/**
+ * Streams rows of storage, or of another archive, into archive or CSV
+ * file. Reads and writes go in blocks, so memory use is constant.
+ */
+static int exportRows(const string & dbUri, const string & sourceArchive, const string & outPath,
+        const string & format, int from, int to) {
+    Storage *storage = NULL;
+    ArchiveReader reader;
+    int clusterSize;
+    if(!sourceArchive.empty()) {
+        if(!reader.open(sourceArchive)) {
+            cerr << "Could not open archive " << sourceArchive << endl;
+            return EXIT_FAILURE;
+        }
+        clusterSize = reader.clusterSize();
+    } else {
+        string location;
+        storage = Storage::create(dbUri, location);
+        if(storage == NULL || !storage->connectReadOnly(location)) {
+            cerr << "Could not open database " << dbUri << endl;
+            delete storage;
+            return EXIT_FAILURE;
+        }
+        clusterSize = storage->clusterSize();
+
+        // Unfinished cluster is never exported
+        int now = time(NULL);
+        if(to > now - now % clusterSize)
+            to = now - now % clusterSize;
+    }
+
+    ArchiveWriter archive;
+    ArchiveSink archiveSink(archive);
+    CsvWriter csv;
+    KeyPressSink *sink;
+    bool ok;
+    if(format == "csv") {
+        ok = csv.open(outPath);
+        sink = &csv;
+    } else {
+        ok = archive.open(outPath, clusterSize);
+        sink = &archiveSink;
+    }
+
+    if(storage) {
+        ok = ok && storage->scanRange(from, to, *sink);
+        storage->disconnect();
+        delete storage;
+    } else {
+        ok = ok && scan_archive(reader, from, to, *sink);
+    }
+    uint64_t rows;
+    if(format == "csv") {
+        ok = csv.close() && ok;
+        rows = csv.rows();
+    } else {
+        ok = archive.close() && ok;
+        rows = archive.rows();
+    }
+
+    if(!ok) {
+        cerr << "Writing " << outPath << " failed" << endl;
+        return EXIT_FAILURE;
+    }
+    // Keep standard output clean when data goes there
+    if(outPath != "-")
+        cout << rows << " rows exported to " << outPath << endl;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Prints rows of archive as text
+ */
+static int dumpArchive(const string & archivePath, int from, int to) {
+    ArchiveReader reader;
+    if(!reader.open(archivePath)) {
+        cerr << "Could not open archive " << archivePath << endl;
+        return EXIT_FAILURE;
+    }
+    for(size_t i = 0; i < reader.blockCount(); i++) {
+        ArchiveColumns cols;
+        const ArchiveBlockInfo & info = reader.blockInfo(i);
+        if(info.maxTime < from || info.minTime >= to)
+            continue;
+        if(!reader.readBlock(i, cols)) {
+            cerr << "Block " << i << " of " << archivePath << " is corrupted" << endl;
+            return EXIT_FAILURE;
+        }
+        for(size_t r = 0; r < cols.size(); r++) {
+            if(cols.times[r] >= from && cols.times[r] < to)
+                printf("%d|%d|%d\n", cols.times[r], cols.groups[r], cols.counts[r]);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Prints keypresses per group (or per bucket and group) of archive
+ */
+static int summarizeArchive(const string & archivePath, int from, int to, int bucket) {
+    ArchiveReader reader;
+    if(!reader.open(archivePath)) {
+        cerr << "Could not open archive " << archivePath << endl;
+        return EXIT_FAILURE;
+    }
+    bool ok;
+    if(bucket > 0) {
+        map<pair<int, int>, int64_t> sums;
+        if((ok = reader.bucketSums(from, to, bucket, sums))) {
+            for(map<pair<int, int>, int64_t>::iterator it = sums.begin(); it != sums.end(); ++it)
+                printf("%d|%d|%lld\n", it->first.first, it->first.second, (long long) it->second);
+        }
+    } else {
+        map<int, int64_t> totals;
+        if((ok = reader.groupTotals(from, to, totals))) {
+            for(map<int, int64_t>::iterator it = totals.begin(); it != totals.end(); ++it)
+                printf("%d|%lld\n", it->first, (long long) it->second);
+        }
+    }
+    if(!ok) {
+        cerr << "Archive " << archivePath << " is corrupted" << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "display help message")
+        ("db", po::value<string>(), "keyfrog storage, path or URI like tsfile:/path (default ~/.keyfrog/keyfrog.db)")
+        ("out", po::value<string>(), "file to create (- for standard output, csv only)")
+        ("format", po::value<string>()->default_value("archive"), "format of --out: archive or csv")
+        ("archive", po::value<string>(), "with --out, read rows from given archive instead of database")
+        ("dump", po::value<string>(), "print rows of given archive")
+        ("stats", po::value<string>(), "print keypresses per group of given archive")
+        ("bucket", po::value<int>()->default_value(0), "with --stats, sum per bucket of given seconds")
+        ("from", po::value<int>()->default_value(0), "first timestamp (inclusive)")
+        ("to", po::value<int>()->default_value(INT_MAX), "last timestamp (exclusive)")
+        ;
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    } catch(po::error & e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    if (vm.count("help") || (!vm.count("out") && !vm.count("dump") && !vm.count("stats"))) {
+        cout << desc << "\n";
+        return EXIT_SUCCESS;
+    }
+
+    int from = vm["from"].as<int>();
+    int to = vm["to"].as<int>();
+
+    if (vm.count("dump")) {
+        return dumpArchive(vm["dump"].as<string>(), from, to);
+    }
+
+    if (vm.count("stats")) {
+        return summarizeArchive(vm["stats"].as<string>(), from, to, vm["bucket"].as<int>());
+    }
+
+    string dbPath;
+    if (vm.count("db")) {
+        dbPath = vm["db"].as<string>();
+    } else if (!vm.count("archive")) {
+        char * homeEnvVar = getenv("HOME");
+        if(homeEnvVar == NULL) {
+            cerr << "HOME is not set, use --db" << endl;
+            return EXIT_FAILURE;
+        }
+        dbPath = string(homeEnvVar) + "/.keyfrog/keyfrog.db";
+    }
+    string format = vm["format"].as<string>();
+    string outPath = vm["out"].as<string>();
+    if(format != "archive" && format != "csv") {
+        cerr << "Unknown format " << format << endl;
+        return EXIT_FAILURE;
+    }
+    if(format == "archive" && outPath == "-") {
+        cerr << "Archive can't be written to standard output" << endl;
+        return EXIT_FAILURE;
+    }
+    string sourceArchive = vm.count("archive") ? vm["archive"].as<string>() : "";
+    return exportRows(dbPath, sourceArchive, outPath, format, from, to);
+}
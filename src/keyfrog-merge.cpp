@@ -0,0 +1,142 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <boost/program_options.hpp>
+#include "Merge.h"
+#include "Export.h"
+
+#include <cstdlib>
+#include <climits>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace keyfrog;
+namespace po = boost::program_options;
+
+int main(int argc, char *argv[])
+{
+    po::options_description desc("Usage: keyfrog-merge [options] --out file store...\n"
+            "Stores are storage URIs (path, sqlite:path, tsfile:path) or archive:path\n"
+            "Allowed options");
+    desc.add_options()
+        ("help", "display help message")
+        ("out", po::value<string>(), "file to create (- for standard output, csv only)")
+        ("format", po::value<string>()->default_value("archive"), "format of --out: archive, csv or db (storage URI)")
+        ("from", po::value<int>()->default_value(0), "first timestamp (inclusive)")
+        ("to", po::value<int>()->default_value(INT_MAX), "last timestamp (exclusive)")
+        ("input", po::value<vector<string> >(), "stores to merge")
+        ;
+    po::positional_options_description positional;
+    positional.add("input", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+        po::notify(vm);
+    } catch(po::error & e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    if (vm.count("help") || !vm.count("out") || !vm.count("input")) {
+        cout << desc << "\n";
+        return EXIT_SUCCESS;
+    }
+
+    string format = vm["format"].as<string>();
+    string outPath = vm["out"].as<string>();
+    if(format != "archive" && format != "csv" && format != "db") {
+        cerr << "Unknown format " << format << endl;
+        return EXIT_FAILURE;
+    }
+    if(format != "csv" && outPath == "-") {
+        cerr << "Only csv can be written to standard output" << endl;
+        return EXIT_FAILURE;
+    }
+
+    Merger merger;
+    const vector<string> & inputs = vm["input"].as<vector<string> >();
+    for(size_t i = 0; i < inputs.size(); i++) {
+        if(!merger.addInput(inputs[i])) {
+            cerr << merger.error() << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    int from = vm["from"].as<int>();
+    int to = vm["to"].as<int>();
+    bool ok;
+    uint64_t rows;
+    if(format == "db") {
+        string location;
+        Storage *storage = Storage::create(outPath, location);
+        if(storage == NULL) {
+            cerr << "Unknown storage " << outPath << endl;
+            return EXIT_FAILURE;
+        }
+        storage->setClusterSize(merger.clusterSize());
+        if(!storage->connect(location)) {
+            cerr << "Could not open " << outPath << endl;
+            delete storage;
+            return EXIT_FAILURE;
+        }
+        StorageSink sink(*storage);
+        ok = merger.run(from, to, sink);
+        ok = sink.finish() && ok;
+        rows = sink.rows();
+        storage->disconnect();
+        delete storage;
+    } else if(format == "csv") {
+        CsvWriter csv;
+        ok = csv.open(outPath) && merger.run(from, to, csv);
+        ok = csv.close() && ok;
+        rows = csv.rows();
+    } else {
+        ArchiveWriter archive;
+        ArchiveSink sink(archive);
+        ok = archive.open(outPath, merger.clusterSize()) && merger.run(from, to, sink);
+        ok = archive.close() && ok;
+        rows = archive.rows();
+    }
+
+    if(!ok) {
+        cerr << "Merge failed: " << (merger.error().empty() ? "could not write " + outPath : merger.error()) << endl;
+        return EXIT_FAILURE;
+    }
+    if(outPath != "-")
+        cout << merger.rowsRead() << " rows of " << inputs.size() << " stores merged into "
+            << rows << " rows of " << outPath << endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,277 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <boost/program_options.hpp>
+#include "Query.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <climits>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace std;
+using namespace keyfrog;
+namespace po = boost::program_options;
+
+/**
+ * Parses timestamp given as seconds since epoch or as local date YYYY-MM-DD
+ */
+static bool parseTime(const string & text, int & timestamp) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(text.c_str(), "%Y-%m-%d", &tm);
+    if(end != NULL && *end == '\0') {
+        tm.tm_isdst = -1;
+        timestamp = mktime(&tm);
+        return true;
+    }
+    char *numEnd;
+    long value = strtol(text.c_str(), &numEnd, 10);
+    if(text.empty() || *numEnd != '\0')
+        return false;
+    timestamp = value;
+    return true;
+}
+
+static void printTotals(const vector<GroupTotal> & totals, bool json) {
+    if(json) {
+        printf("[");
+        for(size_t i = 0; i < totals.size(); i++)
+            printf("%s{\"group\":%d,\"count\":%lld}", i ? "," : "", totals[i].appGroup, totals[i].count);
+        printf("]\n");
+    } else {
+        printf("group,count\n");
+        for(size_t i = 0; i < totals.size(); i++)
+            printf("%d,%lld\n", totals[i].appGroup, totals[i].count);
+    }
+}
+
+static void printSeries(const vector<SeriesPoint> & points, bool json) {
+    if(json) {
+        printf("[");
+        for(size_t i = 0; i < points.size(); i++)
+            printf("%s{\"time\":%d,\"group\":%d,\"value\":%g}", i ? "," : "",
+                    points[i].time, points[i].appGroup, points[i].value);
+        printf("]\n");
+    } else {
+        printf("time,group,value\n");
+        for(size_t i = 0; i < points.size(); i++)
+            printf("%d,%d,%g\n", points[i].time, points[i].appGroup, points[i].value);
+    }
+}
+
+/**
+ * Prints nonzero keycode buckets, then modifiers
+ */
+static void printKeys(const KeyHistogram & keys, bool json) {
+    if(json) {
+        printf("{\"keys\":{");
+        bool first = true;
+        for(unsigned i = 0; i < KeyHistogram::keyCount; i++) {
+            if(keys.keys[i]) {
+                printf("%s\"%u\":%u", first ? "" : ",", i, keys.keys[i]);
+                first = false;
+            }
+        }
+        printf("},\"modifiers\":{");
+        for(unsigned i = 0; i < KeyHistogram::modifierCount; i++)
+            printf("%s\"%s\":%u", i ? "," : "", KeyHistogram::modifierName(i), keys.modifiers[i]);
+        printf("}}\n");
+    } else {
+        printf("key,count\n");
+        for(unsigned i = 0; i < KeyHistogram::keyCount; i++) {
+            if(keys.keys[i])
+                printf("%u,%u\n", i, keys.keys[i]);
+        }
+        for(unsigned i = 0; i < KeyHistogram::modifierCount; i++)
+            printf("%s,%u\n", KeyHistogram::modifierName(i), keys.modifiers[i]);
+    }
+}
+
+static void printActive(const map<int, ActiveTime> & active, bool json) {
+    if(json) {
+        printf("[");
+        for(map<int, ActiveTime>::const_iterator it = active.begin(); it != active.end(); ++it)
+            printf("%s{\"group\":%d,\"seconds\":%.3f,\"sessions\":%lld}", it == active.begin() ? "" : ",",
+                    it->first, it->second.milliseconds / 1000.0, it->second.sessions);
+        printf("]\n");
+    } else {
+        printf("group,seconds,sessions\n");
+        for(map<int, ActiveTime>::const_iterator it = active.begin(); it != active.end(); ++it)
+            printf("%d,%.3f,%lld\n", it->first, it->second.milliseconds / 1000.0, it->second.sessions);
+    }
+}
+
+static void printSeats(const map<pair<int, int>, long long> & seats, bool json) {
+    if(json) {
+        printf("[");
+        for(map<pair<int, int>, long long>::const_iterator it = seats.begin(); it != seats.end(); ++it)
+            printf("%s{\"seat\":%d,\"group\":%d,\"count\":%lld}", it == seats.begin() ? "" : ",",
+                    it->first.first, it->first.second, it->second);
+        printf("]\n");
+    } else {
+        printf("seat,group,count\n");
+        for(map<pair<int, int>, long long>::const_iterator it = seats.begin(); it != seats.end(); ++it)
+            printf("%d,%d,%lld\n", it->first.first, it->first.second, it->second);
+    }
+}
+
+/**
+ * Prints percentiles of inter-key intervals (milliseconds) and typing
+ * speed derived from their mean, a word being five keypresses
+ */
+static void printIntervals(const IntervalHistogram & intervals, bool json) {
+    double wpm = intervals.count ? 60000.0 / (intervals.mean() * 5) : 0.0;
+    if(json) {
+        printf("{\"count\":%llu,\"mean\":%.1f,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"wpm\":%.1f}\n",
+                (unsigned long long) intervals.count, intervals.mean(), intervals.percentile(0.5),
+                intervals.percentile(0.9), intervals.percentile(0.99), wpm);
+    } else {
+        printf("count,mean,p50,p90,p99,wpm\n");
+        printf("%llu,%.1f,%u,%u,%u,%.1f\n", (unsigned long long) intervals.count, intervals.mean(),
+                intervals.percentile(0.5), intervals.percentile(0.9), intervals.percentile(0.99), wpm);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    po::options_description desc("Usage: keyfrog-query [options] totals|top|series|average|keys|active|intervals|seats\nAllowed options");
+    desc.add_options()
+        ("help", "display help message")
+        ("db", po::value<string>(), "keyfrog storage, path or URI like tsfile:/path (default ~/.keyfrog/keyfrog.db)")
+        ("from", po::value<string>()->default_value("0"), "first timestamp or date YYYY-MM-DD (inclusive)")
+        ("to", po::value<string>(), "last timestamp or date YYYY-MM-DD (exclusive, default now)")
+        ("bucket", po::value<int>()->default_value(3600), "bucket length in seconds (series, average)")
+        ("window", po::value<int>()->default_value(24), "buckets per moving average")
+        ("limit", po::value<int>()->default_value(10), "number of groups listed by top")
+        ("group", po::value<int>()->default_value(-1), "restrict series (or keys, intervals) to one group")
+        ("format", po::value<string>()->default_value("csv"), "output format: csv or json")
+        ("command", po::value<string>(), "query to run")
+        ;
+    po::positional_options_description positional;
+    positional.add("command", 1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+        po::notify(vm);
+    } catch(po::error & e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    if (vm.count("help") || !vm.count("command")) {
+        cout << desc << "\n";
+        return EXIT_SUCCESS;
+    }
+
+    int from, to = time(NULL);
+    if(!parseTime(vm["from"].as<string>(), from) ||
+            (vm.count("to") && !parseTime(vm["to"].as<string>(), to))) {
+        cerr << "Invalid time range" << endl;
+        return EXIT_FAILURE;
+    }
+    string format = vm["format"].as<string>();
+    if(format != "csv" && format != "json") {
+        cerr << "Unknown format " << format << endl;
+        return EXIT_FAILURE;
+    }
+    bool json = format == "json";
+
+    string dbPath;
+    if (vm.count("db")) {
+        dbPath = vm["db"].as<string>();
+    } else {
+        char * homeEnvVar = getenv("HOME");
+        if(homeEnvVar == NULL) {
+            cerr << "HOME is not set, use --db" << endl;
+            return EXIT_FAILURE;
+        }
+        dbPath = string(homeEnvVar) + "/.keyfrog/keyfrog.db";
+    }
+
+    Query query;
+    if(!query.open(dbPath)) {
+        cerr << query.error() << endl;
+        return EXIT_FAILURE;
+    }
+
+    string command = vm["command"].as<string>();
+    vector<GroupTotal> totals;
+    vector<SeriesPoint> points;
+    bool ok;
+    if(command == "totals") {
+        if((ok = query.totals(from, to, totals)))
+            printTotals(totals, json);
+    } else if(command == "top") {
+        if((ok = query.top(from, to, vm["limit"].as<int>(), totals)))
+            printTotals(totals, json);
+    } else if(command == "series") {
+        if((ok = query.series(from, to, vm["bucket"].as<int>(), vm["group"].as<int>(), points)))
+            printSeries(points, json);
+    } else if(command == "average") {
+        if((ok = query.movingAverage(from, to, vm["bucket"].as<int>(), vm["window"].as<int>(),
+                        vm["group"].as<int>(), points)))
+            printSeries(points, json);
+    } else if(command == "keys") {
+        KeyHistogram keys;
+        if((ok = query.keys(from, to, vm["group"].as<int>(), keys)))
+            printKeys(keys, json);
+    } else if(command == "active") {
+        map<int, ActiveTime> active;
+        if((ok = query.activeTime(from, to, active)))
+            printActive(active, json);
+    } else if(command == "intervals") {
+        IntervalHistogram intervals;
+        if((ok = query.intervals(from, to, vm["group"].as<int>(), intervals)))
+            printIntervals(intervals, json);
+    } else if(command == "seats") {
+        map<pair<int, int>, long long> seats;
+        if((ok = query.seats(from, to, seats)))
+            printSeats(seats, json);
+    } else {
+        cerr << "Unknown query " << command << endl;
+        return EXIT_FAILURE;
+    }
+
+    if(!ok) {
+        cerr << "Query failed: " << query.error() << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,243 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <boost/program_options.hpp>
+
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <unistd.h>
+
+#include "ConfigReader.h"
+#include "Configuration.h"
+#include "StorageManager.h"
+#include "EventFilter.h"
+#include "EventMonitorReplay.h"
+
+using namespace std;
+using namespace keyfrog;
+namespace po = boost::program_options;
+
+static int64_t monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t percentile(vector<int64_t> & sorted, double p) {
+    if(sorted.empty())
+        return 0;
+    size_t i = (size_t) (p * (sorted.size() - 1));
+    return sorted[i];
+}
+
+/**
+ * Drives EventFilter and StorageManager with a recorded trace,
+ * the way the daemon drives them with live events
+ */
+int main(int argc, char *argv[])
+{
+    po::options_description desc("Usage: keyfrog-replay [options] trace\n"
+            "Trace is recorded by the daemon with <capture trace=\"path\" />\n"
+            "Allowed options");
+    desc.add_options()
+        ("help", "display help message")
+        ("config", po::value<string>(), "configuration with groups (default ~/.keyfrog/config)")
+        ("storage", po::value<string>()->default_value("sqlite::memory:"), "storage URI keypresses go to")
+        ("speed", po::value<double>()->default_value(0), "replay speed, 1 - as recorded, 0 - as fast as possible")
+        ("trace", po::value<string>(), "trace file")
+        ;
+    po::positional_options_description positional;
+    positional.add("trace", 1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+        po::notify(vm);
+    } catch(po::error & e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    if (vm.count("help") || !vm.count("trace")) {
+        cout << desc << "\n";
+        return EXIT_SUCCESS;
+    }
+
+    // Groups and options
+    Configuration configuration;
+    string configPath;
+    if(vm.count("config")) {
+        configPath = vm["config"].as<string>();
+    } else {
+        const char *home = getenv("HOME");
+        configPath = string(home ? home : "") + "/.keyfrog/config";
+    }
+    if(access(configPath.c_str(), R_OK) != 0) {
+        cerr << "Could not read configuration " << configPath << endl;
+        return EXIT_FAILURE;
+    }
+    configuration.setConfigPath(configPath);
+    ConfigReader configReader;
+    configReader.setConfiguration(configuration);
+    configReader.readConfig();
+    Options & options = configuration.options();
+
+    // Storage, without journal
+    string storageUri = vm["storage"].as<string>();
+    string location;
+    Storage *backend = Storage::create(storageUri, location);
+    if(backend == NULL) {
+        cerr << "Unknown storage " << storageUri << endl;
+        return EXIT_FAILURE;
+    }
+    StorageManager storage(backend);
+    storage.setClusterSize(options.clusterSize());
+    storage.setCommitInterval(options.commitInterval());
+    storage.setCompactionIdle(0);
+    if(!storage.connect(location)) {
+        cerr << "Could not open " << storageUri << endl;
+        return EXIT_FAILURE;
+    }
+
+    // Event source with resolvers answering from the trace
+    KfWindowCacheReplay wim;
+    ProcessManagerReplay pm;
+    EventMonitorReplay monitor(wim, pm);
+    monitor.setSpeed(vm["speed"].as<double>());
+    string tracePath = vm["trace"].as<string>();
+    if(!monitor.connect(tracePath)) {
+        cerr << "Could not open trace " << tracePath << endl;
+        return EXIT_FAILURE;
+    }
+    EventFilter filter(monitor, wim, pm);
+    filter.setFilterConfig(configuration.filterConfig());
+
+    unsigned long events = 0, keyPresses = 0, attributed = 0;
+    map<int, long long> groups;
+    // Typing sessions, from event times of the trace
+    Sessionizer sessions(options.sessionGap());
+    KeyIntervals keyIntervals;
+    // Trace times are placed after start of the replay, as recorded
+    bool clockSet = false;
+    int replayStart = 0;
+    uint32_t traceStart = 0;
+    int timestamp;
+    uint32_t interval;
+    map<int, ActiveTime> active;
+    map<int, IntervalHistogram> intervals;
+    // Time from taking a batch from monitor to storing its last event
+    vector<int64_t> batchTimes;
+
+    monitor.start();
+    int64_t begin = monotonic_us();
+    while(!monitor.finished()) {
+        int64_t batchBegin = monotonic_us();
+        filter.pollEvents();
+        if(filter.numEvents() == 0) {
+            monitor.waitForEvents();
+            continue;
+        }
+        while(filter.numEvents()) {
+            Event event = filter.nextEvent();
+            events ++;
+            switch(event.type()) {
+                case kfKeyPress:
+                    keyPresses ++;
+                    if(event.groupId() == -1)
+                        break;
+                    attributed ++;
+                    groups[event.groupId()] ++;
+                    if(!clockSet) {
+                        replayStart = time(NULL);
+                        traceStart = event.time();
+                        clockSet = true;
+                    }
+                    timestamp = replayStart + ((uint32_t) event.time() - traceStart) / 1000;
+                    if(options.keyStatsState())
+                        storage.addKeyStroke(event.groupId(), timestamp, event.keyCode(), event.modifiers());
+                    else
+                        storage.addKeyPress(event.groupId(), timestamp, 1);
+                    // A trace is one display, the first seat
+                    storage.addSeatKeyPresses(0, event.groupId(), timestamp, 1);
+                    if(keyIntervals.keyPress(event.time(), interval)) {
+                        storage.addInterval(event.groupId(), timestamp, interval);
+                        intervals[event.groupId()].add(interval);
+                    }
+                    if(options.sessionGap() > 0) {
+                        bool newSession;
+                        uint32_t ms = sessions.keyPress(event.groupId(), event.time(), newSession);
+                        storage.addActiveTime(event.groupId(), timestamp, ms, newSession);
+                        active[event.groupId()].milliseconds += ms;
+                        active[event.groupId()].sessions += newSession;
+                    }
+                    break;
+                case kfDestroyNotify:
+                    wim.findAndUseWindow(event.destWin());
+                    wim.invalidateEntry();
+                    break;
+                default:
+                    break;
+            }
+        }
+        batchTimes.push_back(monotonic_us() - batchBegin);
+    }
+    int64_t replayTime = monotonic_us() - begin;
+
+    int64_t flushBegin = monotonic_us();
+    bool flushed = storage.flush();
+    int64_t flushTime = monotonic_us() - flushBegin;
+
+    sort(batchTimes.begin(), batchTimes.end());
+    printf("events %lu, keypresses %lu, attributed %lu\n", events, keyPresses, attributed);
+    printf("replay %.3f ms, %.0f events/s\n", replayTime / 1000.0,
+            replayTime ? events * 1e6 / replayTime : 0.0);
+    printf("batches %lu, time us p50 %lld p99 %lld max %lld\n", (unsigned long) batchTimes.size(),
+            (long long) percentile(batchTimes, 0.5), (long long) percentile(batchTimes, 0.99),
+            (long long) (batchTimes.empty() ? 0 : batchTimes.back()));
+    printf("commit %.3f ms%s\n", flushTime / 1000.0, flushed ? "" : " (failed)");
+    for(map<int, long long>::const_iterator it = groups.begin(); it != groups.end(); ++it) {
+        const ActiveTime & groupActive = active[it->first];
+        const IntervalHistogram & groupIntervals = intervals[it->first];
+        printf("group %d %lld, active %.1f s in %lld sessions, interval p50 %u ms p99 %u ms\n", it->first, it->second,
+                groupActive.milliseconds / 1000.0, groupActive.sessions,
+                groupIntervals.percentile(0.5), groupIntervals.percentile(0.99));
+    }
+
+    return flushed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -43,6 +43,7 @@
 #include <cstdlib>
 #include <exception>
 #include <iostream>
+#include <vector>
 
 using namespace std;
 using namespace keyfrog;
@@ -54,7 +55,7 @@ int main(int argc, char *argv[])
     desc.add_options()
         ("help", "display help message")
         ("nb", "don't run in background")
-        ("display", po::value<string>(), "X display name, eg. :0")
+        ("display", po::value<vector<string> >(), "X display name, eg. :0 (may be given many times)")
         ;
 
     po::variables_map vm;
@@ -72,11 +73,14 @@ int main(int argc, char *argv[])
     }
 
     Daemon daemon(daemonMode);
+    // Displays from command line replace ones from config
     if(vm.count("display")) {
-        // FIXME
-        daemon.connectXserver(vm["display"].as<string>());
+        const vector<string> & displays = vm["display"].as<vector<string> >();
+        for(size_t i = 0; i < displays.size(); i++)
+            daemon.addDisplay(displays[i]);
     }
-    daemon.run();
-
-    return EXIT_SUCCESS;    
+    // Process monitor and commiter threads are still running,
+    // so the daemon object is left alone (pending keypresses
+    // are in the journal)
+    exit(daemon.run());
 }
@@ -0,0 +1,230 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+/*
+ * Runs the same writes against every storage backend and checks that
+ * reads agree with what was written. Run with "make check".
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "Storage.h"
+#include "Common.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace std;
+using namespace keyfrog;
+
+typedef map<pair<int, int>, long long> Cells;
+/// ( cluster, ( seat, group ) ) sums
+typedef map<pair<int, pair<int, int> >, long long> SeatCells;
+
+static const int groups[] = { 1, 2, 7, 100 };
+static const int groupCount = sizeof(groups) / sizeof(groups[0]);
+/// Days of data written
+static const int days = 3;
+
+static int failures = 0;
+
+static void check(bool ok, const string & backend, const char *what) {
+    if(!ok) {
+        printf("%s: %s FAILED\n", backend.c_str(), what);
+        failures ++;
+    }
+}
+
+/// Small LCG, so that every backend gets the same writes
+static unsigned nextRandom(unsigned & state) {
+    state = state * 1103515245 + 12345;
+    return (state >> 16) & 0x7fff;
+}
+
+/// Collects scanned rows in order
+class RowsSink : public KeyPressSink {
+    public:
+    vector<KeyPressRow> rows;
+    virtual bool consume(const KeyPressRow *batch, size_t n) {
+        rows.insert(rows.end(), batch, batch + n);
+        return true;
+    }
+};
+
+/// Writes keypresses, in batches and out of order; returns ( cluster, group ) sums written
+static Cells write(Storage & storage, int base, SeatCells & seats) {
+    Cells cells;
+    unsigned state = 1;
+    for(int batch = 0; batch < 20; batch++) {
+        check(storage.beginBatch(), "write", "beginBatch");
+        for(int i = 0; i < 50; i++) {
+            int timestamp = base + (nextRandom(state) * 8 + nextRandom(state) % 8) % (days * 24 * 3600);
+            int group = groups[nextRandom(state) % groupCount];
+            int count = 1 + nextRandom(state) % 5;
+            storage.addKeyPress(group, timestamp, count);
+            cells[make_pair(storage.getClusterStart(timestamp), group)] += count;
+            // Two seats, counted on top of all keypresses
+            check(storage.addSeatKeyPresses(i % 2, group, timestamp, count), "write", "addSeatKeyPresses");
+            seats[make_pair(storage.getClusterStart(timestamp), make_pair(i % 2, group))] += count;
+        }
+        check(storage.commitBatch(), "write", "commitBatch");
+    }
+
+    // Aborted batch leaves nothing behind
+    storage.beginBatch();
+    storage.addKeyPress(9, base + 3600, 1000);
+    storage.abortBatch();
+
+    // Older than anything written so far, outside of batch
+    storage.addKeyPress(2, base - 3600, 3);
+    cells[make_pair(storage.getClusterStart(base - 3600), 2)] += 3;
+    return cells;
+}
+
+static map<int, long long> expectedTotals(const Cells & cells, int from, int to) {
+    map<int, long long> out;
+    for(Cells::const_iterator it = cells.begin(); it != cells.end(); ++it) {
+        if(it->first.first >= from && it->first.first < to)
+            out[it->first.second] += it->second;
+    }
+    return out;
+}
+
+static Cells expectedSeries(const Cells & cells, int from, int to, int bucket, int group) {
+    Cells out;
+    for(Cells::const_iterator it = cells.begin(); it != cells.end(); ++it) {
+        if(it->first.first >= from && it->first.first < to && (group == -1 || it->first.second == group))
+            out[make_pair(local_bucket_start(it->first.first, bucket), it->first.second)] += it->second;
+    }
+    return out;
+}
+
+static Cells expectedSeats(const SeatCells & seats, int from, int to) {
+    Cells out;
+    for(SeatCells::const_iterator it = seats.begin(); it != seats.end(); ++it) {
+        if(it->first.first >= from && it->first.first < to)
+            out[it->first.second] += it->second;
+    }
+    return out;
+}
+
+/// Seats are checked only on backends keeping them
+static void checkReads(Storage & storage, const string & backend, const Cells & cells,
+        const SeatCells * seats, int base) {
+    int ranges[][2] = {
+        { 0, 0x7fffffff },
+        { base + 7000, base + 2 * 24 * 3600 + 123 },
+        { base + 3600, base + 7200 },
+        { base - 7 * 24 * 3600, base }
+    };
+    for(size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+        int from = ranges[r][0], to = ranges[r][1];
+        map<int, long long> totals;
+        check(storage.totals(from, to, totals) && totals == expectedTotals(cells, from, to), backend, "totals");
+        if(seats) {
+            Cells seatTotals;
+            check(storage.seatTotals(from, to, seatTotals) && seatTotals == expectedSeats(*seats, from, to),
+                    backend, "seatTotals");
+        }
+
+        for(int bucket = 3600; bucket <= 86400; bucket *= 24) {
+            Cells series;
+            check(storage.series(from, to, bucket, -1, series) && series == expectedSeries(cells, from, to, bucket, -1),
+                    backend, "series");
+            series.clear();
+            check(storage.series(from, to, bucket, 7, series) && series == expectedSeries(cells, from, to, bucket, 7),
+                    backend, "series of group");
+        }
+    }
+
+    RowsSink all;
+    check(storage.scanRange(0, 0x7fffffff, all), backend, "scanRange");
+    bool same = all.rows.size() == cells.size();
+    Cells::const_iterator it = cells.begin();
+    for(size_t i = 0; same && i < all.rows.size(); i++, ++it) {
+        same = all.rows[i].clusterBegin == it->first.first && all.rows[i].appGroup == it->first.second &&
+            all.rows[i].count == it->second;
+    }
+    check(same, backend, "scanRange rows");
+
+    RowsSink one;
+    check(storage.scanGroupRange(7, 0, 0x7fffffff, one), backend, "scanGroupRange");
+    same = true;
+    int last = -1;
+    long long sum = 0;
+    for(size_t i = 0; same && i < one.rows.size(); i++) {
+        same = one.rows[i].appGroup == 7 && one.rows[i].clusterBegin > last;
+        last = one.rows[i].clusterBegin;
+        sum += one.rows[i].count;
+    }
+    check(same && sum == expectedTotals(cells, 0, 0x7fffffff)[7], backend, "scanGroupRange rows");
+}
+
+static void testBackend(const string & uri, bool hasSeats) {
+    string location;
+    Storage *storage = Storage::create(uri, location);
+    unlink(location.c_str());
+    if(storage == NULL || !storage->connect(location)) {
+        check(false, uri, "connect");
+        delete storage;
+        return;
+    }
+    int base = storage->getClusterStart(time(NULL) - (days + 2) * 24 * 3600);
+    SeatCells seats;
+    Cells cells = write(*storage, base, seats);
+    checkReads(*storage, uri, cells, hasSeats ? &seats : NULL, base);
+    storage->disconnect();
+    delete storage;
+
+    // What was committed is there for a read-only reader too
+    storage = Storage::create(uri, location);
+    if(!storage->connectReadOnly(location))
+        check(false, uri, "connectReadOnly");
+    else
+        checkReads(*storage, uri + " (read-only)", cells, hasSeats ? &seats : NULL, base);
+    storage->disconnect();
+    delete storage;
+    unlink(location.c_str());
+}
+
+int main() {
+    testBackend("sqlite:storage-test.db", true);
+    testBackend("tsfile:storage-test.kts", false);
+    if(failures)
+        return EXIT_FAILURE;
+    printf("Storage backends agree\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,481 @@
+/*********************************************************************************
+ *   Copyright (C) 2006-2013 by Sebastian Gniazdowski                            *
+ *   All Rights reserved.                                                        *
+ *                                                                               *
+ *   Redistribution and use in source and binary forms, with or without          *
+ *   modification, are permitted provided that the following conditions          *
+ *   are met:                                                                    *
+ *   1. Redistributions of source code must retain the above copyright           *
+ *      notice, this list of conditions and the following disclaimer.            *
+ *   2. Redistributions in binary form must reproduce the above copyright        *
+ *      notice, this list of conditions and the following disclaimer in the      *
+ *      documentation and/or other materials provided with the distribution.     *
+ *   3. Neither the name of the Keyfrog nor the names of its contributors        *
+ *      may be used to endorse or promote products derived from this software    *
+ *      without specific prior written permission.                               *
+ *                                                                               *
+ *   THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND     *
+ *   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE       *
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+ *   ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE    *
+ *   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL  *
+ *   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS     *
+ *   OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)       *
+ *   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT  *
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY   *
+ *   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF      *
+ *   SUCH DAMAGE.                                                                *
+ *********************************************************************************/
+
+/*
+ * Sends keypresses with XTEST through the daemon's pipeline
+ * (EventMonitorX11, EventFilter, StorageManager) at given rates and
+ * reports, as JSON, latency from injection to StorageManager, CPU
+ * time of the pipeline, X requests per keypress and lost keypresses.
+ * Needs X server with RECORD and XTEST; "make bench" runs it under
+ * Xvfb (see x11-bench.sh).
+ *
+ * Windows get WM_CLASS and _NET_WM_PID of forked processes renamed
+ * to look like applications, so all three ways of matching a group
+ * (window class, process name, process inside a terminal) are used.
+ */
+
+#if HAVE_CONFIG_H       /* HAVE_CONFIG_H */
+#include <config.h>
+#else                           /* HAVE_CONFIG_H */
+#include <FallbackConfigH.h>
+#endif                          /* HAVE_CONFIG_H */
+
+#include <boost/program_options.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/bind.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <csignal>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef HOST_IS_LINUX
+#include <sys/prctl.h>
+#endif
+
+#include "ProcessManagerLinux.h"
+#include "ProcessManagerMac.h"
+#include "ProcessManagerFBSD.h"
+#include "StorageManager.h"
+#include "KfWindowCache.h"
+#include "EventFilter.h"
+#include "EventMonitorX11.h"
+
+#include <X11/Xatom.h>
+
+using namespace std;
+using namespace keyfrog;
+namespace po = boost::program_options;
+
+/// Application a synthetic window pretends to be
+struct FakeApp {
+    const char *className;
+    const char *process;
+    /// Process started "inside" (terminals), NULL if none
+    const char *child;
+    /// Group the config below gives it, -1 - none
+    int group;
+};
+
+static const FakeApp fakeApps[] = {
+    { "XTerm", "xterm", "vim", 100 },       // terminal process
+    { "Firefox", "firefox", NULL, 200 },    // window class
+    { "Blender", "gimp", NULL, 300 },       // process name
+    { "Xclock", "xclock", NULL, -1 },       // no group
+};
+static const int fakeAppCount = sizeof(fakeApps) / sizeof(fakeApps[0]);
+
+/// Keypresses that go to one window before focus moves on
+static const int keysPerFocus = 50;
+
+/// Time to wait for late events after the last injection
+static const int64_t drainTimeout = 2000000;
+
+static int64_t monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t thread_cpu_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t percentile(const vector<int64_t> & sorted, double p) {
+    if(sorted.empty())
+        return 0;
+    return sorted[(size_t) (p * (sorted.size() - 1))];
+}
+
+static void set_process_name(const char *name) {
+#ifdef HOST_IS_LINUX
+    prctl(PR_SET_NAME, name, 0, 0, 0);
+#endif
+}
+
+/**
+ * Forks a process named like the application (and its child if it
+ * has one) that sleeps until killed. Returns pid, which is also
+ * the process group to kill.
+ */
+static pid_t spawn_fake(const FakeApp & app) {
+    int ready[2];
+    if(pipe(ready) == -1)
+        return -1;
+    pid_t pid = fork();
+    if(pid == 0) {
+        setpgid(0, 0);
+        set_process_name(app.process);
+        if(app.child && fork() == 0) {
+            set_process_name(app.child);
+            if(write(ready[1], "c", 1)) {}
+            pause();
+            _exit(0);
+        }
+        if(write(ready[1], "p", 1)) {}
+        pause();
+        _exit(0);
+    }
+    close(ready[1]);
+    char buf[2];
+    size_t want = app.child ? 2 : 1, got = 0;
+    while(pid > 0 && got < want) {
+        ssize_t n = read(ready[0], buf, want - got);
+        if(n <= 0)
+            break;
+        got += n;
+    }
+    close(ready[0]);
+    return pid;
+}
+
+static Window create_window(Display *dpy, const FakeApp & app, pid_t pid, int i) {
+    Window window = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), 10 + 20 * i, 10 + 20 * i, 200, 100, 0, 0, 0);
+
+    XClassHint hint;
+    hint.res_name = const_cast<char *>(app.process);
+    hint.res_class = const_cast<char *>(app.className);
+    XSetClassHint(dpy, window, &hint);
+
+    Atom netWmPid = XInternAtom(dpy, "_NET_WM_PID", False);
+    unsigned long value = pid;
+    XChangeProperty(dpy, window, netWmPid, XA_CARDINAL, 32, PropModeReplace, (unsigned char *) &value, 1);
+
+    XMapWindow(dpy, window);
+    return window;
+}
+
+/**
+ * Injects keypresses from its own thread and X connection, moving
+ * focus between windows. Keycodes cycle, so a key is pressed again
+ * only well after its release (a release and press of one key in the
+ * same millisecond is taken for autorepeat by the RECORD monitor).
+ */
+class Injector {
+    Display *m_display;
+    const vector<Window> & m_windows;
+    int m_rate;
+    int m_count;
+
+    boost::mutex m_mutex;
+    vector<int64_t> m_sent;
+    vector<int> m_expectedGroups;
+    const vector<int> & m_windowGroups;
+    bool m_done;
+    int64_t m_doneTime;
+
+    public:
+    Injector(Display *display, const vector<Window> & windows, const vector<int> & windowGroups, int rate, int count)
+        : m_display(display), m_windows(windows), m_rate(rate), m_count(count),
+        m_windowGroups(windowGroups), m_done(false), m_doneTime(0) {
+        m_sent.reserve(count);
+        m_expectedGroups.reserve(count);
+    }
+
+    void run() {
+        int64_t start = monotonic_us();
+        for(int k = 0; k < m_count; k++) {
+            int64_t due = start + (int64_t) k * 1000000 / m_rate;
+            int64_t now = monotonic_us();
+            if(due > now)
+                usleep(due - now);
+
+            size_t w = (k / keysPerFocus) % m_windows.size();
+            if(k % keysPerFocus == 0)
+                XSetInputFocus(m_display, m_windows[w], RevertToParent, CurrentTime);
+            // a .. ; on PC keyboards
+            unsigned int keycode = 38 + k % 20;
+            {
+                boost::mutex::scoped_lock lock(m_mutex);
+                m_sent.push_back(monotonic_us());
+                m_expectedGroups.push_back(m_windowGroups[w]);
+            }
+            XTestFakeKeyEvent(m_display, keycode, True, CurrentTime);
+            XTestFakeKeyEvent(m_display, keycode, False, CurrentTime);
+            XFlush(m_display);
+        }
+        XSync(m_display, False);
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_done = true;
+        m_doneTime = monotonic_us();
+    }
+
+    /// Injection time and group of k-th keypress, false if not sent yet
+    bool sent(size_t k, int64_t & time, int & group) {
+        boost::mutex::scoped_lock lock(m_mutex);
+        if(k >= m_sent.size())
+            return false;
+        time = m_sent[k];
+        group = m_expectedGroups[k];
+        return true;
+    }
+
+    /// All keypresses sent, and when
+    bool done(int64_t & doneTime) {
+        boost::mutex::scoped_lock lock(m_mutex);
+        doneTime = m_doneTime;
+        return m_done;
+    }
+};
+
+struct StepResult {
+    int rate;
+    int injected;
+    int received;
+    int misattributed;
+    vector<int64_t> latencies;
+    int64_t cpu;
+    unsigned long requests;
+    int64_t commit;
+    int64_t duration;
+};
+
+int main(int argc, char *argv[])
+{
+    po::options_description desc("Usage: x11-bench [options]\n"
+            "Runs against X server given by --display or DISPLAY\n"
+            "Allowed options");
+    desc.add_options()
+        ("help", "display help message")
+        ("display", po::value<string>(), "X display")
+        ("rates", po::value<string>()->default_value("50,500,5000"), "keypresses per second, one step each")
+        ("keys", po::value<int>()->default_value(5000), "keypresses per step")
+        ("windows", po::value<int>()->default_value(8), "synthetic windows")
+        ("out", po::value<string>()->default_value("-"), "JSON output file (- for standard output)")
+        ;
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    } catch(po::error & e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    if(vm.count("help")) {
+        ostringstream help;
+        help << desc;
+        printf("%s\n", help.str().c_str());
+        return EXIT_SUCCESS;
+    }
+
+    string displayName;
+    if(vm.count("display"))
+        displayName = vm["display"].as<string>();
+    else if(getenv("DISPLAY"))
+        displayName = getenv("DISPLAY");
+
+    vector<int> rates;
+    {
+        istringstream in(vm["rates"].as<string>());
+        string rate;
+        while(getline(in, rate, ','))
+            if(atoi(rate.c_str()) > 0)
+                rates.push_back(atoi(rate.c_str()));
+    }
+    int keys = vm["keys"].as<int>();
+    int windowCount = vm["windows"].as<int>();
+    if(rates.empty() || keys <= 0 || windowCount <= 0) {
+        fprintf(stderr, "Nothing to do\n");
+        return EXIT_FAILURE;
+    }
+
+    // Injecting connection, used only by Injector while a step runs
+    Display *app = XOpenDisplay(displayName.c_str());
+    if(app == NULL) {
+        fprintf(stderr, "Could not open display %s\n", displayName.c_str());
+        return EXIT_FAILURE;
+    }
+    int event, error, major, minor;
+    if(!XTestQueryExtension(app, &event, &error, &major, &minor)) {
+        fprintf(stderr, "No XTEST extension\n");
+        return EXIT_FAILURE;
+    }
+
+    // Fake applications and their windows
+    vector<pid_t> fakes;
+    vector<Window> windows;
+    vector<int> windowGroups;
+    for(int i = 0; i < windowCount; i++) {
+        const FakeApp & fake = fakeApps[i % fakeAppCount];
+        pid_t pid = spawn_fake(fake);
+        if(pid <= 0) {
+            fprintf(stderr, "Could not fork\n");
+            break;
+        }
+        fakes.push_back(pid);
+        windows.push_back(create_window(app, fake, pid, i));
+        windowGroups.push_back(fake.group);
+    }
+    XSync(app, False);
+
+    // Groups matching the fake applications
+    FilterConfig filterConfig;
+    Group terminal, browser, graphics;
+    terminal.setId(100);
+    terminal.addTerminalProcess("vim");
+    browser.setId(200);
+    browser.addWindowClass("firefox");
+    graphics.setId(300);
+    graphics.addProcess("gimp");
+    filterConfig.addGroup(terminal);
+    filterConfig.addGroup(browser);
+    filterConfig.addGroup(graphics);
+
+    // Pipeline, as set up by Daemon
+#ifdef HOST_IS_OSX
+    ProcessManagerMac pm;
+#elif defined HOST_IS_LINUX
+    ProcessManagerLinux pm;
+#elif defined HOST_IS_FBSD
+    ProcessManagerFBSD pm;
+#endif
+    pm.createProcTree();
+    KfWindowCache wim;
+    EventMonitorX11 monitor;
+    EventFilter filter(monitor, wim, pm);
+    filter.setFilterConfig(filterConfig);
+    if(!filter.connect(displayName)) {
+        fprintf(stderr, "Could not connect to display %s\n", displayName.c_str());
+        return EXIT_FAILURE;
+    }
+    filter.start();
+
+    string location;
+    Storage *backend = Storage::create("sqlite::memory:", location);
+    StorageManager storage(backend);
+    // Commits are done (and timed) by the benchmark
+    storage.setCommitInterval(24 * 3600);
+    storage.setCompactionIdle(0);
+    storage.connect(location);
+
+    vector<StepResult> results;
+    for(size_t s = 0; s < rates.size(); s++) {
+        StepResult result;
+        result.rate = rates[s];
+        result.injected = keys;
+        result.received = 0;
+        result.misattributed = 0;
+
+        Injector injector(app, windows, windowGroups, rates[s], keys);
+        int64_t cpuBegin = thread_cpu_us();
+        unsigned long requestsBegin = XNextRequest(monitor.ctrlDisplay());
+        int64_t begin = monotonic_us();
+        boost::thread thread(boost::bind(&Injector::run, &injector));
+
+        while(true) {
+            filter.pollEvents();
+            while(filter.numEvents()) {
+                Event ev = filter.nextEvent();
+                if(ev.type() == kfKeyPress) {
+                    if(ev.groupId() != -1)
+                        storage.addKeyStroke(ev.groupId(), ev.keyCode(), ev.modifiers());
+                    int64_t sentTime;
+                    int group;
+                    if(injector.sent(result.received, sentTime, group)) {
+                        result.latencies.push_back(monotonic_us() - sentTime);
+                        if(group != ev.groupId())
+                            result.misattributed ++;
+                    }
+                    result.received ++;
+                } else if(ev.type() == kfDestroyNotify) {
+                    wim.findAndUseWindow(ev.destWin());
+                    wim.invalidateEntry();
+                }
+            }
+
+            int64_t doneTime;
+            if(injector.done(doneTime) &&
+                    (result.received >= keys || monotonic_us() - doneTime > drainTimeout))
+                break;
+
+            // Same wait as Daemon::waitForInput()
+            pollfd pfd;
+            pfd.fd = filter.fileDescriptor();
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            poll(&pfd, pfd.fd != -1 ? 1 : 0, pfd.fd != -1 ? 100 : 75);
+        }
+        thread.join();
+        result.duration = monotonic_us() - begin;
+        result.cpu = thread_cpu_us() - cpuBegin;
+        result.requests = XNextRequest(monitor.ctrlDisplay()) - requestsBegin;
+
+        int64_t commitBegin = monotonic_us();
+        storage.flush();
+        result.commit = monotonic_us() - commitBegin;
+
+        sort(result.latencies.begin(), result.latencies.end());
+        results.push_back(result);
+    }
+
+    for(size_t i = 0; i < fakes.size(); i++)
+        kill(-fakes[i], SIGKILL);
+    while(waitpid(-1, NULL, 0) > 0)
+        ;
+
+    // Report
+    string outPath = vm["out"].as<string>();
+    FILE *out = outPath == "-" ? stdout : fopen(outPath.c_str(), "w");
+    if(out == NULL) {
+        fprintf(stderr, "Could not create %s\n", outPath.c_str());
+        return EXIT_FAILURE;
+    }
+    const char *vendor = ServerVendor(app);
+    fprintf(out, "{\n  \"benchmark\": \"x11-pipeline\",\n");
+    fprintf(out, "  \"server\": \"%s %d\",\n", vendor ? vendor : "", VendorRelease(app));
+    fprintf(out, "  \"windows\": %d,\n  \"steps\": [\n", (int) windows.size());
+    for(size_t i = 0; i < results.size(); i++) {
+        const StepResult & r = results[i];
+        fprintf(out, "    {\"rate\": %d, \"injected\": %d, \"received\": %d, \"dropped\": %d, \"misattributed\": %d,\n",
+                r.rate, r.injected, r.received, r.injected > r.received ? r.injected - r.received : 0, r.misattributed);
+        fprintf(out, "     \"latency_us\": {\"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"max\": %lld},\n",
+                (long long) percentile(r.latencies, 0.5), (long long) percentile(r.latencies, 0.9),
+                (long long) percentile(r.latencies, 0.99), (long long) (r.latencies.empty() ? 0 : r.latencies.back()));
+        fprintf(out, "     \"cpu_us_per_1k_keys\": %.1f, \"x_requests_per_key\": %.3f, \"commit_us\": %lld, \"duration_us\": %lld}%s\n",
+                r.received ? r.cpu * 1000.0 / r.received : 0.0,
+                r.received ? (double) r.requests / r.received : 0.0,
+                (long long) r.commit, (long long) r.duration, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    if(out != stdout)
+        fclose(out);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Starts Xvfb on a free display, runs x11-bench against it and stops
+# the server. Usage: x11-bench.sh <x11-bench binary> <json file> [options]
+
+bench=$1
+out=$2
+shift 2
+
+if ! command -v Xvfb >/dev/null 2>&1; then
+    echo "Xvfb not found, X11 benchmark skipped"
+    exit 0
+fi
+
+display=99
+while [ -e /tmp/.X$display-lock ]; do
+    display=$((display + 1))
+done
+
+Xvfb :$display -screen 0 1024x768x24 -nolisten tcp >/dev/null 2>&1 &
+xvfb=$!
+trap 'kill $xvfb 2>/dev/null' EXIT INT TERM
+
+# Wait up to 5 seconds for the server socket
+i=0
+while [ ! -e /tmp/.X11-unix/X$display ] && [ $i -lt 50 ]; do
+    sleep 0.1
+    i=$((i + 1))
+done
+
+"$bench" --display :$display --out "$out" "$@" && echo "Results written to $out"